@@ -0,0 +1,437 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  ChainBenchmark.cpp
+ * @brief Headless benchmark of the protection -> manager -> arm chain
+ * @date $Date$
+ *
+ * $Id$
+ */
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ProtectionJudge.h"
+#include "MotionSequencer.h"
+#include "SpeedScaler.h"
+#include "CycleMetrics.h"
+#include "SimulatedArm.h"
+#include "AllocGuard.h"
+
+// HumanProtection / Manager の既定値と同じ値
+static const double JUDGE_PARAMETER = 1500.0;
+static const double SLOW_PARAMETER = 2500.0;
+static const double DANGER_THRESHOLD_TIME = 0.5;
+static const double SPEED_DEADBAND = 0.05;
+static const double SPEED_HOLD_TIME = 0.5;
+static const double SPEED_MIN_RATIO = 0.1;
+static const int WAIT_CYCLES = 2400;
+
+// Manager の教示点 (Pick1, Place, Pick2, Place)
+static const double PICK1_POINT[SimulatedArm::AXIS_NUM] = { 0.000, -0.098, 0.233, 0.000, 1.385, 0.000 };
+static const double PLACE_POINT[SimulatedArm::AXIS_NUM] = { -1.555, -1.181, 0.673, 0.000, 0.609, 0.000 };
+static const double PICK2_POINT[SimulatedArm::AXIS_NUM] = { -1.555, 0.006, 0.135, 0.000, 1.486, 0.000 };
+static const double STOP_POINT[SimulatedArm::AXIS_NUM] = { 999.0, 999.0, 999.0, 999.0, 999.0, 999.0 };
+
+typedef std::chrono::steady_clock WallClock;
+
+/*!
+ * @brief 1条件の設定
+ */
+struct Case
+{
+  double rate;      // 姿勢の入力周期 [Hz]
+  int people;       // 追跡する人数
+  int points;       // 1人あたりの判定点数 (ゾーンの複雑さの代わり)
+};
+
+/*!
+ * @brief 段ごとの処理時間 [ns] を記録する
+ *
+ * 計測中はメモリ確保しないよう、サンプル領域は事前に確保しておく。
+ */
+class StageTimer
+{
+ public:
+  void reserve(size_t n) { m_samples.clear(); m_samples.reserve(n); }
+  void add(WallClock::time_point from, WallClock::time_point to)
+  {
+    if (m_samples.size() == m_samples.capacity()) return;
+    m_samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count());
+  }
+
+  void write(FILE* fp, const char* name)
+  {
+    double mean = 0.0;
+    long long p50 = 0, p90 = 0, p99 = 0, max = 0;
+    size_t n = m_samples.size();
+    if (n > 0)
+    {
+      for (size_t i = 0; i < n; i++) mean += m_samples[i];
+      mean /= n;
+      std::sort(m_samples.begin(), m_samples.end());
+      p50 = m_samples[(n - 1) * 50 / 100];
+      p90 = m_samples[(n - 1) * 90 / 100];
+      p99 = m_samples[(n - 1) * 99 / 100];
+      max = m_samples[n - 1];
+    }
+    std::fprintf(fp, "\"%s\": {\"count\": %lu, \"mean_ns\": %.1f, \"p50_ns\": %lld, "
+                 "\"p90_ns\": %lld, \"p99_ns\": %lld, \"max_ns\": %lld}",
+                 name, static_cast<unsigned long>(n), mean, p50, p90, p99, max);
+  }
+
+ private:
+  std::vector<long long> m_samples;
+};
+
+/*!
+ * @brief 人の手の位置を生成する
+ *
+ * 各人はカメラからの距離 z が正弦波で近づいたり離れたりする。
+ * 周期と位相を人ごとにずらし、時々 judge_parameter を割り込ませる。
+ */
+class SyntheticSource
+{
+ public:
+  SyntheticSource(int people, int points)
+    : m_people(people), m_points(points), m_size(0), m_rng(12345), m_noise(0.0, 5.0)
+  {
+    m_pts.resize(people * points);
+    m_owner.resize(people * points);
+  }
+
+  // 見えている点だけを先頭から詰めて返す
+  const JudgePoint* points() const { return &m_pts[0]; }
+  // 点ごとの人の ID (HumanState の user_id に当たる)
+  const long* owners() const { return &m_owner[0]; }
+  int size() const { return m_size; }
+
+  void generate(double t)
+  {
+    m_size = 0;
+    for (int k = 0; k < m_people; k++)
+    {
+      double period = 40.0 + 7.0 * k;
+      double z = 2600.0 + 1200.0 * std::sin(2.0 * M_PI * t / period + 1.3 * k);
+      // 遠ざかった人はときどき見失う。HumanProtection と同じく、
+      // 見失った点は判定に渡さない ((0,0,0) を入れると目の前の人になる)
+      if (z > 3600.0) continue;
+      for (int j = 0; j < m_points; j++)
+      {
+        m_owner[m_size] = k + 1;
+        JudgePoint& p = m_pts[m_size++];
+        p.x = 300.0 * k + 40.0 * j + m_noise(m_rng);
+        p.y = 20.0 * j + m_noise(m_rng);
+        p.z = z + 30.0 * j + m_noise(m_rng);
+      }
+    }
+  }
+
+ private:
+  int m_people;
+  int m_points;
+  int m_size;
+  std::mt19937 m_rng;
+  std::normal_distribution<double> m_noise;
+  std::vector<JudgePoint> m_pts;
+  std::vector<long> m_owner;
+};
+
+/*!
+ * @brief 1条件の結果
+ */
+struct Result
+{
+  Case c;
+  double duration;
+  double wall;
+  double cpu;
+  long frames;
+  long ticks;
+  unsigned long allocations;
+  long stops;
+  double stop_latency_mean;
+  double stop_latency_max;
+  CycleMetrics::Snapshot metrics;
+};
+
+static double cpuSeconds()
+{
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6 +
+         ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+}
+
+static const double* phasePoint(int phase)
+{
+  switch (phase)
+  {
+    case 1: return PLACE_POINT;
+    case 2: return PICK2_POINT;
+    case 3: return PLACE_POINT;
+    default: return PICK1_POINT;
+  }
+}
+
+/*!
+ * @brief 仮想時間で duration 秒分を回す
+ *
+ * Manager の実行周期 control_rate で刻み、姿勢は c.rate ごとに生成・判定する。
+ * HumanProtection -> Manager の経路は同一プロセス直結 (遅延なし) とみなす。
+ */
+static Result runCase(const Case& c, double duration, double control_rate,
+                      StageTimer* stages)
+{
+  Result r;
+  std::memset(&r, 0, sizeof(r));
+  r.c = c;
+  r.duration = duration;
+
+  SyntheticSource source(c.people, c.points);
+  ProtectionJudge judge;
+  judge.configure(JUDGE_PARAMETER, SLOW_PARAMETER, DANGER_THRESHOLD_TIME);
+  judge.reset();
+  MotionSequencer sequencer;
+  sequencer.configure(WAIT_CYCLES);
+  sequencer.reset();
+  SpeedScaler scaler;
+  scaler.configure(SPEED_DEADBAND, SPEED_HOLD_TIME, SPEED_MIN_RATIO);
+  SimulatedArm arm;
+  CycleMetrics metrics;
+  metrics.configure(duration + 10.0, 10.0);
+
+  // 仮想時刻は steady_clock の原点からの経過として CycleMetrics に渡す
+  CycleMetrics::Clock::time_point origin;
+  metrics.reset(origin);
+  scaler.reset(origin);
+  arm.setSpeedRatio(scaler.commanded());
+
+  long ticks = static_cast<long>(duration * control_rate);
+  long frames = static_cast<long>(duration * c.rate) + 1;
+  stages[0].reserve(frames);
+  stages[1].reserve(frames);
+  stages[2].reserve(ticks);
+  stages[3].reserve(ticks);
+
+  double dt = 1.0 / control_rate;
+  double frame_period = 1.0 / c.rate;
+  double next_frame = 0.0;
+  bool stop = false;
+  double speed_ratio = 1.0;
+  unsigned long alloc_start = AllocGuard::violations();
+
+  double cpu_start = cpuSeconds();
+  WallClock::time_point wall_start = WallClock::now();
+  for (long i = 0; i < ticks; i++)
+  {
+    ALLOC_GUARD_SCOPE("ChainBenchmark");
+
+    double t = i * dt;
+    CycleMetrics::Clock::time_point now = origin +
+      std::chrono::duration_cast<CycleMetrics::Clock::duration>(std::chrono::duration<double>(t));
+
+    // 1. 姿勢の生成と HumanProtection の判定
+    if (t >= next_frame)
+    {
+      next_frame += frame_period;
+      WallClock::time_point t0 = WallClock::now();
+      source.generate(t);
+      WallClock::time_point t1 = WallClock::now();
+      ProtectionJudge::Decision d = judge.evaluate(source.points(), source.size(), source.owners(), t);
+      WallClock::time_point t2 = WallClock::now();
+      stages[0].add(t0, t1);
+      stages[1].add(t1, t2);
+      stop = d.stop;
+      speed_ratio = d.speed_ratio;
+      r.frames++;
+    }
+
+    // 2. Manager の1周期
+    WallClock::time_point t3 = WallClock::now();
+    unsigned long percent;
+    if (scaler.update(speed_ratio, now, percent)) arm.setSpeedRatio(percent);
+
+    unsigned int actions = sequencer.step(stop);
+    if (actions & MotionSequencer::STOP)
+    {
+      arm.movePTPJointAbs(STOP_POINT, SimulatedArm::AXIS_NUM);
+      if (actions & MotionSequencer::STOP_BEGIN) metrics.onStop(now);
+    }
+    else
+    {
+      if (actions & MotionSequencer::RESUME)
+      {
+        arm.movePTPJointAbs(phasePoint(sequencer.resumePhase()), SimulatedArm::AXIS_NUM);
+        metrics.onResume(now, 0.0);
+      }
+      if (actions & MotionSequencer::ADVANCE)
+      {
+        metrics.onPhaseStart(sequencer.advancePhase(), now);
+        arm.movePTPJointAbs(phasePoint(sequencer.advancePhase()), SimulatedArm::AXIS_NUM);
+      }
+    }
+    WallClock::time_point t4 = WallClock::now();
+
+    // 3. アームを1周期分進める
+    arm.step(dt);
+    WallClock::time_point t5 = WallClock::now();
+    stages[2].add(t3, t4);
+    stages[3].add(t4, t5);
+  }
+  r.wall = std::chrono::duration<double>(WallClock::now() - wall_start).count();
+  r.cpu = cpuSeconds() - cpu_start;
+  r.allocations = AllocGuard::violations() - alloc_start;
+  r.ticks = ticks;
+
+  double last;
+  arm.getStopLatency(last, r.stop_latency_mean, r.stop_latency_max, r.stops);
+  r.metrics = metrics.snapshot(origin +
+    std::chrono::duration_cast<CycleMetrics::Clock::duration>(std::chrono::duration<double>(duration)));
+  return r;
+}
+
+static void writeResult(FILE* fp, Result& r, StageTimer* stages)
+{
+  std::fprintf(fp, "    {\"rate_hz\": %.1f, \"people\": %d, \"points_per_person\": %d,\n",
+               r.c.rate, r.c.people, r.c.points);
+  std::fprintf(fp, "     \"sim_seconds\": %.1f, \"wall_seconds\": %.6f, \"cpu_seconds\": %.6f,\n",
+               r.duration, r.wall, r.cpu);
+  std::fprintf(fp, "     \"frames\": %ld, \"ticks\": %ld, \"frames_per_wall_second\": %.1f, "
+               "\"realtime_factor\": %.1f,\n",
+               r.frames, r.ticks, r.wall > 0.0 ? r.frames / r.wall : 0.0,
+               r.wall > 0.0 ? r.duration / r.wall : 0.0);
+  std::fprintf(fp, "     \"allocations\": %lu,\n", r.allocations);
+  std::fprintf(fp, "     \"stages\": {");
+  static const char* names[4] = { "source", "protection", "manager", "arm" };
+  for (int s = 0; s < 4; s++)
+  {
+    std::fprintf(fp, "%s\n       ", s == 0 ? "" : ",");
+    stages[s].write(fp, names[s]);
+  }
+  std::fprintf(fp, "},\n");
+  std::fprintf(fp, "     \"stops\": %ld, \"stop_latency_mean_seconds\": %.4f, "
+               "\"stop_latency_max_seconds\": %.4f,\n",
+               r.stops, r.stop_latency_mean, r.stop_latency_max);
+  std::fprintf(fp, "     \"cycles\": %.0f, \"cycles_per_hour\": %.2f, \"availability\": %.4f}",
+               r.metrics.cycles, r.metrics.cycles_per_hour, r.metrics.availability);
+}
+
+// "15,30,60" を数値の並びにする
+static std::vector<double> parseList(const char* arg)
+{
+  std::vector<double> v;
+  std::string s(arg);
+  size_t pos = 0;
+  while (pos <= s.size())
+  {
+    size_t comma = s.find(',', pos);
+    if (comma == std::string::npos) comma = s.size();
+    if (comma > pos) v.push_back(std::atof(s.substr(pos, comma - pos).c_str()));
+    pos = comma + 1;
+  }
+  return v;
+}
+
+static void usage(const char* prog)
+{
+  std::fprintf(stderr,
+    "usage: %s [options]\n"
+    "  --rates LIST      pose input rates [Hz] (default 15,30,60)\n"
+    "  --people LIST     tracked people (default 1,2,4,8)\n"
+    "  --points LIST     judged points per person (default 1,4,16)\n"
+    "  --duration SEC    simulated seconds per case (default 120)\n"
+    "  --control-rate HZ Manager execution rate (default 800)\n"
+    "  --label TEXT      build label stored in the output\n"
+    "  --output FILE     write JSON to FILE instead of stdout\n", prog);
+}
+
+int main(int argc, char** argv)
+{
+  std::vector<double> rates = parseList("15,30,60");
+  std::vector<double> people = parseList("1,2,4,8");
+  std::vector<double> points = parseList("1,4,16");
+  double duration = 120.0;
+  double control_rate = 800.0;
+  std::string label;
+  std::string output;
+
+  for (int i = 1; i < argc; i++)
+  {
+    std::string a = argv[i];
+    if (i + 1 >= argc)
+    {
+      usage(argv[0]);
+      return 1;
+    }
+    if (a == "--rates") rates = parseList(argv[++i]);
+    else if (a == "--people") people = parseList(argv[++i]);
+    else if (a == "--points") points = parseList(argv[++i]);
+    else if (a == "--duration") duration = std::atof(argv[++i]);
+    else if (a == "--control-rate") control_rate = std::atof(argv[++i]);
+    else if (a == "--label") label = argv[++i];
+    else if (a == "--output") output = argv[++i];
+    else
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (duration <= 0.0 || control_rate <= 0.0)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  FILE* fp = stdout;
+  if (!output.empty())
+  {
+    fp = std::fopen(output.c_str(), "w");
+    if (fp == NULL)
+    {
+      std::perror(output.c_str());
+      return 1;
+    }
+  }
+
+  std::fprintf(fp, "{\n  \"benchmark\": \"protection_manager_chain\",\n");
+  std::fprintf(fp, "  \"label\": \"%s\",\n", label.c_str());
+  std::fprintf(fp, "  \"compiler\": \"%s\",\n", __VERSION__);
+  std::fprintf(fp, "  \"control_rate_hz\": %.1f,\n", control_rate);
+  std::fprintf(fp, "  \"results\": [\n");
+
+  StageTimer stages[4];
+  bool first = true;
+  for (size_t a = 0; a < rates.size(); a++)
+  {
+    for (size_t b = 0; b < people.size(); b++)
+    {
+      for (size_t c = 0; c < points.size(); c++)
+      {
+        Case bc;
+        bc.rate = rates[a];
+        bc.people = static_cast<int>(people[b]);
+        bc.points = static_cast<int>(points[c]);
+        if (bc.rate <= 0.0 || bc.people <= 0 || bc.points <= 0) continue;
+
+        std::fprintf(stderr, "rate=%.1f people=%d points=%d\n", bc.rate, bc.people, bc.points);
+        Result r = runCase(bc, duration, control_rate, stages);
+        if (!first) std::fprintf(fp, ",\n");
+        writeResult(fp, r, stages);
+        first = false;
+      }
+    }
+  }
+  std::fprintf(fp, "\n  ]\n}\n");
+
+  if (fp != stdout) std::fclose(fp);
+  return 0;
+}
@@ -0,0 +1,69 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  AllocGuard.h
+ * @brief Test-only detection of heap allocations in control cycles
+ * @date  $Date$
+ *
+ * $Id$
+ */
+
+#ifndef ALLOCGUARD_H
+#define ALLOCGUARD_H
+
+/*
+ * ENABLE_ALLOC_GUARD を定義してビルドしたときだけ、グローバルな
+ * operator new/delete を置き換えてヒープ確保を数える。
+ *
+ *   ALLOC_GUARD_SCOPE("Manager::onExecute");  // このスコープ内の確保を数える
+ *   { ALLOC_GUARD_PAUSE(); m_out.write(); }    // ミドルウェア内部の確保は除外する
+ *
+ * スコープを抜けたときに確保があれば標準エラーに出力する。
+ * 環境変数 ALLOC_GUARD=abort のときは確保した時点で abort() する (CI 用)。
+ * 定義しない通常ビルドではマクロは何も生成しない。
+ */
+
+#ifdef ENABLE_ALLOC_GUARD
+
+class AllocGuard
+{
+ public:
+  /*!
+   * @brief 呼び出したスレッドでヒープ確保を数える区間
+   */
+  class Scope
+  {
+   public:
+    explicit Scope(const char* name);
+    ~Scope();
+   private:
+    const char* m_name;
+    unsigned long m_start;
+  };
+
+  /*!
+   * @brief Scope の中で一時的に数えるのをやめる区間
+   */
+  class Pause
+  {
+   public:
+    Pause();
+    ~Pause();
+  };
+
+  // 起動からの違反 (Scope 内での確保) 回数の合計
+  static unsigned long violations();
+};
+
+#define ALLOC_GUARD_CAT_(a, b) a##b
+#define ALLOC_GUARD_CAT(a, b) ALLOC_GUARD_CAT_(a, b)
+#define ALLOC_GUARD_SCOPE(name) AllocGuard::Scope ALLOC_GUARD_CAT(alloc_guard_scope_, __LINE__)(name)
+#define ALLOC_GUARD_PAUSE() AllocGuard::Pause ALLOC_GUARD_CAT(alloc_guard_pause_, __LINE__)
+
+#else
+
+#define ALLOC_GUARD_SCOPE(name)
+#define ALLOC_GUARD_PAUSE()
+
+#endif // ENABLE_ALLOC_GUARD
+
+#endif // ALLOCGUARD_H
@@ -0,0 +1,129 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  CycleMonitor.h
+ * @brief Execution-context cycle interval / execution time and overrun budget
+ * @date  $Date$
+ *
+ * $Id$
+ */
+
+#ifndef CYCLEMONITOR_H
+#define CYCLEMONITOR_H
+
+#include <chrono>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "JitterStats.h"
+#include "MetricRegistry.h"
+
+/*!
+ * @class CycleMonitor
+ * @brief onExecute の開始間隔と実行時間を計り、周期の取りこぼしを数える
+ *
+ * 実行時間が周期を超えた場合と、開始が周期の半分以上遅れた場合を
+ * オーバーランとする。直近 window 秒のオーバーランが budget を超えたら
+ * overBudget() が true になる。配列は configure() でだけ確保する。
+ *
+ *   CycleMonitor::Scope cycle(monitor);  // onExecute の先頭に置く
+ */
+class CycleMonitor
+{
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  // toArray() の要素数
+  static const int STATUS_LENGTH = 8;
+
+  struct Status
+  {
+    double period;          // 設定周期 [s]
+    double interval;        // 実測した平均開始間隔 [s]
+    double jitter_p99;      // 開始間隔のずれの p99 [s]
+    double exec_mean;       // 実行時間の平均 [s]
+    double exec_max;        // 実行時間の最大 [s]
+    uint64_t overruns;      // 直近 window 秒のオーバーラン
+    uint64_t overruns_total;
+    bool over_budget;
+  };
+
+  /*!
+   * @brief onExecute の区間
+   */
+  class Scope
+  {
+   public:
+    explicit Scope(CycleMonitor& monitor) : m_monitor(monitor) { m_monitor.begin(Clock::now()); }
+    ~Scope() { m_monitor.end(Clock::now()); }
+   private:
+    CycleMonitor& m_monitor;
+  };
+
+  CycleMonitor();
+
+  /*!
+   * @brief MetricRegistry にヒストグラム等を登録する (onInitialize から呼ぶ)
+   * @param label 例: component="Manager0"
+   */
+  void attach(const std::string& label);
+
+  /*!
+   * @param period 実行コンテキストの周期 [s]
+   * @param budget window 秒あたりに許すオーバーラン回数
+   * @param window 集計窓 [s]
+   */
+  void configure(double period, int budget, double window);
+  void reset(Clock::time_point now);
+
+  void begin(Clock::time_point now);
+  void end(Clock::time_point now);
+
+  bool overBudget() const { return m_over_budget; }
+  double period() const { return m_period; }
+  // 実測の平均開始間隔 [s]。まだ計れていなければ設定周期
+  double meanInterval() const;
+  const JitterStats& jitter() const { return m_jitter; }
+
+  Status status() const;
+  static void toArray(const Status& s, double* out);
+
+  /*!
+   * @brief 状態を出力すべきか (period 秒ごと、または予算超過の状態が変わったとき)
+   */
+  bool statusDue(Clock::time_point now, double period);
+
+ private:
+  // 直近 window 秒のオーバーラン数
+  uint64_t windowOverruns() const;
+
+  double m_period;
+  int m_budget;
+  Clock::time_point m_origin;
+  std::vector<uint64_t> m_window;    // 1秒ごとのオーバーラン数
+  std::vector<long> m_window_index;  // 各要素が表す秒
+  long m_current;                    // 最後に数えた秒
+
+  JitterStats m_jitter;
+  Clock::time_point m_begin;
+  Clock::time_point m_last_begin;
+  bool m_started;
+  bool m_late;
+  bool m_prev_overrun;
+  uint64_t m_cycles;
+  double m_interval_sum;
+  double m_exec_sum;
+  double m_exec_max;
+  uint64_t m_overruns_total;
+  bool m_over_budget;
+  bool m_status_sent;
+  bool m_status_budget;              // 最後に出力した予算超過状態
+  Clock::time_point m_status_time;
+
+  MetricHistogram* m_interval_hist;
+  MetricHistogram* m_exec_hist;
+  MetricCounter* m_overrun_counter;
+  MetricGauge* m_budget_gauge;
+};
+
+#endif // CYCLEMONITOR_H
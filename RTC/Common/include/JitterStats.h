@@ -0,0 +1,72 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  JitterStats.h
+ * @brief Cycle period jitter histogram for periodic components
+ * @date  $Date$
+ *
+ * $Id$
+ */
+
+#ifndef JITTERSTATS_H
+#define JITTERSTATS_H
+
+#include <chrono>
+#include <stdint.h>
+#include <vector>
+
+/*!
+ * @class JitterStats
+ * @brief 周期実行の起床間隔と設定周期とのずれを 1us 刻みのヒストグラムで集計する
+ *
+ * 配列は configure() でだけ確保するので、tick() はメモリ確保をしない。
+ * 上限を超えたずれは最後のビンに入れ、max は正確な値を残す。
+ */
+class JitterStats
+{
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Report
+  {
+    uint64_t count;   // 集計したサイクル数
+    double mean;      // 平均ずれ [s]
+    double p50;
+    double p99;
+    double p999;
+    double max;       // 最大ずれ [s]
+  };
+
+  JitterStats();
+
+  /*!
+   * @param period 設定周期 [s]
+   * @param range ヒストグラムの範囲 [s]
+   */
+  void configure(double period, double range);
+  void reset();
+
+  /*!
+   * @brief サイクルの開始時に呼ぶ
+   */
+  void tick(Clock::time_point now);
+
+  Report report() const;
+
+  /*!
+   * @brief 集計結果を1行で標準出力に出す
+   */
+  void print(const char* name) const;
+
+ private:
+  double percentile(double q) const;
+
+  double m_period;
+  std::vector<uint64_t> m_bins;  // 1us 刻み
+  uint64_t m_count;
+  double m_sum;
+  double m_max;
+  bool m_started;
+  Clock::time_point m_last;
+};
+
+#endif // JITTERSTATS_H
@@ -0,0 +1,167 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  MetricRegistry.h
+ * @brief Process-wide counters, gauges and histograms in Prometheus text format
+ * @date  $Date$
+ *
+ * $Id$
+ */
+
+#ifndef METRICREGISTRY_H
+#define METRICREGISTRY_H
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+
+/*!
+ * @class MetricCounter
+ * @brief 単調増加のカウンタ。inc() は relaxed な fetch_add 1回
+ */
+class MetricCounter
+{
+ public:
+  MetricCounter() : m_value(0) {}
+  void inc(uint64_t n = 1) { m_value.fetch_add(n, std::memory_order_relaxed); }
+  uint64_t value() const { return m_value.load(std::memory_order_relaxed); }
+ private:
+  std::atomic<uint64_t> m_value;
+};
+
+/*!
+ * @class MetricGauge
+ * @brief 現在値。set() は relaxed な store 1回
+ */
+class MetricGauge
+{
+ public:
+  MetricGauge() : m_bits(0) {}
+  void set(double v)
+  {
+    uint64_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    m_bits.store(bits, std::memory_order_relaxed);
+  }
+  double value() const
+  {
+    uint64_t bits = m_bits.load(std::memory_order_relaxed);
+    double v;
+    std::memcpy(&v, &bits, sizeof(v));
+    return v;
+  }
+ private:
+  std::atomic<uint64_t> m_bits;
+};
+
+/*!
+ * @class MetricHistogram
+ * @brief 固定バケットの時間ヒストグラム [s]
+ *
+ * observe() は該当バケットと合計 (ns 単位の整数) への relaxed な fetch_add 2回。
+ * 件数はバケットの合計として書き出し時に求める。
+ */
+class MetricHistogram
+{
+ public:
+  static const int MAX_BUCKETS = 16;
+
+  MetricHistogram();
+
+  /*!
+   * @param bounds バケットの上限 [s] (昇順)。NULL なら制御周期向けの既定値
+   */
+  void configure(const double* bounds, int n);
+
+  void observe(double seconds)
+  {
+    int i = 0;
+    while (i < m_bucket_num && seconds > m_bounds[i]) i++;
+    m_counts[i].fetch_add(1, std::memory_order_relaxed);
+    if (seconds > 0.0)
+    {
+      m_sum_ns.fetch_add(static_cast<uint64_t>(seconds * 1e9), std::memory_order_relaxed);
+    }
+  }
+
+  int bucketNum() const { return m_bucket_num; }
+  double bound(int i) const { return m_bounds[i]; }
+  // i == bucketNum() は +Inf
+  uint64_t count(int i) const { return m_counts[i].load(std::memory_order_relaxed); }
+  double sum() const { return m_sum_ns.load(std::memory_order_relaxed) * 1e-9; }
+
+ private:
+  int m_bucket_num;
+  double m_bounds[MAX_BUCKETS];
+  std::atomic<uint64_t> m_counts[MAX_BUCKETS + 1];
+  std::atomic<uint64_t> m_sum_ns;
+};
+
+/*!
+ * @class MetricTimer
+ * @brief スコープの所要時間をヒストグラムに入れ、上限を超えたら overrun を数える
+ */
+class MetricTimer
+{
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  MetricTimer(MetricHistogram& hist, MetricCounter* overrun = NULL, double limit = 0.0)
+    : m_hist(hist), m_overrun(overrun), m_limit(limit), m_start(Clock::now()) {}
+  ~MetricTimer()
+  {
+    double t = std::chrono::duration<double>(Clock::now() - m_start).count();
+    m_hist.observe(t);
+    if (m_overrun != NULL && m_limit > 0.0 && t > m_limit) m_overrun->inc();
+  }
+
+ private:
+  MetricHistogram& m_hist;
+  MetricCounter* m_overrun;
+  double m_limit;
+  Clock::time_point m_start;
+};
+
+/*!
+ * @class MetricRegistry
+ * @brief プロセスで1つのメトリクス登録先と書き出し
+ *
+ * 登録 (counter()/gauge()/histogram()) は onInitialize 等で行い、返された
+ * 参照を保持して周期処理から更新する。同じ名前とラベルの登録には同じ
+ * オブジェクトを返すので、1プロセス構成でも複数回の初期化でも重複しない。
+ * 登録したオブジェクトはプロセス終了まで解放しない。
+ *
+ * labels は Prometheus のラベル部分 (例: component="Manager") をそのまま渡す。
+ */
+class MetricRegistry
+{
+ public:
+  static MetricCounter& counter(const std::string& name, const std::string& labels,
+                                const std::string& help);
+  static MetricGauge& gauge(const std::string& name, const std::string& labels,
+                            const std::string& help);
+  static MetricHistogram& histogram(const std::string& name, const std::string& labels,
+                                    const std::string& help,
+                                    const double* bounds = NULL, int n = 0);
+
+  /*!
+   * @brief 全メトリクスを Prometheus テキスト形式にする
+   */
+  static std::string render();
+
+  /*!
+   * @brief 別スレッドで定期的に書き出す (プロセスで最初の呼び出しのみ有効)
+   * @param target 書き出し先。"unix:<path>" なら UNIX ソケットで接続ごとに返し、
+   *               それ以外は node-exporter の textfile としてファイルに書く
+   * @param period ファイルの書き出し周期 [s]
+   */
+  static void startExporter(const std::string& target, double period);
+
+  /*!
+   * @brief ファイルへ1回書き出す (一時ファイルから rename する)
+   */
+  static bool writeFile(const std::string& path);
+};
+
+#endif // METRICREGISTRY_H
@@ -0,0 +1,118 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  PersonTracker.h
+ * @brief Gated detection-to-track assignment with stable person IDs
+ * @date  $Date$
+ *
+ * $Id$
+ */
+
+#ifndef PERSONTRACKER_H
+#define PERSONTRACKER_H
+
+/*!
+ * @class PersonTracker
+ * @brief 毎フレームの人の検出を追跡に割り当て、人ごとに変わらない ID を付ける
+ *
+ * 追跡ごとに位置・速度を持ち、前回からの速度で予測した位置と検出の重心の
+ * 距離をコストとして、gate_distance 以内の組を近い順に貪欲に割り当てる。
+ * 上流の ID (hint) が追跡の覚えている ID と同じ検出は距離によらず優先する
+ * (上流の ID が入れ替わったときだけ距離で引き継ぐ)。
+ * 割り当てのない検出は新しい追跡を生み、max_missing 秒検出のない追跡は消す。
+ *
+ * 追跡ごとにゾーン (呼び出し側が決める整数) とその滞在時間を持つ。
+ * 検出のなかったフレームではゾーンを 0 に戻す。
+ *
+ * 配列はすべて固定長で、10 人程度なら update() は数マイクロ秒で終わる。
+ */
+class PersonTracker
+{
+ public:
+  static const int MAX_TRACKS = 16;
+
+  struct Detection
+  {
+    float x, y, z;    // 観測点の重心 [mm]
+    long hint;        // 上流の ID (負ならなし)
+  };
+
+  PersonTracker();
+
+  /*!
+   * @param capacity 同時に持つ追跡の数 (MAX_TRACKS まで)
+   * @param gate_distance 予測位置からこの距離 [mm] 以内の検出だけを割り当てる
+   * @param max_missing 検出がこの時間 [s] 続けてなければ追跡を消す
+   */
+  void configure(int capacity, double gate_distance, double max_missing);
+
+  // すべての追跡を消す (ID の採番は続ける)
+  void reset();
+
+  /*!
+   * @brief 今回のフレームの検出を割り当てる
+   * @param assigned 検出 i を割り当てた追跡のスロット (n 個)。空きがなければ -1
+   * @return 割り当てられなかった検出の数
+   *
+   * 空きがなければ、今回検出のなかった追跡のうち最も長く見えていないものを消して使う。
+   */
+  int update(const Detection* dets, int n, double now, int* assigned);
+
+  // スロットは追跡が生きている間変わらない
+  bool alive(int slot) const { return m_tracks[slot].alive; }
+  // 直前の update() で検出が割り当てられた
+  bool updated(int slot) const { return m_tracks[slot].updated; }
+  // 直前の update() で生まれた (前の追跡の状態を引き継がないこと)
+  bool created(int slot) const { return m_tracks[slot].created; }
+  long id(int slot) const { return m_tracks[slot].id; }
+  long hint(int slot) const { return m_tracks[slot].hint; }
+  int capacity() const { return m_capacity; }
+  // 生きている追跡の数
+  int count() const;
+
+  void position(int slot, float& x, float& y, float& z) const;
+  void velocity(int slot, float& vx, float& vy, float& vz) const;
+
+  // 追跡が生まれてからの時間 [s]
+  double age(int slot, double now) const { return now - m_tracks[slot].born; }
+
+  // ゾーンが変わったときだけ滞在時間を測り直す
+  void setZone(int slot, int zone, double now);
+  int zone(int slot) const { return m_tracks[slot].zone; }
+  double zoneTime(int slot, double now) const { return now - m_tracks[slot].zone_since; }
+
+ private:
+  struct Track
+  {
+    bool alive;
+    bool updated;
+    bool created;
+    long id;
+    long hint;
+    float pos[3];
+    float vel[3];
+    double born;
+    double last_seen;
+    int zone;
+    double zone_since;
+  };
+
+  // 割り当て候補 (追跡, 検出) とそのコスト
+  struct Pair
+  {
+    float cost;
+    int track;
+    int detection;
+  };
+
+  static bool lessCost(const Pair& a, const Pair& b) { return a.cost < b.cost; }
+  int birth(const Detection& d, double now);
+
+  int m_capacity;
+  float m_gate2;          // 比較は2乗で行う
+  double m_max_missing;
+  long m_next_id;
+  Track m_tracks[MAX_TRACKS];
+  Pair m_pairs[MAX_TRACKS * MAX_TRACKS];
+};
+
+#endif // PERSONTRACKER_H
@@ -0,0 +1,164 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  PoseRecord.h
+ * @brief Fixed-size records of the pose data types for ShmRing
+ * @date  $Date$
+ *
+ * $Id$
+ */
+
+#ifndef POSERECORD_H
+#define POSERECORD_H
+
+#include <stdint.h>
+
+#include "TimedPose3DQuaternionStub.h"
+#include "TimedSkeltonStub.h"
+
+// 1レコードに入る最大数 (超えた分は切り捨てる)
+static const uint32_t POSE_RECORD_MAX_POSES = 32;
+static const uint32_t POSE_RECORD_MAX_SKELTONS = 6;
+static const uint32_t POSE_RECORD_MAX_JOINTS = 25;
+
+/*!
+ * @brief RTC::Pose3DQuaternion と同じ並び
+ */
+struct PoseData
+{
+  double x, y, z;
+  double qx, qy, qz, qw;
+};
+
+struct TimeData
+{
+  uint32_t sec;
+  uint32_t nsec;
+};
+
+// TimedPose3DQuaternion
+struct PoseRecord
+{
+  TimeData tm;
+  PoseData pose;
+};
+
+// TimedPose3DQuaternionSeq
+struct PoseSeqRecord
+{
+  TimeData tm;
+  uint32_t length;
+  uint32_t reserved;
+  PoseData data[POSE_RECORD_MAX_POSES];
+};
+
+// TimedSkeltonSeq
+struct SkeltonData
+{
+  int32_t id;
+  uint32_t length;
+  PoseData pose[POSE_RECORD_MAX_JOINTS];
+};
+
+struct SkeltonSeqRecord
+{
+  TimeData tm;
+  uint32_t length;
+  uint32_t reserved;
+  SkeltonData data[POSE_RECORD_MAX_SKELTONS];
+};
+
+// --- RTC の型との変換 ---
+
+inline void toRecord(const RTC::Time& tm, TimeData& out)
+{
+  out.sec = tm.sec;
+  out.nsec = tm.nsec;
+}
+
+inline void fromRecord(const TimeData& in, RTC::Time& tm)
+{
+  tm.sec = in.sec;
+  tm.nsec = in.nsec;
+}
+
+inline void toRecord(const RTC::Pose3DQuaternion& p, PoseData& out)
+{
+  out.x = p.p3D.x;
+  out.y = p.p3D.y;
+  out.z = p.p3D.z;
+  out.qx = p.q.x;
+  out.qy = p.q.y;
+  out.qz = p.q.z;
+  out.qw = p.q.w;
+}
+
+inline void fromRecord(const PoseData& in, RTC::Pose3DQuaternion& p)
+{
+  p.p3D.x = in.x;
+  p.p3D.y = in.y;
+  p.p3D.z = in.z;
+  p.q.x = in.qx;
+  p.q.y = in.qy;
+  p.q.z = in.qz;
+  p.q.w = in.qw;
+}
+
+inline void toRecord(const RTC::TimedPose3DQuaternion& d, PoseRecord& out)
+{
+  toRecord(d.tm, out.tm);
+  toRecord(d.pose_q, out.pose);
+}
+
+inline void fromRecord(const PoseRecord& in, RTC::TimedPose3DQuaternion& d)
+{
+  fromRecord(in.tm, d.tm);
+  fromRecord(in.pose, d.pose_q);
+}
+
+inline void toRecord(const RTC::TimedPose3DQuaternionSeq& d, PoseSeqRecord& out)
+{
+  toRecord(d.tm, out.tm);
+  uint32_t n = d.data.length();
+  if (n > POSE_RECORD_MAX_POSES) n = POSE_RECORD_MAX_POSES;
+  out.length = n;
+  for (uint32_t i = 0; i < n; i++) toRecord(d.data[i], out.data[i]);
+}
+
+inline void fromRecord(const PoseSeqRecord& in, RTC::TimedPose3DQuaternionSeq& d)
+{
+  fromRecord(in.tm, d.tm);
+  d.data.length(in.length);
+  for (uint32_t i = 0; i < in.length; i++) fromRecord(in.data[i], d.data[i]);
+}
+
+inline void toRecord(const RTC::TimedSkeltonSeq& d, SkeltonSeqRecord& out)
+{
+  toRecord(d.tm, out.tm);
+  uint32_t n = d.data.length();
+  if (n > POSE_RECORD_MAX_SKELTONS) n = POSE_RECORD_MAX_SKELTONS;
+  out.length = n;
+  for (uint32_t i = 0; i < n; i++)
+  {
+    const RTC::Skelton& s = d.data[i];
+    uint32_t m = s.pose_q.length();
+    if (m > POSE_RECORD_MAX_JOINTS) m = POSE_RECORD_MAX_JOINTS;
+    out.data[i].id = s.ID;
+    out.data[i].length = m;
+    for (uint32_t j = 0; j < m; j++) toRecord(s.pose_q[j], out.data[i].pose[j]);
+  }
+}
+
+inline void fromRecord(const SkeltonSeqRecord& in, RTC::TimedSkeltonSeq& d)
+{
+  fromRecord(in.tm, d.tm);
+  d.data.length(in.length);
+  for (uint32_t i = 0; i < in.length; i++)
+  {
+    RTC::Skelton& s = d.data[i];
+    s.ID = in.data[i].id;
+    s.pose_q.length(in.data[i].length);
+    for (uint32_t j = 0; j < in.data[i].length; j++) fromRecord(in.data[i].pose[j], s.pose_q[j]);
+  }
+}
+
+#endif // POSERECORD_H
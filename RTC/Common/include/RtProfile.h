@@ -0,0 +1,68 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  RtProfile.h
+ * @brief Real-time scheduling, CPU affinity and memory locking helpers
+ * @date  $Date$
+ *
+ * $Id$
+ */
+
+#ifndef RTPROFILE_H
+#define RTPROFILE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+/*!
+ * @class RtProfile
+ * @brief コンポーネントの実行スレッドをリアルタイム向けに設定する
+ *
+ * いずれも失敗理由を標準出力に出して false を返すだけで、
+ * 設定できなかった場合も通常のスケジューリングで動作を続ける。
+ * SCHED_FIFO/SCHED_RR と mlockall には CAP_SYS_NICE / CAP_IPC_LOCK
+ * (または rlimit の rtprio / memlock) が必要。
+ */
+class RtProfile
+{
+ public:
+  /*!
+   * @brief 呼び出したスレッドのスケジューリングポリシーを設定する
+   * @param policy "other", "fifo", "rr" のいずれか
+   * @param priority fifo/rr の優先度 (1-99)
+   */
+  static bool setScheduling(const std::string& policy, int priority);
+
+  /*!
+   * @brief スレッドの CPU アフィニティを設定する
+   * @param tid スレッド ID (0 で呼び出したスレッド)
+   * @param cpus "2", "2,3", "0-3" 形式の CPU リスト。空なら何もしない
+   */
+  static bool setAffinity(pid_t tid, const std::string& cpus);
+
+  /*!
+   * @brief プロセスのメモリを全てロックし、以降のページフォルトを防ぐ
+   */
+  static bool lockMemory();
+
+  /*!
+   * @brief 呼び出したスレッドのスタックを bytes 分触っておく
+   */
+  static void prefaultStack(size_t bytes);
+
+  /*!
+   * @brief プロセス内のスレッド ID 一覧 (/proc/self/task)
+   */
+  static std::vector<pid_t> threadIds();
+
+  /*!
+   * @brief before に含まれないスレッドの CPU アフィニティを設定する
+   *
+   * ライブラリが内部で作るワーカースレッドを、作成前後の差分で特定して固定する。
+   * @return 設定したスレッド数
+   */
+  static int setAffinityOfNewThreads(const std::vector<pid_t>& before, const std::string& cpus);
+};
+
+#endif // RTPROFILE_H
@@ -0,0 +1,155 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  ShmRing.h
+ * @brief Shared-memory single-producer / multi-consumer ring
+ * @date  $Date$
+ *
+ * $Id$
+ */
+
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+
+/*!
+ * @brief 共有メモリ先頭のヘッダ
+ */
+struct ShmRingHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slot_size;            // 1レコードのバイト数
+  uint32_t slot_count;
+  std::atomic<uint64_t> head;    // 次に書き込むレコード番号
+  std::atomic<uint32_t> notify;  // 書き込みごとに増える futex ワード
+  uint32_t reserved;
+};
+
+/*!
+ * @class ShmRing
+ * @brief プロセス間で固定長レコードを受け渡す SPMC リング
+ *
+ * 書き手は1つ、読み手は任意個。各スロットの番号 (seq) を seqlock として使い、
+ * 読み手は共有メモリ上のレコードをコピーせずに参照する。参照中に書き手が
+ * 一周して上書きした場合は release() が false を返す。
+ * 読み手が追いつけずに上書きされたレコード数は lost() で分かる。
+ * 書き込みは futex で通知するので、読み手は wait() で待つこともできる。
+ */
+class ShmRing
+{
+ public:
+  ShmRing();
+  ~ShmRing();
+
+  /*!
+   * @brief 書き手として作成 (既に同じ形式のリングがあれば番号を引き継ぐ)
+   * @param name 共有メモリ名 (先頭の '/' は省略可)
+   */
+  bool create(const std::string& name, size_t slot_size, size_t slot_count);
+
+  /*!
+   * @brief 読み手として接続する。書き手がまだいなければ false
+   */
+  bool open(const std::string& name, size_t slot_size);
+
+  void close();
+  bool isOpen() const { return m_header != NULL; }
+
+  // --- 書き手 ---
+  /*!
+   * @brief 次のスロットを確保し、書き込み先を返す
+   */
+  void* beginWrite();
+  /*!
+   * @brief beginWrite() で書いたレコードを公開し、読み手を起こす
+   */
+  void commit();
+
+  // --- 読み手 ---
+  /*!
+   * @brief 未読の次のレコードを参照する (なければ NULL)
+   */
+  const void* acquire();
+  /*!
+   * @brief 最新のレコードを参照する (それより古い未読は読み飛ばす)
+   */
+  const void* acquireLatest();
+  /*!
+   * @brief acquire したレコードの参照を終える
+   * @return 参照中に上書きされていなければ true
+   */
+  bool release();
+
+  /*!
+   * @brief 新しいレコードが来るまで待つ
+   * @param timeout 最大待ち時間 [s]
+   * @return 未読のレコードがあれば true
+   */
+  bool wait(double timeout);
+
+  // 上書きで読めなかったレコード数
+  uint64_t lost() const { return m_lost; }
+
+ private:
+  bool map(const std::string& name, size_t size, bool writer);
+  unsigned char* slot(uint64_t n) const;
+  std::atomic<uint64_t>& slotSeq(uint64_t n) const;
+
+  std::string m_name;
+  ShmRingHeader* m_header;
+  size_t m_size;
+  size_t m_stride;
+
+  uint64_t m_cursor;     // 読み手: 次に読む番号
+  uint64_t m_reading;    // 読み手: acquire 中の番号
+  bool     m_acquired;
+  uint64_t m_lost;
+};
+
+/*!
+ * @brief 型付きの書き手
+ */
+template <typename Record>
+class ShmRingWriter
+{
+ public:
+  bool create(const std::string& name, size_t slot_count)
+  {
+    return m_ring.create(name, sizeof(Record), slot_count);
+  }
+  void close() { m_ring.close(); }
+  bool isOpen() const { return m_ring.isOpen(); }
+
+  Record* beginWrite() { return static_cast<Record*>(m_ring.beginWrite()); }
+  void commit() { m_ring.commit(); }
+
+ private:
+  ShmRing m_ring;
+};
+
+/*!
+ * @brief 型付きの読み手
+ */
+template <typename Record>
+class ShmRingReader
+{
+ public:
+  bool open(const std::string& name) { return m_ring.open(name, sizeof(Record)); }
+  void close() { m_ring.close(); }
+  bool isOpen() const { return m_ring.isOpen(); }
+
+  const Record* acquire() { return static_cast<const Record*>(m_ring.acquire()); }
+  const Record* acquireLatest() { return static_cast<const Record*>(m_ring.acquireLatest()); }
+  bool release() { return m_ring.release(); }
+  bool wait(double timeout) { return m_ring.wait(timeout); }
+  uint64_t lost() const { return m_ring.lost(); }
+
+ private:
+  ShmRing m_ring;
+};
+
+#endif // SHMRING_H
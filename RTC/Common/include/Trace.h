@@ -0,0 +1,84 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  Trace.h
+ * @brief Scoped trace points dumped in Chrome trace-event format
+ * @date  $Date$
+ *
+ * $Id$
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+
+/*
+ * ENABLE_TRACE を定義してビルドしたときだけ、区間の開始・終了時刻を
+ * スレッドごとのリングバッファに記録する。
+ *
+ *   TRACE_SCOPE("Nuitrack::waitUpdate");  // このスコープの区間を記録する
+ *   TRACE_INSTANT("StopBegin");           // 時点のイベントを記録する
+ *
+ * 記録は TSC (x86 以外では steady_clock) を読んでリングに書くだけで、
+ * ロックもメモリ確保もしない。リングが一周したら古いものから上書きする。
+ *
+ * Trace::dump() で chrome://tracing / Perfetto で読める JSON を書き出す。
+ * Trace::dumpOnSignal() を呼んでおくと SIGUSR1 で書き出せる。
+ * 名前は文字列リテラルなどプロセス終了まで有効なものを渡すこと。
+ * 定義しない通常ビルドではマクロは何も生成せず、Trace の関数は何もしない。
+ */
+
+#ifdef ENABLE_TRACE
+
+class Trace
+{
+ public:
+  /*!
+   * @brief 区間イベント
+   */
+  class Scope
+  {
+   public:
+    explicit Scope(const char* name);
+    ~Scope();
+   private:
+    const char* m_name;
+    unsigned long long m_begin;
+  };
+
+  static void instant(const char* name);
+
+  /*!
+   * @brief 全スレッドのリングの内容を Chrome trace-event JSON で書き出す
+   *
+   * 記録中のスレッドを止めずに読むので、書き出し中に上書きされた
+   * 最古付近のイベントは欠けることがある。
+   */
+  static bool dump(const std::string& path);
+
+  /*!
+   * @brief SIGUSR1 を受けたら path へ書き出す (プロセスで最初の呼び出しのみ有効)
+   */
+  static void dumpOnSignal(const std::string& path);
+};
+
+#define TRACE_CAT_(a, b) a##b
+#define TRACE_CAT(a, b) TRACE_CAT_(a, b)
+#define TRACE_SCOPE(name) Trace::Scope TRACE_CAT(trace_scope_, __LINE__)(name)
+#define TRACE_INSTANT(name) Trace::instant(name)
+
+#else
+
+class Trace
+{
+ public:
+  static bool dump(const std::string&) { return false; }
+  static void dumpOnSignal(const std::string&) {}
+};
+
+#define TRACE_SCOPE(name)
+#define TRACE_INSTANT(name)
+
+#endif // ENABLE_TRACE
+
+#endif // TRACE_H
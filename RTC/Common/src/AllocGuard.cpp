@@ -0,0 +1,128 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  AllocGuard.cpp
+ * @brief Test-only detection of heap allocations in control cycles
+ * @date $Date$
+ *
+ * $Id$
+ */
+
+#include "AllocGuard.h"
+
+#ifdef ENABLE_ALLOC_GUARD
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// operator new から呼ばれるので、ここではヒープを使わない
+static thread_local int tl_scope = 0;
+static thread_local int tl_pause = 0;
+static thread_local unsigned long tl_count = 0;
+static std::atomic<unsigned long> g_violations(0);
+
+static bool abortOnAlloc()
+{
+  static int mode = -1;
+  if (mode < 0)
+  {
+    const char* env = std::getenv("ALLOC_GUARD");
+    mode = (env != NULL && std::strcmp(env, "abort") == 0) ? 1 : 0;
+  }
+  return mode == 1;
+}
+
+static void* guardedAlloc(std::size_t size)
+{
+  if (tl_scope > 0 && tl_pause == 0)
+  {
+    tl_count++;
+    g_violations.fetch_add(1, std::memory_order_relaxed);
+    if (abortOnAlloc())
+    {
+      std::fprintf(stderr, "AllocGuard: heap allocation of %lu bytes in a guarded scope\n",
+                   static_cast<unsigned long>(size));
+      std::abort();
+    }
+  }
+  return std::malloc(size == 0 ? 1 : size);
+}
+
+AllocGuard::Scope::Scope(const char* name)
+  : m_name(name), m_start(tl_count)
+{
+  tl_scope++;
+}
+
+AllocGuard::Scope::~Scope()
+{
+  tl_scope--;
+  unsigned long n = tl_count - m_start;
+  if (n > 0)
+  {
+    std::fprintf(stderr, "AllocGuard: %lu heap allocation(s) in %s\n", n, m_name);
+  }
+}
+
+AllocGuard::Pause::Pause()
+{
+  tl_pause++;
+}
+
+AllocGuard::Pause::~Pause()
+{
+  tl_pause--;
+}
+
+unsigned long AllocGuard::violations()
+{
+  return g_violations.load(std::memory_order_relaxed);
+}
+
+void* operator new(std::size_t size)
+{
+  void* p = guardedAlloc(size);
+  if (p == NULL) throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[](std::size_t size)
+{
+  void* p = guardedAlloc(size);
+  if (p == NULL) throw std::bad_alloc();
+  return p;
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+  return guardedAlloc(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+  return guardedAlloc(size);
+}
+
+void operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+  std::free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+  std::free(p);
+}
+
+#endif // ENABLE_ALLOC_GUARD
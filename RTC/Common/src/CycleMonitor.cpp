@@ -0,0 +1,166 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  CycleMonitor.cpp
+ * @brief Execution-context cycle interval / execution time and overrun budget
+ * @date $Date$
+ *
+ * $Id$
+ */
+
+#include "CycleMonitor.h"
+
+#include <algorithm>
+#include <cmath>
+
+CycleMonitor::CycleMonitor()
+  : m_period(0.001), m_budget(10), m_current(0), m_started(false), m_late(false), m_prev_overrun(false),
+    m_cycles(0), m_interval_sum(0.0), m_exec_sum(0.0), m_exec_max(0.0),
+    m_overruns_total(0), m_over_budget(false), m_status_sent(false), m_status_budget(false),
+    m_interval_hist(NULL), m_exec_hist(NULL), m_overrun_counter(NULL), m_budget_gauge(NULL)
+{
+  configure(m_period, m_budget, 10.0);
+}
+
+void CycleMonitor::attach(const std::string& label)
+{
+  m_interval_hist = &MetricRegistry::histogram("safety_cycle_interval_seconds", label, "Interval between onExecute starts");
+  m_exec_hist = &MetricRegistry::histogram("safety_execute_seconds", label, "onExecute duration");
+  m_overrun_counter = &MetricRegistry::counter("safety_cycle_overruns_total", label, "onExecute calls that missed their deadline");
+  m_budget_gauge = &MetricRegistry::gauge("safety_cycle_over_budget", label, "1 while overruns exceed the budget");
+}
+
+void CycleMonitor::configure(double period, int budget, double window)
+{
+  m_period = (period > 0.0) ? period : 0.001;
+  m_budget = budget;
+  size_t n = static_cast<size_t>(std::max(1.0, std::ceil(window)));
+  m_window.assign(n, 0);
+  m_window_index.assign(n, -1);
+  // 開始間隔のずれは周期の10倍まで 1us 刻みで数える
+  m_jitter.configure(m_period, m_period * 10.0);
+  reset(Clock::now());
+}
+
+void CycleMonitor::reset(Clock::time_point now)
+{
+  std::fill(m_window.begin(), m_window.end(), 0);
+  std::fill(m_window_index.begin(), m_window_index.end(), -1);
+  m_origin = now;
+  m_current = 0;
+  m_jitter.reset();
+  m_started = false;
+  m_late = false;
+  m_prev_overrun = false;
+  m_cycles = 0;
+  m_interval_sum = 0.0;
+  m_exec_sum = 0.0;
+  m_exec_max = 0.0;
+  m_overruns_total = 0;
+  m_over_budget = false;
+  m_status_sent = false;
+  m_status_budget = false;
+  if (m_budget_gauge != NULL) m_budget_gauge->set(0.0);
+}
+
+void CycleMonitor::begin(Clock::time_point now)
+{
+  m_jitter.tick(now);
+  m_late = false;
+  if (m_started)
+  {
+    double interval = std::chrono::duration<double>(now - m_last_begin).count();
+    m_interval_sum += interval;
+    if (m_interval_hist != NULL) m_interval_hist->observe(interval);
+    // 半周期以上遅れて始まった周期も取りこぼしとみなす。
+    // 前の周期の超過で遅れた分は前の周期で数えているので除く
+    m_late = (interval > m_period * 1.5) && !m_prev_overrun;
+  }
+  m_started = true;
+  m_last_begin = now;
+  m_begin = now;
+}
+
+void CycleMonitor::end(Clock::time_point now)
+{
+  double exec = std::chrono::duration<double>(now - m_begin).count();
+  m_cycles++;
+  m_exec_sum += exec;
+  m_exec_max = std::max(m_exec_max, exec);
+  if (m_exec_hist != NULL) m_exec_hist->observe(exec);
+
+  m_current = static_cast<long>(std::chrono::duration<double>(now - m_origin).count());
+  size_t slot = m_current % m_window.size();
+  if (m_window_index[slot] != m_current)
+  {
+    m_window[slot] = 0;
+    m_window_index[slot] = m_current;
+  }
+
+  m_prev_overrun = (exec > m_period);
+  if (m_prev_overrun || m_late)
+  {
+    m_window[slot]++;
+    m_overruns_total++;
+    if (m_overrun_counter != NULL) m_overrun_counter->inc();
+  }
+
+  bool over = m_budget >= 0 && windowOverruns() > static_cast<uint64_t>(m_budget);
+  if (over != m_over_budget && m_budget_gauge != NULL) m_budget_gauge->set(over ? 1.0 : 0.0);
+  m_over_budget = over;
+}
+
+uint64_t CycleMonitor::windowOverruns() const
+{
+  long first = m_current - static_cast<long>(m_window.size()) + 1;
+  uint64_t n = 0;
+  for (size_t i = 0; i < m_window.size(); i++)
+  {
+    if (m_window_index[i] >= first && m_window_index[i] <= m_current) n += m_window[i];
+  }
+  return n;
+}
+
+double CycleMonitor::meanInterval() const
+{
+  // 開始間隔は2周期目から数えるので cycles - 1 で割る
+  if (m_cycles < 2) return m_period;
+  return m_interval_sum / (m_cycles - 1);
+}
+
+CycleMonitor::Status CycleMonitor::status() const
+{
+  Status s;
+  s.period = m_period;
+  s.interval = meanInterval();
+  s.jitter_p99 = m_jitter.report().p99;
+  s.exec_mean = (m_cycles > 0) ? m_exec_sum / m_cycles : 0.0;
+  s.exec_max = m_exec_max;
+  s.overruns = windowOverruns();
+  s.overruns_total = m_overruns_total;
+  s.over_budget = m_over_budget;
+  return s;
+}
+
+void CycleMonitor::toArray(const Status& s, double* out)
+{
+  out[0] = s.period;
+  out[1] = s.interval;
+  out[2] = s.jitter_p99;
+  out[3] = s.exec_mean;
+  out[4] = s.exec_max;
+  out[5] = static_cast<double>(s.overruns);
+  out[6] = static_cast<double>(s.overruns_total);
+  out[7] = s.over_budget ? 1.0 : 0.0;
+}
+
+bool CycleMonitor::statusDue(Clock::time_point now, double period)
+{
+  bool due = !m_status_sent || m_over_budget != m_status_budget ||
+    (period > 0.0 && std::chrono::duration<double>(now - m_status_time).count() >= period);
+  if (!due) return false;
+
+  m_status_sent = true;
+  m_status_budget = m_over_budget;
+  m_status_time = now;
+  return true;
+}
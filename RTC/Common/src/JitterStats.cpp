@@ -0,0 +1,87 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  JitterStats.cpp
+ * @brief Cycle period jitter histogram for periodic components
+ * @date $Date$
+ *
+ * $Id$
+ */
+
+#include "JitterStats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+JitterStats::JitterStats()
+  : m_period(0.001), m_count(0), m_sum(0.0), m_max(0.0), m_started(false)
+{
+  configure(m_period, 0.01);
+}
+
+void JitterStats::configure(double period, double range)
+{
+  m_period = period;
+  size_t n = static_cast<size_t>(std::max(1.0, range * 1e6)) + 1;
+  m_bins.assign(n, 0);
+  reset();
+}
+
+void JitterStats::reset()
+{
+  std::fill(m_bins.begin(), m_bins.end(), 0);
+  m_count = 0;
+  m_sum = 0.0;
+  m_max = 0.0;
+  m_started = false;
+}
+
+void JitterStats::tick(Clock::time_point now)
+{
+  if (m_started)
+  {
+    double dt = std::chrono::duration<double>(now - m_last).count();
+    double jitter = std::fabs(dt - m_period);
+    size_t bin = std::min(static_cast<size_t>(jitter * 1e6), m_bins.size() - 1);
+    m_bins[bin]++;
+    m_count++;
+    m_sum += jitter;
+    m_max = std::max(m_max, jitter);
+  }
+  m_started = true;
+  m_last = now;
+}
+
+double JitterStats::percentile(double q) const
+{
+  if (m_count == 0) return 0.0;
+
+  uint64_t target = static_cast<uint64_t>(std::ceil(q * m_count));
+  uint64_t acc = 0;
+  for (size_t i = 0; i < m_bins.size(); i++)
+  {
+    acc += m_bins[i];
+    if (acc >= target) return std::min((i + 1) * 1e-6, m_max);
+  }
+  return m_max;
+}
+
+JitterStats::Report JitterStats::report() const
+{
+  Report r;
+  r.count = m_count;
+  r.mean = (m_count > 0) ? m_sum / m_count : 0.0;
+  r.p50 = percentile(0.5);
+  r.p99 = percentile(0.99);
+  r.p999 = percentile(0.999);
+  r.max = m_max;
+  return r;
+}
+
+void JitterStats::print(const char* name) const
+{
+  Report r = report();
+  std::printf("%s jitter: n=%llu mean=%.1fus p50=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus\n",
+              name, static_cast<unsigned long long>(r.count),
+              r.mean * 1e6, r.p50 * 1e6, r.p99 * 1e6, r.p999 * 1e6, r.max * 1e6);
+}
@@ -0,0 +1,260 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  MetricRegistry.cpp
+ * @brief Process-wide counters, gauges and histograms in Prometheus text format
+ * @date $Date$
+ *
+ * $Id$
+ */
+
+#include "MetricRegistry.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 既定のバケット [s]: 1周期 (1ms 前後) から Nuitrack のフレーム遅延まで
+static const double DEFAULT_BOUNDS[] = {
+  0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01,
+  0.025, 0.05, 0.1, 0.25, 0.5, 1.0
+};
+
+MetricHistogram::MetricHistogram()
+  : m_bucket_num(0), m_sum_ns(0)
+{
+  for (int i = 0; i <= MAX_BUCKETS; i++) m_counts[i].store(0, std::memory_order_relaxed);
+  configure(NULL, 0);
+}
+
+void MetricHistogram::configure(const double* bounds, int n)
+{
+  if (bounds == NULL || n <= 0)
+  {
+    bounds = DEFAULT_BOUNDS;
+    n = sizeof(DEFAULT_BOUNDS) / sizeof(DEFAULT_BOUNDS[0]);
+  }
+  if (n > MAX_BUCKETS) n = MAX_BUCKETS;
+  for (int i = 0; i < n; i++) m_bounds[i] = bounds[i];
+  m_bucket_num = n;
+}
+
+namespace
+{
+  enum MetricType { COUNTER, GAUGE, HISTOGRAM };
+
+  struct Entry
+  {
+    MetricType type;
+    std::string name;
+    std::string labels;
+    std::string help;
+    MetricCounter counter;
+    MetricGauge gauge;
+    MetricHistogram histogram;
+  };
+
+  // 要素のアドレスが変わらないよう deque に置く
+  std::mutex g_mutex;
+  std::deque<Entry>& entries()
+  {
+    static std::deque<Entry> e;
+    return e;
+  }
+
+  Entry& lookup(MetricType type, const std::string& name, const std::string& labels,
+                const std::string& help)
+  {
+    std::lock_guard<std::mutex> guard(g_mutex);
+    std::deque<Entry>& e = entries();
+    for (size_t i = 0; i < e.size(); i++)
+    {
+      if (e[i].type == type && e[i].name == name && e[i].labels == labels) return e[i];
+    }
+    e.emplace_back();
+    Entry& n = e.back();
+    n.type = type;
+    n.name = name;
+    n.labels = labels;
+    n.help = help;
+    return n;
+  }
+
+  const char* typeName(MetricType type)
+  {
+    switch (type)
+    {
+      case COUNTER: return "counter";
+      case GAUGE:   return "gauge";
+      default:      return "histogram";
+    }
+  }
+
+  std::string labelSet(const std::string& labels, const std::string& extra = "")
+  {
+    if (labels.empty() && extra.empty()) return "";
+    if (labels.empty()) return "{" + extra + "}";
+    if (extra.empty()) return "{" + labels + "}";
+    return "{" + labels + "," + extra + "}";
+  }
+}
+
+MetricCounter& MetricRegistry::counter(const std::string& name, const std::string& labels,
+                                       const std::string& help)
+{
+  return lookup(COUNTER, name, labels, help).counter;
+}
+
+MetricGauge& MetricRegistry::gauge(const std::string& name, const std::string& labels,
+                                   const std::string& help)
+{
+  return lookup(GAUGE, name, labels, help).gauge;
+}
+
+MetricHistogram& MetricRegistry::histogram(const std::string& name, const std::string& labels,
+                                           const std::string& help,
+                                           const double* bounds, int n)
+{
+  Entry& e = lookup(HISTOGRAM, name, labels, help);
+  if (bounds != NULL) e.histogram.configure(bounds, n);
+  return e.histogram;
+}
+
+std::string MetricRegistry::render()
+{
+  std::lock_guard<std::mutex> guard(g_mutex);
+  std::deque<Entry>& e = entries();
+  std::string out;
+  char buf[128];
+  std::vector<bool> done(e.size(), false);
+
+  // 同じ名前のもの (ラベル違い) は HELP/TYPE の下にまとめる
+  for (size_t i = 0; i < e.size(); i++)
+  {
+    if (done[i]) continue;
+    out += "# HELP " + e[i].name + " " + e[i].help + "\n";
+    out += "# TYPE " + e[i].name + " " + typeName(e[i].type) + "\n";
+    for (size_t j = i; j < e.size(); j++)
+    {
+      if (done[j] || e[j].name != e[i].name || e[j].type != e[i].type) continue;
+      done[j] = true;
+      const Entry& m = e[j];
+      if (m.type == COUNTER)
+      {
+        std::snprintf(buf, sizeof(buf), " %llu\n", static_cast<unsigned long long>(m.counter.value()));
+        out += m.name + labelSet(m.labels) + buf;
+      }
+      else if (m.type == GAUGE)
+      {
+        std::snprintf(buf, sizeof(buf), " %.9g\n", m.gauge.value());
+        out += m.name + labelSet(m.labels) + buf;
+      }
+      else
+      {
+        const MetricHistogram& h = m.histogram;
+        uint64_t cumulative = 0;
+        for (int b = 0; b <= h.bucketNum(); b++)
+        {
+          cumulative += h.count(b);
+          if (b < h.bucketNum()) std::snprintf(buf, sizeof(buf), "le=\"%g\"", h.bound(b));
+          else std::snprintf(buf, sizeof(buf), "le=\"+Inf\"");
+          std::string le(buf);
+          std::snprintf(buf, sizeof(buf), " %llu\n", static_cast<unsigned long long>(cumulative));
+          out += m.name + "_bucket" + labelSet(m.labels, le) + buf;
+        }
+        std::snprintf(buf, sizeof(buf), " %.9g\n", h.sum());
+        out += m.name + "_sum" + labelSet(m.labels) + buf;
+        std::snprintf(buf, sizeof(buf), " %llu\n", static_cast<unsigned long long>(cumulative));
+        out += m.name + "_count" + labelSet(m.labels) + buf;
+      }
+    }
+  }
+  return out;
+}
+
+bool MetricRegistry::writeFile(const std::string& path)
+{
+  if (path.empty()) return false;
+
+  std::string text = render();
+  std::string tmp = path + ".tmp";
+  FILE* fp = std::fopen(tmp.c_str(), "w");
+  if (fp == NULL) return false;
+  std::fwrite(text.data(), 1, text.size(), fp);
+  std::fclose(fp);
+
+  // node-exporter が書きかけを読まないよう rename で置き換える
+  return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+static void serveSocket(const std::string& path)
+{
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) return;
+
+  sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  unlink(path.c_str());
+  if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 4) != 0)
+  {
+    std::perror(path.c_str());
+    close(fd);
+    return;
+  }
+
+  // 接続ごとに現在値を書いて閉じる (socat - UNIX-CONNECT:<path> で読める)
+  for (;;)
+  {
+    int client = accept(fd, NULL, NULL);
+    if (client < 0)
+    {
+      // 割り込みと接続側の中断だけすぐやり直す。EMFILE などは続くので
+      // 空回りしないように待ってからやり直す
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      std::perror("accept");
+      std::this_thread::sleep_for(std::chrono::seconds(1));
+      continue;
+    }
+    std::string text = MetricRegistry::render();
+    size_t sent = 0;
+    while (sent < text.size())
+    {
+      ssize_t n = send(client, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+      if (n <= 0) break;
+      sent += n;
+    }
+    close(client);
+  }
+}
+
+void MetricRegistry::startExporter(const std::string& target, double period)
+{
+  static std::atomic<bool> started(false);
+  if (target.empty() || started.exchange(true)) return;
+
+  if (target.compare(0, 5, "unix:") == 0)
+  {
+    std::thread(serveSocket, target.substr(5)).detach();
+    return;
+  }
+
+  if (period <= 0.0) period = 5.0;
+  std::thread([target, period]()
+  {
+    for (;;)
+    {
+      writeFile(target);
+      std::this_thread::sleep_for(std::chrono::duration<double>(period));
+    }
+  }).detach();
+}
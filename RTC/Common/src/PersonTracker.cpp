@@ -0,0 +1,194 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  PersonTracker.cpp
+ * @brief Gated detection-to-track assignment with stable person IDs
+ * @date $Date$
+ *
+ * $Id$
+ */
+
+#include "PersonTracker.h"
+
+#include <algorithm>
+
+// 上流の ID が一致する組は距離のどの組よりも先に割り当てる
+static const float HINT_COST = -1.0f;
+// 速度は観測から求めた値へこの割合で近づける
+static const float VELOCITY_GAIN = 0.5f;
+
+PersonTracker::PersonTracker()
+  : m_capacity(MAX_TRACKS), m_gate2(600.0f * 600.0f), m_max_missing(0.5), m_next_id(1)
+{
+  reset();
+}
+
+void PersonTracker::configure(int capacity, double gate_distance, double max_missing)
+{
+  int prev = m_capacity;
+  m_capacity = std::max(1, std::min(capacity, static_cast<int>(MAX_TRACKS)));
+  m_gate2 = static_cast<float>(gate_distance * gate_distance);
+  m_max_missing = max_missing;
+  if (m_capacity != prev) reset();
+}
+
+void PersonTracker::reset()
+{
+  for (int k = 0; k < MAX_TRACKS; k++)
+  {
+    m_tracks[k].alive = false;
+    m_tracks[k].updated = false;
+    m_tracks[k].created = false;
+  }
+}
+
+int PersonTracker::count() const
+{
+  int n = 0;
+  for (int k = 0; k < m_capacity; k++) n += m_tracks[k].alive ? 1 : 0;
+  return n;
+}
+
+int PersonTracker::update(const Detection* dets, int n, double now, int* assigned)
+{
+  n = std::min(n, static_cast<int>(MAX_TRACKS));
+
+  // 生きている追跡と検出の全組からゲート内のものを集める
+  int pairs = 0;
+  for (int k = 0; k < m_capacity; k++)
+  {
+    Track& tr = m_tracks[k];
+    tr.updated = false;
+    tr.created = false;
+    if (!tr.alive) continue;
+
+    float dt = static_cast<float>(now - tr.last_seen);
+    float px = tr.pos[0] + tr.vel[0] * dt;
+    float py = tr.pos[1] + tr.vel[1] * dt;
+    float pz = tr.pos[2] + tr.vel[2] * dt;
+    for (int i = 0; i < n; i++)
+    {
+      const Detection& d = dets[i];
+      float cost;
+      if (d.hint >= 0 && d.hint == tr.hint)
+      {
+        cost = HINT_COST;
+      }
+      else
+      {
+        float dx = d.x - px, dy = d.y - py, dz = d.z - pz;
+        cost = dx * dx + dy * dy + dz * dz;
+        if (cost > m_gate2) continue;
+      }
+      Pair& p = m_pairs[pairs++];
+      p.cost = cost;
+      p.track = k;
+      p.detection = i;
+    }
+  }
+
+  // コストの小さい組から、どちらもまだ使っていなければ割り当てる
+  std::sort(m_pairs, m_pairs + pairs, lessCost);
+  for (int i = 0; i < n; i++) assigned[i] = -1;
+  for (int j = 0; j < pairs; j++)
+  {
+    const Pair& p = m_pairs[j];
+    Track& tr = m_tracks[p.track];
+    if (tr.updated || assigned[p.detection] >= 0) continue;
+
+    const Detection& d = dets[p.detection];
+    float dt = static_cast<float>(now - tr.last_seen);
+    float obs[3] = { d.x, d.y, d.z };
+    for (int a = 0; a < 3; a++)
+    {
+      if (dt > 0.0f) tr.vel[a] += ((obs[a] - tr.pos[a]) / dt - tr.vel[a]) * VELOCITY_GAIN;
+      tr.pos[a] = obs[a];
+    }
+    if (d.hint >= 0) tr.hint = d.hint;
+    tr.last_seen = now;
+    tr.updated = true;
+    assigned[p.detection] = p.track;
+  }
+
+  // 見えなくなって max_missing を過ぎた追跡を消す。見えていない間はゾーンに居ない
+  for (int k = 0; k < m_capacity; k++)
+  {
+    Track& tr = m_tracks[k];
+    if (!tr.alive || tr.updated) continue;
+    if (now - tr.last_seen > m_max_missing)
+    {
+      tr.alive = false;
+      continue;
+    }
+    setZone(k, 0, now);
+  }
+
+  int unassigned = 0;
+  for (int i = 0; i < n; i++)
+  {
+    if (assigned[i] >= 0) continue;
+    assigned[i] = birth(dets[i], now);
+    if (assigned[i] < 0) unassigned++;
+  }
+  return unassigned;
+}
+
+int PersonTracker::birth(const Detection& d, double now)
+{
+  // 空きがなければ、今回見えていない追跡のうち最も古く見えたものを譲らせる
+  int slot = -1;
+  for (int k = 0; k < m_capacity && slot < 0; k++)
+  {
+    if (!m_tracks[k].alive) slot = k;
+  }
+  for (int k = 0; k < m_capacity && slot < 0; k++)
+  {
+    const Track& tr = m_tracks[k];
+    if (tr.updated) continue;
+    slot = k;
+    for (int j = k + 1; j < m_capacity; j++)
+    {
+      if (!m_tracks[j].updated && m_tracks[j].last_seen < m_tracks[slot].last_seen) slot = j;
+    }
+  }
+  if (slot < 0) return -1;
+
+  Track& tr = m_tracks[slot];
+  tr.alive = true;
+  tr.updated = true;
+  tr.created = true;
+  tr.id = m_next_id++;
+  tr.hint = d.hint;
+  tr.pos[0] = d.x;
+  tr.pos[1] = d.y;
+  tr.pos[2] = d.z;
+  tr.vel[0] = tr.vel[1] = tr.vel[2] = 0.0f;
+  tr.born = now;
+  tr.last_seen = now;
+  tr.zone = 0;
+  tr.zone_since = now;
+  return slot;
+}
+
+void PersonTracker::position(int slot, float& x, float& y, float& z) const
+{
+  const Track& tr = m_tracks[slot];
+  x = tr.pos[0];
+  y = tr.pos[1];
+  z = tr.pos[2];
+}
+
+void PersonTracker::velocity(int slot, float& vx, float& vy, float& vz) const
+{
+  const Track& tr = m_tracks[slot];
+  vx = tr.vel[0];
+  vy = tr.vel[1];
+  vz = tr.vel[2];
+}
+
+void PersonTracker::setZone(int slot, int zone, double now)
+{
+  Track& tr = m_tracks[slot];
+  if (tr.zone == zone) return;
+  tr.zone = zone;
+  tr.zone_since = now;
+}
@@ -0,0 +1,254 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  ShmRing.cpp
+ * @brief Shared-memory single-producer / multi-consumer ring
+ * @date $Date$
+ *
+ * $Id$
+ */
+
+#include "ShmRing.h"
+
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "ShmRing needs lock-free 64bit atomics");
+
+static const uint32_t SHM_RING_MAGIC = 0x524e4753; // "SGNR"
+static const uint32_t SHM_RING_VERSION = 1;
+// ヘッダとスロットはキャッシュライン単位で並べる
+static const size_t SHM_RING_ALIGN = 64;
+// スロット先頭の seq の分
+static const size_t SLOT_SEQ_SIZE = sizeof(uint64_t);
+
+static size_t alignUp(size_t n)
+{
+  return (n + SHM_RING_ALIGN - 1) / SHM_RING_ALIGN * SHM_RING_ALIGN;
+}
+
+static std::string shmName(const std::string& name)
+{
+  return (!name.empty() && name[0] == '/') ? name : "/" + name;
+}
+
+ShmRing::ShmRing()
+  : m_header(NULL), m_size(0), m_stride(0),
+    m_cursor(0), m_reading(0), m_acquired(false), m_lost(0)
+{
+}
+
+ShmRing::~ShmRing()
+{
+  close();
+}
+
+bool ShmRing::map(const std::string& name, size_t size, bool writer)
+{
+  int flags = writer ? (O_CREAT | O_RDWR) : O_RDWR;
+  int fd = shm_open(shmName(name).c_str(), flags, 0666);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+  {
+    ::close(fd);
+    return false;
+  }
+  if (writer && static_cast<size_t>(st.st_size) != size)
+  {
+    if (ftruncate(fd, size) != 0)
+    {
+      ::close(fd);
+      return false;
+    }
+  }
+  if (!writer) size = st.st_size;
+  if (size < sizeof(ShmRingHeader))
+  {
+    ::close(fd);
+    return false;
+  }
+
+  void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED) return false;
+
+  m_header = static_cast<ShmRingHeader*>(p);
+  m_size = size;
+  m_name = name;
+  return true;
+}
+
+bool ShmRing::create(const std::string& name, size_t slot_size, size_t slot_count)
+{
+  close();
+  if (slot_size == 0 || slot_count == 0) return false;
+
+  size_t stride = alignUp(SLOT_SEQ_SIZE + slot_size);
+  size_t size = alignUp(sizeof(ShmRingHeader)) + stride * slot_count;
+  if (!map(name, size, true)) return false;
+  m_stride = stride;
+
+  // 同じ形式のリングが残っていれば番号を引き継ぎ、読み手がそのまま続けられるようにする
+  ShmRingHeader* h = m_header;
+  if (h->magic != SHM_RING_MAGIC || h->version != SHM_RING_VERSION ||
+      h->slot_size != slot_size || h->slot_count != slot_count)
+  {
+    std::memset(static_cast<void*>(h), 0, m_size);
+    h->slot_size = static_cast<uint32_t>(slot_size);
+    h->slot_count = static_cast<uint32_t>(slot_count);
+    h->version = SHM_RING_VERSION;
+    h->head.store(0, std::memory_order_relaxed);
+    h->notify.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    h->magic = SHM_RING_MAGIC;
+  }
+  return true;
+}
+
+bool ShmRing::open(const std::string& name, size_t slot_size)
+{
+  close();
+  if (!map(name, 0, false)) return false;
+
+  ShmRingHeader* h = m_header;
+  size_t stride = alignUp(SLOT_SEQ_SIZE + h->slot_size);
+  if (h->magic != SHM_RING_MAGIC || h->version != SHM_RING_VERSION ||
+      h->slot_size != slot_size || h->slot_count == 0 ||
+      m_size < alignUp(sizeof(ShmRingHeader)) + stride * h->slot_count)
+  {
+    close();
+    return false;
+  }
+  m_stride = stride;
+
+  // 接続以降に書かれたレコードから読む
+  m_cursor = h->head.load(std::memory_order_acquire);
+  m_acquired = false;
+  m_lost = 0;
+  return true;
+}
+
+void ShmRing::close()
+{
+  // 共有メモリ名は残しておき、書き手・読み手の再起動で同じリングにつながるようにする
+  if (m_header != NULL)
+  {
+    munmap(static_cast<void*>(m_header), m_size);
+    m_header = NULL;
+  }
+  m_size = 0;
+  m_acquired = false;
+}
+
+unsigned char* ShmRing::slot(uint64_t n) const
+{
+  unsigned char* base = reinterpret_cast<unsigned char*>(m_header) + alignUp(sizeof(ShmRingHeader));
+  return base + (n % m_header->slot_count) * m_stride;
+}
+
+std::atomic<uint64_t>& ShmRing::slotSeq(uint64_t n) const
+{
+  return *reinterpret_cast<std::atomic<uint64_t>*>(slot(n));
+}
+
+void* ShmRing::beginWrite()
+{
+  if (m_header == NULL) return NULL;
+
+  // 書き込み中は seq を奇数にする
+  uint64_t n = m_header->head.load(std::memory_order_relaxed);
+  slotSeq(n).store(2 * n + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  return slot(n) + SLOT_SEQ_SIZE;
+}
+
+void ShmRing::commit()
+{
+  if (m_header == NULL) return;
+
+  uint64_t n = m_header->head.load(std::memory_order_relaxed);
+  slotSeq(n).store(2 * n + 2, std::memory_order_release);
+  m_header->head.store(n + 1, std::memory_order_release);
+
+  m_header->notify.fetch_add(1, std::memory_order_release);
+  syscall(SYS_futex, reinterpret_cast<int*>(&m_header->notify), FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+const void* ShmRing::acquire()
+{
+  if (m_header == NULL) return NULL;
+
+  uint64_t head = m_header->head.load(std::memory_order_acquire);
+  uint64_t count = m_header->slot_count;
+  if (m_cursor > head) m_cursor = head; // 書き手がリングを作り直した
+
+  while (m_cursor < head)
+  {
+    // 一周以上遅れた分は読めない
+    if (head - m_cursor > count)
+    {
+      m_lost += head - count - m_cursor;
+      m_cursor = head - count;
+    }
+
+    uint64_t seq = slotSeq(m_cursor).load(std::memory_order_acquire);
+    if (seq == 2 * m_cursor + 2)
+    {
+      m_reading = m_cursor;
+      m_acquired = true;
+      return slot(m_cursor) + SLOT_SEQ_SIZE;
+    }
+
+    // 読む前に書き手に上書きされた
+    m_lost++;
+    m_cursor++;
+  }
+  return NULL;
+}
+
+const void* ShmRing::acquireLatest()
+{
+  if (m_header == NULL) return NULL;
+
+  uint64_t head = m_header->head.load(std::memory_order_acquire);
+  if (head > 0 && m_cursor + 1 < head) m_cursor = head - 1; // 意図した読み飛ばしは lost に数えない
+  return acquire();
+}
+
+bool ShmRing::release()
+{
+  if (m_header == NULL || !m_acquired) return false;
+
+  // 参照中に上書きされていないか seq を読み直して確かめる
+  std::atomic_thread_fence(std::memory_order_acquire);
+  uint64_t seq = slotSeq(m_reading).load(std::memory_order_relaxed);
+  bool ok = (seq == 2 * m_reading + 2);
+  if (!ok) m_lost++;
+
+  m_cursor = m_reading + 1;
+  m_acquired = false;
+  return ok;
+}
+
+bool ShmRing::wait(double timeout)
+{
+  if (m_header == NULL) return false;
+
+  uint32_t v = m_header->notify.load(std::memory_order_acquire);
+  if (m_header->head.load(std::memory_order_acquire) > m_cursor) return true;
+
+  struct timespec ts;
+  ts.tv_sec = static_cast<time_t>(timeout);
+  ts.tv_nsec = static_cast<long>((timeout - ts.tv_sec) * 1e9);
+  syscall(SYS_futex, reinterpret_cast<int*>(&m_header->notify), FUTEX_WAIT, v, &ts, NULL, 0);
+
+  return m_header->head.load(std::memory_order_acquire) > m_cursor;
+}
@@ -0,0 +1,211 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  Trace.cpp
+ * @brief Scoped trace points dumped in Chrome trace-event format
+ * @date $Date$
+ *
+ * $Id$
+ */
+
+#include "Trace.h"
+
+#ifdef ENABLE_TRACE
+
+#include <signal.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// 1スレッドあたりのイベント数 (2 のべき乗)
+#ifndef TRACE_RING_EVENTS
+#define TRACE_RING_EVENTS 16384
+#endif
+
+// 記録するスレッド数の上限。超えたスレッドは記録しない
+static const int MAX_THREADS = 64;
+
+struct TraceEvent
+{
+  const char* name;
+  unsigned long long begin;
+  unsigned long long end;    // 時点イベントは begin と同じ
+};
+
+struct TraceRing
+{
+  long tid;
+  std::atomic<unsigned long> head;   // 次に書く位置 (通算)
+  TraceEvent events[TRACE_RING_EVENTS];
+};
+
+static TraceRing* g_rings[MAX_THREADS];
+static std::atomic<int> g_ring_num(0);
+static thread_local TraceRing* tl_ring = NULL;
+static thread_local bool tl_full = false;
+
+static inline unsigned long long ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// TSC と steady_clock の対応を取るための起点
+struct TraceOrigin
+{
+  unsigned long long tick;
+  std::chrono::steady_clock::time_point time;
+  TraceOrigin() : tick(ticks()), time(std::chrono::steady_clock::now()) {}
+};
+static TraceOrigin g_origin;
+
+static TraceRing* ring()
+{
+  if (tl_ring != NULL || tl_full) return tl_ring;
+
+  // スレッドで最初の1回だけ。AllocGuard に数えられないよう malloc で取る
+  int index = g_ring_num.load(std::memory_order_relaxed);
+  do
+  {
+    if (index >= MAX_THREADS)
+    {
+      tl_full = true;
+      return NULL;
+    }
+  } while (!g_ring_num.compare_exchange_weak(index, index + 1));
+
+  TraceRing* r = static_cast<TraceRing*>(std::calloc(1, sizeof(TraceRing)));
+  if (r == NULL)
+  {
+    tl_full = true;
+    return NULL;
+  }
+  r->tid = syscall(SYS_gettid);
+  r->head.store(0, std::memory_order_relaxed);
+  g_rings[index] = r;
+  tl_ring = r;
+  return r;
+}
+
+static inline void record(const char* name, unsigned long long begin, unsigned long long end)
+{
+  TraceRing* r = ring();
+  if (r == NULL) return;
+
+  unsigned long h = r->head.load(std::memory_order_relaxed);
+  TraceEvent& e = r->events[h & (TRACE_RING_EVENTS - 1)];
+  e.name = name;
+  e.begin = begin;
+  e.end = end;
+  r->head.store(h + 1, std::memory_order_release);
+}
+
+Trace::Scope::Scope(const char* name)
+  : m_name(name), m_begin(ticks())
+{
+}
+
+Trace::Scope::~Scope()
+{
+  record(m_name, m_begin, ticks());
+}
+
+void Trace::instant(const char* name)
+{
+  unsigned long long t = ticks();
+  record(name, t, t);
+}
+
+bool Trace::dump(const std::string& path)
+{
+  if (path.empty()) return false;
+
+  // 起点からの TSC の進みと実時間の比で us に換算する
+  unsigned long long tick_now = ticks();
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - g_origin.time).count();
+  double us_per_tick = (tick_now > g_origin.tick && elapsed > 0.0) ?
+    elapsed * 1e6 / (tick_now - g_origin.tick) : 1e-3;
+
+  std::string tmp = path + ".tmp";
+  FILE* fp = std::fopen(tmp.c_str(), "w");
+  if (fp == NULL) return false;
+
+  long pid = getpid();
+  std::fprintf(fp, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+  bool first = true;
+  int n = g_ring_num.load(std::memory_order_acquire);
+  for (int i = 0; i < n && i < MAX_THREADS; i++)
+  {
+    TraceRing* r = g_rings[i];
+    if (r == NULL) continue;
+
+    unsigned long head = r->head.load(std::memory_order_acquire);
+    unsigned long from = (head > TRACE_RING_EVENTS) ? head - TRACE_RING_EVENTS : 0;
+    for (unsigned long k = from; k < head; k++)
+    {
+      const TraceEvent& e = r->events[k & (TRACE_RING_EVENTS - 1)];
+      if (e.name == NULL || e.begin < g_origin.tick) continue;
+
+      double ts = (e.begin - g_origin.tick) * us_per_tick;
+      if (e.end == e.begin)
+      {
+        std::fprintf(fp, "%s{\"name\": \"%s\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, "
+                     "\"pid\": %ld, \"tid\": %ld}",
+                     first ? "" : ",\n", e.name, ts, pid, r->tid);
+      }
+      else
+      {
+        double dur = (e.end > e.begin) ? (e.end - e.begin) * us_per_tick : 0.0;
+        std::fprintf(fp, "%s{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, "
+                     "\"pid\": %ld, \"tid\": %ld}",
+                     first ? "" : ",\n", e.name, ts, dur, pid, r->tid);
+      }
+      first = false;
+    }
+  }
+  std::fprintf(fp, "\n]}\n");
+  std::fclose(fp);
+
+  return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+static std::atomic<bool> g_dump_requested(false);
+
+static void onSignal(int)
+{
+  g_dump_requested.store(true, std::memory_order_relaxed);
+}
+
+void Trace::dumpOnSignal(const std::string& path)
+{
+  static std::atomic<bool> started(false);
+  if (path.empty() || started.exchange(true)) return;
+
+  // シグナルハンドラではフラグを立てるだけにし、書き出しは専用スレッドで行う
+  signal(SIGUSR1, onSignal);
+  std::thread([path]()
+  {
+    for (;;)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      if (g_dump_requested.exchange(false))
+      {
+        if (dump(path)) std::fprintf(stderr, "Trace: written to %s\n", path.c_str());
+      }
+    }
+  }).detach();
+}
+
+#endif // ENABLE_TRACE
@@ -0,0 +1,92 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  DepthBackground.h
+ * @brief Per-pixel background depth model of the empty cell for HumanDetection
+ * @date  $Date$
+ *
+ * $Id$
+ */
+
+#ifndef DEPTHBACKGROUND_H
+#define DEPTHBACKGROUND_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "DepthPyramid.h"
+
+/*!
+ * @class DepthBackground
+ * @brief 無人のセルの深度を画素ごとに覚え、それより手前にあるものを侵入とみなす
+ *
+ * DepthPyramid の1つの段 (1 以上) を入力とし、画素ごとに深度の平均と
+ * 平均からの絶対偏差を 1/2^shift の指数移動平均で持つ。配列は項目ごとの
+ * 連続した配列 (平均・偏差・観測済み) で、学習と比較のループは -O3 で
+ * ベクトル化される。
+ *
+ * 覆う範囲に範囲内の画素がない (DepthPyramid::NONE) 画素は「何もない」背景として
+ * 覚えるので、範囲内に何かが現れれば侵入になる。ロボットの画素は robot() の
+ * 配列で除く: 値はロボットが取りうる最も近い深度 [mm] で、それ以上奥の画素は
+ * 学習にも比較にも使わない (NONE ならロボットはいない)。学習中に一度も
+ * ロボットに隠れずに見えなかった画素は比較しない。
+ */
+class DepthBackground
+{
+ public:
+  struct Intrusion
+  {
+    int pixels;      // 侵入とみなした画素の数
+    bool found;
+    int x;           // 最も近い侵入画素の段での位置
+    int y;
+    uint16_t depth;  // [mm]
+  };
+
+  DepthBackground();
+
+  /*!
+   * @param cols, rows 入力する段の大きさ
+   * @param margin 背景よりこれ以上手前なら侵入とする最小の差 [mm]
+   * @param deviation_scale 差の閾値に足す偏差の倍数
+   * @param shift 移動平均の重み 1/2^shift
+   */
+  void configure(int cols, int rows, int margin, int deviation_scale, int shift);
+
+  /*!
+   * @brief 覚えた背景を捨てる。ロボットの配列は NONE にする
+   */
+  void reset();
+
+  // ロボットが取りうる最も近い深度 (行優先、cols × rows)。RobotSilhouette が描く
+  uint16_t* robot() { return m_robot.empty() ? NULL : &m_robot[0]; }
+  // アームなし (NONE) にする
+  void clearRobot();
+  int cols() const { return m_cols; }
+  int rows() const { return m_rows; }
+
+  /*!
+   * @brief 段の深度で背景を更新する (段の大きさが configure と違えば何もしない)
+   */
+  void learn(const DepthPyramid::Level& lv);
+
+  /*!
+   * @brief 背景より手前の画素を数え、最も近いものを返す
+   */
+  Intrusion compare(const DepthPyramid::Level& lv) const;
+
+  // 一度も見えなかった (比較しない) 画素の数
+  int unlearned() const;
+
+ private:
+  int m_cols, m_rows;
+  int m_margin;
+  int m_scale;
+  int m_shift;
+
+  std::vector<uint16_t> m_mean;    // 背景の深度 [mm] (NONE は何もない)
+  std::vector<uint16_t> m_dev;     // 平均からの絶対偏差 [mm]
+  std::vector<uint8_t> m_seen;     // ロボットに隠れずに見えた
+  std::vector<uint16_t> m_robot;
+};
+
+#endif // DEPTHBACKGROUND_H
@@ -0,0 +1,108 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  DepthPyramid.h
+ * @brief Min-pooled depth image pyramid over a region of interest for HumanDetection
+ * @date  $Date$
+ *
+ * $Id$
+ */
+
+#ifndef DEPTHPYRAMID_H
+#define DEPTHPYRAMID_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*!
+ * @class DepthPyramid
+ * @brief 深度画像の関心領域を 2×2 の最小値で縮めた多段の画像
+ *
+ * 段 0 はセンサのバッファをそのまま指し (コピーしない)、関心領域の切り出しは
+ * 先頭の位置と行の幅だけで表す。段 1 は段 0 から、範囲外 (near_limit 未満・
+ * far_limit 超・測定なし) を NONE にしながら1回の走査で作り、段 2 以降は
+ * 1つ前の段の 2×2 の最小値にする。どの段の画素も、それが覆う段 0 の範囲内の
+ * 画素のうち最も近い深度になるので、距離や占有の問い合わせは粗い段から始めて
+ * 必要なところだけ細かい段へ降りればよい。
+ *
+ * 段 1 を作るループは -O3 でベクトル化される。配列は configure() で確保し、
+ * build() は画像の大きさが変わらない限り確保しない。
+ */
+class DepthPyramid
+{
+ public:
+  static const int MAX_LEVELS = 8;
+  // 段 1 以上で、覆う範囲に範囲内の画素がない
+  static const uint16_t NONE = 0xffff;
+
+  struct Level
+  {
+    const uint16_t* data;
+    int cols;
+    int rows;
+    int stride;    // 行の間隔 [画素]
+
+    uint16_t at(int x, int y) const { return data[y * stride + x]; }
+  };
+
+  struct Nearest
+  {
+    bool found;    // 範囲内の画素があった
+    int col;       // 画像全体での位置 [画素]
+    int row;
+    uint16_t depth;  // [mm]
+  };
+
+  DepthPyramid();
+
+  /*!
+   * @param roi "x0 y0 x1 y1" [画素] (x1, y1 は含まない。区切りは空白かカンマ)。空なら画像全体
+   * @param levels 段の数 (段 0 を含む。2 ～ MAX_LEVELS)
+   * @param near_limit これより近い値は無視する [mm] (0 は常に無視)
+   * @param far_limit これより遠い値は無視する [mm]
+   * @param cols, rows センサの画像の大きさ
+   * @return roi の書式が正しければ true (誤りなら画像全体)
+   */
+  bool configure(const std::string& roi, int levels, int near_limit, int far_limit, int cols, int rows);
+
+  /*!
+   * @brief 行優先の深度画像 [mm] から全段を作る。depth は次の build() まで参照する
+   */
+  void build(const uint16_t* depth, int cols, int rows);
+
+  int levels() const { return m_levels; }
+  const Level& level(int l) const { return m_level[l]; }
+  // 関心領域の左上 (段 0 の (0,0)) の画像全体での位置
+  int roiX() const { return m_x0; }
+  int roiY() const { return m_y0; }
+
+  // 段 0 の値が範囲内か
+  bool inRange(uint16_t d) const { return static_cast<uint16_t>(d - m_near) <= m_span; }
+
+  /*!
+   * @brief 範囲内で最も近い画素。最も粗い段の最小値から、同じ値の子をたどって段 0 まで降りる
+   */
+  Nearest nearest() const;
+
+  /*!
+   * @brief 段 level (1 以上) の画素 (x, y) の値を持つ段 0 の画素
+   */
+  Nearest locate(int level, int x, int y) const;
+
+ private:
+  void resize(int cols, int rows);
+
+  std::string m_roi;
+  int m_levels;
+  uint16_t m_near;
+  uint16_t m_span;             // far_limit - near_limit
+  int m_cols, m_rows;          // 確保した画像の大きさ
+  int m_x0, m_y0;              // 関心領域 (画像に収めたもの)
+  int m_x1, m_y1;
+  int m_roi_x0, m_roi_y0;      // 設定された関心領域 (負なら画像全体)
+  int m_roi_x1, m_roi_y1;
+  Level m_level[MAX_LEVELS];
+  std::vector<uint16_t> m_buffer[MAX_LEVELS];
+};
+
+#endif // DEPTHPYRAMID_H
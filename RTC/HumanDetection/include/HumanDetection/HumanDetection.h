@@ -23,6 +23,8 @@
 // <rtc-template block="consumer_stub_h">
 #include "TimedPose3DQuaternionStub.h"
 #include "TimedSkeltonStub.h"
+#include "TimedHumanStateStub.h"
+#include "TimedTrackedPointsStub.h"
 
 // </rtc-template>
 
@@ -32,8 +34,27 @@
 #include <rtm/DataInPort.h>
 #include <rtm/DataOutPort.h>
 
+#include <atomic>
+#include <thread>
+
 #include <nuitrack/Nuitrack.h>
 
+#include "ShmRing.h"
+#include "PoseRecord.h"
+#include "RtProfile.h"
+#include "AllocGuard.h"
+#include "Trace.h"
+#include "MetricRegistry.h"
+#include "CycleMonitor.h"
+#include "PointFilterBank.h"
+#include "PointGate.h"
+#include "PersonTracker.h"
+#include "DepthPyramid.h"
+#include "DepthBackground.h"
+#include "RobotSilhouette.h"
+#include "QualityController.h"
+#include "StageQueue.h"
+
 /*!
  * @class HumanDetection
  * @brief Human Detection RT Component 
@@ -214,11 +235,340 @@ class HumanDetection
 
   // Configuration variable declaration
   // <rtc-template block="config_declare">
+  /*!
+   * RightHandPose を流す共有メモリリング名 (空なら使わない)
+   * - Name: pose_ring
+   * - DefaultValue: 
+   */
+  std::string m_pose_ring;
+  /*!
+   * 共有メモリリングのレコード数
+   * - Name: pose_ring_slots
+   * - DefaultValue: 64
+   */
+  int m_pose_ring_slots;
+  /*!
+   * 実行スレッドのスケジューリングポリシー (other, fifo, rr)
+   * - Name: rt_policy
+   * - DefaultValue: other
+   */
+  std::string m_rt_policy;
+  /*!
+   * fifo / rr のときの優先度 (1-99)
+   * - Name: rt_priority
+   * - DefaultValue: 70
+   */
+  int m_rt_priority;
+  /*!
+   * 実行スレッドを固定する CPU (空なら固定しない)
+   * - Name: rt_cpus
+   * - DefaultValue: 
+   */
+  std::string m_rt_cpus;
+  /*!
+   * Nuitrack の内部スレッドを固定する CPU (空なら固定しない)
+   * - Name: nuitrack_cpus
+   * - DefaultValue: 
+   */
+  std::string m_nuitrack_cpus;
+  /*!
+   * 1 ならプロセスのメモリをロックする (mlockall)
+   * - Name: rt_lock_memory
+   * - DefaultValue: 0
+   */
+  int m_rt_lock_memory;
+  /*!
+   * SIGUSR1 と非活性化時にトレースを書き出すファイル (ENABLE_TRACE ビルドのみ、空で無効)
+   * - Name: trace_file
+   * - DefaultValue: 
+   */
+  std::string m_trace_file;
+  /*!
+   * メトリクスの書き出し先 (node-exporter の textfile、"unix:<path>" で UNIX ソケット、空で無効)
+   * - Name: prom_export
+   * - DefaultValue: 
+   */
+  std::string m_prom_export;
+  /*!
+   * メトリクスファイルの書き出し周期 [s]
+   * - Name: prom_export_period
+   * - DefaultValue: 5.0
+   */
+  double m_prom_export_period;
+  /*!
+   * overrun_window 秒あたりに許すオーバーラン回数 (超えると CycleStatus に出力)
+   * - Name: overrun_budget
+   * - DefaultValue: 10
+   */
+  int m_overrun_budget;
+  /*!
+   * オーバーランを数える窓 [s]
+   * - Name: overrun_window
+   * - DefaultValue: 10.0
+   */
+  double m_overrun_window;
+  /*!
+   * 周期の状態を出力する周期 [s] (予算超過の変化時は即時)
+   * - Name: cycle_status_period
+   * - DefaultValue: 1.0
+   */
+  double m_cycle_status_period;
+  /*!
+   * 1 なら手・関節の座標を One Euro フィルタで平滑化する
+   * - Name: filter_enable
+   * - DefaultValue: 1
+   */
+  int m_filter_enable;
+  /*!
+   * 手の静止時の遮断周波数 [Hz] (小さいほどジッタが減り、遅れが増える)
+   * - Name: filter_hand_min_cutoff
+   * - DefaultValue: 1.0
+   */
+  double m_filter_hand_min_cutoff;
+  /*!
+   * 手の速度 [mm/s] あたりの遮断周波数の増分 [Hz] (大きいほど速い動きへの遅れが減る)
+   * - Name: filter_hand_beta
+   * - DefaultValue: 0.005
+   */
+  double m_filter_hand_beta;
+  /*!
+   * 関節の静止時の遮断周波数 [Hz]
+   * - Name: filter_joint_min_cutoff
+   * - DefaultValue: 0.5
+   */
+  double m_filter_joint_min_cutoff;
+  /*!
+   * 関節の速度 [mm/s] あたりの遮断周波数の増分 [Hz]
+   * - Name: filter_joint_beta
+   * - DefaultValue: 0.002
+   */
+  double m_filter_joint_beta;
+  /*!
+   * フィルタ内で速度を平滑化する遮断周波数 [Hz]
+   * - Name: filter_d_cutoff
+   * - DefaultValue: 1.0
+   */
+  double m_filter_d_cutoff;
+  /*!
+   * 1 なら物理的にありえない手の移動を棄却する
+   * - Name: gate_enable
+   * - DefaultValue: 1
+   */
+  int m_gate_enable;
+  /*!
+   * 手の速さの上限 [mm/s] (超えた観測は棄却する)
+   * - Name: gate_max_speed
+   * - DefaultValue: 5000.0
+   */
+  double m_gate_max_speed;
+  /*!
+   * 手の加速度の上限 [mm/s^2] (超えた観測は棄却する)
+   * - Name: gate_max_accel
+   * - DefaultValue: 150000.0
+   */
+  double m_gate_max_accel;
+  /*!
+   * 棄却中に直前の推定を保持する最長時間 [s] (超えたら観測を採用し直す)
+   * - Name: gate_max_hold
+   * - DefaultValue: 0.2
+   */
+  double m_gate_max_hold;
+  /*!
+   * 1 なら RightHandPose / LeftHandPose / HandPoints にも手を出力する (0 なら HumanState だけ)
+   * - Name: legacy_ports
+   * - DefaultValue: 1
+   */
+  int m_legacy_ports;
+  /*!
+   * 1 なら骨格も追跡して HumanState に関節を入れる
+   * - Name: skeleton_enable
+   * - DefaultValue: 0
+   */
+  int m_skeleton_enable;
+  /*!
+   * この信頼度以上の関節だけを観測ありとする
+   * - Name: skeleton_min_confidence
+   * - DefaultValue: 0.3
+   */
+  double m_skeleton_min_confidence;
+  /*!
+   * 1 なら非活性化しても Nuitrack を止めず、再活性化を待ち時間なしで行う (0 なら非活性化で解放する)
+   * - Name: keep_warm
+   * - DefaultValue: 0
+   */
+  int m_keep_warm;
+  /*!
+   * 使うセンサ (空なら最初のもの、数字なら getDeviceList の番号、それ以外はシリアル番号)
+   * - Name: camera_device
+   * - DefaultValue: 
+   */
+  std::string m_camera_device;
+  /*!
+   * Nuitrack のユーザ ID が変わったとき、同じ人とみなす重心の移動量 [mm]
+   * - Name: track_gate_distance
+   * - DefaultValue: 600.0
+   */
+  double m_track_gate_distance;
+  /*!
+   * 見えなくなった人の枠 (ユーザ番号) を残しておく時間 [s]
+   * - Name: track_max_missing
+   * - DefaultValue: 0.5
+   */
+  double m_track_max_missing;
+  /*!
+   * 深度画像の最近点を NearestDepth に出力する (手の追跡より先に人を捉える高速経路)
+   * - Name: depth_enable
+   * - DefaultValue: 0
+   */
+  int m_depth_enable;
+  /*!
+   * 最近点を探す画素の矩形 "x0 y0 x1 y1" (x1, y1 は含まない)。空なら画像全体
+   * - Name: depth_roi
+   * - DefaultValue: 
+   */
+  std::string m_depth_roi;
+  /*!
+   * これより近い深度は無視する [mm]
+   * - Name: depth_near_limit
+   * - DefaultValue: 300
+   */
+  int m_depth_near_limit;
+  /*!
+   * これより遠い深度は無視する [mm]
+   * - Name: depth_far_limit
+   * - DefaultValue: 4000
+   */
+  int m_depth_far_limit;
+  /*!
+   * 深度のピラミッドの段数 (元の解像度を含む。2 ～ 8)
+   * - Name: depth_pyramid_levels
+   * - DefaultValue: 4
+   */
+  int m_depth_pyramid_levels;
+  /*!
+   * DepthPyramid に出力する段 (0 なら出力しない)
+   * - Name: depth_publish_level
+   * - DefaultValue: 0
+   */
+  int m_depth_publish_level;
+  /*!
+   * 1 なら無人のセルの深度を学習し、それより手前の画素を Intrusion に出力する (depth_enable のとき)
+   * - Name: depth_background_enable
+   * - DefaultValue: 0
+   */
+  int m_depth_background_enable;
+  /*!
+   * 背景を持つピラミッドの段 (1 以上。depth_pyramid_levels より小さい段に切り詰める)
+   * - Name: depth_background_level
+   * - DefaultValue: 2
+   */
+  int m_depth_background_level;
+  /*!
+   * 活性化後に背景を学習する時間 [s] (この間はセルを無人にし、アームを一巡させる)
+   * - Name: depth_background_learn_time
+   * - DefaultValue: 5.0
+   */
+  double m_depth_background_learn_time;
+  /*!
+   * 背景よりこれ以上手前の画素を侵入とする [mm]
+   * - Name: depth_background_margin
+   * - DefaultValue: 80
+   */
+  int m_depth_background_margin;
+  /*!
+   * 侵入とする差に足す、学習した背景の偏差の倍数
+   * - Name: depth_background_deviation_scale
+   * - DefaultValue: 3
+   */
+  int m_depth_background_deviation_scale;
+  /*!
+   * アームの標準 DH パラメータ。関節ごとの "a alpha d offset" [mm, deg] をセミコロンで区切る (空ならアームを除かない)
+   * - Name: robot_dh
+   * - DefaultValue: 
+   */
+  std::string m_robot_dh;
+  /*!
+   * カメラ座標系でのアームの基部 "x y z roll pitch yaw" [mm, deg] (x 右・y 上・z 前方)
+   * - Name: robot_base
+   * - DefaultValue: 
+   */
+  std::string m_robot_base;
+  /*!
+   * アームのリンクの半径 [mm] (関節角の遅れの分の余裕を含める)
+   * - Name: robot_link_radius
+   * - DefaultValue: 120.0
+   */
+  double m_robot_link_radius;
+  /*!
+   * これより古い JointState ではアームを除かない [s]
+   * - Name: robot_joint_max_age
+   * - DefaultValue: 0.2
+   */
+  double m_robot_joint_max_age;
+  /*!
+   * 処理が遅れたときに切り替える Nuitrack の設定の段。段ごとの "key=value,key=value" をセミコロンで区切り、先頭が最も高品質 (空なら切り替えない。1段なら常にその設定)
+   * - Name: adapt_levels
+   * - DefaultValue: 
+   */
+  std::string m_adapt_levels;
+  /*!
+   * 1フレームの処理時間 (waitUpdate の後から onExecute の終わりまで) の上限 [s]
+   * - Name: adapt_budget
+   * - DefaultValue: 0.025
+   */
+  double m_adapt_budget;
+  /*!
+   * 処理時間と取りこぼしが上限のこの割合未満なら段を上げる
+   * - Name: adapt_headroom
+   * - DefaultValue: 0.5
+   */
+  double m_adapt_headroom;
+  /*!
+   * 取りこぼしたセンサのフレームの割合の上限
+   * - Name: adapt_max_skipped
+   * - DefaultValue: 0.1
+   */
+  double m_adapt_max_skipped;
+  /*!
+   * 上限の超過がこれだけ続いたら段を下げる [s]
+   * - Name: adapt_down_time
+   * - DefaultValue: 2.0
+   */
+  double m_adapt_down_time;
+  /*!
+   * 余裕がこれだけ続いたら段を上げる [s]
+   * - Name: adapt_up_time
+   * - DefaultValue: 30.0
+   */
+  double m_adapt_up_time;
+  /*!
+   * 段の切り替え (Nuitrack の起動し直し) の最短の間隔 [s]。活性化からも数える
+   * - Name: adapt_min_interval
+   * - DefaultValue: 60.0
+   */
+  double m_adapt_min_interval;
+  /*!
+   * 1 なら待ち・追跡・出力を別のスレッドの段で並行して行う
+   * - Name: pipeline_enable
+   * - DefaultValue: 0
+   */
+  int m_pipeline_enable;
+  /*!
+   * 段の間で受け渡しを待てるフレームの数 (一杯なら古いものから捨てる)
+   * - Name: pipeline_depth
+   * - DefaultValue: 2
+   */
+  int m_pipeline_depth;
 
   // </rtc-template>
 
   // DataInPort declaration
   // <rtc-template block="inport_declare">
+  RTC::TimedDoubleSeq m_JointState;
+  /*!
+   * アームの関節角 [rad] (Manager の joint_state)。robot_dh のアームを深度の背景から除く
+   */
+  RTC::InPort<RTC::TimedDoubleSeq> m_JointStateIn;
   
   // </rtc-template>
 
@@ -241,6 +591,56 @@ class HumanDetection
   /*!
    */
   RTC::OutPort<RTC::TimedSkeltonSeq> m_SkeltonOut;
+  RTC::TimedDoubleSeq m_CycleStatus;
+  /*!
+   * 並びは CycleMonitor::toArray を参照
+   */
+  RTC::OutPort<RTC::TimedDoubleSeq> m_CycleStatusOut;
+  RTC::TimedHumanState m_HumanState;
+  /*!
+   * 1フレームの全ユーザの手・関節。点番号はユーザ × slots_per_user + スロット
+   * (0:右手, 1:左手, 2〜:関節)。gate は PointGate::State
+   */
+  RTC::OutPort<RTC::TimedHumanState> m_HumanStateOut;
+  RTC::TimedTrackedPoints m_HandPoints;
+  /*!
+   * 全ユーザの手 (legacy_ports のとき)。点番号はユーザ × 2 + (0:右, 1:左)、
+   * presence のビットが立っていない点は無視する
+   */
+  RTC::OutPort<RTC::TimedTrackedPoints> m_HandPointsOut;
+  RTC::TimedTrackedPoints m_NearestDepth;
+  /*!
+   * 関心領域で最も近い深度画素のカメラ座標 [mm] (depth_enable のとき)。
+   * points[0] が最近点で、範囲内の画素がなければ presence の bit 0 が立たない
+   */
+  RTC::OutPort<RTC::TimedTrackedPoints> m_NearestDepthOut;
+  RTC::TimedUShortSeq m_DepthPyramid;
+  /*!
+   * depth_publish_level の段 (depth_enable のとき)。並びは
+   * 0 段, 1 列数, 2 行数, 3-4 関心領域の左上 [画素], 5〜 行優先の深度 [mm]
+   * (0xffff は覆う範囲に depth_near_limit ～ depth_far_limit の画素なし)
+   */
+  RTC::OutPort<RTC::TimedUShortSeq> m_DepthPyramidOut;
+  RTC::TimedDoubleSeq m_Intrusion;
+  /*!
+   * 背景より手前の画素 (depth_background_enable のとき、深度のフレームごと)。並びは
+   * 0 状態 (0:学習中, 1:判定中), 1 侵入画素の数 (depth_background_level の段),
+   * 2-4 最も近い侵入画素のカメラ座標 [mm] (なければ 0)
+   */
+  RTC::OutPort<RTC::TimedDoubleSeq> m_IntrusionOut;
+  RTC::TimedDoubleSeq m_QualityStatus;
+  /*!
+   * adapt_levels の段 (活性化時・切り替え時と cycle_status_period ごと)。並びは
+   * 0 段, 1 段の数, 2 直前の窓の平均処理時間 [s], 3 取りこぼしたフレームの割合,
+   * 4 下げた回数, 5 上げた回数
+   */
+  RTC::OutPort<RTC::TimedDoubleSeq> m_QualityStatusOut;
+  RTC::TimedULong m_SensorStatus;
+  /*!
+   * 0 以外の間は人が見えていない (1: 段の切り替えで Nuitrack を起動し直している)。
+   * HumanProtection の SensorStatus につなぐと、その間は停止する
+   */
+  RTC::OutPort<RTC::TimedULong> m_SensorStatusOut;
   
   // </rtc-template>
 
@@ -262,9 +662,192 @@ class HumanDetection
  private:
 
   tdv::nuitrack::HandTracker::Ptr handTracker;
+  tdv::nuitrack::SkeletonTracker::Ptr skeletonTracker;
+  tdv::nuitrack::DepthSensor::Ptr depthSensor;
+  // ピラミッドの段 0 が指しているフレーム (コピーせずに参照を持つ)
+  tdv::nuitrack::DepthFrame::Ptr depthFrameInUse;
   tdv::nuitrack::HandTrackerData::Ptr handData;
   tdv::nuitrack::Hand::Ptr rightHand;
   tdv::nuitrack::Hand::Ptr leftHand;
+
+  // 同一ホストの別プロセスへ RightHandPose を渡すリング
+  ShmRingWriter<PoseRecord> poseRing;
+
+  // RightHandPose を OutPort (legacy_ports のときだけ) と共有メモリリングへ書く
+  void writeRightHand();
+  // 手を従来の RightHandPose / LeftHandPose / HandPoints の形で書く。
+  // RightHandPose / LeftHandPose には全ユーザで最も近い右手・左手を入れる
+  void writeLegacyHands(const RTC::TimedHumanState& state);
+  // hand (0:右, 1:左) が見えている中で z が最小の点の番号 (なければ -1)
+  int nearestHand(const RTC::TimedHumanState& state, int hand) const;
+
+  // Nuitrack 初期化前のスレッド (これ以外を Nuitrack のスレッドとみなす)
+  std::vector<pid_t> threadsBeforeNuitrack;
+
+  // Nuitrack の状態。keep_warm では非活性化をまたいで NUITRACK_RUNNING のまま
+  enum NuitrackState
+  {
+    NUITRACK_RELEASED = 0,
+    NUITRACK_INITIALIZED,
+    NUITRACK_RUNNING
+  };
+  NuitrackState nuitrackState;
+  int runningSkeleton;        // 起動時の skeleton_enable
+  std::string runningDevice;  // 起動時の camera_device
+  int runningDepth;           // 起動時の depth_enable
+  std::string runningQuality; // 起動時に設定した adapt_levels の段
+
+  // 必要なら init し、トラッカを作って run する (動作中なら何もしない)
+  bool startNuitrack();
+  // camera_device のセンサを Nuitrack に指定する (見つからなければ false)
+  bool selectDevice();
+  // release してトラッカを捨てる
+  void stopNuitrack();
+
+  // MetricRegistry に登録したメトリクス
+  MetricCounter* framesReceived;   // waitUpdate で得たフレーム
+  MetricGauge* usersTracked;       // 直近のフレームで追跡に割り当てた人数
+  MetricHistogram* depthLatency;   // waitUpdate から NearestDepth の書き込みまで
+  MetricHistogram* depthBuild;     // ピラミッドを作る時間
+  MetricHistogram* backgroundTime; // 背景の学習・比較の時間
+  MetricGauge* intrusionPixels;    // 直近のフレームで背景より手前だった画素
+  MetricHistogram* frameProcessing; // waitUpdate の後から onExecute の終わりまで (パイプラインでは最も遅い段)
+  MetricGauge* qualityLevel;       // adapt_levels の今の段
+  MetricCounter* qualityDowns;     // 段を下げた回数
+  MetricCounter* qualityUps;       // 段を上げた回数
+  MetricCounter* trackDrops;       // 追跡の段の前で捨てたフレーム
+  MetricCounter* publishDrops;     // 出力の段の前で捨てたフレーム
+
+  // 実行周期・実行時間の監視。waitUpdate (パイプラインでは出力の段の受け取り) の待ちも実行時間に含む
+  CycleMonitor monitor;
+
+  // 周期の状態を CycleStatus へ出力する
+  void publishCycleStatus(CycleMonitor::Clock::time_point now);
+
+  // 処理時間と取りこぼしから Nuitrack の設定の段を切り替える。切り替えは
+  // Nuitrack の起動し直しになるので、その周期は出力が止まる
+  QualityController quality;
+  int qualitySwitchesDown;
+  int qualitySwitchesUp;
+  // processing はそのフレームの処理時間 (パイプラインでは最も遅い段の時間)
+  bool adaptQuality(double processing, uint64_t stamp);
+  bool switchQuality(int level);
+  void publishQualityStatus();
+  // 起動し直しの前に SensorStatus を 1 にし、次の HumanState を書いたら 0 に戻す
+  bool sensorBlind;
+  void publishSensorStatus(bool blind);
+
+  // Nuitrack が同時に追跡するユーザ数の上限と、1人あたりの関節数
+  static const int MAX_USERS = 6;
+  static const int JOINT_NUM = 25;
+
+  // 手は棄却判定してから、関節はそのまま平滑化する。gate の点番号は
+  // ユーザ × 2 + (0:右, 1:左)、filters は handSlot / jointSlot からの相対
+  PointGate gate;
+  PointFilterBank filters;
+  int handSlot;
+  int jointSlot;
+  int slotsPerUser;
+  CycleMonitor::Clock::time_point lastFrame;
+
+  // Nuitrack のユーザを追跡に割り当て、人ごとに同じユーザ番号 (枠) を使う。
+  // 枠 u の手・骨格は hands[userHand[u]] / skeletons[userSkeleton[u]] (なければ -1)
+  PersonTracker tracker;
+  int userHand[MAX_USERS];
+  int userSkeleton[MAX_USERS];
+  PersonTracker::Detection detections[PersonTracker::MAX_TRACKS];
+  int detectionPoints[PersonTracker::MAX_TRACKS];
+  int detectionHand[PersonTracker::MAX_TRACKS];
+  int detectionSkeleton[PersonTracker::MAX_TRACKS];
+  int detectionTrack[PersonTracker::MAX_TRACKS];
+  void associateUsers(const std::vector<tdv::nuitrack::UserHands>& hands,
+                      const std::vector<tdv::nuitrack::Skeleton>& skeletons, double t, RTC::TimedHumanState& state);
+  int findDetection(long id, int& n);
+  void addToDetection(int i, float x, float y, float z);
+
+  // 1フレームの出力。出力ポートへは m_HumanState などではなくこれを write(value) で書く。
+  // パイプラインでは追跡の段が埋めて出力の段が書くので、待ち行列の要素ごとに持つ
+  struct FrameOutput
+  {
+    RTC::TimedHumanState state;
+    RTC::TimedTrackedPoints nearest;
+    RTC::TimedUShortSeq pyramid;
+    RTC::TimedDoubleSeq intrusion;
+    bool nearestReady;          // 書いていない値があるか
+    bool pyramidReady;
+    bool intrusionReady;
+    CycleMonitor::Clock::time_point arrival;  // waitUpdate から戻った時刻
+    uint64_t stamp;             // 手のフレームのセンサのタイムスタンプ [us]
+    double tracking;            // 追跡の段の処理時間 [s]
+  };
+  // 直列 (pipeline_enable = 0) での出力
+  FrameOutput directOutput;
+  unsigned long humanFrame;
+  // 出力の配列を活性化時の設定とセンサの解像度で確保する
+  void allocateOutput(FrameOutput& out);
+  void allocateOutputs();
+  // 溜まっている出力をポートへ書く
+  void writeDepth(FrameOutput& out);
+  void writeHumanState(FrameOutput& out);
+
+  // 深度画像のピラミッドを作り、最近点を手の追跡より先に NearestDepth へ書く
+  DepthPyramid depthPyramid;
+  // センサの解像度でピラミッド・背景・出力の配列を確保する (relearn なら背景を学び直す)
+  void configureDepth(bool relearn);
+  // 深度画素 (col, row, depth [mm]) からカメラ座標 [mm] への変換。x = (k[0] col + k[1]) depth,
+  // y = (k[2] row + k[3]) depth。configureDepth でセンサの変換から求めておき、
+  // パイプラインの追跡の段が待ちの段と並行して DepthSensor を呼ばないようにする
+  float depthToRealCoeffs[4];
+  void depthToReal(int col, int row, uint16_t depth, RTC::Point3D& p) const;
+  // frame を受け取ってピラミッドと最近点を求める (frame がなければ false)
+  bool processDepth(tdv::nuitrack::DepthFrame::Ptr& frame, CycleMonitor::Clock::time_point arrival, FrameOutput& out);
+  void processDepthLevel(FrameOutput& out);
+
+  // 深度の背景。活性化後 depth_background_learn_time 秒は学習し、その後は比較して
+  // Intrusion へ書く。アームの画素は最新の JointState から描いて除く
+  DepthBackground background;
+  RobotSilhouette robotSilhouette;
+  int backgroundLevel;
+  bool backgroundStarted;
+  bool backgroundLearning;
+  CycleMonitor::Clock::time_point backgroundLearnEnd;
+  double jointAngles[RobotSilhouette::MAX_JOINTS];
+  bool jointReceived;
+  CycleMonitor::Clock::time_point jointTime;
+  void processBackground(CycleMonitor::Clock::time_point now, FrameOutput& out);
+  void drawRobot(CycleMonitor::Clock::time_point now);
+
+  // 手と骨格を棄却判定・平滑化して state に置く
+  void trackUsers(const std::vector<tdv::nuitrack::UserHands>& hands,
+                  const std::vector<tdv::nuitrack::Skeleton>& skeletons,
+                  CycleMonitor::Clock::time_point now, RTC::TimedHumanState& state);
+  void setPoint(RTC::TimedHumanState& state, int index, bool present, float x, float y, float z,
+                float confidence, int gate_state);
+  static bool isPresent(const RTC::TimedHumanState& state, int index);
+
+  // pipeline_enable では、待ち (capture)・追跡 (track)・出力 (実行コンテキスト) を
+  // 別のスレッドで並行して行い、段の間は StageQueue で受け渡す。フレームの
+  // 間隔は3つの段の合計ではなく最も遅い段で決まる
+  struct FrameInput
+  {
+    std::vector<tdv::nuitrack::UserHands> hands;
+    std::vector<tdv::nuitrack::Skeleton> skeletons;
+    tdv::nuitrack::DepthFrame::Ptr depth;
+    CycleMonitor::Clock::time_point arrival;
+    uint64_t stamp;
+  };
+  StageQueue<FrameInput> captured;
+  StageQueue<FrameOutput> tracked;
+  std::thread captureThread;
+  std::thread trackThread;
+  std::atomic<bool> pipelineRunning;
+  std::atomic<bool> pipelineFailed;  // 待ちの段が Nuitrack の例外で止まった
+  void startPipeline();
+  void stopPipeline();
+  void runCapture();
+  void runTrack();
+  RTC::ReturnCode_t publishStage();
+
   // <rtc-template block="private_attribute">
   
   // </rtc-template>
@@ -0,0 +1,104 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  PointFilterBank.h
+ * @brief One Euro filter bank for tracked points of HumanDetection
+ * @date  $Date$
+ *
+ * $Id$
+ */
+
+#ifndef POINTFILTERBANK_H
+#define POINTFILTERBANK_H
+
+#include <vector>
+
+/*!
+ * @class PointFilterBank
+ * @brief 追跡点の座標をまとめて平滑化する One Euro フィルタの集合
+ *
+ * 全ユーザの手・関節の x/y/z を1本ずつの「レーン」として配列に並べ
+ * (structure of arrays)、update() で全レーンを分岐なしの1ループで
+ * 更新する。ループはコンパイラの自動ベクトル化にかかる形にしてある。
+ *
+ * 遅い動きでは min_cutoff まで遮断周波数を下げてジッタを抑え、
+ * 速い動きでは beta × 速度だけ遮断周波数を上げて遅れを抑える。
+ * 観測が途切れた点は次の観測値から新しく始める。
+ */
+class PointFilterBank
+{
+ public:
+  // 点の種類ごとにパラメータを持つ
+  enum PointClass
+  {
+    CLASS_HAND = 0,
+    CLASS_JOINT,
+    CLASS_NUM
+  };
+
+  struct Params
+  {
+    float min_cutoff;   // 静止時の遮断周波数 [Hz]
+    float beta;         // 速度 [mm/s] あたりの遮断周波数の増分 [Hz]
+  };
+
+  PointFilterBank();
+
+  /*!
+   * @brief 点の割り当てを空にする (メモリ確保はここと addPoints だけ)
+   * @param d_cutoff 速度の平滑化の遮断周波数 [Hz]
+   */
+  void clear(float d_cutoff);
+
+  /*!
+   * @brief 種類 c の点を n 個割り当てる
+   * @return 先頭の点番号
+   */
+  int addPoints(PointClass c, int n);
+
+  /*!
+   * @brief 種類ごとのパラメータを設定する (割り当て済みの点にも反映)
+   */
+  void setParams(PointClass c, const Params& p);
+
+  int size() const { return m_points; }
+
+  /*!
+   * @brief 今回のフレームで点 i を観測した
+   */
+  void set(int i, float x, float y, float z);
+
+  /*!
+   * @brief 点 i を次の観測から始め直す (別の人の点になったとき)
+   */
+  void reset(int i);
+
+  /*!
+   * @brief 観測した点を平滑化する。観測されなかった点はリセットする
+   * @param dt 前フレームからの経過時間 [s]
+   */
+  void update(float dt);
+
+  /*!
+   * @brief 平滑化後の座標 (update() 後、今回観測した点のみ有効)
+   */
+  void get(int i, float& x, float& y, float& z) const;
+
+ private:
+  static const int AXES = 3;
+
+  int m_points;
+  float m_d_cutoff;
+  Params m_params[CLASS_NUM];
+
+  // レーン (点番号 × 3 + 軸) ごとの配列
+  std::vector<float> m_raw;         // 今回の観測値
+  std::vector<float> m_value;       // 平滑化した値
+  std::vector<float> m_deriv;       // 平滑化した速度
+  std::vector<float> m_min_cutoff;
+  std::vector<float> m_beta;
+  std::vector<float> m_seen;        // 今回観測したら 1
+  std::vector<float> m_fresh;       // 前回観測がなければ 1 (値を初期化する)
+  std::vector<int>   m_class;       // 点ごとの種類
+};
+
+#endif // POINTFILTERBANK_H
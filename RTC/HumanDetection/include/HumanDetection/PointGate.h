@@ -0,0 +1,104 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  PointGate.h
+ * @brief Velocity / acceleration gating of tracked points for HumanDetection
+ * @date  $Date$
+ *
+ * $Id$
+ */
+
+#ifndef POINTGATE_H
+#define POINTGATE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "MetricRegistry.h"
+
+/*!
+ * @class PointGate
+ * @brief 物理的にありえない速度・加速度の観測を捨て、直前の推定を保持する
+ *
+ * 点ごとに前回採用した位置と速度を持ち、今回の観測から求めた速度が
+ * max_speed を、速度の変化が max_accel を超えたら棄却する。棄却中は
+ * 前回の位置を出力し続け、max_hold 秒を超えたら観測を採用し直す
+ * (本当に移動した場合に追従できなくなるのを防ぐ)。
+ * 1点あたりの処理は点の数だけに比例し、配列は configure() でだけ確保する。
+ */
+class PointGate
+{
+ public:
+  enum State
+  {
+    STATE_LOST = 0,    // 観測なし (推定値なし)
+    STATE_ACCEPTED,    // 今回の観測を採用
+    STATE_HELD         // 今回の観測を棄却し、前回の推定を保持
+  };
+
+  PointGate();
+
+  /*!
+   * @brief MetricRegistry に棄却数のカウンタを登録する (onInitialize から呼ぶ)
+   * @param label 例: component="HumanDetection0"
+   */
+  void attach(const std::string& label);
+
+  /*!
+   * @param points 点の数
+   * @param max_speed 許す速さ [mm/s]
+   * @param max_accel 許す加速度 [mm/s^2]
+   * @param max_hold 棄却して前回の推定を保持する最長時間 [s]
+   */
+  void configure(int points, float max_speed, float max_accel, float max_hold);
+
+  /*!
+   * @brief 今回のフレームで点 i を観測した
+   */
+  void set(int i, float x, float y, float z);
+
+  /*!
+   * @brief 点 i の推定を捨てる (別の人の点になったとき)。次の観測は無条件に採用する
+   */
+  void reset(int i);
+
+  /*!
+   * @brief 観測を判定する。観測されなかった点は STATE_LOST になる
+   * @param dt 前フレームからの経過時間 [s]
+   */
+  void update(float dt);
+
+  State state(int i) const { return static_cast<State>(m_state[i]); }
+
+  /*!
+   * @brief 推定の確からしさ [0, 1]。採用で 1、保持中は max_hold に向けて 0 へ下がる
+   */
+  float confidence(int i) const;
+
+  /*!
+   * @brief 採用した観測か保持中の推定 (STATE_LOST 以外で有効)
+   */
+  void get(int i, float& x, float& y, float& z) const;
+
+ private:
+  static const int AXES = 3;
+
+  int m_points;
+  float m_max_speed2;   // 比較は2乗で行う
+  float m_max_accel2;
+  float m_max_hold;
+
+  // 点ごとの配列 (座標は点番号 × 3 + 軸)
+  std::vector<float> m_raw;
+  std::vector<float> m_pos;
+  std::vector<float> m_vel;
+  std::vector<float> m_held;      // 棄却が続いている時間 [s]
+  std::vector<uint8_t> m_seen;
+  std::vector<uint8_t> m_state;
+
+  MetricCounter* m_speed_rejects;
+  MetricCounter* m_accel_rejects;
+  MetricCounter* m_hold_expired;
+};
+
+#endif // POINTGATE_H
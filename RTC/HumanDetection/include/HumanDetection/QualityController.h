@@ -0,0 +1,130 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  QualityController.h
+ * @brief Stepping the Nuitrack settings down and up from the measured frame load for HumanDetection
+ * @date  $Date$
+ *
+ * $Id$
+ */
+
+#ifndef QUALITYCONTROLLER_H
+#define QUALITYCONTROLLER_H
+
+#include <stdint.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+/*!
+ * @class QualityController
+ * @brief 処理の遅れから Nuitrack の設定の段を下げ、余裕が戻れば上げる
+ *
+ * 段は Nuitrack の設定値 (key=value) の組で、0 が最も高品質。フレームごとの
+ * 処理時間とセンサのタイムスタンプの間隔 (最短の間隔の何倍か) から取りこぼした
+ * フレーム数を WINDOW 秒ごとに集計し、平均の処理時間が budget を超えるか
+ * 取りこぼしの割合が max_skipped を超える窓が down_time 秒続いたら1段下げる。
+ * 平均が budget × headroom 未満かつ取りこぼしが max_skipped × headroom 未満の
+ * 窓が up_time 秒続いたら1段上げる。段を変えると Nuitrack を起動し直すので、
+ * reset() から SETTLE 秒の測定は捨てる。起動し直している間は人が見えないので、
+ * reset() から min_interval 秒は条件を満たしても切り替えない。
+ *
+ * 段の解析でだけ確保し、update() は確保しない。
+ */
+class QualityController
+{
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  // 集計の窓 [s]
+  static const double WINDOW;
+  // 起動し直した直後の測定を捨てる時間 [s]
+  static const double SETTLE;
+
+  struct Setting
+  {
+    std::string key;
+    std::string value;
+  };
+
+  struct Window
+  {
+    int frames;         // 処理したフレーム
+    int skipped;        // 取りこぼしたフレーム
+    double processing;  // 平均の処理時間 [s]
+  };
+
+  QualityController();
+
+  /*!
+   * @brief 段を設定する。前回と同じ指定なら今の段を保つ
+   * @param spec 段ごとの "key=value,key=value" をセミコロンで区切る。空なら段なし
+   * @return 書式が正しければ true (誤りなら段なし)
+   */
+  bool setLevels(const std::string& spec);
+
+  /*!
+   * @param budget 1フレームの処理時間の上限 [s]
+   * @param headroom 上げる条件の budget・max_skipped に対する割合
+   * @param max_skipped 取りこぼしたフレームの割合の上限
+   * @param down_time 超過がこれだけ続いたら下げる [s]
+   * @param up_time 余裕がこれだけ続いたら上げる [s]
+   * @param min_interval reset() から次に切り替えられるまでの時間 [s]
+   */
+  void configure(double budget, double headroom, double max_skipped, double down_time, double up_time,
+                 double min_interval);
+
+  /*!
+   * @brief 測定をやり直す (段は変えない)。Nuitrack を起動したときに呼ぶ
+   */
+  void reset(Clock::time_point now);
+
+  int levels() const { return static_cast<int>(m_levels.size()); }
+  int level() const { return m_level; }
+  void setLevel(int level) { m_level = level; }
+  const std::vector<Setting>& settings(int level) const { return m_levels[level]; }
+  // 段の指定の文字列 (表示用)
+  const std::string& text(int level) const { return m_texts[level]; }
+  // 今の段の指定 (段なしなら空)
+  std::string current() const { return m_levels.empty() ? std::string() : m_texts[m_level]; }
+
+  /*!
+   * @brief 1フレームを処理した
+   * @param processing そのフレームの処理時間 [s]
+   * @param stamp センサのタイムスタンプ [us] (0 なら取りこぼしは数えない)
+   * @return 切り替えるべき段 (切り替えないなら -1)
+   */
+  int update(double processing, uint64_t stamp, Clock::time_point now);
+
+  // 直前に閉じた窓の集計
+  const Window& last() const { return m_last; }
+
+ private:
+  std::vector<std::vector<Setting> > m_levels;
+  std::vector<std::string> m_texts;
+  std::string m_spec;
+  int m_level;
+
+  double m_budget;
+  double m_headroom;
+  double m_max_skipped;
+  double m_down_time;
+  double m_up_time;
+  double m_min_interval;
+
+  Clock::time_point m_settle_until;
+  Clock::time_point m_switch_after;   // これより前は切り替えない
+  Clock::time_point m_window_start;
+  int m_frames;
+  int m_skipped;
+  double m_processing_sum;
+  Window m_last;
+
+  // 条件が続いている時間 [s]
+  double m_over;
+  double m_under;
+
+  uint64_t m_last_stamp;
+  uint64_t m_interval;   // これまでで最短のタイムスタンプの間隔 [us]
+};
+
+#endif // QUALITYCONTROLLER_H
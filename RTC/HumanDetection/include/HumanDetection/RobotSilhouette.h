@@ -0,0 +1,80 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  RobotSilhouette.h
+ * @brief Projection of the robot arm into the depth image from its joint state for HumanDetection
+ * @date  $Date$
+ *
+ * $Id$
+ */
+
+#ifndef ROBOTSILHOUETTE_H
+#define ROBOTSILHOUETTE_H
+
+#include <stdint.h>
+#include <string>
+
+/*!
+ * @class RobotSilhouette
+ * @brief 関節角からアームの形をカプセルの列で求め、深度画像に描く
+ *
+ * リンクは標準 DH パラメータで表し、隣り合う関節座標系の原点を結ぶ線分を
+ * 半径 radius のカプセルとみなす。カプセルはカメラ座標系へ写してから
+ * ピンホールで投影し、覆う画素にカプセルの最も近い深度を書く (同じ画素に
+ * 複数のカプセルがあれば近い方)。投影した太さは最も近い端で求めるので、
+ * 描く範囲は実際のシルエットより広くなる側に倒れる。
+ *
+ * カメラ座標系は Nuitrack と同じく x 右・y 上・z 前方 [mm]。
+ */
+class RobotSilhouette
+{
+ public:
+  static const int MAX_JOINTS = 8;
+
+  RobotSilhouette();
+
+  /*!
+   * @param dh 関節ごとの "a alpha d offset" [mm, deg, mm, deg] をセミコロンで区切る。空ならアームなし
+   * @param base カメラ座標系でのロボットの基部 "x y z roll pitch yaw" [mm, deg]。空なら恒等変換
+   * @param radius リンクの半径 (余裕を含む) [mm]
+   * @return 書式が正しければ true (誤りならアームなし)
+   */
+  bool configure(const std::string& dh, const std::string& base, double radius);
+
+  // DH パラメータで表した関節の数 (0 ならアームなし)
+  int joints() const { return m_joints; }
+
+  /*!
+   * @brief 段 0 の画像のカメラ内部パラメータ [画素]
+   */
+  void setProjection(float fx, float fy, float cx, float cy);
+
+  /*!
+   * @brief 関節角 [rad] でのアームを描く。out は NONE で埋めてから描く
+   * @param q 関節角 (joints() 個)
+   * @param out 描く先 (行優先、cols × rows)。値はその画素でのアームの最も近い深度 [mm]
+   * @param level ピラミッドの段 (画素は段 0 の 2^level 四方)
+   * @param x0, y0 段 0 の (0, 0) の画像全体での位置 [画素]
+   * @return アームを描いた画素の数
+   */
+  int render(const double* q, uint16_t* out, int cols, int rows, int level, int x0, int y0) const;
+
+ private:
+  struct Link
+  {
+    float a, cos_alpha, sin_alpha, d, offset;
+  };
+
+  // カメラ座標系での線分を投影して描く
+  int drawCapsule(const float* p0, const float* p1, uint16_t* out, int cols, int rows,
+                  float fx, float fy, float cx, float cy) const;
+
+  int m_joints;
+  Link m_links[MAX_JOINTS];
+  float m_radius;
+  // ロボット基部 → カメラ座標系 (p' = R p + T)
+  float m_rot[9];
+  float m_trans[3];
+  float m_fx, m_fy, m_cx, m_cy;
+};
+
+#endif // ROBOTSILHOUETTE_H
@@ -0,0 +1,164 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  StageQueue.h
+ * @brief Bounded single-producer / single-consumer queue between the HumanDetection pipeline stages
+ * @date  $Date$
+ *
+ * $Id$
+ */
+
+#ifndef STAGEQUEUE_H
+#define STAGEQUEUE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+/*!
+ * @class StageQueue
+ * @brief 前の段が埋めた要素を次の段へ渡す、長さの決まった SPSC 待ち行列
+ *
+ * 要素は configure() で capacity + 2 個確保し、書き手が埋めている1個と
+ * 読み手が読んでいる1個を除いたものを順番に受け渡す。要素そのものは
+ * コピーせず、番号だけを付け替える。
+ *
+ * 書き手は待たない。待ち行列が一杯なら最も古い要素を捨てて入れる
+ * (センサのフレームは新しいものほど価値があるので、遅い段の前では
+ * 古いフレームから落とす)。読み手は pop() で次の要素が来るまで待つ。
+ * ロックは番号の付け替えの間だけ持ち、メモリ確保はしない。
+ */
+template <typename T>
+class StageQueue
+{
+ public:
+  StageQueue() : m_capacity(0), m_head(0), m_count(0), m_writing(0), m_reading(NONE), m_closed(false) {}
+
+  /*!
+   * @brief 要素を確保して空にする
+   * @param capacity 受け渡しを待てる要素の数 (1 未満なら 1)
+   */
+  void configure(size_t capacity)
+  {
+    m_capacity = (capacity < 1) ? 1 : capacity;
+    m_slots.clear();
+    m_slots.resize(m_capacity + 2);
+    m_queue.assign(m_capacity, 0);
+    m_free.reserve(m_slots.size());
+    reset();
+  }
+
+  /*!
+   * @brief 空にして close() を取り消す (要素の中身はそのまま)
+   */
+  void reset()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_head = 0;
+    m_count = 0;
+    m_writing = 0;
+    m_reading = NONE;
+    m_closed = false;
+    m_free.clear();
+    for (size_t i = m_slots.size(); i > 1; i--) m_free.push_back(i - 1);
+  }
+
+  /*!
+   * @brief 待っている読み手を起こし、以降の pop() を待たせない
+   */
+  void close()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_closed = true;
+    }
+    m_cond.notify_all();
+  }
+
+  // 要素の数と要素 (段を動かす前の確保用)
+  size_t size() const { return m_slots.size(); }
+  T& slot(size_t i) { return m_slots[i]; }
+
+  // --- 書き手 ---
+  /*!
+   * @brief 次に渡す要素 (push() まで書き手だけが触る)
+   */
+  T* writeSlot() { return &m_slots[m_writing]; }
+
+  /*!
+   * @brief writeSlot() を読み手へ渡し、次の要素に移る
+   * @return 一杯で最も古い要素を捨てたら false
+   */
+  bool push()
+  {
+    bool kept = true;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_count == m_capacity)
+      {
+        m_free.push_back(m_queue[m_head]);
+        m_head = (m_head + 1) % m_capacity;
+        m_count--;
+        kept = false;
+      }
+      m_queue[(m_head + m_count) % m_capacity] = m_writing;
+      m_count++;
+      m_writing = m_free.back();
+      m_free.pop_back();
+    }
+    m_cond.notify_one();
+    return kept;
+  }
+
+  // --- 読み手 ---
+  /*!
+   * @brief 前に pop() した要素を返し、次の要素を待って受け取る
+   * @param timeout 最大待ち時間 [s]
+   * @return 受け取った要素 (時間切れか close() 後で空なら NULL)
+   */
+  T* pop(double timeout)
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_reading != NONE)
+    {
+      m_free.push_back(m_reading);
+      m_reading = NONE;
+    }
+    m_cond.wait_for(lock, std::chrono::duration<double>(timeout), [this] { return m_count > 0 || m_closed; });
+    if (m_count == 0) return NULL;
+    m_reading = m_queue[m_head];
+    m_head = (m_head + 1) % m_capacity;
+    m_count--;
+    return &m_slots[m_reading];
+  }
+
+  /*!
+   * @brief pop() した要素を返す (次の pop() でも返る)
+   */
+  void release()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_reading == NONE) return;
+    m_free.push_back(m_reading);
+    m_reading = NONE;
+  }
+
+ private:
+  static const size_t NONE = static_cast<size_t>(-1);
+
+  std::vector<T> m_slots;
+  std::vector<size_t> m_queue;  // 受け渡しを待つ要素の番号 (m_head から m_count 個)
+  std::vector<size_t> m_free;   // どこにも使っていない要素の番号
+  size_t m_capacity;
+  size_t m_head;
+  size_t m_count;
+  size_t m_writing;             // 書き手が埋めている要素
+  size_t m_reading;             // 読み手が読んでいる要素 (なければ NONE)
+  bool m_closed;
+
+  std::mutex m_mutex;
+  std::condition_variable m_cond;
+};
+
+#endif // STAGEQUEUE_H
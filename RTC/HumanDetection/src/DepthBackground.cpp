@@ -0,0 +1,146 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  DepthBackground.cpp
+ * @brief Per-pixel background depth model of the empty cell for HumanDetection
+ * @date $Date$
+ *
+ * $Id$
+ */
+
+#include "DepthBackground.h"
+
+#include <algorithm>
+
+DepthBackground::DepthBackground()
+  : m_cols(0), m_rows(0), m_margin(0), m_scale(0), m_shift(4)
+{
+}
+
+void DepthBackground::configure(int cols, int rows, int margin, int deviation_scale, int shift)
+{
+  m_cols = std::max(0, cols);
+  m_rows = std::max(0, rows);
+  m_margin = std::max(0, margin);
+  m_scale = std::max(0, deviation_scale);
+  m_shift = std::max(0, std::min(shift, 8));
+
+  size_t n = static_cast<size_t>(m_cols) * m_rows;
+  m_mean.resize(n);
+  m_dev.resize(n);
+  m_seen.resize(n);
+  m_robot.resize(n);
+  reset();
+}
+
+void DepthBackground::reset()
+{
+  std::fill(m_mean.begin(), m_mean.end(), DepthPyramid::NONE);
+  std::fill(m_dev.begin(), m_dev.end(), 0);
+  std::fill(m_seen.begin(), m_seen.end(), 0);
+  clearRobot();
+}
+
+void DepthBackground::clearRobot()
+{
+  std::fill(m_robot.begin(), m_robot.end(), DepthPyramid::NONE);
+}
+
+// 1行分の学習。最初に見えた値 (または何もなかった画素に初めて現れた値) で始め、
+// 以降は差の 1/2^shift ずつ寄せる (四捨五入して平均が片側へずれないようにする)
+static void learnRow(const uint16_t* __restrict d, const uint16_t* __restrict robot,
+                     uint16_t* __restrict mean, uint16_t* __restrict dev, uint8_t* __restrict seen,
+                     int n, int shift)
+{
+  const int none = DepthPyramid::NONE;
+  const int half = (1 << shift) >> 1;
+  for (int x = 0; x < n; x++)
+  {
+    int v = d[x], r = robot[x], m = mean[x], s = dev[x];
+    bool visible = (r == none) | (v < r);
+    bool valid = v != none;
+    bool seed = (seen[x] == 0) | (m == none);
+    int diff = v - m;
+    int ad = (diff < 0) ? -diff : diff;
+    int nm = seed ? v : m + ((diff + half) >> shift);
+    int ns = seed ? 0 : s + ((ad - s + half) >> shift);
+    bool update = visible & valid;
+    mean[x] = static_cast<uint16_t>(update ? nm : m);
+    dev[x] = static_cast<uint16_t>(update ? ns : s);
+    seen[x] = static_cast<uint8_t>(seen[x] | visible);
+  }
+}
+
+// 1行分の比較。侵入画素の数を返し、その最小の深度を nearest に書く
+static int compareRow(const uint16_t* __restrict d, const uint16_t* __restrict robot,
+                      const uint16_t* __restrict mean, const uint16_t* __restrict dev,
+                      const uint8_t* __restrict seen, int n, int margin, int scale, int& nearest)
+{
+  const int none = DepthPyramid::NONE;
+  int count = 0, best = none;
+  for (int x = 0; x < n; x++)
+  {
+    int v = d[x], r = robot[x];
+    // NONE の画素は v + 閾値が平均を超えるので侵入にならない
+    bool hit = (seen[x] != 0) & (v + margin + scale * dev[x] < mean[x]) & ((r == none) | (v < r));
+    count += hit;
+    best = std::min(best, hit ? v : none);
+  }
+  nearest = best;
+  return count;
+}
+
+void DepthBackground::learn(const DepthPyramid::Level& lv)
+{
+  if (lv.data == NULL || lv.cols != m_cols || lv.rows != m_rows) return;
+  for (int y = 0; y < m_rows; y++)
+  {
+    size_t o = static_cast<size_t>(y) * m_cols;
+    learnRow(lv.data + y * lv.stride, &m_robot[o], &m_mean[o], &m_dev[o], &m_seen[o], m_cols, m_shift);
+  }
+}
+
+DepthBackground::Intrusion DepthBackground::compare(const DepthPyramid::Level& lv) const
+{
+  Intrusion r;
+  r.pixels = 0;
+  r.found = false;
+  r.x = r.y = 0;
+  r.depth = 0;
+  if (lv.data == NULL || lv.cols != m_cols || lv.rows != m_rows) return r;
+
+  int best = DepthPyramid::NONE, best_row = -1;
+  for (int y = 0; y < m_rows; y++)
+  {
+    size_t o = static_cast<size_t>(y) * m_cols;
+    int nearest;
+    r.pixels += compareRow(lv.data + y * lv.stride, &m_robot[o], &m_mean[o], &m_dev[o], &m_seen[o],
+                           m_cols, m_margin, m_scale, nearest);
+    if (nearest < best)
+    {
+      best = nearest;
+      best_row = y;
+    }
+  }
+  if (best_row < 0) return r;
+
+  // 最も近い値を持つ行だけを見直して列を決める
+  const uint16_t* d = lv.data + best_row * lv.stride;
+  size_t o = static_cast<size_t>(best_row) * m_cols;
+  for (int x = 0; x < m_cols; x++)
+  {
+    if (d[x] != best || !m_seen[o + x]) continue;
+    if (d[x] + m_margin + m_scale * m_dev[o + x] >= m_mean[o + x]) continue;
+    if (m_robot[o + x] != DepthPyramid::NONE && d[x] >= m_robot[o + x]) continue;
+    r.found = true;
+    r.x = x;
+    r.y = best_row;
+    r.depth = d[x];
+    break;
+  }
+  return r;
+}
+
+int DepthBackground::unlearned() const
+{
+  return static_cast<int>(std::count(m_seen.begin(), m_seen.end(), 0));
+}
@@ -0,0 +1,236 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  DepthPyramid.cpp
+ * @brief Min-pooled depth image pyramid over a region of interest for HumanDetection
+ * @date $Date$
+ *
+ * $Id$
+ */
+
+#include "DepthPyramid.h"
+
+#include <algorithm>
+#include <cstdio>
+
+DepthPyramid::DepthPyramid()
+  : m_levels(2), m_near(1), m_span(0xfffe), m_cols(0), m_rows(0),
+    m_x0(0), m_y0(0), m_x1(0), m_y1(0),
+    m_roi_x0(-1), m_roi_y0(-1), m_roi_x1(-1), m_roi_y1(-1)
+{
+  for (int l = 0; l < MAX_LEVELS; l++)
+  {
+    m_level[l].data = NULL;
+    m_level[l].cols = m_level[l].rows = m_level[l].stride = 0;
+  }
+}
+
+bool DepthPyramid::configure(const std::string& roi, int levels, int near_limit, int far_limit, int cols, int rows)
+{
+  m_levels = std::max(2, std::min(levels, static_cast<int>(MAX_LEVELS)));
+  // 0 (測れなかった画素) は d - near が大きな値に回り込むので範囲外になる
+  near_limit = std::max(1, std::min(near_limit, 0xfffe));
+  far_limit = std::max(near_limit, std::min(far_limit, 0xfffe));
+  m_near = static_cast<uint16_t>(near_limit);
+  m_span = static_cast<uint16_t>(far_limit - near_limit);
+
+  bool ok = true;
+  m_roi_x0 = m_roi_y0 = m_roi_x1 = m_roi_y1 = -1;
+  if (!roi.empty())
+  {
+    std::string s = roi;
+    std::replace(s.begin(), s.end(), ',', ' ');
+    int v[4];
+    char rest;
+    ok = std::sscanf(s.c_str(), "%d %d %d %d %c", &v[0], &v[1], &v[2], &v[3], &rest) == 4 &&
+         v[0] >= 0 && v[1] >= 0 && v[2] > v[0] && v[3] > v[1];
+    if (ok)
+    {
+      m_roi_x0 = v[0];
+      m_roi_y0 = v[1];
+      m_roi_x1 = v[2];
+      m_roi_y1 = v[3];
+    }
+  }
+
+  m_cols = m_rows = -1;
+  resize(cols, rows);
+  return ok;
+}
+
+void DepthPyramid::resize(int cols, int rows)
+{
+  m_cols = cols;
+  m_rows = rows;
+  m_x0 = 0;
+  m_y0 = 0;
+  m_x1 = cols;
+  m_y1 = rows;
+  if (m_roi_x0 >= 0)
+  {
+    m_x0 = std::min(m_roi_x0, cols);
+    m_y0 = std::min(m_roi_y0, rows);
+    m_x1 = std::min(m_roi_x1, cols);
+    m_y1 = std::min(m_roi_y1, rows);
+  }
+
+  // 奇数の辺は切り上げ、はみ出た子は端の画素で代用する
+  int w = m_x1 - m_x0, h = m_y1 - m_y0;
+  m_level[0].cols = w;
+  m_level[0].rows = h;
+  m_level[0].stride = cols;
+  for (int l = 1; l < m_levels; l++)
+  {
+    w = (w + 1) / 2;
+    h = (h + 1) / 2;
+    m_buffer[l].assign(static_cast<size_t>(w) * h, NONE);
+    m_level[l].data = m_buffer[l].empty() ? NULL : &m_buffer[l][0];
+    m_level[l].cols = w;
+    m_level[l].rows = h;
+    m_level[l].stride = w;
+  }
+}
+
+// 段 0 の2行から段 1 の1行を作る。範囲外は NONE にしてから最小値を取る
+static void reduceFirst(const uint16_t* __restrict r0, const uint16_t* __restrict r1,
+                        uint16_t* __restrict out, int n, uint16_t near, uint16_t span)
+{
+  for (int x = 0; x < n; x++)
+  {
+    uint16_t a = r0[2 * x], b = r0[2 * x + 1], c = r1[2 * x], d = r1[2 * x + 1];
+    a = (static_cast<uint16_t>(a - near) <= span) ? a : DepthPyramid::NONE;
+    b = (static_cast<uint16_t>(b - near) <= span) ? b : DepthPyramid::NONE;
+    c = (static_cast<uint16_t>(c - near) <= span) ? c : DepthPyramid::NONE;
+    d = (static_cast<uint16_t>(d - near) <= span) ? d : DepthPyramid::NONE;
+    uint16_t m0 = (a < b) ? a : b;
+    uint16_t m1 = (c < d) ? c : d;
+    out[x] = (m0 < m1) ? m0 : m1;
+  }
+}
+
+// 段 l の2行から段 l+1 の1行を作る
+static void reduceNext(const uint16_t* __restrict r0, const uint16_t* __restrict r1,
+                       uint16_t* __restrict out, int n)
+{
+  for (int x = 0; x < n; x++)
+  {
+    uint16_t m0 = std::min(r0[2 * x], r0[2 * x + 1]);
+    uint16_t m1 = std::min(r1[2 * x], r1[2 * x + 1]);
+    out[x] = std::min(m0, m1);
+  }
+}
+
+void DepthPyramid::build(const uint16_t* depth, int cols, int rows)
+{
+  if (cols != m_cols || rows != m_rows) resize(cols, rows);
+  m_level[0].data = depth + m_y0 * cols + m_x0;
+
+  for (int l = 1; l < m_levels; l++)
+  {
+    const Level& src = m_level[l - 1];
+    Level& dst = m_level[l];
+    uint16_t* out = &m_buffer[l][0];
+    int pairs = src.cols / 2;
+    for (int y = 0; y < dst.rows; y++)
+    {
+      const uint16_t* r0 = src.data + (2 * y) * src.stride;
+      const uint16_t* r1 = (2 * y + 1 < src.rows) ? r0 + src.stride : r0;
+      uint16_t* o = out + y * dst.stride;
+      if (l == 1)
+      {
+        reduceFirst(r0, r1, o, pairs, m_near, m_span);
+        if (pairs < dst.cols)
+        {
+          // 奇数幅の最後の列
+          uint16_t a = r0[src.cols - 1], c = r1[src.cols - 1];
+          a = inRange(a) ? a : NONE;
+          c = inRange(c) ? c : NONE;
+          o[pairs] = std::min(a, c);
+        }
+      }
+      else
+      {
+        reduceNext(r0, r1, o, pairs);
+        if (pairs < dst.cols) o[pairs] = std::min(r0[src.cols - 1], r1[src.cols - 1]);
+      }
+    }
+  }
+}
+
+DepthPyramid::Nearest DepthPyramid::nearest() const
+{
+  Nearest r;
+  r.found = false;
+  r.col = r.row = 0;
+  r.depth = 0;
+  if (m_level[0].data == NULL) return r;
+
+  // 最も粗い段は小さいので全体を見る
+  const Level& top = m_level[m_levels - 1];
+  uint16_t best = NONE;
+  int x = 0, y = 0;
+  for (int j = 0; j < top.rows; j++)
+  {
+    for (int i = 0; i < top.cols; i++)
+    {
+      if (top.at(i, j) < best)
+      {
+        best = top.at(i, j);
+        x = i;
+        y = j;
+      }
+    }
+  }
+  if (best == NONE) return r;
+  return locate(m_levels - 1, x, y);
+}
+
+DepthPyramid::Nearest DepthPyramid::locate(int level, int x, int y) const
+{
+  Nearest r;
+  r.found = false;
+  r.col = r.row = 0;
+  r.depth = 0;
+  if (level < 1 || level >= m_levels || m_level[0].data == NULL) return r;
+  uint16_t best = m_level[level].at(x, y);
+  if (best == NONE) return r;
+
+  // 段 1 までは同じ値を持つ子へ降りる
+  for (int l = level - 1; l >= 1; l--)
+  {
+    const Level& lv = m_level[l];
+    int cx = 2 * x, cy = 2 * y;
+    int nx = cx, ny = cy;
+    for (int k = 0; k < 4; k++)
+    {
+      int i = std::min(cx + (k & 1), lv.cols - 1);
+      int j = std::min(cy + (k >> 1), lv.rows - 1);
+      if (lv.at(i, j) == best)
+      {
+        nx = i;
+        ny = j;
+        break;
+      }
+    }
+    x = nx;
+    y = ny;
+  }
+
+  // 段 0 では範囲内の画素から同じ値を探す
+  const Level& base = m_level[0];
+  int cx = 2 * x, cy = 2 * y;
+  for (int k = 0; k < 4; k++)
+  {
+    int i = std::min(cx + (k & 1), base.cols - 1);
+    int j = std::min(cy + (k >> 1), base.rows - 1);
+    uint16_t d = base.at(i, j);
+    if (d == best && inRange(d))
+    {
+      r.found = true;
+      r.col = m_x0 + i;
+      r.row = m_y0 + j;
+      r.depth = d;
+      return r;
+    }
+  }
+  return r;
+}
@@ -9,6 +9,17 @@
 
 #include "HumanDetection.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <exception>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// パイプラインの段が前の段を待つ最大時間 [s] (止めるときに気付くまでの時間)
+static const double PIPELINE_WAIT = 0.1;
+
 // Module specification
 // <rtc-template block="module_spec">
 static const char* humandetection_spec[] =
@@ -24,11 +35,178 @@ static const char* humandetection_spec[] =
     "max_instance",      "1",
     "language",          "C++",
     "lang_type",         "compile",
+    // Configuration variables
+    "conf.default.pose_ring", "",
+    "conf.default.pose_ring_slots", "64",
+    "conf.default.rt_policy", "other",
+    "conf.default.rt_priority", "70",
+    "conf.default.rt_cpus", "",
+    "conf.default.nuitrack_cpus", "",
+    "conf.default.rt_lock_memory", "0",
+    "conf.default.trace_file", "",
+    "conf.default.prom_export", "",
+    "conf.default.prom_export_period", "5.0",
+    "conf.default.overrun_budget", "10",
+    "conf.default.overrun_window", "10.0",
+    "conf.default.cycle_status_period", "1.0",
+    "conf.default.filter_enable", "1",
+    "conf.default.filter_hand_min_cutoff", "1.0",
+    "conf.default.filter_hand_beta", "0.005",
+    "conf.default.filter_joint_min_cutoff", "0.5",
+    "conf.default.filter_joint_beta", "0.002",
+    "conf.default.filter_d_cutoff", "1.0",
+    "conf.default.gate_enable", "1",
+    "conf.default.gate_max_speed", "5000.0",
+    "conf.default.gate_max_accel", "150000.0",
+    "conf.default.gate_max_hold", "0.2",
+    "conf.default.legacy_ports", "1",
+    "conf.default.skeleton_enable", "0",
+    "conf.default.skeleton_min_confidence", "0.3",
+    "conf.default.keep_warm", "0",
+    "conf.default.camera_device", "",
+    "conf.default.track_gate_distance", "600.0",
+    "conf.default.track_max_missing", "0.5",
+    "conf.default.depth_enable", "0",
+    "conf.default.depth_roi", "",
+    "conf.default.depth_near_limit", "300",
+    "conf.default.depth_far_limit", "4000",
+    "conf.default.depth_pyramid_levels", "4",
+    "conf.default.depth_publish_level", "0",
+    "conf.default.depth_background_enable", "0",
+    "conf.default.depth_background_level", "2",
+    "conf.default.depth_background_learn_time", "5.0",
+    "conf.default.depth_background_margin", "80",
+    "conf.default.depth_background_deviation_scale", "3",
+    "conf.default.robot_dh", "",
+    "conf.default.robot_base", "",
+    "conf.default.robot_link_radius", "120.0",
+    "conf.default.robot_joint_max_age", "0.2",
+    "conf.default.adapt_levels", "",
+    "conf.default.adapt_budget", "0.025",
+    "conf.default.adapt_headroom", "0.5",
+    "conf.default.adapt_max_skipped", "0.1",
+    "conf.default.adapt_down_time", "2.0",
+    "conf.default.adapt_up_time", "30.0",
+    "conf.default.adapt_min_interval", "60.0",
+    "conf.default.pipeline_enable", "0",
+    "conf.default.pipeline_depth", "2",
+    // Widget
+    "conf.__widget__.pose_ring", "text",
+    "conf.__widget__.pose_ring_slots", "text",
+    "conf.__widget__.rt_policy", "text",
+    "conf.__widget__.rt_priority", "text",
+    "conf.__widget__.rt_cpus", "text",
+    "conf.__widget__.nuitrack_cpus", "text",
+    "conf.__widget__.rt_lock_memory", "text",
+    "conf.__widget__.trace_file", "text",
+    "conf.__widget__.prom_export", "text",
+    "conf.__widget__.prom_export_period", "text",
+    "conf.__widget__.overrun_budget", "text",
+    "conf.__widget__.overrun_window", "text",
+    "conf.__widget__.cycle_status_period", "text",
+    "conf.__widget__.filter_enable", "text",
+    "conf.__widget__.filter_hand_min_cutoff", "text",
+    "conf.__widget__.filter_hand_beta", "text",
+    "conf.__widget__.filter_joint_min_cutoff", "text",
+    "conf.__widget__.filter_joint_beta", "text",
+    "conf.__widget__.filter_d_cutoff", "text",
+    "conf.__widget__.gate_enable", "text",
+    "conf.__widget__.gate_max_speed", "text",
+    "conf.__widget__.gate_max_accel", "text",
+    "conf.__widget__.gate_max_hold", "text",
+    "conf.__widget__.legacy_ports", "text",
+    "conf.__widget__.skeleton_enable", "text",
+    "conf.__widget__.skeleton_min_confidence", "text",
+    "conf.__widget__.keep_warm", "text",
+    "conf.__widget__.camera_device", "text",
+    "conf.__widget__.track_gate_distance", "text",
+    "conf.__widget__.track_max_missing", "text",
+    "conf.__widget__.depth_enable", "text",
+    "conf.__widget__.depth_roi", "text",
+    "conf.__widget__.depth_near_limit", "text",
+    "conf.__widget__.depth_far_limit", "text",
+    "conf.__widget__.depth_pyramid_levels", "text",
+    "conf.__widget__.depth_publish_level", "text",
+    "conf.__widget__.depth_background_enable", "text",
+    "conf.__widget__.depth_background_level", "text",
+    "conf.__widget__.depth_background_learn_time", "text",
+    "conf.__widget__.depth_background_margin", "text",
+    "conf.__widget__.depth_background_deviation_scale", "text",
+    "conf.__widget__.robot_dh", "text",
+    "conf.__widget__.robot_base", "text",
+    "conf.__widget__.robot_link_radius", "text",
+    "conf.__widget__.robot_joint_max_age", "text",
+    "conf.__widget__.adapt_levels", "text",
+    "conf.__widget__.adapt_budget", "text",
+    "conf.__widget__.adapt_headroom", "text",
+    "conf.__widget__.adapt_max_skipped", "text",
+    "conf.__widget__.adapt_down_time", "text",
+    "conf.__widget__.adapt_up_time", "text",
+    "conf.__widget__.adapt_min_interval", "text",
+    "conf.__widget__.pipeline_enable", "text",
+    "conf.__widget__.pipeline_depth", "text",
+    // Constraints
+    "conf.__type__.pose_ring", "string",
+    "conf.__type__.pose_ring_slots", "int",
+    "conf.__type__.rt_policy", "string",
+    "conf.__type__.rt_priority", "int",
+    "conf.__type__.rt_cpus", "string",
+    "conf.__type__.nuitrack_cpus", "string",
+    "conf.__type__.rt_lock_memory", "int",
+    "conf.__type__.trace_file", "string",
+    "conf.__type__.prom_export", "string",
+    "conf.__type__.prom_export_period", "double",
+    "conf.__type__.overrun_budget", "int",
+    "conf.__type__.overrun_window", "double",
+    "conf.__type__.cycle_status_period", "double",
+    "conf.__type__.filter_enable", "int",
+    "conf.__type__.filter_hand_min_cutoff", "double",
+    "conf.__type__.filter_hand_beta", "double",
+    "conf.__type__.filter_joint_min_cutoff", "double",
+    "conf.__type__.filter_joint_beta", "double",
+    "conf.__type__.filter_d_cutoff", "double",
+    "conf.__type__.gate_enable", "int",
+    "conf.__type__.gate_max_speed", "double",
+    "conf.__type__.gate_max_accel", "double",
+    "conf.__type__.gate_max_hold", "double",
+    "conf.__type__.legacy_ports", "int",
+    "conf.__type__.skeleton_enable", "int",
+    "conf.__type__.skeleton_min_confidence", "double",
+    "conf.__type__.keep_warm", "int",
+    "conf.__type__.camera_device", "string",
+    "conf.__type__.track_gate_distance", "double",
+    "conf.__type__.track_max_missing", "double",
+    "conf.__type__.depth_enable", "int",
+    "conf.__type__.depth_roi", "string",
+    "conf.__type__.depth_near_limit", "int",
+    "conf.__type__.depth_far_limit", "int",
+    "conf.__type__.depth_pyramid_levels", "int",
+    "conf.__type__.depth_publish_level", "int",
+    "conf.__type__.depth_background_enable", "int",
+    "conf.__type__.depth_background_level", "int",
+    "conf.__type__.depth_background_learn_time", "double",
+    "conf.__type__.depth_background_margin", "int",
+    "conf.__type__.depth_background_deviation_scale", "int",
+    "conf.__type__.robot_dh", "string",
+    "conf.__type__.robot_base", "string",
+    "conf.__type__.robot_link_radius", "double",
+    "conf.__type__.robot_joint_max_age", "double",
+    "conf.__type__.adapt_levels", "string",
+    "conf.__type__.adapt_budget", "double",
+    "conf.__type__.adapt_headroom", "double",
+    "conf.__type__.adapt_max_skipped", "double",
+    "conf.__type__.adapt_down_time", "double",
+    "conf.__type__.adapt_up_time", "double",
+    "conf.__type__.adapt_min_interval", "double",
+    "conf.__type__.pipeline_enable", "int",
+    "conf.__type__.pipeline_depth", "int",
     ""
   };
 // </rtc-template>
 
 std::vector<tdv::nuitrack::UserHands> userHands;
+// 直近の手のフレームのセンサのタイムスタンプ [us] (取りこぼしの検出に使う)
+uint64_t handTimestamp = 0;
  
 ///////////////////////////////////////////////////////////////////////////////
 //Callback functions for Nuitrack
@@ -45,8 +223,34 @@ void onHandUpdate(tdv::nuitrack::HandTrackerData::Ptr handData)
       return;
   }
 
+  TRACE_SCOPE("HumanDetection::onHandUpdate");
   userHands = handData->getUsersHands();
+  handTimestamp = handData->getTimestamp();
+
+}
+
+std::vector<tdv::nuitrack::Skeleton> userSkeletons;
+
+//=============================================================================
+//Callback function For skeleton tracking (skeleton_enable のときだけ登録)
+//=============================================================================
+void onSkeletonUpdate(tdv::nuitrack::SkeletonData::Ptr skeletonData)
+{
+  if (!skeletonData) return;
 
+  TRACE_SCOPE("HumanDetection::onSkeletonUpdate");
+  userSkeletons = skeletonData->getSkeletons();
+}
+
+tdv::nuitrack::DepthFrame::Ptr depthFrame;
+
+//=============================================================================
+//Callback function For depth frames (depth_enable のときだけ登録)
+//=============================================================================
+void onDepthUpdate(tdv::nuitrack::DepthFrame::Ptr frame)
+{
+  // 処理は onExecute (パイプラインでは追跡の段) で行い、ここでは最新のフレームを覚えるだけにする
+  depthFrame = frame;
 }
 
 /*!
@@ -56,10 +260,19 @@ void onHandUpdate(tdv::nuitrack::HandTrackerData::Ptr handData)
 HumanDetection::HumanDetection(RTC::Manager* manager)
     // <rtc-template block="initializer">
   : RTC::DataFlowComponentBase(manager),
+    m_JointStateIn("JointState", m_JointState),
     m_FacePoseOut("FacePose", m_FacePose),
     m_RightHandPoseOut("RightHandPose", m_RightHandPose),
     m_LeftHandPoseOut("LeftHandPose", m_LeftHandPose),
-    m_SkeltonOut("Skelton", m_Skelton)
+    m_SkeltonOut("Skelton", m_Skelton),
+    m_CycleStatusOut("CycleStatus", m_CycleStatus),
+    m_HumanStateOut("HumanState", m_HumanState),
+    m_HandPointsOut("HandPoints", m_HandPoints),
+    m_NearestDepthOut("NearestDepth", m_NearestDepth),
+    m_DepthPyramidOut("DepthPyramid", m_DepthPyramid),
+    m_IntrusionOut("Intrusion", m_Intrusion),
+    m_QualityStatusOut("QualityStatus", m_QualityStatus),
+    m_SensorStatusOut("SensorStatus", m_SensorStatus)
 
     // </rtc-template>
 {
@@ -79,12 +292,21 @@ RTC::ReturnCode_t HumanDetection::onInitialize()
   // Registration: InPort/OutPort/Service
   // <rtc-template block="registration">
   // Set InPort buffers
+  addInPort("JointState", m_JointStateIn);
 
   // Set OutPort buffer
   addOutPort("FacePose", m_FacePoseOut);
   addOutPort("RightHandPose", m_RightHandPoseOut);
   addOutPort("LeftHandPose", m_LeftHandPoseOut);
   addOutPort("Skelton", m_SkeltonOut);
+  addOutPort("CycleStatus", m_CycleStatusOut);
+  addOutPort("HumanState", m_HumanStateOut);
+  addOutPort("HandPoints", m_HandPointsOut);
+  addOutPort("NearestDepth", m_NearestDepthOut);
+  addOutPort("DepthPyramid", m_DepthPyramidOut);
+  addOutPort("Intrusion", m_IntrusionOut);
+  addOutPort("QualityStatus", m_QualityStatusOut);
+  addOutPort("SensorStatus", m_SensorStatusOut);
 
   // Set service provider to Ports
 
@@ -95,9 +317,96 @@ RTC::ReturnCode_t HumanDetection::onInitialize()
   // </rtc-template>
 
   // <rtc-template block="bind_config">
+  bindParameter("pose_ring", m_pose_ring, "");
+  bindParameter("pose_ring_slots", m_pose_ring_slots, "64");
+  bindParameter("rt_policy", m_rt_policy, "other");
+  bindParameter("rt_priority", m_rt_priority, "70");
+  bindParameter("rt_cpus", m_rt_cpus, "");
+  bindParameter("nuitrack_cpus", m_nuitrack_cpus, "");
+  bindParameter("rt_lock_memory", m_rt_lock_memory, "0");
+  bindParameter("trace_file", m_trace_file, "");
+  bindParameter("prom_export", m_prom_export, "");
+  bindParameter("prom_export_period", m_prom_export_period, "5.0");
+  bindParameter("overrun_budget", m_overrun_budget, "10");
+  bindParameter("overrun_window", m_overrun_window, "10.0");
+  bindParameter("cycle_status_period", m_cycle_status_period, "1.0");
+  bindParameter("filter_enable", m_filter_enable, "1");
+  bindParameter("filter_hand_min_cutoff", m_filter_hand_min_cutoff, "1.0");
+  bindParameter("filter_hand_beta", m_filter_hand_beta, "0.005");
+  bindParameter("filter_joint_min_cutoff", m_filter_joint_min_cutoff, "0.5");
+  bindParameter("filter_joint_beta", m_filter_joint_beta, "0.002");
+  bindParameter("filter_d_cutoff", m_filter_d_cutoff, "1.0");
+  bindParameter("gate_enable", m_gate_enable, "1");
+  bindParameter("gate_max_speed", m_gate_max_speed, "5000.0");
+  bindParameter("gate_max_accel", m_gate_max_accel, "150000.0");
+  bindParameter("gate_max_hold", m_gate_max_hold, "0.2");
+  bindParameter("legacy_ports", m_legacy_ports, "1");
+  bindParameter("skeleton_enable", m_skeleton_enable, "0");
+  bindParameter("skeleton_min_confidence", m_skeleton_min_confidence, "0.3");
+  bindParameter("keep_warm", m_keep_warm, "0");
+  bindParameter("camera_device", m_camera_device, "");
+  bindParameter("track_gate_distance", m_track_gate_distance, "600.0");
+  bindParameter("track_max_missing", m_track_max_missing, "0.5");
+  bindParameter("depth_enable", m_depth_enable, "0");
+  bindParameter("depth_roi", m_depth_roi, "");
+  bindParameter("depth_near_limit", m_depth_near_limit, "300");
+  bindParameter("depth_far_limit", m_depth_far_limit, "4000");
+  bindParameter("depth_pyramid_levels", m_depth_pyramid_levels, "4");
+  bindParameter("depth_publish_level", m_depth_publish_level, "0");
+  bindParameter("depth_background_enable", m_depth_background_enable, "0");
+  bindParameter("depth_background_level", m_depth_background_level, "2");
+  bindParameter("depth_background_learn_time", m_depth_background_learn_time, "5.0");
+  bindParameter("depth_background_margin", m_depth_background_margin, "80");
+  bindParameter("depth_background_deviation_scale", m_depth_background_deviation_scale, "3");
+  bindParameter("robot_dh", m_robot_dh, "");
+  bindParameter("robot_base", m_robot_base, "");
+  bindParameter("robot_link_radius", m_robot_link_radius, "120.0");
+  bindParameter("robot_joint_max_age", m_robot_joint_max_age, "0.2");
+  bindParameter("adapt_levels", m_adapt_levels, "");
+  bindParameter("adapt_budget", m_adapt_budget, "0.025");
+  bindParameter("adapt_headroom", m_adapt_headroom, "0.5");
+  bindParameter("adapt_max_skipped", m_adapt_max_skipped, "0.1");
+  bindParameter("adapt_down_time", m_adapt_down_time, "2.0");
+  bindParameter("adapt_up_time", m_adapt_up_time, "30.0");
+  bindParameter("adapt_min_interval", m_adapt_min_interval, "60.0");
+  bindParameter("pipeline_enable", m_pipeline_enable, "0");
+  bindParameter("pipeline_depth", m_pipeline_depth, "2");
+
+  // 周期処理からは登録済みのメトリクスを更新するだけにする
+  std::string label = std::string("component=\"") + getInstanceName() + "\"";
+  framesReceived = &MetricRegistry::counter("safety_frames_received_total", label, "Frames received by the component");
+  usersTracked = &MetricRegistry::gauge("safety_tracked_persons", label, "Persons in the latest frame");
+  depthLatency = &MetricRegistry::histogram("safety_depth_latency_seconds", label, "Frame arrival to the NearestDepth write");
+  depthBuild = &MetricRegistry::histogram("safety_depth_pyramid_seconds", label, "Time to build the depth pyramid");
+  backgroundTime = &MetricRegistry::histogram("safety_depth_background_seconds", label,
+                                              "Time to learn or compare the depth background");
+  intrusionPixels = &MetricRegistry::gauge("safety_depth_intrusion_pixels", label,
+                                           "Depth pixels closer than the learned background");
+  frameProcessing = &MetricRegistry::histogram("safety_frame_processing_seconds", label,
+                                               "Frame processing time after waitUpdate");
+  qualityLevel = &MetricRegistry::gauge("safety_quality_level", label, "Current adapt_levels level (0: highest quality)");
+  qualityDowns = &MetricRegistry::counter("safety_quality_switches_total", label + ",direction=\"down\"",
+                                          "Nuitrack setting level switches");
+  qualityUps = &MetricRegistry::counter("safety_quality_switches_total", label + ",direction=\"up\"",
+                                        "Nuitrack setting level switches");
+  trackDrops = &MetricRegistry::counter("safety_pipeline_dropped_total", label + ",stage=\"track\"",
+                                        "Frames dropped in front of a pipeline stage");
+  publishDrops = &MetricRegistry::counter("safety_pipeline_dropped_total", label + ",stage=\"publish\"",
+                                          "Frames dropped in front of a pipeline stage");
+  monitor.attach(label);
+  gate.attach(label);
   // </rtc-template>
 
+  threadsBeforeNuitrack = RtProfile::threadIds();
   tdv::nuitrack::Nuitrack::init("");
+  nuitrackState = NUITRACK_INITIALIZED;
+  runningSkeleton = 0;
+  runningDepth = 0;
+  qualitySwitchesDown = 0;
+  qualitySwitchesUp = 0;
+  humanFrame = 0;
+  pipelineRunning = false;
+  pipelineFailed = false;
 
   return RTC::RTC_OK;
 }
@@ -105,6 +414,9 @@ RTC::ReturnCode_t HumanDetection::onInitialize()
 
 RTC::ReturnCode_t HumanDetection::onFinalize()
 {
+  // keep_warm で動かし続けていた Nuitrack はここで解放する
+  stopPipeline();
+  if (nuitrackState != NUITRACK_RELEASED) stopNuitrack();
   return RTC::RTC_OK;
 }
 
@@ -125,87 +437,986 @@ RTC::ReturnCode_t HumanDetection::onShutdown(RTC::UniqueId ec_id)
 
 RTC::ReturnCode_t HumanDetection::onActivated(RTC::UniqueId ec_id)
 {
-  handTracker = tdv::nuitrack::HandTracker::create();
-  handTracker->connectOnUpdate(std::bind(onHandUpdate, std::placeholders::_1));
-  tdv::nuitrack::Nuitrack::run();
+  // adapt_levels が前回と同じなら、下げた段のまま起動する
+  if (!quality.setLevels(m_adapt_levels))
+  {
+    std::printf("Invalid adapt_levels \"%s\": using the Nuitrack defaults\n", m_adapt_levels.c_str());
+  }
+  quality.configure(m_adapt_budget, m_adapt_headroom, m_adapt_max_skipped, m_adapt_down_time, m_adapt_up_time,
+                    m_adapt_min_interval);
+  if (!startNuitrack()) return RTC::RTC_ERROR;
+
+  // 非活性化の間に残った前回の追跡結果は使わない (次の waitUpdate で埋まる)
+  userHands.clear();
+  userSkeletons.clear();
+  depthFrame.reset();
+  configureDepth(true);
+  jointReceived = false;
+  tracker.configure(MAX_USERS, m_track_gate_distance, m_track_max_missing);
+  tracker.reset();
+
+  if (m_rt_lock_memory) RtProfile::lockMemory();
+  RtProfile::setAffinity(0, m_rt_cpus);
+  RtProfile::setScheduling(m_rt_policy, m_rt_priority);
+
+  if (!m_pose_ring.empty() && !poseRing.create(m_pose_ring, m_pose_ring_slots))
+  {
+    std::printf("Cannot create shared memory ring: %s\n", m_pose_ring.c_str());
+  }
+  Trace::dumpOnSignal(m_trace_file);
+
+  // getExecutionContext は複製した参照を返すので _var で解放する
+  RTC::ExecutionContext_var ec = getExecutionContext(ec_id);
+  double rate = CORBA::is_nil(ec) ? 0.0 : ec->get_rate();
+  monitor.configure(rate > 0.0 ? 1.0 / rate : 1.0 / 30.0, m_overrun_budget, m_overrun_window);
+  m_CycleStatus.data.length(CycleMonitor::STATUS_LENGTH);
+
+  // 点の種類ごとのパラメータを設定してから点を割り当てる
+  PointFilterBank::Params hand = { static_cast<float>(m_filter_hand_min_cutoff), static_cast<float>(m_filter_hand_beta) };
+  PointFilterBank::Params joint = { static_cast<float>(m_filter_joint_min_cutoff), static_cast<float>(m_filter_joint_beta) };
+  filters.clear(static_cast<float>(m_filter_d_cutoff));
+  filters.setParams(PointFilterBank::CLASS_HAND, hand);
+  filters.setParams(PointFilterBank::CLASS_JOINT, joint);
+  handSlot = filters.addPoints(PointFilterBank::CLASS_HAND, MAX_USERS * 2);
+  jointSlot = m_skeleton_enable ? filters.addPoints(PointFilterBank::CLASS_JOINT, MAX_USERS * JOINT_NUM) : 0;
+  gate.configure(MAX_USERS * 2, static_cast<float>(m_gate_max_speed),
+                 static_cast<float>(m_gate_max_accel), static_cast<float>(m_gate_max_hold));
+
+  slotsPerUser = 2 + (m_skeleton_enable ? JOINT_NUM : 0);
+  humanFrame = 0;
+  if (m_pipeline_enable)
+  {
+    captured.configure(m_pipeline_depth);
+    tracked.configure(m_pipeline_depth);
+  }
+  allocateOutputs();
+  lastFrame = CycleMonitor::Clock::now();
+  quality.reset(lastFrame);
+  m_QualityStatus.data.length(6);
+  publishQualityStatus();
+  sensorBlind = false;
+  MetricRegistry::startExporter(m_prom_export, m_prom_export_period);
+  if (m_pipeline_enable) startPipeline();
   return RTC::RTC_OK;
 }
 
 
 RTC::ReturnCode_t HumanDetection::onDeactivated(RTC::UniqueId ec_id)
 {
-  tdv::nuitrack::Nuitrack::release();
+  // keep_warm では出力を止めるだけにする。センサと Nuitrack のスレッドは
+  // 動いたままなので、非活性化中もその分の CPU と電力を使う
+  stopPipeline();
+  if (!m_keep_warm) stopNuitrack();
+  poseRing.close();
+  Trace::dump(m_trace_file);
   return RTC::RTC_OK;
 }
 
 
 RTC::ReturnCode_t HumanDetection::onExecute(RTC::UniqueId ec_id)
 {
-  tdv::nuitrack::Nuitrack::waitUpdate(handTracker);
-  
-  // 【修正】手が検出されない場合
-  if(userHands.empty())
+  // 定常周期ではヒープ確保をしない (ENABLE_ALLOC_GUARD ビルドで検査)
+  ALLOC_GUARD_SCOPE("HumanDetection::onExecute");
+  TRACE_SCOPE("HumanDetection::onExecute");
+  CycleMonitor::Scope cycle(monitor);
+
+  // パイプラインでは実行コンテキストのスレッドは出力の段になる
+  if (pipelineRunning) return publishStage();
+
   {
-    // std::printf("No user hands - Sending Safe Data (0,0,0)\n");
-    
-    // 安全を示すために座標に0を入れて送信する
-    m_RightHandPose.pose_q.p3D.x = 0.0;
-    m_RightHandPose.pose_q.p3D.y = 0.0;
-    m_RightHandPose.pose_q.p3D.z = 0.0;
-    m_RightHandPoseOut.write();
+    // Nuitrack 内部 (コールバックでの userHands の更新を含む) の確保は除外する
+    TRACE_SCOPE("Nuitrack::waitUpdate");
+    ALLOC_GUARD_PAUSE();
+    tdv::nuitrack::Nuitrack::waitUpdate(handTracker);
+  }
+  framesReceived->inc();
+  CycleMonitor::Clock::time_point now = CycleMonitor::Clock::now();
+  FrameOutput& out = directOutput;
+  out.arrival = now;
 
-    return RTC::RTC_OK;
+  // 手の追跡を待たずに守れるよう、深度の最近点を最初に出す
+  if (depthSensor && processDepth(depthFrame, now, out))
+  {
+    writeDepth(out);
+    if (m_depth_publish_level > 0) processDepthLevel(out);
+    if (m_depth_background_enable) processBackground(now, out);
+    writeDepth(out);
   }
+  publishCycleStatus(now);
 
-  //In current version, the components just can detect the hand for 1 person
-  // auto cnt = userHands.size();
-  
-  auto rightHand = userHands[0].rightHand;
-  auto leftHand = userHands[0].leftHand;
+  // 全ユーザの手・関節を1つのメッセージにまとめて1回で書く
+  trackUsers(userHands, userSkeletons, now, out.state);
+  writeHumanState(out);
 
-  if (!rightHand)
+  if (quality.levels() > 1 &&
+      !adaptQuality(std::chrono::duration<double>(CycleMonitor::Clock::now() - now).count(), handTimestamp))
   {
-    // 右手が見つからない場合も安全データを送る
-    // std::printf("Right hand not found\n");
-    m_RightHandPose.pose_q.p3D.x = 0.0;
-    m_RightHandPose.pose_q.p3D.y = 0.0;
-    m_RightHandPose.pose_q.p3D.z = 0.0;
-    m_RightHandPoseOut.write();
+    return RTC::RTC_ERROR;
+  }
+  return RTC::RTC_OK;
+}
+
+void HumanDetection::startPipeline()
+{
+  stopPipeline();
+  captured.reset();
+  tracked.reset();
+  pipelineFailed = false;
+  pipelineRunning = true;
+  captureThread = std::thread(&HumanDetection::runCapture, this);
+  trackThread = std::thread(&HumanDetection::runTrack, this);
+}
+
+void HumanDetection::stopPipeline()
+{
+  pipelineRunning = false;
+  captured.close();
+  tracked.close();
+  // 待ちの段は waitUpdate から戻る (次のフレームが来る) まで止まらない
+  if (captureThread.joinable()) captureThread.join();
+  if (trackThread.joinable()) trackThread.join();
+}
+
+void HumanDetection::runCapture()
+{
+  RtProfile::setAffinity(0, m_rt_cpus);
+  RtProfile::setScheduling(m_rt_policy, m_rt_priority);
+  try
+  {
+    while (pipelineRunning)
+    {
+      {
+        TRACE_SCOPE("Nuitrack::waitUpdate");
+        tdv::nuitrack::Nuitrack::waitUpdate(handTracker);
+      }
+      framesReceived->inc();
+
+      // コールバックが置いた結果を要素へ移す。入れ替えるだけでコピーも確保もしない。
+      // 入れ替えで戻ってきた前の要素の中身は古いフレームなので空にしておき、
+      // 次の waitUpdate でコールバックが来なければそのフレームは観測なしになる
+      FrameInput* in = captured.writeSlot();
+      in->arrival = CycleMonitor::Clock::now();
+      in->stamp = handTimestamp;
+      in->hands.swap(userHands);
+      userHands.clear();
+      in->skeletons.swap(userSkeletons);
+      userSkeletons.clear();
+      in->depth = depthFrame;
+      depthFrame.reset();
+      if (!captured.push()) trackDrops->inc();
+    }
+  }
+  catch (const std::exception& e)
+  {
+    std::printf("Capture stage stopped: %s\n", e.what());
+    pipelineFailed = true;
+  }
+  captured.close();
+}
+
+void HumanDetection::runTrack()
+{
+  RtProfile::setAffinity(0, m_rt_cpus);
+  RtProfile::setScheduling(m_rt_policy, m_rt_priority);
+  while (pipelineRunning)
+  {
+    FrameInput* in = captured.pop(PIPELINE_WAIT);
+    if (!in)
+    {
+      if (pipelineFailed) break;
+      continue;
+    }
+
+    // 定常状態ではヒープ確保をしない (ENABLE_ALLOC_GUARD ビルドで検査)
+    ALLOC_GUARD_SCOPE("HumanDetection::runTrack");
+    TRACE_SCOPE("HumanDetection::track");
+    CycleMonitor::Clock::time_point start = CycleMonitor::Clock::now();
+    FrameOutput* out = tracked.writeSlot();
+    // 捨てられた要素の書いていない値は出さない
+    out->nearestReady = out->pyramidReady = out->intrusionReady = false;
+    out->arrival = in->arrival;
+    out->stamp = in->stamp;
+    if (depthSensor && processDepth(in->depth, in->arrival, *out))
+    {
+      if (m_depth_publish_level > 0) processDepthLevel(*out);
+      if (m_depth_background_enable) processBackground(in->arrival, *out);
+    }
+    trackUsers(in->hands, in->skeletons, in->arrival, out->state);
+    out->tracking = std::chrono::duration<double>(CycleMonitor::Clock::now() - start).count();
+    if (!tracked.push()) publishDrops->inc();
+  }
+  tracked.close();
+}
+
+RTC::ReturnCode_t HumanDetection::publishStage()
+{
+  FrameOutput* out;
+  {
+    TRACE_SCOPE("HumanDetection::tracked.pop");
+    out = tracked.pop(PIPELINE_WAIT);
+  }
+  CycleMonitor::Clock::time_point now = CycleMonitor::Clock::now();
+  publishCycleStatus(now);
+  if (!out) return pipelineFailed ? RTC::RTC_ERROR : RTC::RTC_OK;
+
+  writeDepth(*out);
+  writeHumanState(*out);
+
+  // 段の切り替えで待ち行列を作り直す前に要素を返す
+  double processing = std::max(out->tracking, std::chrono::duration<double>(CycleMonitor::Clock::now() - now).count());
+  uint64_t stamp = out->stamp;
+  tracked.release();
+  if (quality.levels() > 1 && !adaptQuality(processing, stamp)) return RTC::RTC_ERROR;
+  return RTC::RTC_OK;
+}
+
+bool HumanDetection::adaptQuality(double processing, uint64_t stamp)
+{
+  CycleMonitor::Clock::time_point now = CycleMonitor::Clock::now();
+  frameProcessing->observe(processing);
+  int level = quality.update(processing, stamp, now);
+  if (level < 0) return true;
+  return switchQuality(level);
+}
+
+bool HumanDetection::switchQuality(int level)
+{
+  const QualityController::Window& w = quality.last();
+  std::printf("Quality level %d -> %d (processing %.1fms, skipped %d of %d frames): %s\n",
+              quality.level(), level, w.processing * 1e3, w.skipped, w.frames + w.skipped,
+              quality.text(level).c_str());
+  if (level > quality.level())
+  {
+    qualitySwitchesDown++;
+    qualityDowns->inc();
   }
   else
   {
-    std::printf("Right hand position: x = %.0f, y = %.0f, z = %.0f\n", rightHand->xReal, rightHand->yReal, rightHand->zReal);
+    qualitySwitchesUp++;
+    qualityUps->inc();
+  }
+  quality.setLevel(level);
 
-    m_RightHandPose.pose_q.p3D.x = rightHand->xReal;
-    m_RightHandPose.pose_q.p3D.y = rightHand->yReal;
-    m_RightHandPose.pose_q.p3D.z = rightHand->zReal;  
+  // 起動し直している間 (1～数秒) は人が見えないので、先に HumanProtection を止めさせる
+  publishSensorStatus(true);
+  {
+    // 設定値は run の前にしか反映されないので、Nuitrack を起動し直す。
+    // パイプラインは waitUpdate の中にいる待ちの段ごと止める
+    TRACE_SCOPE("HumanDetection::switchQuality");
+    ALLOC_GUARD_PAUSE();
+    bool pipelined = pipelineRunning;
+    if (pipelined) stopPipeline();
+    if (!startNuitrack())
+    {
+      std::printf("Cannot restart Nuitrack with quality level %d\n", level);
+      return false;
+    }
+    configureDepth(false);
+    allocateOutputs();
+    userHands.clear();
+    userSkeletons.clear();
+    if (pipelined) startPipeline();
+  }
+  quality.reset(CycleMonitor::Clock::now());
+  publishQualityStatus();
+  return true;
+}
 
-    m_RightHandPoseOut.write();
+void HumanDetection::publishSensorStatus(bool blind)
+{
+  sensorBlind = blind;
+  m_SensorStatus.data = blind ? 1 : 0;
+  setTimestamp(m_SensorStatus);
+  TRACE_SCOPE("HumanDetection::SensorStatus.write");
+  ALLOC_GUARD_PAUSE();
+  m_SensorStatusOut.write();
+}
+
+void HumanDetection::publishQualityStatus()
+{
+  const QualityController::Window& w = quality.last();
+  qualityLevel->set(quality.level());
+  m_QualityStatus.data[0] = quality.level();
+  m_QualityStatus.data[1] = quality.levels();
+  m_QualityStatus.data[2] = w.processing;
+  m_QualityStatus.data[3] = (w.frames + w.skipped > 0) ? static_cast<double>(w.skipped) / (w.frames + w.skipped) : 0.0;
+  m_QualityStatus.data[4] = qualitySwitchesDown;
+  m_QualityStatus.data[5] = qualitySwitchesUp;
+  setTimestamp(m_QualityStatus);
+  TRACE_SCOPE("HumanDetection::QualityStatus.write");
+  ALLOC_GUARD_PAUSE();
+  m_QualityStatusOut.write();
+}
+
+bool HumanDetection::startNuitrack()
+{
+  if (nuitrackState == NUITRACK_RUNNING)
+  {
+    // 動かしたままの Nuitrack をそのまま使う (再活性化は数ミリ秒で済む)
+    if (runningSkeleton == m_skeleton_enable && runningDepth == m_depth_enable &&
+        runningDevice == m_camera_device && runningQuality == quality.current()) return true;
+    // 骨格追跡・深度の最近点の有無か使うセンサか設定の段が変わったらモジュールを作り直す
+    stopNuitrack();
+  }
+  if (nuitrackState == NUITRACK_RELEASED)
+  {
+    threadsBeforeNuitrack = RtProfile::threadIds();
+    tdv::nuitrack::Nuitrack::init("");
+    nuitrackState = NUITRACK_INITIALIZED;
+  }
+  // 別のカメラの座標を別の外部パラメータで使わないよう、見つからなければ起動しない
+  if (!selectDevice()) return false;
+
+  // adapt_levels の今の段の設定値 (init で nuitrack.config の値に戻るので毎回設定する)
+  if (quality.levels() > 0)
+  {
+    const std::vector<QualityController::Setting>& settings = quality.settings(quality.level());
+    for (size_t i = 0; i < settings.size(); i++)
+    {
+      tdv::nuitrack::Nuitrack::setConfigValue(settings[i].key, settings[i].value);
+    }
+  }
 
+  handTracker = tdv::nuitrack::HandTracker::create();
+  handTracker->connectOnUpdate(std::bind(onHandUpdate, std::placeholders::_1));
+  if (m_skeleton_enable)
+  {
+    skeletonTracker = tdv::nuitrack::SkeletonTracker::create();
+    skeletonTracker->connectOnUpdate(std::bind(onSkeletonUpdate, std::placeholders::_1));
   }
+  if (m_depth_enable)
+  {
+    depthSensor = tdv::nuitrack::DepthSensor::create();
+    depthSensor->connectOnNewFrame(std::bind(onDepthUpdate, std::placeholders::_1));
+  }
+  tdv::nuitrack::Nuitrack::run();
+  nuitrackState = NUITRACK_RUNNING;
+  runningSkeleton = m_skeleton_enable;
+  runningDepth = m_depth_enable;
+  runningDevice = m_camera_device;
+  runningQuality = quality.current();
+
+  // Nuitrack のワーカースレッドと実行コンテキストのスレッドを別の CPU に分ける
+  std::vector<pid_t> exclude = threadsBeforeNuitrack;
+  exclude.push_back(static_cast<pid_t>(syscall(SYS_gettid)));
+  std::sort(exclude.begin(), exclude.end());
+  RtProfile::setAffinityOfNewThreads(exclude, m_nuitrack_cpus);
+  return true;
+}
 
-  if (!leftHand)
+bool HumanDetection::selectDevice()
+{
+  if (m_camera_device.empty()) return true;
+
+  std::vector<tdv::nuitrack::device::NuitrackDevice::Ptr> devices = tdv::nuitrack::Nuitrack::getDeviceList();
+  char* end = NULL;
+  long index = std::strtol(m_camera_device.c_str(), &end, 10);
+  for (size_t i = 0; i < devices.size(); i++)
+  {
+    std::string serial = devices[i]->getInfo(tdv::nuitrack::device::DeviceInfoType::SERIAL_NUMBER);
+    if ((*end == '\0' && static_cast<long>(i) == index) || serial == m_camera_device)
+    {
+      std::printf("Using sensor %zu (serial %s)\n", i, serial.c_str());
+      tdv::nuitrack::Nuitrack::setDevice(devices[i]);
+      return true;
+    }
+  }
+  std::printf("Sensor not found: camera_device=%s (%zu sensors connected)\n",
+              m_camera_device.c_str(), devices.size());
+  return false;
+}
+
+void HumanDetection::stopNuitrack()
+{
+  tdv::nuitrack::Nuitrack::release();
+  handTracker.reset();
+  skeletonTracker.reset();
+  depthSensor.reset();
+  depthFrame.reset();
+  depthFrameInUse.reset();
+  nuitrackState = NUITRACK_RELEASED;
+}
+
+void HumanDetection::configureDepth(bool relearn)
+{
+  if (!depthSensor) return;
+
+  // ピラミッドと DepthPyramid の配列はセンサの解像度でここで確保する
+  tdv::nuitrack::OutputMode mode = depthSensor->getOutputMode();
+  if (!depthPyramid.configure(m_depth_roi, m_depth_pyramid_levels, m_depth_near_limit, m_depth_far_limit,
+                              mode.xres, mode.yres))
+  {
+    std::printf("Invalid depth_roi \"%s\": using the whole depth image\n", m_depth_roi.c_str());
+  }
+
+  // 背景は活性化のたびと、段の切り替えで段の大きさが変わったときに学び直す
+  backgroundLevel = std::max(1, std::min(m_depth_background_level, depthPyramid.levels() - 1));
+  const DepthPyramid::Level& lv = depthPyramid.level(backgroundLevel);
+  if (relearn || lv.cols != background.cols() || lv.rows != background.rows())
+  {
+    background.configure(lv.cols, lv.rows, m_depth_background_margin, m_depth_background_deviation_scale, 4);
+    backgroundStarted = false;
+    backgroundLearning = true;
+  }
+  if (!robotSilhouette.configure(m_robot_dh, m_robot_base, m_robot_link_radius))
+  {
+    std::printf("Invalid robot_dh \"%s\" or robot_base \"%s\": the arm is not masked\n",
+                m_robot_dh.c_str(), m_robot_base.c_str());
+  }
+  // 内部パラメータは水平画角から求める
+  float f = (mode.hfov > 0.0f) ? 0.5f * mode.xres / std::tan(0.5f * mode.hfov) : 0.0f;
+  robotSilhouette.setProjection(f, f, 0.5f * mode.xres, 0.5f * mode.yres);
+
+  // 画素からカメラ座標への変換は画像の両端の2点をセンサに変換させて写し取る
+  const int depth = 1000;
+  tdv::nuitrack::Vector3 p0 = depthSensor->convertProjToRealCoords(0, 0, depth);
+  tdv::nuitrack::Vector3 p1 = depthSensor->convertProjToRealCoords(mode.xres, mode.yres, depth);
+  depthToRealCoeffs[0] = (mode.xres > 0) ? (p1.x - p0.x) / (mode.xres * depth) : 0.0f;
+  depthToRealCoeffs[1] = p0.x / depth;
+  depthToRealCoeffs[2] = (mode.yres > 0) ? (p1.y - p0.y) / (mode.yres * depth) : 0.0f;
+  depthToRealCoeffs[3] = p0.y / depth;
+}
+
+void HumanDetection::depthToReal(int col, int row, uint16_t depth, RTC::Point3D& p) const
+{
+  p.x = (depthToRealCoeffs[0] * col + depthToRealCoeffs[1]) * depth;
+  p.y = (depthToRealCoeffs[2] * row + depthToRealCoeffs[3]) * depth;
+  p.z = depth;
+}
+
+void HumanDetection::allocateOutputs()
+{
+  allocateOutput(directOutput);
+  for (size_t i = 0; i < tracked.size(); i++) allocateOutput(tracked.slot(i));
+  m_HandPoints.points.length(MAX_USERS * 2);
+  m_HandPoints.confidence.length(MAX_USERS * 2);
+}
+
+void HumanDetection::allocateOutput(FrameOutput& out)
+{
+  // HumanState の各配列はここでだけ確保し、周期処理では値を書き換えるだけにする
+  CORBA::ULong n = MAX_USERS * slotsPerUser;
+  out.state.frame = 0;
+  out.state.max_users = MAX_USERS;
+  out.state.slots_per_user = static_cast<CORBA::UShort>(slotsPerUser);
+  out.state.user_id.length(MAX_USERS);
+  out.state.presence.length((n + 31) / 32);
+  out.state.points.length(n);
+  out.state.confidence.length(n);
+  out.state.gate.length(n);
+  out.nearest.points.length(1);
+  out.nearest.confidence.length(1);
+  out.nearest.confidence[0] = 1.0f;
+  out.nearestReady = out.pyramidReady = out.intrusionReady = false;
+  out.stamp = 0;
+  out.tracking = 0.0;
+  if (!depthSensor) return;
+
+  // DepthPyramid と Intrusion の配列はセンサの解像度で確保する
+  int level = std::min(m_depth_publish_level, depthPyramid.levels() - 1);
+  if (level > 0)
+  {
+    const DepthPyramid::Level& lv = depthPyramid.level(level);
+    out.pyramid.data.length(5 + lv.cols * lv.rows);
+  }
+  out.intrusion.data.length(5);
+}
+
+void HumanDetection::writeDepth(FrameOutput& out)
+{
+  if (out.nearestReady)
+  {
+    {
+      TRACE_SCOPE("HumanDetection::NearestDepth.write");
+      ALLOC_GUARD_PAUSE();
+      m_NearestDepthOut.write(out.nearest);
+    }
+    depthLatency->observe(std::chrono::duration<double>(CycleMonitor::Clock::now() - out.arrival).count());
+    out.nearestReady = false;
+  }
+  if (out.pyramidReady)
+  {
+    TRACE_SCOPE("HumanDetection::DepthPyramid.write");
+    ALLOC_GUARD_PAUSE();
+    m_DepthPyramidOut.write(out.pyramid);
+    out.pyramidReady = false;
+  }
+  if (out.intrusionReady)
+  {
+    TRACE_SCOPE("HumanDetection::Intrusion.write");
+    ALLOC_GUARD_PAUSE();
+    m_IntrusionOut.write(out.intrusion);
+    out.intrusionReady = false;
+  }
+}
+
+void HumanDetection::writeHumanState(FrameOutput& out)
+{
+  {
+    TRACE_SCOPE("HumanDetection::HumanState.write");
+    ALLOC_GUARD_PAUSE();
+    m_HumanStateOut.write(out.state);
+  }
+  if (sensorBlind) publishSensorStatus(false);
+  if (m_legacy_ports || poseRing.isOpen()) writeLegacyHands(out.state);
+}
+
+bool HumanDetection::processDepth(tdv::nuitrack::DepthFrame::Ptr& frame, CycleMonitor::Clock::time_point arrival,
+                                  FrameOutput& out)
+{
+  TRACE_SCOPE("HumanDetection::processDepth");
+  // 同じフレームは一度だけ処理する。センサのバッファは次のフレームまでこれで保持する
+  if (!frame) return false;
+  depthFrameInUse.reset();
+  depthFrameInUse.swap(frame);
+
+  {
+    TRACE_SCOPE("DepthPyramid::build");
+    CycleMonitor::Clock::time_point start = CycleMonitor::Clock::now();
+    depthPyramid.build(depthFrameInUse->getData(), depthFrameInUse->getCols(), depthFrameInUse->getRows());
+    depthBuild->observe(std::chrono::duration<double>(CycleMonitor::Clock::now() - start).count());
+  }
+
+  DepthPyramid::Nearest r = depthPyramid.nearest();
+  // 範囲内の画素がなければ presence を落とすだけで、点の値は意味を持たない
+  out.nearest.presence = r.found ? 1 : 0;
+  if (r.found) depthToReal(r.col, r.row, r.depth, out.nearest.points[0]);
+  setTimestamp(out.nearest);
+  out.nearestReady = true;
+  return true;
+}
+
+void HumanDetection::processDepthLevel(FrameOutput& out)
+{
+  int level = std::min(m_depth_publish_level, depthPyramid.levels() - 1);
+  const DepthPyramid::Level& lv = depthPyramid.level(level);
+  CORBA::ULong n = 5 + lv.cols * lv.rows;
+  if (out.pyramid.data.length() != n) return;  // 活性化後に段を変えたら次の活性化から
+
+  out.pyramid.data[0] = static_cast<CORBA::UShort>(level);
+  out.pyramid.data[1] = static_cast<CORBA::UShort>(lv.cols);
+  out.pyramid.data[2] = static_cast<CORBA::UShort>(lv.rows);
+  out.pyramid.data[3] = static_cast<CORBA::UShort>(depthPyramid.roiX());
+  out.pyramid.data[4] = static_cast<CORBA::UShort>(depthPyramid.roiY());
+  CORBA::UShort* data = out.pyramid.data.get_buffer() + 5;
+  for (int y = 0; y < lv.rows; y++)
+  {
+    std::copy(lv.data + y * lv.stride, lv.data + y * lv.stride + lv.cols, data + y * lv.cols);
+  }
+  out.pyramid.tm = out.nearest.tm;
+  out.pyramidReady = true;
+}
+
+void HumanDetection::processBackground(CycleMonitor::Clock::time_point arrival, FrameOutput& out)
+{
+  TRACE_SCOPE("HumanDetection::processBackground");
+  CycleMonitor::Clock::time_point start = CycleMonitor::Clock::now();
+  drawRobot(start);
+
+  // 学習の時間は最初のフレームから数える
+  if (!backgroundStarted)
+  {
+    backgroundStarted = true;
+    backgroundLearnEnd = arrival + std::chrono::duration_cast<CycleMonitor::Clock::duration>(
+                                     std::chrono::duration<double>(m_depth_background_learn_time));
+  }
+  bool learning = arrival < backgroundLearnEnd;
+
+  const DepthPyramid::Level& lv = depthPyramid.level(backgroundLevel);
+  DepthBackground::Intrusion r;
+  r.pixels = 0;
+  r.found = false;
+  if (learning)
+  {
+    TRACE_SCOPE("DepthBackground::learn");
+    background.learn(lv);
+  }
+  else
+  {
+    TRACE_SCOPE("DepthBackground::compare");
+    r = background.compare(lv);
+  }
+  backgroundTime->observe(std::chrono::duration<double>(CycleMonitor::Clock::now() - start).count());
+  intrusionPixels->set(r.pixels);
+
+  if (backgroundLearning && !learning)
+  {
+    std::printf("Depth background learned (%d of %d pixels never seen)\n",
+                background.unlearned(), lv.cols * lv.rows);
+  }
+  backgroundLearning = learning;
+
+  out.intrusion.data[0] = learning ? 0.0 : 1.0;
+  out.intrusion.data[1] = r.pixels;
+  out.intrusion.data[2] = 0.0;
+  out.intrusion.data[3] = 0.0;
+  out.intrusion.data[4] = 0.0;
+  if (r.found)
+  {
+    // 段の画素が覆う範囲で、同じ深度を持つ元の画素の位置に直す
+    DepthPyramid::Nearest n = depthPyramid.locate(backgroundLevel, r.x, r.y);
+    if (n.found)
+    {
+      RTC::Point3D p;
+      depthToReal(n.col, n.row, n.depth, p);
+      out.intrusion.data[2] = p.x;
+      out.intrusion.data[3] = p.y;
+      out.intrusion.data[4] = p.z;
+    }
+  }
+  out.intrusion.tm = out.nearest.tm;
+  out.intrusionReady = true;
+}
+
+void HumanDetection::drawRobot(CycleMonitor::Clock::time_point now)
+{
+  if (m_JointStateIn.isNew())
+  {
+    {
+      TRACE_SCOPE("HumanDetection::JointState.read");
+      ALLOC_GUARD_PAUSE();
+      m_JointStateIn.read();
+    }
+    // 関節の数が DH パラメータに足りないものは使わない
+    int n = robotSilhouette.joints();
+    if (n > 0 && static_cast<int>(m_JointState.data.length()) >= n)
+    {
+      for (int i = 0; i < n; i++) jointAngles[i] = m_JointState.data[i];
+      jointReceived = true;
+      jointTime = now;
+    }
+  }
+
+  // 関節角が古ければアームは除かない (アームも侵入として数えられる側に倒す)
+  if (!jointReceived || std::chrono::duration<double>(now - jointTime).count() > m_robot_joint_max_age)
+  {
+    background.clearRobot();
+    return;
+  }
+  TRACE_SCOPE("RobotSilhouette::render");
+  robotSilhouette.render(jointAngles, background.robot(), background.cols(), background.rows(),
+                         backgroundLevel, depthPyramid.roiX(), depthPyramid.roiY());
+}
+
+void HumanDetection::publishCycleStatus(CycleMonitor::Clock::time_point now)
+{
+  if (!monitor.statusDue(now, m_cycle_status_period)) return;
+
+  CycleMonitor::Status s = monitor.status();
+  if (s.over_budget)
+  {
+    std::printf("Cycle overrun budget exceeded: %llu overruns (exec max %.3fms)\n",
+                static_cast<unsigned long long>(s.overruns), s.exec_max * 1e3);
+  }
+
+  double values[CycleMonitor::STATUS_LENGTH];
+  CycleMonitor::toArray(s, values);
+  for (int i = 0; i < CycleMonitor::STATUS_LENGTH; i++) m_CycleStatus.data[i] = values[i];
+  setTimestamp(m_CycleStatus);
+  {
+    TRACE_SCOPE("HumanDetection::CycleStatus.write");
+    ALLOC_GUARD_PAUSE();
+    m_CycleStatusOut.write();
+  }
+  if (quality.levels() > 1) publishQualityStatus();
+}
+
+bool HumanDetection::isPresent(const RTC::TimedHumanState& state, int index)
+{
+  return (state.presence[index / 32] >> (index % 32)) & 1u;
+}
+
+void HumanDetection::setPoint(RTC::TimedHumanState& state, int index, bool present, float x, float y, float z,
+                              float confidence, int gate_state)
+{
+  if (present) state.presence[index / 32] |= 1u << (index % 32);
+  state.points[index].x = x;
+  state.points[index].y = y;
+  state.points[index].z = z;
+  state.confidence[index] = confidence;
+  state.gate[index] = static_cast<CORBA::Octet>(gate_state);
+}
+
+void HumanDetection::trackUsers(const std::vector<tdv::nuitrack::UserHands>& hands,
+                                const std::vector<tdv::nuitrack::Skeleton>& skeletons,
+                                CycleMonitor::Clock::time_point now, RTC::TimedHumanState& state)
+{
+  TRACE_SCOPE("HumanDetection::trackUsers");
+  float dt = std::chrono::duration<float>(now - lastFrame).count();
+  lastFrame = now;
+
+  // 取得時刻を付けておき、下流で安全系の遅延を計れるようにする
+  setTimestamp(state);
+  state.frame = ++humanFrame;
+  for (CORBA::ULong w = 0; w < state.presence.length(); w++) state.presence[w] = 0;
+  for (int u = 0; u < MAX_USERS; u++) state.user_id[u] = -1;
+
+  // ユーザ番号は追跡の枠。user_id には Nuitrack の ID ではなく追跡の ID を入れる
+  associateUsers(hands, skeletons, std::chrono::duration<double>(now.time_since_epoch()).count(), state);
+  for (int u = 0; u < MAX_USERS; u++)
+  {
+    if (userHand[u] < 0) continue;
+    const tdv::nuitrack::Hand::Ptr& right = hands[userHand[u]].rightHand;
+    const tdv::nuitrack::Hand::Ptr& left = hands[userHand[u]].leftHand;
+    int i = u * 2;
+    if (right) gate.set(i, right->xReal, right->yReal, right->zReal);
+    if (left) gate.set(i + 1, left->xReal, left->yReal, left->zReal);
+  }
+
+  // 棄却された観測の代わりに直前の推定を平滑化へ渡す。棄却しない設定では
+  // 観測値をそのまま採用する
+  if (m_gate_enable)
+  {
+    gate.update(dt);
+  }
+  for (int i = 0; i < MAX_USERS * 2; i++)
+  {
+    PointGate::State gate_state = PointGate::STATE_LOST;
+    float confidence = 0.0f;
+    float x = 0.0f, y = 0.0f, z = 0.0f;
+    int u = i / 2;
+    if (m_gate_enable)
+    {
+      gate_state = gate.state(i);
+      confidence = gate.confidence(i);
+      if (gate_state != PointGate::STATE_LOST) gate.get(i, x, y, z);
+    }
+    else if (userHand[u] >= 0)
+    {
+      const tdv::nuitrack::UserHands& user = hands[userHand[u]];
+      const tdv::nuitrack::Hand::Ptr& hand = (i % 2 == 0) ? user.rightHand : user.leftHand;
+      if (hand)
+      {
+        gate_state = PointGate::STATE_ACCEPTED;
+        confidence = 1.0f;
+        x = hand->xReal;
+        y = hand->yReal;
+        z = hand->zReal;
+      }
+    }
+    bool present = (gate_state != PointGate::STATE_LOST);
+    if (m_filter_enable && present) filters.set(handSlot + i, x, y, z);
+    setPoint(state, u * slotsPerUser + i % 2, present, x, y, z, confidence, gate_state);
+  }
+
+  if (m_skeleton_enable)
+  {
+    for (int u = 0; u < MAX_USERS; u++)
+    {
+      if (userSkeleton[u] < 0) continue;
+      const tdv::nuitrack::Skeleton& skeleton = skeletons[userSkeleton[u]];
+      int joints = std::min(static_cast<int>(skeleton.joints.size()), JOINT_NUM);
+      for (int j = 0; j < joints; j++)
+      {
+        const tdv::nuitrack::Joint& joint = skeleton.joints[j];
+        bool present = joint.confidence >= m_skeleton_min_confidence;
+        if (m_filter_enable && present) filters.set(jointSlot + u * JOINT_NUM + j, joint.real.x, joint.real.y, joint.real.z);
+        setPoint(state, u * slotsPerUser + 2 + j, present, joint.real.x, joint.real.y, joint.real.z, joint.confidence,
+                 present ? PointGate::STATE_ACCEPTED : PointGate::STATE_LOST);
+      }
+    }
+  }
+
+  // 観測されなかった点 (見失った手・いなくなったユーザ) は次の観測から始め直す
+  if (!m_filter_enable) return;
+  filters.update(dt);
+  for (int u = 0; u < MAX_USERS; u++)
+  {
+    for (int slot = 0; slot < slotsPerUser; slot++)
+    {
+      int index = u * slotsPerUser + slot;
+      if (!isPresent(state, index)) continue;
+      int f = (slot < 2) ? handSlot + u * 2 + slot : jointSlot + u * JOINT_NUM + slot - 2;
+      float x, y, z;
+      filters.get(f, x, y, z);
+      state.points[index].x = x;
+      state.points[index].y = y;
+      state.points[index].z = z;
+    }
+  }
+}
+
+void HumanDetection::associateUsers(const std::vector<tdv::nuitrack::UserHands>& hands,
+                                    const std::vector<tdv::nuitrack::Skeleton>& skeletons, double t,
+                                    RTC::TimedHumanState& state)
+{
+  TRACE_SCOPE("HumanDetection::associateUsers");
+
+  // Nuitrack のユーザ ID ごとに、見えている手と関節の重心を1つの検出にする
+  int n = 0;
+  for (size_t k = 0; k < hands.size(); k++)
+  {
+    const tdv::nuitrack::UserHands& user = hands[k];
+    int i = findDetection(user.userId, n);
+    if (i < 0) continue;
+    detectionHand[i] = static_cast<int>(k);
+    if (user.rightHand) addToDetection(i, user.rightHand->xReal, user.rightHand->yReal, user.rightHand->zReal);
+    if (user.leftHand) addToDetection(i, user.leftHand->xReal, user.leftHand->yReal, user.leftHand->zReal);
+  }
+  for (size_t k = 0; m_skeleton_enable && k < skeletons.size(); k++)
+  {
+    const tdv::nuitrack::Skeleton& skeleton = skeletons[k];
+    int i = findDetection(skeleton.id, n);
+    if (i < 0) continue;
+    detectionSkeleton[i] = static_cast<int>(k);
+    for (size_t j = 0; j < skeleton.joints.size(); j++)
+    {
+      const tdv::nuitrack::Joint& joint = skeleton.joints[j];
+      if (joint.confidence >= m_skeleton_min_confidence) addToDetection(i, joint.real.x, joint.real.y, joint.real.z);
+    }
+  }
+
+  // 点のないユーザは追跡しない
+  int m = 0;
+  for (int i = 0; i < n; i++)
+  {
+    if (detectionPoints[i] == 0) continue;
+    PersonTracker::Detection& d = detections[m];
+    d = detections[i];
+    d.x /= detectionPoints[i];
+    d.y /= detectionPoints[i];
+    d.z /= detectionPoints[i];
+    detectionHand[m] = detectionHand[i];
+    detectionSkeleton[m] = detectionSkeleton[i];
+    m++;
+  }
+  tracker.update(detections, m, t, detectionTrack);
+
+  for (int u = 0; u < MAX_USERS; u++)
+  {
+    userHand[u] = -1;
+    userSkeleton[u] = -1;
+  }
+  for (int i = 0; i < m; i++)
+  {
+    int u = detectionTrack[i];
+    if (u < 0) continue;
+    userHand[u] = detectionHand[i];
+    userSkeleton[u] = detectionSkeleton[i];
+    state.user_id[u] = tracker.id(u);
+
+    // 枠が別の人に渡ったら、前の人の推定から棄却・平滑化しない
+    if (!tracker.created(u)) continue;
+    for (int h = 0; h < 2; h++)
+    {
+      gate.reset(u * 2 + h);
+      filters.reset(handSlot + u * 2 + h);
+    }
+    for (int j = 0; m_skeleton_enable && j < JOINT_NUM; j++) filters.reset(jointSlot + u * JOINT_NUM + j);
+  }
+  usersTracked->set(m);
+}
+
+int HumanDetection::findDetection(long id, int& n)
+{
+  for (int i = 0; i < n; i++)
+  {
+    if (detections[i].hint == id) return i;
+  }
+  if (n >= PersonTracker::MAX_TRACKS) return -1;
+
+  PersonTracker::Detection& d = detections[n];
+  d.x = d.y = d.z = 0.0f;
+  d.hint = id;
+  detectionPoints[n] = 0;
+  detectionHand[n] = -1;
+  detectionSkeleton[n] = -1;
+  return n++;
+}
+
+void HumanDetection::addToDetection(int i, float x, float y, float z)
+{
+  detections[i].x += x;
+  detections[i].y += y;
+  detections[i].z += z;
+  detectionPoints[i]++;
+}
+
+int HumanDetection::nearestHand(const RTC::TimedHumanState& state, int hand) const
+{
+  // 追跡の枠は人が来た順に埋まらないので、全ユーザから探す
+  int best = -1;
+  for (int u = 0; u < MAX_USERS; u++)
+  {
+    int index = u * slotsPerUser + hand;
+    if (!isPresent(state, index)) continue;
+    if (best < 0 || state.points[index].z < state.points[best].z) best = index;
+  }
+  return best;
+}
+
+void HumanDetection::writeLegacyHands(const RTC::TimedHumanState& state)
+{
+  // 従来の形式では (0,0,0) で「手がない」(安全) を表す
+  m_RightHandPose.tm = state.tm;
+  m_LeftHandPose.tm = state.tm;
+
+  int right = nearestHand(state, 0);
+  if (right < 0)
+  {
+    m_RightHandPose.pose_q.p3D.x = 0.0;
+    m_RightHandPose.pose_q.p3D.y = 0.0;
+    m_RightHandPose.pose_q.p3D.z = 0.0;
+  }
+  else
+  {
+    m_RightHandPose.pose_q.p3D = state.points[right];
+    std::printf("Right hand position: x = %.0f, y = %.0f, z = %.0f\n",
+                m_RightHandPose.pose_q.p3D.x, m_RightHandPose.pose_q.p3D.y, m_RightHandPose.pose_q.p3D.z);
+  }
+  writeRightHand();
+
+  if (!m_legacy_ports) return;
+  int left = nearestHand(state, 1);
+  if (left < 0)
   {
-    // 左手は今回は使わないが念の為
-    // No left hand
-    // std::printf("Left hand of the first user is not found\n");
     m_LeftHandPose.pose_q.p3D.x = 0.0;
     m_LeftHandPose.pose_q.p3D.y = 0.0;
-    m_LeftHandPose.pose_q.p3D.z = 0.0; 
-    m_LeftHandPoseOut.write();
+    m_LeftHandPose.pose_q.p3D.z = 0.0;
   }
   else
   {
-    // std::printf("Light hand position: x = %.0f, y = %.0f, z = %.0f\n", leftHand->xReal, leftHand->yReal, leftHand->zReal);
+    m_LeftHandPose.pose_q.p3D = state.points[left];
+  }
+  {
+    TRACE_SCOPE("HumanDetection::LeftHandPose.write");
+    ALLOC_GUARD_PAUSE();
+    m_LeftHandPoseOut.write();
+  }
 
-    m_LeftHandPose.pose_q.p3D.x = leftHand->xReal;
-    m_LeftHandPose.pose_q.p3D.y = leftHand->yReal;
-    m_LeftHandPose.pose_q.p3D.z = leftHand->zReal; 
+  // HandPoints は HumanState の手のスロットだけを抜き出したもの
+  CORBA::ULong presence = 0;
+  for (int i = 0; i < MAX_USERS * 2; i++)
+  {
+    int index = (i / 2) * slotsPerUser + i % 2;
+    m_HandPoints.points[i] = state.points[index];
+    m_HandPoints.confidence[i] = state.confidence[index];
+    if (isPresent(state, index)) presence |= 1u << i;
+  }
+  m_HandPoints.tm = state.tm;
+  m_HandPoints.presence = presence;
+  TRACE_SCOPE("HumanDetection::HandPoints.write");
+  ALLOC_GUARD_PAUSE();
+  m_HandPointsOut.write();
+}
 
-    m_LeftHandPoseOut.write();
+void HumanDetection::writeRightHand()
+{
+  if (m_legacy_ports)
+  {
+    TRACE_SCOPE("HumanDetection::RightHandPose.write");
+    ALLOC_GUARD_PAUSE();
+    m_RightHandPoseOut.write();
   }
 
-  return RTC::RTC_OK;
+  // 共有メモリ上のスロットへ直接書き込む
+  if (poseRing.isOpen())
+  {
+    TRACE_SCOPE("HumanDetection::pose_ring.write");
+    PoseRecord* rec = poseRing.beginWrite();
+    toRecord(m_RightHandPose, *rec);
+    poseRing.commit();
+  }
 }
 
 extern "C"
@@ -0,0 +1,140 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  PointFilterBank.cpp
+ * @brief One Euro filter bank for tracked points of HumanDetection
+ * @date $Date$
+ *
+ * $Id$
+ */
+
+#include "PointFilterBank.h"
+
+#include <cmath>
+
+static const float TWO_PI = 6.2831853f;
+
+PointFilterBank::PointFilterBank()
+  : m_points(0), m_d_cutoff(1.0f)
+{
+  for (int c = 0; c < CLASS_NUM; c++)
+  {
+    m_params[c].min_cutoff = 1.0f;
+    m_params[c].beta = 0.0f;
+  }
+}
+
+void PointFilterBank::clear(float d_cutoff)
+{
+  m_points = 0;
+  m_d_cutoff = d_cutoff;
+  m_raw.clear();
+  m_value.clear();
+  m_deriv.clear();
+  m_min_cutoff.clear();
+  m_beta.clear();
+  m_seen.clear();
+  m_fresh.clear();
+  m_class.clear();
+}
+
+int PointFilterBank::addPoints(PointClass c, int n)
+{
+  int first = m_points;
+  m_points += n;
+
+  size_t lanes = static_cast<size_t>(m_points) * AXES;
+  m_raw.resize(lanes, 0.0f);
+  m_value.resize(lanes, 0.0f);
+  m_deriv.resize(lanes, 0.0f);
+  m_min_cutoff.resize(lanes, m_params[c].min_cutoff);
+  m_beta.resize(lanes, m_params[c].beta);
+  m_seen.resize(lanes, 0.0f);
+  m_fresh.resize(lanes, 1.0f);
+  m_class.resize(m_points, c);
+  return first;
+}
+
+void PointFilterBank::setParams(PointClass c, const Params& p)
+{
+  m_params[c] = p;
+  for (int i = 0; i < m_points; i++)
+  {
+    if (m_class[i] != c) continue;
+    for (int k = 0; k < AXES; k++)
+    {
+      m_min_cutoff[i * AXES + k] = p.min_cutoff;
+      m_beta[i * AXES + k] = p.beta;
+    }
+  }
+}
+
+void PointFilterBank::set(int i, float x, float y, float z)
+{
+  float* raw = &m_raw[i * AXES];
+  raw[0] = x;
+  raw[1] = y;
+  raw[2] = z;
+  float* seen = &m_seen[i * AXES];
+  seen[0] = seen[1] = seen[2] = 1.0f;
+}
+
+void PointFilterBank::reset(int i)
+{
+  float* fresh = &m_fresh[i * AXES];
+  fresh[0] = fresh[1] = fresh[2] = 1.0f;
+}
+
+// 全レーンを同じ命令列で処理する。観測の有無・初回かどうかは 0/1 の係数で
+// 混ぜて分岐をなくす。restrict はメンバの vector から取ったポインタでは
+// 効かないことがあるので、引数で受けてベクトル化させる
+static void filterLanes(int lanes, float dt, float d_cutoff,
+                        const float* __restrict raw,
+                        float* __restrict value,
+                        float* __restrict deriv,
+                        const float* __restrict min_cutoff,
+                        const float* __restrict beta,
+                        float* __restrict seen,
+                        float* __restrict fresh)
+{
+  const float rate = 1.0f / dt;
+  const float wd = TWO_PI * d_cutoff * dt;
+  const float alpha_d = wd / (wd + 1.0f);
+
+  for (int i = 0; i < lanes; i++)
+  {
+    float f = fresh[i];
+    float s = seen[i];
+
+    float d = deriv[i] + alpha_d * ((raw[i] - value[i]) * rate - deriv[i]);
+    float cutoff = min_cutoff[i] + beta[i] * std::fabs(d);
+    float w = TWO_PI * cutoff * dt;
+    float v = value[i] + (w / (w + 1.0f)) * (raw[i] - value[i]);
+
+    // 初回は観測値をそのまま使い、速度は 0 から始める
+    v += f * (raw[i] - v);
+    d -= f * d;
+
+    // 観測されなかったレーンは値を残し、次の観測で初期化する
+    value[i] += s * (v - value[i]);
+    deriv[i] += s * (d - deriv[i]);
+    fresh[i] = 1.0f - s;
+    seen[i] = 0.0f;
+  }
+}
+
+void PointFilterBank::update(float dt)
+{
+  if (m_points == 0) return;
+  if (!(dt > 0.0f)) dt = 1e-3f;
+
+  filterLanes(m_points * AXES, dt, m_d_cutoff, &m_raw[0], &m_value[0], &m_deriv[0],
+              &m_min_cutoff[0], &m_beta[0], &m_seen[0], &m_fresh[0]);
+}
+
+void PointFilterBank::get(int i, float& x, float& y, float& z) const
+{
+  const float* value = &m_value[i * AXES];
+  x = value[0];
+  y = value[1];
+  z = value[2];
+}
@@ -0,0 +1,152 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  PointGate.cpp
+ * @brief Velocity / acceleration gating of tracked points for HumanDetection
+ * @date $Date$
+ *
+ * $Id$
+ */
+
+#include "PointGate.h"
+
+PointGate::PointGate()
+  : m_points(0), m_max_speed2(0.0f), m_max_accel2(0.0f), m_max_hold(0.0f),
+    m_speed_rejects(NULL), m_accel_rejects(NULL), m_hold_expired(NULL)
+{
+}
+
+void PointGate::attach(const std::string& label)
+{
+  m_speed_rejects = &MetricRegistry::counter("safety_gate_rejects_total", label + ",reason=\"speed\"",
+                                             "Tracked point samples rejected by the gate");
+  m_accel_rejects = &MetricRegistry::counter("safety_gate_rejects_total", label + ",reason=\"accel\"",
+                                             "Tracked point samples rejected by the gate");
+  m_hold_expired = &MetricRegistry::counter("safety_gate_hold_expired_total", label,
+                                            "Rejected points re-accepted after max_hold");
+}
+
+void PointGate::configure(int points, float max_speed, float max_accel, float max_hold)
+{
+  m_points = points;
+  m_max_speed2 = max_speed * max_speed;
+  m_max_accel2 = max_accel * max_accel;
+  m_max_hold = max_hold;
+
+  m_raw.assign(points * AXES, 0.0f);
+  m_pos.assign(points * AXES, 0.0f);
+  m_vel.assign(points * AXES, 0.0f);
+  m_held.assign(points, 0.0f);
+  m_seen.assign(points, 0);
+  m_state.assign(points, STATE_LOST);
+}
+
+void PointGate::set(int i, float x, float y, float z)
+{
+  float* raw = &m_raw[i * AXES];
+  raw[0] = x;
+  raw[1] = y;
+  raw[2] = z;
+  m_seen[i] = 1;
+}
+
+void PointGate::reset(int i)
+{
+  m_held[i] = 0.0f;
+  m_state[i] = STATE_LOST;
+}
+
+void PointGate::update(float dt)
+{
+  if (!(dt > 0.0f)) dt = 1e-3f;
+
+  uint64_t speed_rejects = 0, accel_rejects = 0, hold_expired = 0;
+  for (int i = 0; i < m_points; i++)
+  {
+    float* raw = &m_raw[i * AXES];
+    float* pos = &m_pos[i * AXES];
+    float* vel = &m_vel[i * AXES];
+
+    if (!m_seen[i])
+    {
+      m_state[i] = STATE_LOST;
+      continue;
+    }
+    m_seen[i] = 0;
+
+    bool accept = true;
+    float v[AXES];
+    if (m_state[i] != STATE_LOST)
+    {
+      // 保持中は前回採用した観測からの経過時間で速度を求める
+      float rate = 1.0f / (m_held[i] + dt);
+      float speed2 = 0.0f, accel2 = 0.0f;
+      for (int k = 0; k < AXES; k++)
+      {
+        v[k] = (raw[k] - pos[k]) * rate;
+        float a = (v[k] - vel[k]) * rate;
+        speed2 += v[k] * v[k];
+        accel2 += a * a;
+      }
+      if (speed2 > m_max_speed2)
+      {
+        accept = false;
+        speed_rejects++;
+      }
+      else if (accel2 > m_max_accel2)
+      {
+        accept = false;
+        accel_rejects++;
+      }
+
+      if (!accept)
+      {
+        m_held[i] += dt;
+        if (m_held[i] <= m_max_hold)
+        {
+          m_state[i] = STATE_HELD;
+          continue;
+        }
+        // 保持し続けても観測が戻らないなら、実際に移動したとみなす
+        hold_expired++;
+      }
+    }
+
+    // 初回と保持明けは速度 0 から始める
+    bool reseed = !accept || m_state[i] == STATE_LOST;
+    for (int k = 0; k < AXES; k++)
+    {
+      vel[k] = reseed ? 0.0f : v[k];
+      pos[k] = raw[k];
+    }
+    m_held[i] = 0.0f;
+    m_state[i] = STATE_ACCEPTED;
+  }
+
+  if (m_speed_rejects != NULL)
+  {
+    if (speed_rejects) m_speed_rejects->inc(speed_rejects);
+    if (accel_rejects) m_accel_rejects->inc(accel_rejects);
+    if (hold_expired) m_hold_expired->inc(hold_expired);
+  }
+}
+
+float PointGate::confidence(int i) const
+{
+  switch (m_state[i])
+  {
+  case STATE_ACCEPTED:
+    return 1.0f;
+  case STATE_HELD:
+    return (m_max_hold > 0.0f) ? 1.0f - m_held[i] / m_max_hold : 0.0f;
+  default:
+    return 0.0f;
+  }
+}
+
+void PointGate::get(int i, float& x, float& y, float& z) const
+{
+  const float* pos = &m_pos[i * AXES];
+  x = pos[0];
+  y = pos[1];
+  z = pos[2];
+}
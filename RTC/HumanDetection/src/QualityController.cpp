@@ -0,0 +1,143 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  QualityController.cpp
+ * @brief Stepping the Nuitrack settings down and up from the measured frame load for HumanDetection
+ * @date $Date$
+ *
+ * $Id$
+ */
+
+#include "QualityController.h"
+
+const double QualityController::WINDOW = 0.5;
+const double QualityController::SETTLE = 1.0;
+
+// 前後の空白を除く
+static std::string trim(const std::string& s)
+{
+  size_t b = s.find_first_not_of(" \t");
+  if (b == std::string::npos) return std::string();
+  size_t e = s.find_last_not_of(" \t");
+  return s.substr(b, e - b + 1);
+}
+
+QualityController::QualityController()
+  : m_level(0), m_budget(0.0), m_headroom(0.5), m_max_skipped(0.0), m_down_time(0.0), m_up_time(0.0),
+    m_min_interval(0.0),
+    m_frames(0), m_skipped(0), m_processing_sum(0.0), m_over(0.0), m_under(0.0),
+    m_last_stamp(0), m_interval(0)
+{
+  m_last.frames = m_last.skipped = 0;
+  m_last.processing = 0.0;
+}
+
+bool QualityController::setLevels(const std::string& spec)
+{
+  if (spec == m_spec && !m_levels.empty()) return true;
+  m_spec = spec;
+  m_levels.clear();
+  m_texts.clear();
+  m_level = 0;
+  if (trim(spec).empty()) return true;
+
+  // 段はセミコロン、設定はカンマで区切る (空の段は Nuitrack の既定値のまま)
+  size_t begin = 0;
+  while (true)
+  {
+    size_t end = spec.find(';', begin);
+    std::string item = spec.substr(begin, (end == std::string::npos) ? std::string::npos : end - begin);
+    std::vector<Setting> level;
+    size_t p = 0;
+    while (p <= item.size())
+    {
+      size_t q = item.find(',', p);
+      if (q == std::string::npos) q = item.size();
+      std::string pair = trim(item.substr(p, q - p));
+      p = q + 1;
+      if (pair.empty()) continue;
+      size_t eq = pair.find('=');
+      Setting s;
+      if (eq != std::string::npos)
+      {
+        s.key = trim(pair.substr(0, eq));
+        s.value = trim(pair.substr(eq + 1));
+      }
+      if (s.key.empty())
+      {
+        m_levels.clear();
+        m_texts.clear();
+        return false;
+      }
+      level.push_back(s);
+    }
+    m_levels.push_back(level);
+    m_texts.push_back(trim(item));
+    if (end == std::string::npos) break;
+    begin = end + 1;
+  }
+  return true;
+}
+
+void QualityController::configure(double budget, double headroom, double max_skipped, double down_time, double up_time,
+                                  double min_interval)
+{
+  m_budget = budget;
+  m_headroom = headroom;
+  m_max_skipped = max_skipped;
+  m_down_time = down_time;
+  m_up_time = up_time;
+  m_min_interval = min_interval;
+}
+
+void QualityController::reset(Clock::time_point now)
+{
+  m_settle_until = now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(SETTLE));
+  m_window_start = m_settle_until;
+  m_switch_after = now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(m_min_interval));
+  m_frames = 0;
+  m_skipped = 0;
+  m_processing_sum = 0.0;
+  m_over = 0.0;
+  m_under = 0.0;
+  m_last_stamp = 0;
+  m_interval = 0;
+}
+
+int QualityController::update(double processing, uint64_t stamp, Clock::time_point now)
+{
+  if (now < m_settle_until) return -1;
+
+  // タイムスタンプの間隔が最短の間隔の何倍かで、間に落ちたフレームを数える
+  if (stamp != 0 && m_last_stamp != 0 && stamp > m_last_stamp)
+  {
+    uint64_t d = stamp - m_last_stamp;
+    if (m_interval == 0 || d < m_interval) m_interval = d;
+    m_skipped += static_cast<int>((d + m_interval / 2) / m_interval) - 1;
+  }
+  m_last_stamp = stamp;
+  m_frames++;
+  m_processing_sum += processing;
+
+  double elapsed = std::chrono::duration<double>(now - m_window_start).count();
+  if (elapsed < WINDOW) return -1;
+
+  m_last.frames = m_frames;
+  m_last.skipped = m_skipped;
+  m_last.processing = m_processing_sum / m_frames;
+  m_window_start = now;
+  m_frames = 0;
+  m_skipped = 0;
+  m_processing_sum = 0.0;
+
+  double ratio = static_cast<double>(m_last.skipped) / (m_last.frames + m_last.skipped);
+  bool over = m_last.processing > m_budget || ratio > m_max_skipped;
+  bool under = m_last.processing < m_budget * m_headroom && ratio < m_max_skipped * m_headroom;
+  m_over = over ? m_over + elapsed : 0.0;
+  m_under = under ? m_under + elapsed : 0.0;
+
+  // 条件が続いた時間は数え続け、間隔が空いたら切り替える
+  if (now < m_switch_after) return -1;
+  if (m_over >= m_down_time && m_level + 1 < levels()) return m_level + 1;
+  if (m_under >= m_up_time && m_level > 0) return m_level - 1;
+  return -1;
+}
@@ -0,0 +1,195 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  RobotSilhouette.cpp
+ * @brief Projection of the robot arm into the depth image from its joint state for HumanDetection
+ * @date $Date$
+ *
+ * $Id$
+ */
+
+#include "RobotSilhouette.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+static const double DEG_TO_RAD = 3.14159265358979 / 180.0;
+static const uint16_t NONE = 0xffff;
+// これより手前 (カメラの背後を含む) は線分を切り詰める [mm]
+static const float MIN_DEPTH = 50.0f;
+
+RobotSilhouette::RobotSilhouette()
+  : m_joints(0), m_radius(0.0f), m_fx(0.0f), m_fy(0.0f), m_cx(0.0f), m_cy(0.0f)
+{
+  configure("", "", 0.0);
+}
+
+bool RobotSilhouette::configure(const std::string& dh, const std::string& base, double radius)
+{
+  m_joints = 0;
+  m_radius = static_cast<float>(std::max(0.0, radius));
+
+  bool ok = true;
+  std::string s = dh;
+  std::replace(s.begin(), s.end(), ',', ' ');
+  size_t begin = 0;
+  while (ok && begin < s.size())
+  {
+    size_t end = s.find(';', begin);
+    if (end == std::string::npos) end = s.size();
+    std::string item = s.substr(begin, end - begin);
+    begin = end + 1;
+    if (item.find_first_not_of(" \t") == std::string::npos) continue;
+
+    double a, alpha, d, offset;
+    char rest;
+    if (m_joints >= MAX_JOINTS ||
+        std::sscanf(item.c_str(), "%lf %lf %lf %lf %c", &a, &alpha, &d, &offset, &rest) != 4)
+    {
+      ok = false;
+      break;
+    }
+    Link& l = m_links[m_joints++];
+    l.a = static_cast<float>(a);
+    l.cos_alpha = static_cast<float>(std::cos(alpha * DEG_TO_RAD));
+    l.sin_alpha = static_cast<float>(std::sin(alpha * DEG_TO_RAD));
+    l.d = static_cast<float>(d);
+    l.offset = static_cast<float>(offset * DEG_TO_RAD);
+  }
+
+  double v[6] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+  if (ok && !base.empty())
+  {
+    std::string b = base;
+    std::replace(b.begin(), b.end(), ',', ' ');
+    char rest;
+    ok = std::sscanf(b.c_str(), "%lf %lf %lf %lf %lf %lf %c",
+                     &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &rest) == 6;
+    if (!ok) std::fill(v, v + 6, 0.0);
+  }
+  if (!ok) m_joints = 0;
+
+  // R = Rz(yaw) Ry(pitch) Rx(roll)
+  double cr = std::cos(v[3] * DEG_TO_RAD), sr = std::sin(v[3] * DEG_TO_RAD);
+  double cp = std::cos(v[4] * DEG_TO_RAD), sp = std::sin(v[4] * DEG_TO_RAD);
+  double cy = std::cos(v[5] * DEG_TO_RAD), sy = std::sin(v[5] * DEG_TO_RAD);
+  float* r = m_rot;
+  r[0] = static_cast<float>(cy * cp);
+  r[1] = static_cast<float>(cy * sp * sr - sy * cr);
+  r[2] = static_cast<float>(cy * sp * cr + sy * sr);
+  r[3] = static_cast<float>(sy * cp);
+  r[4] = static_cast<float>(sy * sp * sr + cy * cr);
+  r[5] = static_cast<float>(sy * sp * cr - cy * sr);
+  r[6] = static_cast<float>(-sp);
+  r[7] = static_cast<float>(cp * sr);
+  r[8] = static_cast<float>(cp * cr);
+  for (int k = 0; k < 3; k++) m_trans[k] = static_cast<float>(v[k]);
+  return ok;
+}
+
+void RobotSilhouette::setProjection(float fx, float fy, float cx, float cy)
+{
+  m_fx = fx;
+  m_fy = fy;
+  m_cx = cx;
+  m_cy = cy;
+}
+
+int RobotSilhouette::render(const double* q, uint16_t* out, int cols, int rows, int level, int x0, int y0) const
+{
+  std::fill(out, out + cols * rows, NONE);
+  if (m_joints == 0 || !(m_fx > 0.0f)) return 0;
+
+  // 段の画素 i の中心は段 0 の i * 2^level + (2^level - 1) / 2
+  float scale = 1.0f / static_cast<float>(1 << level);
+  float fx = m_fx * scale, fy = m_fy * scale;
+  float cx = (m_cx - x0 + 0.5f) * scale - 0.5f;
+  float cy = (m_cy - y0 + 0.5f) * scale - 0.5f;
+
+  // 関節座標系の軸 (列) と原点をカメラ座標系で持つ
+  float axis[3][3], p[3];
+  for (int k = 0; k < 3; k++)
+  {
+    for (int c = 0; c < 3; c++) axis[c][k] = m_rot[k * 3 + c];
+    p[k] = m_trans[k];
+  }
+
+  int pixels = 0;
+  for (int i = 0; i < m_joints; i++)
+  {
+    const Link& l = m_links[i];
+    float t = static_cast<float>(q[i]) + l.offset;
+    float ct = std::cos(t), st = std::sin(t);
+
+    // Rz(theta) Tz(d) Tx(a) Rx(alpha)。z 方向と x 方向の2本の線分に分けて描く
+    float mid[3], next[3];
+    for (int k = 0; k < 3; k++)
+    {
+      float x = ct * axis[0][k] + st * axis[1][k];
+      float y = -st * axis[0][k] + ct * axis[1][k];
+      axis[0][k] = x;
+      axis[1][k] = y;
+      mid[k] = p[k] + l.d * axis[2][k];
+      next[k] = mid[k] + l.a * x;
+    }
+    for (int k = 0; k < 3; k++)
+    {
+      float y = axis[1][k], z = axis[2][k];
+      axis[1][k] = l.cos_alpha * y + l.sin_alpha * z;
+      axis[2][k] = -l.sin_alpha * y + l.cos_alpha * z;
+    }
+
+    pixels += drawCapsule(p, mid, out, cols, rows, fx, fy, cx, cy);
+    pixels += drawCapsule(mid, next, out, cols, rows, fx, fy, cx, cy);
+    for (int k = 0; k < 3; k++) p[k] = next[k];
+  }
+  return pixels;
+}
+
+int RobotSilhouette::drawCapsule(const float* p0, const float* p1, uint16_t* out, int cols, int rows,
+                                 float fx, float fy, float cx, float cy) const
+{
+  float a[3] = { p0[0], p0[1], p0[2] };
+  float b[3] = { p1[0], p1[1], p1[2] };
+  if (a[2] < MIN_DEPTH && b[2] < MIN_DEPTH) return 0;
+
+  // カメラのすぐ手前で切り詰める (半径の分だけ奥の端も含めて描く)
+  if (a[2] < MIN_DEPTH || b[2] < MIN_DEPTH)
+  {
+    float* n = (a[2] < MIN_DEPTH) ? a : b;
+    const float* f = (a[2] < MIN_DEPTH) ? b : a;
+    float k = (MIN_DEPTH - f[2]) / (n[2] - f[2]);
+    for (int c = 0; c < 3; c++) n[c] = f[c] + (n[c] - f[c]) * k;
+  }
+
+  float z_near = std::min(a[2], b[2]) - m_radius;
+  float radius = fx * m_radius / std::max(z_near, MIN_DEPTH);
+  uint16_t depth = static_cast<uint16_t>(std::max(0.0f, std::min(z_near, 65534.0f)));
+
+  float ua = cx + fx * a[0] / a[2], va = cy - fy * a[1] / a[2];
+  float ub = cx + fx * b[0] / b[2], vb = cy - fy * b[1] / b[2];
+  int xmin = std::max(0, static_cast<int>(std::floor(std::min(ua, ub) - radius)));
+  int xmax = std::min(cols - 1, static_cast<int>(std::ceil(std::max(ua, ub) + radius)));
+  int ymin = std::max(0, static_cast<int>(std::floor(std::min(va, vb) - radius)));
+  int ymax = std::min(rows - 1, static_cast<int>(std::ceil(std::max(va, vb) + radius)));
+
+  float du = ub - ua, dv = vb - va;
+  float len2 = du * du + dv * dv;
+  float inv = (len2 > 0.0f) ? 1.0f / len2 : 0.0f;
+  float r2 = radius * radius;
+  int pixels = 0;
+  for (int y = ymin; y <= ymax; y++)
+  {
+    uint16_t* o = out + y * cols;
+    for (int x = xmin; x <= xmax; x++)
+    {
+      // 投影した線分への最短距離
+      float s = std::max(0.0f, std::min(1.0f, ((x - ua) * du + (y - va) * dv) * inv));
+      float ex = x - (ua + s * du), ey = y - (va + s * dv);
+      if (ex * ex + ey * ey > r2) continue;
+      if (o[x] == NONE) pixels++;
+      o[x] = std::min(o[x], depth);
+    }
+  }
+  return pixels;
+}
@@ -0,0 +1,141 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  CameraFusion.h
+ * @brief Time alignment and association of multi-camera human states
+ * @date  $Date$
+ *
+ * $Id$
+ */
+
+#ifndef CAMERAFUSION_H
+#define CAMERAFUSION_H
+
+#include <stdint.h>
+#include <string>
+
+/*!
+ * @class CameraFusion
+ * @brief 複数カメラの追跡結果を1つにまとめる
+ *
+ * 各カメラの最新フレームを、全カメラで最も新しい取得時刻まで直前の
+ * フレームからの速度で外挿して揃え、カメラごとの外部パラメータで
+ * ロボット座標系へ写す。ユーザ (人) ごとの観測点の重心が
+ * associate_distance 以内で最も近いものを同じ人とみなし、点ごとに
+ * ロボットに最も近い (z が最小の) 観測を残す。平均するとどのカメラが
+ * 見たよりも遠い点になりうるので、判定が安全側に倒れる方を選ぶ。
+ * 同じカメラの2人がまとめられることはない。
+ *
+ * 配列はすべて固定長で、周期処理でメモリ確保は起きない。
+ */
+class CameraFusion
+{
+ public:
+  static const int MAX_CAMERAS = 4;
+  // 融合後の人数の上限 (HumanProtection が判定する 32 点 = 16 人 × 両手)
+  static const int MAX_USERS = 16;
+  // 1人あたりの点の上限 (両手 + 関節 25)
+  static const int MAX_SLOTS = 27;
+  // 融合後のユーザ ID は 最初に見えたカメラ × ID_STRIDE + そのカメラでの ID
+  static const long ID_STRIDE = 1000;
+
+  struct Point
+  {
+    float x, y, z;
+    float confidence;
+    uint8_t gate;      // PointGate::State
+    uint8_t present;   // 観測あり
+  };
+
+  struct Frame
+  {
+    double t;          // 取得時刻 [s]
+    int users;
+    int slots;
+    long id[MAX_USERS];
+    Point points[MAX_USERS * MAX_SLOTS];  // ユーザ × MAX_SLOTS + スロット
+
+    Point& point(int user, int slot) { return points[user * MAX_SLOTS + slot]; }
+    const Point& point(int user, int slot) const { return points[user * MAX_SLOTS + slot]; }
+  };
+
+  CameraFusion();
+
+  /*!
+   * @param cameras 使うカメラの数 (MAX_CAMERAS まで)
+   * @param slots 出力する1人あたりの点の数 (MAX_SLOTS まで)
+   * @param max_age 最新のカメラよりこれ以上古いフレームは使わない [s]
+   * @param associate_distance 同じ人とみなす重心間の距離 [mm]
+   */
+  void configure(int cameras, int slots, double max_age, double associate_distance);
+
+  /*!
+   * @brief カメラからロボット座標系への変換を設定する
+   * @param spec "x y z roll pitch yaw" [mm, deg] (区切りは空白かカンマ)。空なら恒等変換
+   * @return 書式が正しければ true (誤りなら恒等変換のまま)
+   */
+  bool setExtrinsics(int camera, const std::string& spec);
+
+  /*!
+   * @brief カメラの新しいフレームを書き込む先 (直前のフレームは外挿用に残す)
+   */
+  Frame& beginInput(int camera);
+
+  /*!
+   * @brief 時刻を揃えて全カメラの人をまとめ、out に書く
+   * @return 融合に使ったカメラの数 (0 なら out は変更しない)
+   */
+  int fuse(Frame& out);
+
+  // 直前の fuse() で古すぎて (または一度も届かず) 使わなかったカメラのビット
+  uint32_t staleMask() const { return m_stale; }
+  // 直前の fuse() で MAX_USERS を超えて出力できなかった人数
+  int dropped() const { return m_dropped; }
+
+ private:
+  // 1カメラの1人分の観測 (ロボット座標系、時刻合わせ済み)
+  struct Detection
+  {
+    int camera;
+    long id;
+    float cx, cy, cz;              // 観測点の重心
+    Point points[MAX_SLOTS];
+  };
+
+  // 同じ人とみなした観測のまとまり
+  struct Cluster
+  {
+    uint32_t cameras;              // 含むカメラのビット
+    long id;
+    int members;
+    float cx, cy, cz;
+    Point points[MAX_SLOTS];       // 点ごとに最も近い観測
+  };
+
+  void collect(int camera, double t_ref);
+  void associate();
+  void merge(Cluster& k, const Detection& d);
+
+  int m_cameras;
+  int m_slots;
+  double m_max_age;
+  float m_associate2;              // 比較は2乗で行う
+
+  // カメラ → ロボット座標系 (p' = R p + T)
+  float m_rot[MAX_CAMERAS][9];
+  float m_trans[MAX_CAMERAS][3];
+
+  // カメラごとに最新と直前の2フレーム
+  Frame m_frames[MAX_CAMERAS][2];
+  int m_latest[MAX_CAMERAS];       // 最新フレームの添字
+  int m_received[MAX_CAMERAS];     // 受け取ったフレーム数 (2 で飽和)
+
+  Detection m_detections[MAX_CAMERAS * MAX_USERS];
+  int m_detection_num;
+  Cluster m_clusters[MAX_USERS];
+  int m_cluster_num;
+
+  uint32_t m_stale;
+  int m_dropped;
+};
+
+#endif // CAMERAFUSION_H
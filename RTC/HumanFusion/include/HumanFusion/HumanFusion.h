@@ -0,0 +1,407 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  HumanFusion.h
+ * @brief Human Fusion RT Component 
+ * @date  $Date$
+ *
+ * $Id$
+ */
+
+#ifndef HUMANFUSION_H
+#define HUMANFUSION_H
+
+#include <rtm/idl/BasicDataTypeSkel.h>
+#include <rtm/idl/ExtendedDataTypesSkel.h>
+#include <rtm/idl/InterfaceDataTypesSkel.h>
+
+// Service implementation headers
+// <rtc-template block="service_impl_h">
+
+// </rtc-template>
+
+// Service Consumer stub headers
+// <rtc-template block="consumer_stub_h">
+#include "TimedHumanStateStub.h"
+#include "BasicDataTypeStub.h"
+
+// </rtc-template>
+
+#include <rtm/Manager.h>
+#include <rtm/DataFlowComponentBase.h>
+#include <rtm/CorbaPort.h>
+#include <rtm/DataInPort.h>
+#include <rtm/DataOutPort.h>
+
+#include "RtProfile.h"
+#include "AllocGuard.h"
+#include "Trace.h"
+#include "MetricRegistry.h"
+#include "CycleMonitor.h"
+#include "CameraFusion.h"
+
+/*!
+ * @class HumanFusion
+ * @brief Human Fusion RT Component 
+ *
+ * 複数台の HumanDetection (カメラごとに1プロセス) の HumanState を
+ * HumanState0〜3 で受け、時刻を揃えてロボット座標系で同じ人をまとめた
+ * HumanState を1本出力する。
+ */
+class HumanFusion
+  : public RTC::DataFlowComponentBase
+{
+ public:
+  /*!
+   * @brief constructor
+   * @param manager Maneger Object
+   */
+  HumanFusion(RTC::Manager* manager);
+
+  /*!
+   * @brief destructor
+   */
+  ~HumanFusion();
+
+  // <rtc-template block="public_attribute">
+  
+  // </rtc-template>
+
+  // <rtc-template block="public_operation">
+  
+  // </rtc-template>
+
+  /***
+   *
+   * The initialize action (on CREATED->ALIVE transition)
+   *
+   * @return RTC::ReturnCode_t
+   * 
+   * 
+   */
+   virtual RTC::ReturnCode_t onInitialize();
+
+  /***
+   *
+   * The finalize action (on ALIVE->END transition)
+   *
+   * @return RTC::ReturnCode_t
+   * 
+   * 
+   */
+  // virtual RTC::ReturnCode_t onFinalize();
+
+  /***
+   *
+   * The startup action when ExecutionContext startup
+   *
+   * @param ec_id target ExecutionContext Id
+   *
+   * @return RTC::ReturnCode_t
+   * 
+   * 
+   */
+  // virtual RTC::ReturnCode_t onStartup(RTC::UniqueId ec_id);
+
+  /***
+   *
+   * The shutdown action when ExecutionContext stop
+   *
+   * @param ec_id target ExecutionContext Id
+   *
+   * @return RTC::ReturnCode_t
+   * 
+   * 
+   */
+  // virtual RTC::ReturnCode_t onShutdown(RTC::UniqueId ec_id);
+
+  /***
+   *
+   * The activated action (Active state entry action)
+   *
+   * @param ec_id target ExecutionContext Id
+   *
+   * @return RTC::ReturnCode_t
+   * 
+   * 
+   */
+   virtual RTC::ReturnCode_t onActivated(RTC::UniqueId ec_id);
+
+  /***
+   *
+   * The deactivated action (Active state exit action)
+   *
+   * @param ec_id target ExecutionContext Id
+   *
+   * @return RTC::ReturnCode_t
+   * 
+   * 
+   */
+   virtual RTC::ReturnCode_t onDeactivated(RTC::UniqueId ec_id);
+
+  /***
+   *
+   * The execution action that is invoked periodically
+   *
+   * @param ec_id target ExecutionContext Id
+   *
+   * @return RTC::ReturnCode_t
+   * 
+   * 
+   */
+   virtual RTC::ReturnCode_t onExecute(RTC::UniqueId ec_id);
+
+  /***
+   *
+   * The aborting action when main logic error occurred.
+   *
+   * @param ec_id target ExecutionContext Id
+   *
+   * @return RTC::ReturnCode_t
+   * 
+   * 
+   */
+  // virtual RTC::ReturnCode_t onAborting(RTC::UniqueId ec_id);
+
+  /***
+   *
+   * The error action in ERROR state
+   *
+   * @param ec_id target ExecutionContext Id
+   *
+   * @return RTC::ReturnCode_t
+   * 
+   * 
+   */
+  // virtual RTC::ReturnCode_t onError(RTC::UniqueId ec_id);
+
+  /***
+   *
+   * The reset action that is invoked resetting
+   *
+   * @param ec_id target ExecutionContext Id
+   *
+   * @return RTC::ReturnCode_t
+   * 
+   * 
+   */
+  // virtual RTC::ReturnCode_t onReset(RTC::UniqueId ec_id);
+  
+  /***
+   *
+   * The state update action that is invoked after onExecute() action
+   *
+   * @param ec_id target ExecutionContext Id
+   *
+   * @return RTC::ReturnCode_t
+   * 
+   * 
+   */
+  // virtual RTC::ReturnCode_t onStateUpdate(RTC::UniqueId ec_id);
+
+  /***
+   *
+   * The action that is invoked when execution context's rate is changed
+   *
+   * @param ec_id target ExecutionContext Id
+   *
+   * @return RTC::ReturnCode_t
+   * 
+   * 
+   */
+  // virtual RTC::ReturnCode_t onRateChanged(RTC::UniqueId ec_id);
+
+
+ protected:
+  // <rtc-template block="protected_attribute">
+  
+  // </rtc-template>
+
+  // <rtc-template block="protected_operation">
+  
+  // </rtc-template>
+
+  // Configuration variable declaration
+  // <rtc-template block="config_declare">
+  /*!
+   * 使うカメラの数 (HumanState0 から順に、4 まで)
+   * - Name:  camera_num
+   * - DefaultValue: 3
+   */
+  int m_camera_num;
+  /*!
+   * カメラごとのロボット座標系での位置・姿勢 "x y z roll pitch yaw" [mm, deg] を
+   * ";" で区切って並べる (足りないカメラは恒等変換)
+   * - Name:  camera_extrinsics
+   * - DefaultValue: 
+   */
+  std::string m_camera_extrinsics;
+  /*!
+   * 出力する1人あたりの点の数 (2: 両手のみ、27: 両手と関節)
+   * - Name:  slots_per_user
+   * - DefaultValue: 2
+   */
+  int m_slots_per_user;
+  /*!
+   * 最新のカメラよりこれ以上古いフレームは融合に使わない [s]
+   * - Name:  max_age
+   * - DefaultValue: 0.1
+   */
+  double m_max_age;
+  /*!
+   * 別のカメラの観測を同じ人とみなす重心間の距離 [mm]
+   * - Name:  associate_distance
+   * - DefaultValue: 400.0
+   */
+  double m_associate_distance;
+  /*!
+   * 実行スレッドのスケジューリングポリシー (other, fifo, rr)
+   * - Name:  rt_policy
+   * - DefaultValue: other
+   */
+  std::string m_rt_policy;
+  /*!
+   * fifo / rr のときの優先度 (1-99)
+   * - Name:  rt_priority
+   * - DefaultValue: 80
+   */
+  int m_rt_priority;
+  /*!
+   * 実行スレッドを固定する CPU ("2", "2,3", "2-3"。空なら固定しない)
+   * - Name:  rt_cpus
+   * - DefaultValue: 
+   */
+  std::string m_rt_cpus;
+  /*!
+   * 1 ならプロセスのメモリをロックする (mlockall)
+   * - Name:  rt_lock_memory
+   * - DefaultValue: 0
+   */
+  int m_rt_lock_memory;
+  /*!
+   * SIGUSR1 と非活性化時にトレースを書き出すファイル (ENABLE_TRACE ビルドのみ、空で無効)
+   * - Name:  trace_file
+   * - DefaultValue: 
+   */
+  std::string m_trace_file;
+  /*!
+   * メトリクスの書き出し先 (node-exporter の textfile、"unix:<path>" で UNIX ソケット、空で無効)
+   * - Name:  prom_export
+   * - DefaultValue: 
+   */
+  std::string m_prom_export;
+  /*!
+   * メトリクスファイルの書き出し周期 [s]
+   * - Name:  prom_export_period
+   * - DefaultValue: 5.0
+   */
+  double m_prom_export_period;
+  /*!
+   * overrun_window 秒あたりに許すオーバーラン回数 (超えると CycleStatus に出力)
+   * - Name:  overrun_budget
+   * - DefaultValue: 10
+   */
+  int m_overrun_budget;
+  /*!
+   * オーバーランを数える窓 [s]
+   * - Name:  overrun_window
+   * - DefaultValue: 10.0
+   */
+  double m_overrun_window;
+  /*!
+   * 周期の状態を出力する周期 [s] (予算超過の変化時は即時)
+   * - Name:  cycle_status_period
+   * - DefaultValue: 1.0
+   */
+  double m_cycle_status_period;
+
+  // </rtc-template>
+
+  // DataInPort declaration
+  // <rtc-template block="inport_declare">
+  RTC::TimedHumanState m_camera[CameraFusion::MAX_CAMERAS];
+  /*!
+   * HumanState0〜3。各カメラの HumanDetection の HumanState をつなぐ
+   */
+  RTC::InPort<RTC::TimedHumanState>* m_cameraIn[CameraFusion::MAX_CAMERAS];
+  
+  // </rtc-template>
+
+
+  // DataOutPort declaration
+  // <rtc-template block="outport_declare">
+  RTC::TimedHumanState m_human_state;
+  /*!
+   * 融合した全員の手・関節 (ロボット座標系)。tm は揃えた取得時刻、
+   * user_id は CameraFusion::ID_STRIDE を参照
+   */
+  RTC::OutPort<RTC::TimedHumanState> m_human_stateOut;
+  RTC::TimedULong m_sensor_status;
+  /*!
+   * 直前の融合で使わなかった (古すぎる・一度も届いていない) カメラのビット。
+   * 0 でない間はそのカメラの見ている範囲が死角になる
+   */
+  RTC::OutPort<RTC::TimedULong> m_sensor_statusOut;
+  RTC::TimedDoubleSeq m_cycle_status;
+  /*!
+   * 並びは CycleMonitor::toArray を参照
+   */
+  RTC::OutPort<RTC::TimedDoubleSeq> m_cycle_statusOut;
+  
+  // </rtc-template>
+
+  // CORBA Port declaration
+  // <rtc-template block="corbaport_declare">
+  
+  // </rtc-template>
+
+  // Service declaration
+  // <rtc-template block="service_declare">
+  
+  // </rtc-template>
+
+  // Consumer declaration
+  // <rtc-template block="consumer_declare">
+  
+  // </rtc-template>
+
+ private:
+  // 時刻合わせ・座標変換・同じ人の対応付け
+  CameraFusion fusion;
+  CameraFusion::Frame fused;
+
+  // カメラ c の HumanState を fusion へ取り込む
+  void readCamera(int c);
+  // fused を m_human_state に書く
+  void writeHumanState();
+
+  // MetricRegistry に登録したメトリクス
+  MetricCounter* frames_received;                          // 受け取ったカメラのフレーム
+  MetricCounter* frames_fused;                             // 出力した融合結果
+  MetricCounter* camera_stale[CameraFusion::MAX_CAMERAS];  // 古すぎて使わなかった回数
+  MetricCounter* users_dropped;                            // 人数の上限で出力できなかった人
+  MetricGauge* users_fused;                                // 直近の融合結果の人数
+  uint32_t stale_reported;                                 // 標準出力に知らせたカメラ
+
+  // 実行周期・実行時間の監視
+  CycleMonitor monitor;
+
+  // 周期の状態を CycleStatus へ出力する
+  void publishCycleStatus(CycleMonitor::Clock::time_point now);
+
+  // <rtc-template block="private_attribute">
+  
+  // </rtc-template>
+
+  // <rtc-template block="private_operation">
+  
+  // </rtc-template>
+
+};
+
+
+extern "C"
+{
+  DLL_EXPORT void HumanFusionInit(RTC::Manager* manager);
+};
+
+#endif // HUMANFUSION_H
@@ -0,0 +1,260 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  CameraFusion.cpp
+ * @brief Time alignment and association of multi-camera human states
+ * @date $Date$
+ *
+ * $Id$
+ */
+
+#include "CameraFusion.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+static const double DEG_TO_RAD = 3.14159265358979 / 180.0;
+
+CameraFusion::CameraFusion()
+  : m_cameras(0), m_slots(2), m_max_age(0.1), m_associate2(0.0f),
+    m_detection_num(0), m_cluster_num(0), m_stale(0), m_dropped(0)
+{
+  for (int c = 0; c < MAX_CAMERAS; c++) setExtrinsics(c, "");
+  configure(MAX_CAMERAS, m_slots, m_max_age, 0.0);
+}
+
+void CameraFusion::configure(int cameras, int slots, double max_age, double associate_distance)
+{
+  m_cameras = std::max(1, std::min(cameras, static_cast<int>(MAX_CAMERAS)));
+  m_slots = std::max(1, std::min(slots, static_cast<int>(MAX_SLOTS)));
+  m_max_age = max_age;
+  m_associate2 = static_cast<float>(associate_distance * associate_distance);
+
+  // 前の活性化で受け取ったフレームは使わない
+  for (int c = 0; c < MAX_CAMERAS; c++)
+  {
+    m_latest[c] = 0;
+    m_received[c] = 0;
+  }
+}
+
+bool CameraFusion::setExtrinsics(int camera, const std::string& spec)
+{
+  double v[6] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+  bool ok = true;
+  if (!spec.empty())
+  {
+    std::string s = spec;
+    std::replace(s.begin(), s.end(), ',', ' ');
+    char rest;
+    ok = std::sscanf(s.c_str(), "%lf %lf %lf %lf %lf %lf %c",
+                     &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &rest) == 6;
+    if (!ok) std::fill(v, v + 6, 0.0);
+  }
+
+  // R = Rz(yaw) Ry(pitch) Rx(roll)
+  double cr = std::cos(v[3] * DEG_TO_RAD), sr = std::sin(v[3] * DEG_TO_RAD);
+  double cp = std::cos(v[4] * DEG_TO_RAD), sp = std::sin(v[4] * DEG_TO_RAD);
+  double cy = std::cos(v[5] * DEG_TO_RAD), sy = std::sin(v[5] * DEG_TO_RAD);
+  float* r = m_rot[camera];
+  r[0] = static_cast<float>(cy * cp);
+  r[1] = static_cast<float>(cy * sp * sr - sy * cr);
+  r[2] = static_cast<float>(cy * sp * cr + sy * sr);
+  r[3] = static_cast<float>(sy * cp);
+  r[4] = static_cast<float>(sy * sp * sr + cy * cr);
+  r[5] = static_cast<float>(sy * sp * cr - cy * sr);
+  r[6] = static_cast<float>(-sp);
+  r[7] = static_cast<float>(cp * sr);
+  r[8] = static_cast<float>(cp * cr);
+  for (int k = 0; k < 3; k++) m_trans[camera][k] = static_cast<float>(v[k]);
+  return ok;
+}
+
+CameraFusion::Frame& CameraFusion::beginInput(int camera)
+{
+  // 最新だったフレームを直前のフレームにする
+  if (m_received[camera] > 0) m_latest[camera] ^= 1;
+  if (m_received[camera] < 2) m_received[camera]++;
+  return m_frames[camera][m_latest[camera]];
+}
+
+int CameraFusion::fuse(Frame& out)
+{
+  m_stale = 0;
+  m_dropped = 0;
+
+  // 基準時刻は全カメラで最も新しい取得時刻
+  double t_ref = 0.0;
+  bool any = false;
+  for (int c = 0; c < m_cameras; c++)
+  {
+    if (m_received[c] == 0) continue;
+    double t = m_frames[c][m_latest[c]].t;
+    if (!any || t > t_ref) t_ref = t;
+    any = true;
+  }
+  if (!any) return 0;
+
+  m_detection_num = 0;
+  int used = 0;
+  for (int c = 0; c < m_cameras; c++)
+  {
+    // 途切れたカメラの見ていた範囲は死角になるので、呼び出し側へ知らせる
+    if (m_received[c] == 0 || t_ref - m_frames[c][m_latest[c]].t > m_max_age)
+    {
+      m_stale |= 1u << c;
+      continue;
+    }
+    collect(c, t_ref);
+    used++;
+  }
+
+  associate();
+
+  out.t = t_ref;
+  out.users = m_cluster_num;
+  out.slots = m_slots;
+  for (int k = 0; k < m_cluster_num; k++)
+  {
+    const Cluster& cl = m_clusters[k];
+    out.id[k] = cl.id;
+    for (int s = 0; s < m_slots; s++) out.point(k, s) = cl.points[s];
+  }
+  return used;
+}
+
+void CameraFusion::collect(int camera, double t_ref)
+{
+  const Frame& f = m_frames[camera][m_latest[camera]];
+  const Frame* prev = (m_received[camera] >= 2) ? &m_frames[camera][m_latest[camera] ^ 1] : NULL;
+  const float* r = m_rot[camera];
+  const float* tr = m_trans[camera];
+
+  // 直前のフレームからの速度で基準時刻まで進める
+  float age = static_cast<float>(t_ref - f.t);
+  float rate = 0.0f;
+  if (prev != NULL && f.t > prev->t && age > 0.0f) rate = static_cast<float>(1.0 / (f.t - prev->t));
+
+  int slots = std::min(f.slots, m_slots);
+  for (int u = 0; u < f.users; u++)
+  {
+    // 直前のフレームで同じ ID のユーザ (いなければ外挿しない)
+    int pu = -1;
+    for (int i = 0; rate > 0.0f && i < prev->users; i++)
+    {
+      if (prev->id[i] == f.id[u])
+      {
+        pu = i;
+        break;
+      }
+    }
+
+    Detection& d = m_detections[m_detection_num];
+    d.camera = camera;
+    d.id = f.id[u];
+    d.cx = d.cy = d.cz = 0.0f;
+    int n = 0;
+    for (int s = 0; s < m_slots; s++)
+    {
+      Point& q = d.points[s];
+      if (s >= slots || !f.point(u, s).present)
+      {
+        std::memset(&q, 0, sizeof(q));
+        continue;
+      }
+
+      const Point& p = f.point(u, s);
+      float x = p.x, y = p.y, z = p.z;
+      if (pu >= 0 && prev->point(pu, s).present)
+      {
+        const Point& o = prev->point(pu, s);
+        float k = age * rate;
+        x += (p.x - o.x) * k;
+        y += (p.y - o.y) * k;
+        z += (p.z - o.z) * k;
+      }
+
+      q.x = r[0] * x + r[1] * y + r[2] * z + tr[0];
+      q.y = r[3] * x + r[4] * y + r[5] * z + tr[1];
+      q.z = r[6] * x + r[7] * y + r[8] * z + tr[2];
+      q.confidence = p.confidence;
+      q.gate = p.gate;
+      q.present = 1;
+      d.cx += q.x;
+      d.cy += q.y;
+      d.cz += q.z;
+      n++;
+    }
+    if (n == 0) continue;
+    d.cx /= n;
+    d.cy /= n;
+    d.cz /= n;
+    m_detection_num++;
+  }
+}
+
+void CameraFusion::associate()
+{
+  m_cluster_num = 0;
+  for (int i = 0; i < m_detection_num; i++)
+  {
+    const Detection& d = m_detections[i];
+
+    // 同じカメラをまだ含まないまとまりのうち、重心が最も近いもの
+    int best = -1;
+    float best2 = m_associate2;
+    for (int k = 0; k < m_cluster_num; k++)
+    {
+      const Cluster& cl = m_clusters[k];
+      if (cl.cameras & (1u << d.camera)) continue;
+      float dx = cl.cx - d.cx, dy = cl.cy - d.cy, dz = cl.cz - d.cz;
+      float dist2 = dx * dx + dy * dy + dz * dz;
+      if (dist2 <= best2)
+      {
+        best = k;
+        best2 = dist2;
+      }
+    }
+
+    if (best < 0)
+    {
+      if (m_cluster_num >= MAX_USERS)
+      {
+        m_dropped++;
+        continue;
+      }
+      best = m_cluster_num++;
+      Cluster& cl = m_clusters[best];
+      std::memset(&cl, 0, sizeof(cl));
+      cl.id = d.camera * ID_STRIDE + d.id;
+    }
+    merge(m_clusters[best], d);
+  }
+}
+
+void CameraFusion::merge(Cluster& k, const Detection& d)
+{
+  // 重心はまとめた観測の重心の平均
+  k.members++;
+  float a = 1.0f / k.members;
+  k.cx += (d.cx - k.cx) * a;
+  k.cy += (d.cy - k.cy) * a;
+  k.cz += (d.cz - k.cz) * a;
+  k.cameras |= 1u << d.camera;
+
+  for (int s = 0; s < m_slots; s++)
+  {
+    const Point& p = d.points[s];
+    if (!p.present) continue;
+    Point& q = k.points[s];
+    // HumanProtection は z を距離として判定するので、最も近い観測の位置を使う
+    float confidence = q.present ? std::max(q.confidence, p.confidence) : p.confidence;
+    // どれかのカメラで採用されていれば採用、そうでなければ保持
+    uint8_t gate = (!q.present || p.gate < q.gate) ? p.gate : q.gate;
+    if (!q.present || p.z < q.z) q = p;
+    q.confidence = confidence;
+    q.gate = gate;
+    q.present = 1;
+  }
+}
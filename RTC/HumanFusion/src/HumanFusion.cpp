@@ -0,0 +1,350 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  HumanFusion.cpp
+ * @brief Human Fusion RT Component
+ * @date $Date$
+ *
+ * $Id$
+ */
+
+#include "HumanFusion.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+
+// Module specification
+static const char* humanfusion_spec[] =
+  {
+    "implementation_id", "HumanFusion",
+    "type_name",         "HumanFusion",
+    "description",       "Human Fusion RT Component ",
+    "version",           "1.0.0",
+    "vendor",            "Robot System Design Laboratory, Meijo Univ.",
+    "category",          "Motion Capture",
+    "activity_type",     "PERIODIC",
+    "kind",              "DataFlowComponent",
+    "max_instance",      "1",
+    "language",          "C++",
+    "lang_type",         "compile",
+    "conf.default.camera_num", "3",
+    "conf.default.camera_extrinsics", "",
+    "conf.default.slots_per_user", "2",
+    "conf.default.max_age", "0.1",
+    "conf.default.associate_distance", "400.0",
+    "conf.default.rt_policy", "other",
+    "conf.default.rt_priority", "80",
+    "conf.default.rt_cpus", "",
+    "conf.default.rt_lock_memory", "0",
+    "conf.default.trace_file", "",
+    "conf.default.prom_export", "",
+    "conf.default.prom_export_period", "5.0",
+    "conf.default.overrun_budget", "10",
+    "conf.default.overrun_window", "10.0",
+    "conf.default.cycle_status_period", "1.0",
+    "conf.__widget__.camera_num", "text",
+    "conf.__widget__.camera_extrinsics", "text",
+    "conf.__widget__.slots_per_user", "text",
+    "conf.__widget__.max_age", "text",
+    "conf.__widget__.associate_distance", "text",
+    "conf.__widget__.rt_policy", "text",
+    "conf.__widget__.rt_priority", "text",
+    "conf.__widget__.rt_cpus", "text",
+    "conf.__widget__.rt_lock_memory", "text",
+    "conf.__widget__.trace_file", "text",
+    "conf.__widget__.prom_export", "text",
+    "conf.__widget__.prom_export_period", "text",
+    "conf.__widget__.overrun_budget", "text",
+    "conf.__widget__.overrun_window", "text",
+    "conf.__widget__.cycle_status_period", "text",
+    "conf.__type__.camera_num", "int",
+    "conf.__type__.camera_extrinsics", "string",
+    "conf.__type__.slots_per_user", "int",
+    "conf.__type__.max_age", "double",
+    "conf.__type__.associate_distance", "double",
+    "conf.__type__.rt_policy", "string",
+    "conf.__type__.rt_priority", "int",
+    "conf.__type__.rt_cpus", "string",
+    "conf.__type__.rt_lock_memory", "int",
+    "conf.__type__.trace_file", "string",
+    "conf.__type__.prom_export", "string",
+    "conf.__type__.prom_export_period", "double",
+    "conf.__type__.overrun_budget", "int",
+    "conf.__type__.overrun_window", "double",
+    "conf.__type__.cycle_status_period", "double",
+    ""
+  };
+
+// カメラごとの入力ポート名
+static const char* camera_port_names[CameraFusion::MAX_CAMERAS] =
+  {
+    "HumanState0", "HumanState1", "HumanState2", "HumanState3"
+  };
+
+HumanFusion::HumanFusion(RTC::Manager* manager)
+  : RTC::DataFlowComponentBase(manager),
+    m_human_stateOut("HumanState", m_human_state),
+    m_sensor_statusOut("SensorStatus", m_sensor_status),
+    m_cycle_statusOut("CycleStatus", m_cycle_status)
+{
+  for (int c = 0; c < CameraFusion::MAX_CAMERAS; c++)
+  {
+    m_cameraIn[c] = new RTC::InPort<RTC::TimedHumanState>(camera_port_names[c], m_camera[c]);
+  }
+}
+
+HumanFusion::~HumanFusion()
+{
+  for (int c = 0; c < CameraFusion::MAX_CAMERAS; c++) delete m_cameraIn[c];
+}
+
+RTC::ReturnCode_t HumanFusion::onInitialize()
+{
+  for (int c = 0; c < CameraFusion::MAX_CAMERAS; c++) addInPort(camera_port_names[c], *m_cameraIn[c]);
+  addOutPort("HumanState", m_human_stateOut);
+  addOutPort("SensorStatus", m_sensor_statusOut);
+  addOutPort("CycleStatus", m_cycle_statusOut);
+  bindParameter("camera_num", m_camera_num, "3");
+  bindParameter("camera_extrinsics", m_camera_extrinsics, "");
+  bindParameter("slots_per_user", m_slots_per_user, "2");
+  bindParameter("max_age", m_max_age, "0.1");
+  bindParameter("associate_distance", m_associate_distance, "400.0");
+  bindParameter("rt_policy", m_rt_policy, "other");
+  bindParameter("rt_priority", m_rt_priority, "80");
+  bindParameter("rt_cpus", m_rt_cpus, "");
+  bindParameter("rt_lock_memory", m_rt_lock_memory, "0");
+  bindParameter("trace_file", m_trace_file, "");
+  bindParameter("prom_export", m_prom_export, "");
+  bindParameter("prom_export_period", m_prom_export_period, "5.0");
+  bindParameter("overrun_budget", m_overrun_budget, "10");
+  bindParameter("overrun_window", m_overrun_window, "10.0");
+  bindParameter("cycle_status_period", m_cycle_status_period, "1.0");
+
+  // 周期処理からは登録済みのメトリクスを更新するだけにする
+  std::string label = std::string("component=\"") + getInstanceName() + "\"";
+  frames_received = &MetricRegistry::counter("safety_frames_received_total", label, "Frames received by the component");
+  frames_fused = &MetricRegistry::counter("safety_fusion_frames_total", label, "Fused human states published");
+  for (int c = 0; c < CameraFusion::MAX_CAMERAS; c++)
+  {
+    char camera[32];
+    std::snprintf(camera, sizeof(camera), ",camera=\"%d\"", c);
+    camera_stale[c] = &MetricRegistry::counter("safety_fusion_camera_stale_total", label + camera,
+                                               "Fusions that left a camera out because its frame was too old");
+  }
+  users_dropped = &MetricRegistry::counter("safety_fusion_users_dropped_total", label,
+                                           "Users that did not fit into the fused human state");
+  users_fused = &MetricRegistry::gauge("safety_fusion_users", label, "Users in the latest fused human state");
+  monitor.attach(label);
+  return RTC::RTC_OK;
+}
+
+RTC::ReturnCode_t HumanFusion::onActivated(RTC::UniqueId ec_id)
+{
+  fusion.configure(m_camera_num, m_slots_per_user, m_max_age, m_associate_distance);
+
+  // 外部パラメータは ";" 区切りでカメラ順に並べる
+  std::string rest = m_camera_extrinsics;
+  for (int c = 0; c < CameraFusion::MAX_CAMERAS; c++)
+  {
+    std::string::size_type pos = rest.find(';');
+    std::string spec = rest.substr(0, pos);
+    rest = (pos == std::string::npos) ? std::string() : rest.substr(pos + 1);
+    spec.erase(0, spec.find_first_not_of(" \t"));
+    if (!fusion.setExtrinsics(c, spec))
+    {
+      printf("camera_extrinsics: cannot parse \"%s\" for camera %d. Using identity.\r\n", spec.c_str(), c);
+    }
+  }
+
+  // 出力の各配列はここでだけ確保し、周期処理では値を書き換えるだけにする
+  int slots = std::max(1, std::min(m_slots_per_user, static_cast<int>(CameraFusion::MAX_SLOTS)));
+  CORBA::ULong n = CameraFusion::MAX_USERS * slots;
+  m_human_state.frame = 0;
+  m_human_state.max_users = CameraFusion::MAX_USERS;
+  m_human_state.slots_per_user = static_cast<CORBA::UShort>(slots);
+  m_human_state.user_id.length(CameraFusion::MAX_USERS);
+  m_human_state.presence.length((n + 31) / 32);
+  m_human_state.points.length(n);
+  m_human_state.confidence.length(n);
+  m_human_state.gate.length(n);
+  stale_reported = 0;
+
+  // 実行コンテキストのスレッドから呼ばれるので、ここでリアルタイム設定を行う
+  if (m_rt_lock_memory) RtProfile::lockMemory();
+  RtProfile::setAffinity(0, m_rt_cpus);
+  RtProfile::setScheduling(m_rt_policy, m_rt_priority);
+
+  // getExecutionContext は複製した参照を返すので _var で解放する
+  RTC::ExecutionContext_var ec = getExecutionContext(ec_id);
+  double rate = CORBA::is_nil(ec) ? 0.0 : ec->get_rate();
+  monitor.configure(rate > 0.0 ? 1.0 / rate : 0.005, m_overrun_budget, m_overrun_window);
+  m_cycle_status.data.length(CycleMonitor::STATUS_LENGTH);
+  MetricRegistry::startExporter(m_prom_export, m_prom_export_period);
+  Trace::dumpOnSignal(m_trace_file);
+  return RTC::RTC_OK;
+}
+
+RTC::ReturnCode_t HumanFusion::onDeactivated(RTC::UniqueId ec_id)
+{
+  monitor.jitter().print("HumanFusion");
+  Trace::dump(m_trace_file);
+  return RTC::RTC_OK;
+}
+
+RTC::ReturnCode_t HumanFusion::onExecute(RTC::UniqueId ec_id)
+{
+  // 定常周期ではヒープ確保をしない (ENABLE_ALLOC_GUARD ビルドで検査)
+  ALLOC_GUARD_SCOPE("HumanFusion::onExecute");
+  TRACE_SCOPE("HumanFusion::onExecute");
+  CycleMonitor::Scope cycle(monitor);
+
+  publishCycleStatus(CycleMonitor::Clock::now());
+
+  // どれかのカメラから新しいフレームが来たときだけ融合する
+  bool received = false;
+  for (int c = 0; c < m_camera_num && c < CameraFusion::MAX_CAMERAS; c++)
+  {
+    if (!m_cameraIn[c]->isNew()) continue;
+    readCamera(c);
+    received = true;
+  }
+  if (!received) return RTC::RTC_OK;
+
+  int used;
+  {
+    TRACE_SCOPE("CameraFusion::fuse");
+    used = fusion.fuse(fused);
+  }
+  if (used == 0) return RTC::RTC_OK;
+
+  // 途切れたカメラは死角になるので、SensorStatus で HumanProtection に止めさせる
+  uint32_t stale = fusion.staleMask();
+  for (int c = 0; c < m_camera_num && c < CameraFusion::MAX_CAMERAS; c++)
+  {
+    if (stale & (1u << c)) camera_stale[c]->inc();
+  }
+  if (stale != stale_reported)
+  {
+    printf("Cameras not fused (bit mask): 0x%x\r\n", stale);
+    stale_reported = stale;
+  }
+  if (fusion.dropped() > 0) users_dropped->inc(fusion.dropped());
+  users_fused->set(fused.users);
+
+  writeHumanState();
+  frames_fused->inc();
+  {
+    TRACE_SCOPE("HumanFusion::HumanState.write");
+    ALLOC_GUARD_PAUSE();
+    m_human_stateOut.write();
+  }
+  m_sensor_status.data = stale;
+  m_sensor_status.tm = m_human_state.tm;
+  {
+    TRACE_SCOPE("HumanFusion::SensorStatus.write");
+    ALLOC_GUARD_PAUSE();
+    m_sensor_statusOut.write();
+  }
+  return RTC::RTC_OK;
+}
+
+void HumanFusion::readCamera(int c)
+{
+  // 溜まっている場合は最新のフレームだけを使う
+  {
+    TRACE_SCOPE("HumanFusion::HumanStateN.read");
+    ALLOC_GUARD_PAUSE();
+    while (m_cameraIn[c]->isNew()) m_cameraIn[c]->read();
+  }
+  frames_received->inc();
+
+  const RTC::TimedHumanState& st = m_camera[c];
+  CameraFusion::Frame& f = fusion.beginInput(c);
+  f.t = st.tm.sec + st.tm.nsec * 1e-9;
+  f.users = std::min(static_cast<int>(st.max_users), static_cast<int>(CameraFusion::MAX_USERS));
+  f.slots = std::min(static_cast<int>(st.slots_per_user), static_cast<int>(CameraFusion::MAX_SLOTS));
+
+  CORBA::ULong spu = st.slots_per_user;
+  CORBA::ULong n = std::min(std::min(st.points.length(), st.presence.length() * 32),
+                            std::min(st.confidence.length(), st.gate.length()));
+  for (int u = 0; u < f.users; u++)
+  {
+    f.id[u] = (static_cast<CORBA::ULong>(u) < st.user_id.length()) ? st.user_id[u] : 0;
+    for (int s = 0; s < f.slots; s++)
+    {
+      CameraFusion::Point& p = f.point(u, s);
+      CORBA::ULong index = u * spu + s;
+      p.present = (index < n && ((st.presence[index / 32] >> (index % 32)) & 1u)) ? 1 : 0;
+      if (!p.present) continue;
+      p.x = static_cast<float>(st.points[index].x);
+      p.y = static_cast<float>(st.points[index].y);
+      p.z = static_cast<float>(st.points[index].z);
+      p.confidence = st.confidence[index];
+      p.gate = st.gate[index];
+    }
+  }
+}
+
+void HumanFusion::writeHumanState()
+{
+  RTC::TimedHumanState& st = m_human_state;
+  double sec = std::floor(fused.t);
+  st.tm.sec = static_cast<CORBA::ULong>(sec);
+  st.tm.nsec = static_cast<CORBA::ULong>((fused.t - sec) * 1e9);
+  st.frame++;
+
+  CORBA::ULong spu = st.slots_per_user;
+  for (CORBA::ULong w = 0; w < st.presence.length(); w++) st.presence[w] = 0;
+  for (int u = 0; u < CameraFusion::MAX_USERS; u++)
+  {
+    st.user_id[u] = (u < fused.users) ? fused.id[u] : 0;
+    for (CORBA::ULong s = 0; s < spu; s++)
+    {
+      CORBA::ULong index = u * spu + s;
+      const CameraFusion::Point* p = (u < fused.users) ? &fused.point(u, s) : NULL;
+      if (p == NULL || !p->present)
+      {
+        st.confidence[index] = 0.0f;
+        st.gate[index] = 0;
+        continue;
+      }
+      st.points[index].x = p->x;
+      st.points[index].y = p->y;
+      st.points[index].z = p->z;
+      st.confidence[index] = p->confidence;
+      st.gate[index] = p->gate;
+      st.presence[index / 32] |= 1u << (index % 32);
+    }
+  }
+}
+
+void HumanFusion::publishCycleStatus(CycleMonitor::Clock::time_point now)
+{
+  if (!monitor.statusDue(now, m_cycle_status_period)) return;
+
+  CycleMonitor::Status s = monitor.status();
+  if (s.over_budget)
+  {
+    printf("Cycle overrun budget exceeded: %llu overruns (exec max %.3fms)\r\n",
+           static_cast<unsigned long long>(s.overruns), s.exec_max * 1e3);
+  }
+
+  double values[CycleMonitor::STATUS_LENGTH];
+  CycleMonitor::toArray(s, values);
+  for (int i = 0; i < CycleMonitor::STATUS_LENGTH; i++) m_cycle_status.data[i] = values[i];
+  setTimestamp(m_cycle_status);
+  TRACE_SCOPE("HumanFusion::CycleStatus.write");
+  ALLOC_GUARD_PAUSE();
+  m_cycle_statusOut.write();
+}
+
+extern "C"
+{
+  void HumanFusionInit(RTC::Manager* manager)
+  {
+    coil::Properties profile(humanfusion_spec);
+    manager->registerFactory(profile,
+                             RTC::Create<HumanFusion>,
+                             RTC::Delete<HumanFusion>);
+  }
+};
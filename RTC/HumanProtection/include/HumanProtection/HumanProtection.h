@@ -22,6 +22,8 @@
 // Service Consumer stub headers
 // <rtc-template block="consumer_stub_h">
 #include "TimedPose3DQuaternionStub.h"
+#include "TimedHumanStateStub.h"
+#include "TimedTrackedPointsStub.h"
 #include "BasicDataTypeStub.h"
 
 // </rtc-template>
@@ -32,6 +34,15 @@
 #include <rtm/DataInPort.h>
 #include <rtm/DataOutPort.h>
 
+#include "ShmRing.h"
+#include "PoseRecord.h"
+#include "RtProfile.h"
+#include "AllocGuard.h"
+#include "Trace.h"
+#include "MetricRegistry.h"
+#include "CycleMonitor.h"
+#include "ProtectionJudge.h"
+
 /*!
  * @class HumanProtection
  * @brief Human Protection RT Component 
@@ -218,6 +229,108 @@ class HumanProtection
    * - DefaultValue: 100
    */
   double m_judge_parameter;
+  /*!
+   * この距離 [mm] より近づいたら減速を始める
+   * - Name:  slow_parameter
+   * - DefaultValue: 2500
+   */
+  double m_slow_parameter;
+  /*!
+   * HumanPose の代わりに読む共有メモリリング名 (空なら InPort を使う)
+   * - Name:  pose_ring
+   * - DefaultValue: 
+   */
+  std::string m_pose_ring;
+  /*!
+   * 実行スレッドのスケジューリングポリシー (other, fifo, rr)
+   * - Name:  rt_policy
+   * - DefaultValue: other
+   */
+  std::string m_rt_policy;
+  /*!
+   * fifo / rr のときの優先度 (1-99)
+   * - Name:  rt_priority
+   * - DefaultValue: 80
+   */
+  int m_rt_priority;
+  /*!
+   * 実行スレッドを固定する CPU ("2", "2,3", "2-3"。空なら固定しない)
+   * - Name:  rt_cpus
+   * - DefaultValue: 
+   */
+  std::string m_rt_cpus;
+  /*!
+   * 1 ならプロセスのメモリをロックする (mlockall)
+   * - Name:  rt_lock_memory
+   * - DefaultValue: 0
+   */
+  int m_rt_lock_memory;
+  /*!
+   * 活性化時に確保しておくスタック [byte]
+   * - Name:  rt_stack_prefault
+   * - DefaultValue: 262144
+   */
+  int m_rt_stack_prefault;
+  /*!
+   * 周期ジッタを出力する間隔 [s] (0 以下で非活性化時のみ)
+   * - Name:  jitter_report_period
+   * - DefaultValue: 10.0
+   */
+  double m_jitter_report_period;
+  /*!
+   * SIGUSR1 と非活性化時にトレースを書き出すファイル (ENABLE_TRACE ビルドのみ、空で無効)
+   * - Name:  trace_file
+   * - DefaultValue: 
+   */
+  std::string m_trace_file;
+  /*!
+   * メトリクスの書き出し先 (node-exporter の textfile、"unix:<path>" で UNIX ソケット、空で無効)
+   * - Name:  prom_export
+   * - DefaultValue: 
+   */
+  std::string m_prom_export;
+  /*!
+   * メトリクスファイルの書き出し周期 [s]
+   * - Name:  prom_export_period
+   * - DefaultValue: 5.0
+   */
+  double m_prom_export_period;
+  /*!
+   * overrun_window 秒あたりに許すオーバーラン回数 (超えると CycleStatus に出力)
+   * - Name:  overrun_budget
+   * - DefaultValue: 10
+   */
+  int m_overrun_budget;
+  /*!
+   * オーバーランを数える窓 [s]
+   * - Name:  overrun_window
+   * - DefaultValue: 10.0
+   */
+  double m_overrun_window;
+  /*!
+   * 周期の状態を出力する周期 [s] (予算超過の変化時は即時)
+   * - Name:  cycle_status_period
+   * - DefaultValue: 1.0
+   */
+  double m_cycle_status_period;
+  /*!
+   * 上流のユーザ ID が入れ替わったとき、同じ人とみなす重心の移動量 [mm]
+   * - Name:  track_gate_distance
+   * - DefaultValue: 600.0
+   */
+  double m_track_gate_distance;
+  /*!
+   * 見えなくなった人の追跡を残しておく時間 [s]
+   * - Name:  track_max_missing
+   * - DefaultValue: 0.5
+   */
+  double m_track_max_missing;
+  /*!
+   * NearestDepth をこの時間 [s] 受け取らなければ判定に使わない
+   * - Name:  depth_max_age
+   * - DefaultValue: 0.2
+   */
+  double m_depth_max_age;
 
   // </rtc-template>
 
@@ -227,6 +340,24 @@ class HumanProtection
   /*!
    */
   RTC::InPort<RTC::TimedPose3DQuaternion> m_human_poseIn;
+  RTC::TimedHumanState m_human_state;
+  /*!
+   * 全ユーザの手のうち presence のビットが立っている点だけを判定する。
+   * 一度受け取ったら HumanPose と pose_ring は使わない
+   */
+  RTC::InPort<RTC::TimedHumanState> m_human_stateIn;
+  RTC::TimedTrackedPoints m_nearest_depth;
+  /*!
+   * HumanDetection の深度の最近点 (points[0])。手の点とは別の1人として判定する。
+   * presence の bit 0 が立っていなければ範囲内の画素なし
+   */
+  RTC::InPort<RTC::TimedTrackedPoints> m_nearest_depthIn;
+  RTC::TimedULong m_sensor_status;
+  /*!
+   * 上流の死角のビット (HumanFusion の使えなかったカメラなど)。
+   * 0 でない間は人が見えていなくても停止指令を出し続ける
+   */
+  RTC::InPort<RTC::TimedULong> m_sensor_statusIn;
   
   // </rtc-template>
 
@@ -237,6 +368,17 @@ class HumanProtection
   /*!
    */
   RTC::OutPort<RTC::TimedBoolean> m_stop_comOut;
+  RTC::TimedDouble m_speed_ratio;
+  /*!
+   * 許容速度比 [0, 1]。judge_parameter で 0、slow_parameter 以遠で 1
+   */
+  RTC::OutPort<RTC::TimedDouble> m_speed_ratioOut;
+  RTC::TimedDoubleSeq m_cycle_status;
+  /*!
+   * CycleMonitor::toArray の後に、直近の停止までに危険が続いた時間 [s] と
+   * DANGER_THRESHOLD_TIME [s]
+   */
+  RTC::OutPort<RTC::TimedDoubleSeq> m_cycle_statusOut;
   
   // </rtc-template>
 
@@ -256,6 +398,48 @@ class HumanProtection
   // </rtc-template>
 
  private:
+  // HumanDetection の pose_ring を直接参照する読み手
+  ShmRingReader<PoseRecord> poseRing;
+
+  // リングの最新レコードを m_human_pose に読む
+  bool readPoseRing();
+
+  // 判定する点。HumanState からは各ユーザの両手を、HumanPose からは
+  // (0,0,0) を「検出なし」として写す。最後の1点は深度の最近点
+  static const int MAX_POINTS = 32;
+  static const int DEPTH_POINT = MAX_POINTS;
+  JudgePoint points[MAX_POINTS + 1];
+  long owner[MAX_POINTS + 1];  // 点の持ち主 (HumanState の user_id)
+  uint32_t presence;           // 手の点
+  bool depth_present;          // 深度の最近点があった
+  CycleMonitor::Clock::time_point depth_time;  // 深度の最近点を受け取った時刻
+  RTC::Time input_tm;          // 判定した入力の取得時刻
+  bool human_state_active;     // HumanState を受け取ったことがある
+  uint32_t sensor_blind;       // 最後に受け取った SensorStatus
+  void readHumanState();
+  void readHumanPose();
+  void readNearestDepth(CycleMonitor::Clock::time_point now);
+
+  // 停止・減速の判定 (ベンチマークと共通)
+  ProtectionJudge judge;
+  // MetricRegistry に登録したメトリクス
+  MetricCounter* frames_received;  // 判定した姿勢
+  MetricCounter* frames_dropped;   // pose_ring のあふれで読めなかった姿勢
+  MetricCounter* stop_events;      // 停止指令を出し始めた回数
+  MetricHistogram* decision_latency;// カメラ取得から判定までの時間
+  MetricHistogram* stop_hold;      // 危険を検知してから停止指令までの時間
+  MetricGauge* persons;            // 直近の判定の人数
+  unsigned long long ring_lost;      // frames_dropped に反映済みの lost()
+  bool stop_active;
+
+  // 実行周期・実行時間の監視 (起床間隔のずれを含む)
+  CycleMonitor monitor;
+  CycleMonitor::Clock::time_point jitter_report_time;
+  double last_stop_hold;
+
+  // 周期の状態を CycleStatus へ出力する
+  void publishCycleStatus(CycleMonitor::Clock::time_point now);
+
   // <rtc-template block="private_attribute">
   
   // </rtc-template>
@@ -0,0 +1,128 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  ProtectionJudge.h
+ * @brief Stop / slow-down decision of HumanProtection
+ * @date  $Date$
+ *
+ * $Id$
+ */
+
+#ifndef PROTECTIONJUDGE_H
+#define PROTECTIONJUDGE_H
+
+#include <stdint.h>
+
+#include "PersonTracker.h"
+
+/*!
+ * @brief 判定に使う人の点 [mm]。検出の有無は座標ではなく presence で渡す
+ */
+struct JudgePoint
+{
+  double x;
+  double y;
+  double z;
+};
+
+/*!
+ * @class ProtectionJudge
+ * @brief 人の点から停止指令と速度比を決める
+ *
+ * RTC に依存しないので、HumanProtection の onExecute とベンチマークの
+ * 両方から同じ判定を呼ぶ。時刻は呼び出し側の時計の秒で渡す。
+ *
+ * 点は持ち主 (上流のユーザ ID) ごとに1人にまとめ、PersonTracker で人を
+ * 追跡して危険の継続時間を人ごとに測る。誰か1人の危険が hold_time 続いたら
+ * 停止し、危険な人が入れ替わった場合は新しい人の分を測り直す。
+ */
+class ProtectionJudge
+{
+ public:
+  struct Decision
+  {
+    bool stop;            // 停止指令
+    bool danger;          // 今回の入力が危険範囲にあるか
+    double speed_ratio;   // [0, 1]
+    int present;          // 判定した点の数
+    double nearest;       // 最も近い点の z。present が 0 なら 0
+    double danger_time;   // 危険が続いている時間 [s] (人ごとの最長)。安全なら 0
+    int persons;          // 判定した人数
+    long danger_person;   // danger_time の人の追跡 ID。危険な人がいなければ -1
+  };
+
+  // 人ごとのゾーン (PersonTracker に渡す。0 は今回見えていない)
+  enum Zone
+  {
+    ZONE_NONE = 0,
+    ZONE_SAFE,
+    ZONE_SLOW,
+    ZONE_DANGER
+  };
+
+  static const int MAX_PERSONS = PersonTracker::MAX_TRACKS;
+  // 深度の最近点の持ち主。追跡の ID は 1 から、ID のない人は負の値を使う
+  static const long DEPTH_OWNER = 0;
+
+  ProtectionJudge();
+
+  /*!
+   * @param judge     この距離以下で危険 [mm]
+   * @param slow      この距離から減速を始める [mm]
+   * @param hold_time 危険がこの時間続いたら停止 [s]
+   */
+  void configure(double judge, double slow, double hold_time);
+
+  /*!
+   * @param gate_distance 上流の ID が変わったとき同じ人とみなす距離 [mm]
+   * @param max_missing 見えなくなった人の ID をこの時間 [s] 覚えておく
+   */
+  void configureTracking(double gate_distance, double max_missing);
+  void reset();
+
+  /*!
+   * @brief n 点を1人として判定する。最も近い点で速度比を、どれか1点でも危険なら停止を決める
+   */
+  Decision evaluate(const JudgePoint* pts, int n, double now);
+
+  /*!
+   * @brief n 点を owner[i] ごとの人に分けて判定する
+   */
+  Decision evaluate(const JudgePoint* pts, int n, const long* owner, double now);
+
+  /*!
+   * @brief presence のビット i が立っている pts[i] だけを判定する
+   *
+   * 立っていない点は読まない (座標の値は問わない)。
+   */
+  Decision evaluate(const JudgePoint* pts, uint64_t presence, double now);
+
+  /*!
+   * @brief presence の点を owner[i] ごとの人に分けて判定する
+   *
+   * owner[i] が負の点は ID を持たない人として、同じ値の点どうしでまとめる。
+   * owner が NULL なら全点を1人とする。
+   */
+  Decision evaluate(const JudgePoint* pts, uint64_t presence, const long* owner, double now);
+
+  const PersonTracker& tracker() const { return m_tracker; }
+
+ private:
+  void consider(const JudgePoint& p, long owner, Decision& d);
+  void decide(Decision& d, double now);
+
+  double m_judge;
+  double m_slow;
+  double m_hold_time;
+
+  // 今回の入力を持ち主ごとにまとめたもの
+  PersonTracker m_tracker;
+  PersonTracker::Detection m_persons[MAX_PERSONS];
+  long m_owner[MAX_PERSONS];
+  double m_sum[MAX_PERSONS][3];
+  int m_count[MAX_PERSONS];
+  double m_nearest[MAX_PERSONS];
+  int m_assigned[MAX_PERSONS];
+  int m_person_num;
+};
+
+#endif // PROTECTIONJUDGE_H
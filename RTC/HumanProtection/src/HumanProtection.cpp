@@ -9,6 +9,7 @@
 
 #include "HumanProtection.h"
 #include <chrono> // 時間計測用
+#include <algorithm>
 
 // Module specification
 static const char* humanprotection_spec[] =
@@ -25,22 +26,83 @@ static const char* humanprotection_spec[] =
     "language",          "C++",
     "lang_type",         "compile",
     "conf.default.judge_parameter", "1500",
+    "conf.default.slow_parameter", "2500",
+    "conf.default.pose_ring", "",
+    "conf.default.rt_policy", "other",
+    "conf.default.rt_priority", "80",
+    "conf.default.rt_cpus", "",
+    "conf.default.rt_lock_memory", "0",
+    "conf.default.rt_stack_prefault", "262144",
+    "conf.default.jitter_report_period", "10.0",
+    "conf.default.trace_file", "",
+    "conf.default.prom_export", "",
+    "conf.default.prom_export_period", "5.0",
+    "conf.default.overrun_budget", "10",
+    "conf.default.overrun_window", "10.0",
+    "conf.default.cycle_status_period", "1.0",
+    "conf.default.track_gate_distance", "600.0",
+    "conf.default.track_max_missing", "0.5",
+    "conf.default.depth_max_age", "0.2",
     "conf.__widget__.judge_parameter", "text",
+    "conf.__widget__.slow_parameter", "text",
+    "conf.__widget__.pose_ring", "text",
+    "conf.__widget__.rt_policy", "text",
+    "conf.__widget__.rt_priority", "text",
+    "conf.__widget__.rt_cpus", "text",
+    "conf.__widget__.rt_lock_memory", "text",
+    "conf.__widget__.rt_stack_prefault", "text",
+    "conf.__widget__.jitter_report_period", "text",
+    "conf.__widget__.trace_file", "text",
+    "conf.__widget__.prom_export", "text",
+    "conf.__widget__.prom_export_period", "text",
+    "conf.__widget__.overrun_budget", "text",
+    "conf.__widget__.overrun_window", "text",
+    "conf.__widget__.cycle_status_period", "text",
+    "conf.__widget__.track_gate_distance", "text",
+    "conf.__widget__.track_max_missing", "text",
+    "conf.__widget__.depth_max_age", "text",
     "conf.__type__.judge_parameter", "double",
+    "conf.__type__.slow_parameter", "double",
+    "conf.__type__.pose_ring", "string",
+    "conf.__type__.rt_policy", "string",
+    "conf.__type__.rt_priority", "int",
+    "conf.__type__.rt_cpus", "string",
+    "conf.__type__.rt_lock_memory", "int",
+    "conf.__type__.rt_stack_prefault", "int",
+    "conf.__type__.jitter_report_period", "double",
+    "conf.__type__.trace_file", "string",
+    "conf.__type__.prom_export", "string",
+    "conf.__type__.prom_export_period", "double",
+    "conf.__type__.overrun_budget", "int",
+    "conf.__type__.overrun_window", "double",
+    "conf.__type__.cycle_status_period", "double",
+    "conf.__type__.track_gate_distance", "double",
+    "conf.__type__.track_max_missing", "double",
+    "conf.__type__.depth_max_age", "double",
     ""
   };
 
-// 時間計測用の変数（簡易実装）
-static std::chrono::system_clock::time_point danger_start_time;
-static bool is_danger_counting = false;
+// データのタイムスタンプからの経過時間 [s]
+static double elapsedSince(const RTC::Time& tm)
+{
+  double stamp = tm.sec + tm.nsec * 1e-9;
+  double wall = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+  return wall - stamp;
+}
 
+// 危険がこの時間続いたら停止する [s]
 // 【修正点】1.0秒から0.5秒に変更
 static const double DANGER_THRESHOLD_TIME = 0.5; 
 
 HumanProtection::HumanProtection(RTC::Manager* manager)
   : RTC::DataFlowComponentBase(manager),
     m_human_poseIn("HumanPose", m_human_pose),
-    m_stop_comOut("StopCommand", m_stop_com)
+    m_human_stateIn("HumanState", m_human_state),
+    m_nearest_depthIn("NearestDepth", m_nearest_depth),
+    m_sensor_statusIn("SensorStatus", m_sensor_status),
+    m_stop_comOut("StopCommand", m_stop_com),
+    m_speed_ratioOut("SpeedRatio", m_speed_ratio),
+    m_cycle_statusOut("CycleStatus", m_cycle_status)
 {
 }
 
@@ -51,89 +113,291 @@ HumanProtection::~HumanProtection()
 RTC::ReturnCode_t HumanProtection::onInitialize()
 {
   addInPort("HumanPose", m_human_poseIn);
+  addInPort("HumanState", m_human_stateIn);
+  addInPort("NearestDepth", m_nearest_depthIn);
+  addInPort("SensorStatus", m_sensor_statusIn);
   addOutPort("StopCommand", m_stop_comOut);
+  addOutPort("SpeedRatio", m_speed_ratioOut);
+  addOutPort("CycleStatus", m_cycle_statusOut);
   bindParameter("judge_parameter", m_judge_parameter, "1500");
+  bindParameter("slow_parameter", m_slow_parameter, "2500");
+  bindParameter("pose_ring", m_pose_ring, "");
+  bindParameter("rt_policy", m_rt_policy, "other");
+  bindParameter("rt_priority", m_rt_priority, "80");
+  bindParameter("rt_cpus", m_rt_cpus, "");
+  bindParameter("rt_lock_memory", m_rt_lock_memory, "0");
+  bindParameter("rt_stack_prefault", m_rt_stack_prefault, "262144");
+  bindParameter("jitter_report_period", m_jitter_report_period, "10.0");
+  bindParameter("trace_file", m_trace_file, "");
+  bindParameter("prom_export", m_prom_export, "");
+  bindParameter("prom_export_period", m_prom_export_period, "5.0");
+  bindParameter("overrun_budget", m_overrun_budget, "10");
+  bindParameter("overrun_window", m_overrun_window, "10.0");
+  bindParameter("cycle_status_period", m_cycle_status_period, "1.0");
+  bindParameter("track_gate_distance", m_track_gate_distance, "600.0");
+  bindParameter("track_max_missing", m_track_max_missing, "0.5");
+  bindParameter("depth_max_age", m_depth_max_age, "0.2");
+
+  // 周期処理からは登録済みのメトリクスを更新するだけにする
+  std::string label = std::string("component=\"") + getInstanceName() + "\"";
+  frames_received = &MetricRegistry::counter("safety_frames_received_total", label, "Frames received by the component");
+  frames_dropped = &MetricRegistry::counter("safety_frames_dropped_total", label, "Frames lost before processing");
+  stop_events = &MetricRegistry::counter("safety_stop_events_total", label, "Number of safety stops");
+  decision_latency = &MetricRegistry::histogram("safety_decision_latency_seconds", label, "Camera capture to stop decision latency");
+  stop_hold = &MetricRegistry::histogram("safety_stop_hold_seconds", label, "Time from danger detection to the stop command");
+  persons = &MetricRegistry::gauge("safety_tracked_persons", label, "Persons in the latest frame");
+  monitor.attach(label);
   return RTC::RTC_OK;
 }
 
 RTC::ReturnCode_t HumanProtection::onActivated(RTC::UniqueId ec_id)
 {
   // 起動時にタイマーリセット
-  is_danger_counting = false;
+  judge.configure(m_judge_parameter, m_slow_parameter, DANGER_THRESHOLD_TIME);
+  judge.configureTracking(m_track_gate_distance, m_track_max_missing);
+  judge.reset();
+
+  // 書き手がまだいなければ onExecute で接続し直す
+  if (!m_pose_ring.empty()) poseRing.open(m_pose_ring);
+
+  // 実行コンテキストのスレッドから呼ばれるので、ここでリアルタイム設定を行う
+  if (m_rt_lock_memory) RtProfile::lockMemory();
+  if (m_rt_stack_prefault > 0) RtProfile::prefaultStack(m_rt_stack_prefault);
+  RtProfile::setAffinity(0, m_rt_cpus);
+  RtProfile::setScheduling(m_rt_policy, m_rt_priority);
+
+  // getExecutionContext は複製した参照を返すので _var で解放する
+  RTC::ExecutionContext_var ec = getExecutionContext(ec_id);
+  double rate = CORBA::is_nil(ec) ? 0.0 : ec->get_rate();
+  monitor.configure(rate > 0.0 ? 1.0 / rate : 0.001, m_overrun_budget, m_overrun_window);
+  m_cycle_status.data.length(CycleMonitor::STATUS_LENGTH + 2);
+  jitter_report_time = CycleMonitor::Clock::now();
+  last_stop_hold = 0.0;
+  ring_lost = 0;
+  stop_active = false;
+  human_state_active = false;
+  presence = 0;
+  depth_present = false;
+  sensor_blind = 0;
+  MetricRegistry::startExporter(m_prom_export, m_prom_export_period);
+  Trace::dumpOnSignal(m_trace_file);
   return RTC::RTC_OK;
 }
 
 RTC::ReturnCode_t HumanProtection::onDeactivated(RTC::UniqueId ec_id)
 {
+  monitor.jitter().print("HumanProtection");
+
+  if (poseRing.isOpen())
+  {
+    printf("pose_ring: %llu samples lost by overflow.\r\n", static_cast<unsigned long long>(poseRing.lost()));
+    poseRing.close();
+  }
+  Trace::dump(m_trace_file);
   return RTC::RTC_OK;
 }
 
 RTC::ReturnCode_t HumanProtection::onExecute(RTC::UniqueId ec_id)
 {
-  // データが来ているかチェック
-  if (m_human_poseIn.isNew())
+  // 定常周期ではヒープ確保をしない (ENABLE_ALLOC_GUARD ビルドで検査)
+  ALLOC_GUARD_SCOPE("HumanProtection::onExecute");
+  TRACE_SCOPE("HumanProtection::onExecute");
+  CycleMonitor::Scope cycle(monitor);
+
+  CycleMonitor::Clock::time_point now = CycleMonitor::Clock::now();
+  if (m_jitter_report_period > 0.0 &&
+      std::chrono::duration<double>(now - jitter_report_time).count() >= m_jitter_report_period)
+  {
+    monitor.jitter().print("HumanProtection");
+    jitter_report_time = now;
+  }
+  publishCycleStatus(now);
+
+  // データが来ているかチェック。HumanState を優先し、それがなければ
+  // 従来の HumanPose (pose_ring 指定時は共有メモリ) から読む
+  bool received = false;
+  if (m_human_stateIn.isNew())
+  {
+    {
+      TRACE_SCOPE("HumanProtection::HumanState.read");
+      ALLOC_GUARD_PAUSE();
+      m_human_stateIn.read();
+    }
+    readHumanState();
+    human_state_active = true;
+    received = true;
+  }
+  else if (!human_state_active && !m_pose_ring.empty())
+  {
+    received = readPoseRing();
+    if (received) readHumanPose();
+  }
+  else if (!human_state_active && m_human_poseIn.isNew())
+  {
+    {
+      TRACE_SCOPE("HumanProtection::HumanPose.read");
+      ALLOC_GUARD_PAUSE();
+      m_human_poseIn.read();
+    }
+    readHumanPose();
+    received = true;
+  }
+
+  // 深度の最近点は手の追跡と独立に届くので、どちらが来ても判定する
+  bool depth_received = false;
+  if (m_nearest_depthIn.isNew())
+  {
+    {
+      TRACE_SCOPE("HumanProtection::NearestDepth.read");
+      ALLOC_GUARD_PAUSE();
+      m_nearest_depthIn.read();
+    }
+    readNearestDepth(now);
+    if (!received) input_tm = m_nearest_depth.tm;
+    depth_received = true;
+  }
+
+  // 上流の死角は人の入力が途絶えても知らせが来るので、それだけでも判定を出し直す
+  bool status_received = false;
+  if (m_sensor_statusIn.isNew())
+  {
+    {
+      TRACE_SCOPE("HumanProtection::SensorStatus.read");
+      ALLOC_GUARD_PAUSE();
+      m_sensor_statusIn.read();
+    }
+    if (m_sensor_status.data != sensor_blind)
+    {
+      if (m_sensor_status.data != 0) printf("Upstream sensors blind (bit mask): 0x%lx. Sending STOP.\r\n",
+                                            static_cast<unsigned long>(m_sensor_status.data));
+      else printf("Upstream sensors recovered.\r\n");
+    }
+    sensor_blind = m_sensor_status.data;
+    if (!received && !depth_received) input_tm = m_sensor_status.tm;
+    status_received = true;
+  }
+
+  if (received || depth_received || status_received)
   {
-    m_human_poseIn.read();
+    if (received) frames_received->inc();
     
     // std::cout << "z:= " << m_human_pose.pose_q.p3D.z << std::endl;
 
-    bool current_danger = false;
-
-    // Detectionから (0,0,0) が来た場合は「手がない」＝「安全」
-    if (m_human_pose.pose_q.p3D.x == 0 && m_human_pose.pose_q.p3D.y == 0 && m_human_pose.pose_q.p3D.z == 0)
+    // 判定パラメータは稼働中にも変更されうるので毎回渡す
+    judge.configure(m_judge_parameter, m_slow_parameter, DANGER_THRESHOLD_TIME);
+    judge.configureTracking(m_track_gate_distance, m_track_max_missing);
+    double t = std::chrono::duration<double>(now.time_since_epoch()).count();
+    ProtectionJudge::Decision d;
     {
-      current_danger = false;
+      TRACE_SCOPE("ProtectionJudge::evaluate");
+      // 危険の継続時間は HumanState のユーザごとに測る (HumanPose は1人)
+      uint64_t judged = presence;
+      if (depth_present && std::chrono::duration<double>(now - depth_time).count() <= m_depth_max_age)
+      {
+        judged |= 1ull << DEPTH_POINT;
+      }
+      d = judge.evaluate(points, judged, human_state_active ? owner : NULL, t);
     }
-    // 手の距離(z)が0より大きく、かつ判定パラメータ以下なら「危険」
-    else if ( 0 < m_human_pose.pose_q.p3D.z && m_human_pose.pose_q.p3D.z <= m_judge_parameter)
+    persons->set(d.persons);
+
+    // 死角がある間は見えている人に関係なく止める
+    bool blind = (sensor_blind != 0);
+
+    // 減速: judge_parameter ～ slow_parameter の間で速度比を線形に下げる
+    m_speed_ratio.data = blind ? 0.0 : d.speed_ratio;
+    m_speed_ratio.tm = input_tm;
     {
-      current_danger = true;
+      TRACE_SCOPE("HumanProtection::SpeedRatio.write");
+      ALLOC_GUARD_PAUSE();
+      m_speed_ratioOut.write();
     }
-    else
+
+    if ((received || depth_received) && (input_tm.sec != 0 || input_tm.nsec != 0))
     {
-      current_danger = false;
+      decision_latency->observe(elapsedSince(input_tm));
     }
 
-    // ==========================================
-    // 【改良】継続検知ロジック (0.5秒)
-    // ==========================================
-    if (current_danger)
+    // 継続検知 (0.5秒) を満たしたら本当に停止させる
+    bool stop = d.stop || blind;
+    m_stop_com.data = stop ? 1 : 0;
+    if (stop && !stop_active) stop_events->inc();
+    if (d.stop && !stop_active)
     {
-        // 危険状態が始まったばかりなら時刻を記録
-        if (!is_danger_counting) {
-            danger_start_time = std::chrono::system_clock::now();
-            is_danger_counting = true;
-            m_stop_com.data = 0; // まだ停止しない
-        }
-        else {
-            // 経過時間を計算
-            std::chrono::duration<double> elapsed_seconds = std::chrono::system_clock::now() - danger_start_time;
-            
-            if (elapsed_seconds.count() >= DANGER_THRESHOLD_TIME) {
-                // 指定時間以上経過したので本当に停止させる
-                m_stop_com.data = 1;
-                printf("DANGER DETECTED (> 0.5s)! Sending STOP.\r\n");
-            } else {
-                // まだ指定時間経っていない
-                m_stop_com.data = 0;
-            }
-        }
+      // 判定周期の分だけ DANGER_THRESHOLD_TIME より遅れる。その実測値を残す
+      stop_hold->observe(d.danger_time);
+      last_stop_hold = d.danger_time;
     }
-    else
+    stop_active = stop;
+    if (d.stop)
     {
-        // 安全ならカウンターリセット
-        is_danger_counting = false;
-        m_stop_com.data = 0; // 安全
-        // printf("Safe.\r\n");
+      printf("DANGER DETECTED (> 0.5s, person %ld)! Sending STOP.\r\n", d.danger_person);
     }
     
-    // コマンド出力
+    // コマンド出力 (遅延計測のため入力のタイムスタンプを引き継ぐ)
+    m_stop_com.tm = input_tm;
+    TRACE_SCOPE("HumanProtection::StopCommand.write");
+    ALLOC_GUARD_PAUSE();
     m_stop_comOut.write();
   }
   
   return RTC::RTC_OK;
 }
 
+void HumanProtection::publishCycleStatus(CycleMonitor::Clock::time_point now)
+{
+  if (!monitor.statusDue(now, m_cycle_status_period)) return;
+
+  CycleMonitor::Status s = monitor.status();
+  if (s.over_budget)
+  {
+    printf("Cycle overrun budget exceeded: %llu overruns (exec max %.3fms)\r\n",
+           static_cast<unsigned long long>(s.overruns), s.exec_max * 1e3);
+  }
+
+  double values[CycleMonitor::STATUS_LENGTH];
+  CycleMonitor::toArray(s, values);
+  for (int i = 0; i < CycleMonitor::STATUS_LENGTH; i++) m_cycle_status.data[i] = values[i];
+  m_cycle_status.data[CycleMonitor::STATUS_LENGTH] = last_stop_hold;
+  m_cycle_status.data[CycleMonitor::STATUS_LENGTH + 1] = DANGER_THRESHOLD_TIME;
+  setTimestamp(m_cycle_status);
+  TRACE_SCOPE("HumanProtection::CycleStatus.write");
+  ALLOC_GUARD_PAUSE();
+  m_cycle_statusOut.write();
+}
+
+void HumanProtection::readNearestDepth(CycleMonitor::Clock::time_point now)
+{
+  // 深度の最近点は追跡の ID を持たない1人として、同じ人の時間を測り続ける
+  depth_present = m_nearest_depth.points.length() > 0 && (m_nearest_depth.presence & 1);
+  depth_time = now;
+  if (!depth_present) return;
+  const RTC::Point3D& p = m_nearest_depth.points[0];
+  points[DEPTH_POINT].x = p.x;
+  points[DEPTH_POINT].y = p.y;
+  points[DEPTH_POINT].z = p.z;
+  owner[DEPTH_POINT] = ProtectionJudge::DEPTH_OWNER;
+}
+
+bool HumanProtection::readPoseRing()
+{
+  if (!poseRing.isOpen() && !poseRing.open(m_pose_ring)) return false;
+
+  // 判定には最新の姿勢だけを使う
+  unsigned long long lost = poseRing.lost();
+  if (lost > ring_lost)
+  {
+    frames_dropped->inc(lost - ring_lost);
+    ring_lost = lost;
+  }
+
+  const PoseRecord* rec = poseRing.acquireLatest();
+  if (rec == NULL) return false;
+  fromRecord(*rec, m_human_pose);
+
+  // 読んでいる間に上書きされていたら捨てる
+  return poseRing.release();
+}
+
 extern "C"
 {
   void HumanProtectionInit(RTC::Manager* manager)
@@ -144,3 +408,40 @@ extern "C"
                              RTC::Delete<HumanProtection>);
   }
 };
+
+void HumanProtection::readHumanState()
+{
+  // 各ユーザのスロット 0 (右手), 1 (左手) を points[ユーザ × 2 + 手] に写す。
+  // user_id のないユーザは枠ごとに別の人とする
+  const RTC::TimedHumanState& st = m_human_state;
+  CORBA::ULong spu = st.slots_per_user;
+  CORBA::ULong users = std::min(static_cast<CORBA::ULong>(st.max_users), static_cast<CORBA::ULong>(MAX_POINTS / 2));
+  CORBA::ULong n = std::min(st.points.length(), st.presence.length() * 32);
+  presence = 0;
+  for (CORBA::ULong u = 0; spu >= 2 && u < users; u++)
+  {
+    for (CORBA::ULong h = 0; h < 2; h++)
+    {
+      CORBA::ULong index = u * spu + h;
+      if (index >= n || !((st.presence[index / 32] >> (index % 32)) & 1u)) continue;
+      JudgePoint& p = points[u * 2 + h];
+      p.x = st.points[index].x;
+      p.y = st.points[index].y;
+      p.z = st.points[index].z;
+      owner[u * 2 + h] = (u < st.user_id.length() && st.user_id[u] >= 0) ? st.user_id[u] : -1 - static_cast<long>(u);
+      presence |= 1u << (u * 2 + h);
+    }
+  }
+  input_tm = st.tm;
+}
+
+void HumanProtection::readHumanPose()
+{
+  // 従来の HumanPose は (0,0,0) で「手がない」を表すので、ここで presence に直す
+  const RTC::Point3D& p = m_human_pose.pose_q.p3D;
+  points[0].x = p.x;
+  points[0].y = p.y;
+  points[0].z = p.z;
+  presence = (p.x == 0 && p.y == 0 && p.z == 0) ? 0u : 1u;
+  input_tm = m_human_pose.tm;
+}
@@ -0,0 +1,155 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  ProtectionJudge.cpp
+ * @brief Stop / slow-down decision of HumanProtection
+ * @date $Date$
+ *
+ * $Id$
+ */
+
+#include "ProtectionJudge.h"
+
+#include <algorithm>
+
+ProtectionJudge::ProtectionJudge()
+  : m_judge(1500.0), m_slow(2500.0), m_hold_time(0.5), m_person_num(0)
+{
+  configureTracking(600.0, 0.5);
+}
+
+void ProtectionJudge::configure(double judge, double slow, double hold_time)
+{
+  m_judge = judge;
+  m_slow = slow;
+  m_hold_time = hold_time;
+}
+
+void ProtectionJudge::configureTracking(double gate_distance, double max_missing)
+{
+  m_tracker.configure(MAX_PERSONS, gate_distance, max_missing);
+}
+
+void ProtectionJudge::reset()
+{
+  m_tracker.reset();
+}
+
+static void clear(ProtectionJudge::Decision& d)
+{
+  d.stop = false;
+  d.danger = false;
+  d.speed_ratio = 1.0;
+  d.present = 0;
+  d.nearest = 0.0;
+  d.danger_time = 0.0;
+  d.persons = 0;
+  d.danger_person = -1;
+}
+
+void ProtectionJudge::consider(const JudgePoint& p, long owner, Decision& d)
+{
+  if (d.present == 0 || p.z < d.nearest) d.nearest = p.z;
+  d.present++;
+
+  // 持ち主ごとにまとめる。人数があふれたら最後の人に入れて危険を取りこぼさない
+  int k = 0;
+  while (k < m_person_num && m_owner[k] != owner) k++;
+  if (k == m_person_num)
+  {
+    if (m_person_num < MAX_PERSONS)
+    {
+      m_person_num++;
+      m_owner[k] = owner;
+      m_sum[k][0] = m_sum[k][1] = m_sum[k][2] = 0.0;
+      m_count[k] = 0;
+    }
+    else
+    {
+      k = MAX_PERSONS - 1;
+    }
+  }
+  m_sum[k][0] += p.x;
+  m_sum[k][1] += p.y;
+  m_sum[k][2] += p.z;
+  if (m_count[k] == 0 || p.z < m_nearest[k]) m_nearest[k] = p.z;
+  m_count[k]++;
+}
+
+ProtectionJudge::Decision ProtectionJudge::evaluate(const JudgePoint* pts, int n, double now)
+{
+  return evaluate(pts, n, NULL, now);
+}
+
+ProtectionJudge::Decision ProtectionJudge::evaluate(const JudgePoint* pts, int n, const long* owner, double now)
+{
+  Decision d;
+  clear(d);
+  m_person_num = 0;
+  for (int i = 0; i < n; i++) consider(pts[i], owner != NULL ? owner[i] : 0, d);
+  decide(d, now);
+  return d;
+}
+
+ProtectionJudge::Decision ProtectionJudge::evaluate(const JudgePoint* pts, uint64_t presence, double now)
+{
+  return evaluate(pts, presence, NULL, now);
+}
+
+ProtectionJudge::Decision ProtectionJudge::evaluate(const JudgePoint* pts, uint64_t presence,
+                                                    const long* owner, double now)
+{
+  Decision d;
+  clear(d);
+  m_person_num = 0;
+  // 立っているビットだけをたどる
+  for (uint64_t bits = presence; bits != 0; bits &= bits - 1)
+  {
+    int i = __builtin_ctzll(bits);
+    consider(pts[i], owner != NULL ? owner[i] : 0, d);
+  }
+  decide(d, now);
+  return d;
+}
+
+void ProtectionJudge::decide(Decision& d, double now)
+{
+  // 最も近い点が判定パラメータ以下なら「危険」
+  d.danger = (d.present > 0 && d.nearest <= m_judge);
+
+  // 減速: judge ～ slow の間で速度比を線形に下げる
+  if (d.present > 0 && m_slow > m_judge)
+  {
+    double ratio = (d.nearest - m_judge) / (m_slow - m_judge);
+    d.speed_ratio = std::max(0.0, std::min(1.0, ratio));
+  }
+
+  // 人ごとの重心で追跡し、上流の ID が入れ替わっても同じ人の時間を測り続ける
+  for (int k = 0; k < m_person_num; k++)
+  {
+    PersonTracker::Detection& p = m_persons[k];
+    p.x = static_cast<float>(m_sum[k][0] / m_count[k]);
+    p.y = static_cast<float>(m_sum[k][1] / m_count[k]);
+    p.z = static_cast<float>(m_sum[k][2] / m_count[k]);
+    p.hint = m_owner[k];
+  }
+  m_tracker.update(m_persons, m_person_num, now, m_assigned);
+  d.persons = m_person_num;
+
+  // 継続検知: 危険ゾーンに hold_time 居続けた人がいたら停止
+  for (int k = 0; k < m_person_num; k++)
+  {
+    int slot = m_assigned[k];
+    if (slot < 0) continue;
+    Zone zone = (m_nearest[k] <= m_judge) ? ZONE_DANGER : (m_nearest[k] <= m_slow) ? ZONE_SLOW : ZONE_SAFE;
+    m_tracker.setZone(slot, zone, now);
+    if (zone != ZONE_DANGER) continue;
+
+    double t = m_tracker.zoneTime(slot, now);
+    if (d.danger_person < 0 || t > d.danger_time)
+    {
+      d.danger_time = t;
+      d.danger_person = m_tracker.id(slot);
+    }
+  }
+  d.stop = (d.danger_person >= 0 && d.danger_time >= m_hold_time);
+}
@@ -0,0 +1,94 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  ArmStatePoller.h
+ * @brief Background poller of the manipulator state for Manager
+ * @date  $Date$
+ *
+ * $Id$
+ */
+
+#ifndef ARMSTATEPOLLER_H
+#define ARMSTATEPOLLER_H
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "ManipulatorCommonInterface_CommonStub.h"
+
+#include <rtm/CorbaConsumer.h>
+
+/*!
+ * @brief ポーリングで取得したアームの状態
+ */
+struct ArmState
+{
+  typedef std::chrono::steady_clock Clock;
+
+  static const int MAX_AXIS = 8;
+
+  bool valid;                 // 最後の取得が成功したか
+  int axis_num;
+  double joints[MAX_AXIS];    // getFeedbackPosJoint
+  unsigned long state;        // getState (CONST_BINARY_* のビット)
+  unsigned long alarm_num;    // getActiveAlarm の件数
+  unsigned long alarm_code;   // 先頭アラームのコード
+  Clock::time_point stamp;    // 取得した時刻
+};
+
+/*!
+ * @class ArmStatePoller
+ * @brief 別スレッドでアームの状態を周期取得し、ロックなしで読ませる
+ *
+ * onExecute から CORBA 呼び出しを同期で行わずに済むよう、取得結果を
+ * seqlock で公開する。read() はコピーのみで完了し、待つことはない。
+ *
+ * ポーリングのスレッドは CorbaConsumer を直接使わず、start() の時点の
+ * オブジェクト参照を複製して持つ (接続の変更は次の start() から反映する)。
+ */
+class ArmStatePoller
+{
+ public:
+  typedef RTC::CorbaConsumer<JARA_ARM::ManipulatorCommonInterface_Common> CommonConsumer;
+
+  explicit ArmStatePoller(CommonConsumer& common);
+  ~ArmStatePoller();
+
+  /*!
+   * @brief ポーリング開始
+   * @param rate 取得周期 [Hz]
+   */
+  void start(double rate);
+  void stop();
+  bool isRunning() const { return m_running.load(std::memory_order_relaxed); }
+
+  /*!
+   * @brief 最新の状態を読む
+   * @param out 読み出し先
+   * @return 一度でも取得できていれば true
+   */
+  bool read(ArmState& out) const;
+
+  /*!
+   * @brief 最新の状態の経過時間 [s]
+   */
+  static double age(const ArmState& s, ArmState::Clock::time_point now);
+
+ private:
+  void run(double rate);
+  void poll(ArmState& s);
+  void publish(const ArmState& s);
+
+  // ArmState を 8 バイト単位の atomic にコピーして公開する
+  static const int WORDS = (sizeof(ArmState) + sizeof(unsigned long long) - 1) / sizeof(unsigned long long);
+
+  CommonConsumer& m_common;
+  JARA_ARM::ManipulatorCommonInterface_Common_var m_ref;  // ポーリングのスレッド専用の参照
+  std::thread m_thread;
+  std::atomic<bool> m_running;
+  std::atomic<bool> m_published;
+  std::atomic<unsigned int> m_seq;
+  std::atomic<unsigned long long> m_words[WORDS];
+};
+
+#endif // ARMSTATEPOLLER_H
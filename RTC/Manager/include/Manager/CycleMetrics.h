@@ -0,0 +1,152 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  CycleMetrics.h
+ * @brief Cycle throughput / availability metrics for Manager
+ * @date  $Date$
+ *
+ * $Id$
+ */
+
+#ifndef CYCLEMETRICS_H
+#define CYCLEMETRICS_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+/*!
+ * @class CycleMetrics
+ * @brief ピック&プレースサイクルのスループットと稼働率を集計する
+ *
+ * フェーズ所要時間、完了サイクル数、保護停止時間・回数、復帰レイテンシを
+ * 一定幅のバケットに積算し、直近 window 秒のローリング集計を返す。
+ * onExecute から呼ばれるため、各イベントはバケットへの加算のみで済ませる。
+ */
+class CycleMetrics
+{
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  // 動作フェーズ数 (0:Pick1, 1:Place, 2:Pick2, 3:Place)
+  static const int PHASE_NUM = 4;
+  // 1サイクル中のピック回数 (Pick1, Pick2)
+  static const int PICKS_PER_CYCLE = 2;
+
+  /*!
+   * @brief ローリング集計結果
+   */
+  struct Snapshot
+  {
+    double window;               // 集計対象の経過時間 [s]
+    double cycles;               // 完了サイクル数
+    double cycles_per_hour;
+    double picks_per_hour;
+    double availability;         // 1 - 停止時間 / 経過時間
+    double stop_count;           // 保護停止回数
+    double stop_time;            // 保護停止時間の合計 [s]
+    double resume_latency;       // 平均復帰レイテンシ [s]
+    double lost_cycles_per_stop; // 1回の侵入で失ったサイクル数
+    double lost_picks_per_hour;  // 保護停止による損失ピック数 [/h]
+    double safety_latency;       // 平均安全系レイテンシ [s]
+    double safety_latency_max;   // 最大安全系レイテンシ [s]
+    double phase_time[PHASE_NUM];// フェーズ平均所要時間 [s]
+    double cycles_total;         // 起動からの完了サイクル数 (ファイルのみ)
+    double stop_count_total;     // 起動からの保護停止回数 (ファイルのみ)
+  };
+
+  // Snapshot を TimedDoubleSeq に詰めるときの要素数
+  static const int SNAPSHOT_LENGTH = 11 + PHASE_NUM;
+
+  CycleMetrics();
+
+  /*!
+   * @brief 集計窓の設定
+   * @param window ローリング窓幅 [s]
+   * @param bucket バケット幅 [s]
+   */
+  void configure(double window, double bucket);
+
+  /*!
+   * @brief 計測開始 (onActivated から呼ぶ)
+   */
+  void reset(Clock::time_point now);
+
+  /*!
+   * @brief フェーズ phase の動作指令を送った
+   */
+  void onPhaseStart(int phase, Clock::time_point now);
+
+  /*!
+   * @brief 保護停止に入った
+   */
+  void onStop(Clock::time_point now);
+
+  /*!
+   * @brief 保護停止から復帰し、アームが動作を再開した
+   * @param latency 安全復帰を検知してからアームが動き出すまでの時間 [s]
+   */
+  void onResume(Clock::time_point now, double latency);
+
+  /*!
+   * @brief safety を受け取った
+   * @param latency 検出側のタイムスタンプから受信までの時間 [s]
+   */
+  void onSafetyLatency(Clock::time_point now, double latency);
+
+  bool isStopped() const { return m_stopped; }
+
+  Snapshot snapshot(Clock::time_point now) const;
+
+  /*!
+   * @brief Snapshot を配列に展開する (OutPort 用, SNAPSHOT_LENGTH 要素)
+   */
+  static void toArray(const Snapshot& s, double* out);
+
+  /*!
+   * @brief 集計結果をテキストファイルへ書き出す
+   *
+   * 一時ファイルへ書いてから rename するので、読み手が途中の内容を見ることはない。
+   */
+  bool writeFile(const std::string& path, Clock::time_point now) const;
+
+  /*!
+   * @brief snapshot() の結果をテキストファイルへ書き出す (集計とは別のスレッドから呼べる)
+   */
+  static bool writeFile(const std::string& path, const Snapshot& s);
+
+ private:
+  struct Bucket
+  {
+    long   index;      // バケット番号 (reset からの経過時間 / bucket 幅)
+    double cycles;
+    double stop_count;
+    double stop_time;
+    double resume_latency;
+    double resume_count;
+    double safety_latency;
+    double safety_latency_max;
+    double safety_count;
+    double phase_time[PHASE_NUM];
+    double phase_count[PHASE_NUM];
+  };
+
+  Bucket& bucketAt(Clock::time_point now);
+  void addStopTime(Clock::time_point from, Clock::time_point to);
+  double seconds(Clock::time_point from, Clock::time_point to) const;
+
+  double m_window;
+  double m_bucket;
+  std::vector<Bucket> m_buckets;
+
+  Clock::time_point m_origin;
+  Clock::time_point m_phase_start;
+  Clock::time_point m_stop_start;
+  int  m_phase;
+  bool m_stopped;
+
+  // 起動からの累計
+  double m_total_cycles;
+  double m_total_stops;
+};
+
+#endif // CYCLEMETRICS_H
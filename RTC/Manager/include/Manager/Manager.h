@@ -31,6 +31,16 @@
 #include <string>
 #include <vector>
 
+#include "ArmStatePoller.h"
+#include "CycleMetrics.h"
+#include "MetricsFileWriter.h"
+#include "SpeedScaler.h"
+#include "MotionSequencer.h"
+#include "AllocGuard.h"
+#include "Trace.h"
+#include "MetricRegistry.h"
+#include "CycleMonitor.h"
+
 /*!
  * @class Manager
  * @brief Manager
@@ -58,6 +68,106 @@ class Manager
 
 
  protected:
+  // Configuration variable declaration
+  // <rtc-template block="config_declare">
+  /*!
+   * メトリクスファイルの出力先 (空なら出力しない)
+   * - Name: metrics_file
+   * - DefaultValue: Manager_metrics.txt
+   */
+  std::string m_metrics_file;
+  /*!
+   * スループット集計のローリング窓幅 [s]
+   * - Name: metrics_window
+   * - DefaultValue: 600
+   */
+  double m_metrics_window;
+  /*!
+   * metrics ポートの出力周期 [s]
+   * - Name: metrics_period
+   * - DefaultValue: 1.0
+   */
+  double m_metrics_period;
+  /*!
+   * メトリクスファイルの書き出し周期 [s]
+   * - Name: metrics_flush_period
+   * - DefaultValue: 10.0
+   */
+  double m_metrics_flush_period;
+  /*!
+   * アーム状態のバックグラウンド取得周期 [Hz] (0で無効)
+   * - Name: state_poll_rate
+   * - DefaultValue: 50
+   */
+  double m_state_poll_rate;
+  /*!
+   * 速度比の指令を変える最小の差 [0, 1]
+   * - Name: speed_deadband
+   * - DefaultValue: 0.05
+   */
+  double m_speed_deadband;
+  /*!
+   * 速度比を上げるまでの保持時間 [s]
+   * - Name: speed_hold_time
+   * - DefaultValue: 0.5
+   */
+  double m_speed_hold_time;
+  /*!
+   * 速度比の下限 [0, 1]
+   * - Name: speed_min_ratio
+   * - DefaultValue: 0.1
+   */
+  double m_speed_min_ratio;
+  /*!
+   * stop を変化がなくても再送する周期 [s] (0 以下で変化時のみ)
+   * - Name: stop_heartbeat
+   * - DefaultValue: 1.0
+   */
+  double m_stop_heartbeat;
+  /*!
+   * SIGUSR1 と非活性化時にトレースを書き出すファイル (ENABLE_TRACE ビルドのみ、空で無効)
+   * - Name: trace_file
+   * - DefaultValue: 
+   */
+  std::string m_trace_file;
+  /*!
+   * メトリクスの書き出し先 (node-exporter の textfile、"unix:<path>" で UNIX ソケット、空で無効)
+   * - Name: prom_export
+   * - DefaultValue: 
+   */
+  std::string m_prom_export;
+  /*!
+   * メトリクスファイルの書き出し周期 [s]
+   * - Name: prom_export_period
+   * - DefaultValue: 5.0
+   */
+  double m_prom_export_period;
+  /*!
+   * overrun_window 秒あたりに許すオーバーラン回数 (超えると CycleStatus に出力)
+   * - Name: overrun_budget
+   * - DefaultValue: 10
+   */
+  int m_overrun_budget;
+  /*!
+   * オーバーランを数える窓 [s]
+   * - Name: overrun_window
+   * - DefaultValue: 10.0
+   */
+  double m_overrun_window;
+  /*!
+   * 周期の状態を出力する周期 [s] (予算超過の変化時は即時)
+   * - Name: cycle_status_period
+   * - DefaultValue: 1.0
+   */
+  double m_cycle_status_period;
+  /*!
+   * 動作指令を送ってから次のフェーズまでの待機時間 [s] (実行周期から周期数に換算)
+   * - Name: phase_wait_time
+   * - DefaultValue: 3.0
+   */
+  double m_phase_wait_time;
+  // </rtc-template>
+
   // DataInPort declaration
   // <rtc-template block="inport_declare">
   RTC::TimedBoolean m_safety;
@@ -66,14 +176,27 @@ class Manager
   RTC::InPort<RTC::TimedString> m_end_moveIn;
   RTC::TimedString m_end_manip;
   RTC::InPort<RTC::TimedString> m_end_manipIn;
+  // 許容速度比 [0, 1] (1: 通常速度)
+  RTC::TimedDouble m_speed_ratio;
+  RTC::InPort<RTC::TimedDouble> m_speed_ratioIn;
   // </rtc-template>
 
   // DataOutPort declaration
   // <rtc-template block="outport_declare">
-  RTC::TimedString m_stop;
-  RTC::OutPort<RTC::TimedString> m_stopOut;
+  // 停止状態は変化時と stop_heartbeat 周期でのみ出力する
+  RTC::TimedBoolean m_stop;
+  RTC::OutPort<RTC::TimedBoolean> m_stopOut;
   RTC::TimedString m_start_move;
   RTC::OutPort<RTC::TimedString> m_start_moveOut;
+  // 並びは CycleMetrics::toArray を参照
+  RTC::TimedDoubleSeq m_metrics;
+  RTC::OutPort<RTC::TimedDoubleSeq> m_metricsOut;
+  // CycleMonitor::toArray の後に phase_wait_time の実測換算値 [s]
+  RTC::TimedDoubleSeq m_cycle_status;
+  RTC::OutPort<RTC::TimedDoubleSeq> m_cycle_statusOut;
+  // アームの関節角 [rad]。ArmStatePoller が新しい状態を取得したときだけ出力する
+  RTC::TimedDoubleSeq m_joint_state;
+  RTC::OutPort<RTC::TimedDoubleSeq> m_joint_stateOut;
   // </rtc-template>
 
   // CORBA Port declaration
@@ -91,22 +214,70 @@ class Manager
  private:
   // --- 変数定義 ---
   
-  // 動作フェーズ管理 (0:Pick1, 1:Place, 2:Pick2, 3:Place)
-  int phase; 
-  
-  // 待機用タイマーカウンタ
-  int wait_timer;
-
-  // 直前が危険状態だったかどうかを記録するフラグ
-  bool was_danger;
+  // 動作フェーズ・待機タイマー・直前の危険状態の管理
+  MotionSequencer sequencer;
 
   // 座標保持用
   JARA_ARM::JointPos Pick1Point; // Pick1
   JARA_ARM::JointPos PlacePoint; // Place
   JARA_ARM::JointPos Pick2Point; // Pick2
+  JARA_ARM::JointPos StopPoint;  // 停止信号 (全関節 999.0)
+
+  // 許容速度比から速度指令を決める
+  SpeedScaler speed_scaler;
+
+  // アーム状態のキャッシュ (onExecute からは read() のみ)
+  ArmStatePoller poller;
+
+  // 復帰指令を送ってからアームが動き出すのを待っている間 true
+  bool resume_pending;
+  CycleMetrics::Clock::time_point resume_start;
+
+  // サイクルタイム・稼働率の集計
+  CycleMetrics metrics;
+  CycleMetrics::Clock::time_point metrics_publish_time;
+  CycleMetrics::Clock::time_point metrics_flush_time;
+  // metrics_file への書き出し (実行周期ではファイル I/O をしない)
+  MetricsFileWriter metrics_writer;
+
+  // 内部関数: 集計結果を OutPort / ファイルへ出力する
+  void publishMetrics(CycleMetrics::Clock::time_point now);
+
+  // MetricRegistry に登録したメトリクス
+  MetricCounter* stop_events;      // 停止した回数
+  MetricHistogram* safety_latency; // カメラ取得から safety 受信までの時間
+  MetricHistogram* move_time;      // movePTPJointAbs の呼び出し時間
+  MetricHistogram* set_speed_time; // setSpeedJoint / setSpeedCartesian の呼び出し時間
+  MetricGauge* speed_gauge;        // 指令中の速度比 [0, 1]
+  MetricGauge* stopped_gauge;      // 停止中なら 1
+
+  // 実行周期・実行時間の監視
+  CycleMonitor monitor;
+
+  // 内部関数: 周期の状態を cycle_status へ出力する
+  void publishCycleStatus(CycleMonitor::Clock::time_point now);
+
+  // stop の出力状態
+  bool stop_published;
+  CycleMetrics::Clock::time_point stop_publish_time;
+
+  // 直前に joint_state へ出力したアーム状態の取得時刻
+  ArmState::Clock::time_point joint_state_stamp;
+
+  // 内部関数: 新しいアーム状態の関節角を joint_state へ出力する
+  void publishJointState();
+
+  // 内部関数: 停止状態が変わったとき、または heartbeat 周期で stop を出力する
+  void publishStop(bool stop, CycleMetrics::Clock::time_point now);
+
+  // 内部関数: 許容速度比に応じてアームの速度比を変える
+  void updateSpeed(SpeedScaler::Clock::time_point now);
+
+  // 内部関数: 復帰後にアームが動き出したら復帰完了として記録する
+  void checkResume(CycleMetrics::Clock::time_point now);
 
-  // 内部関数: 現在のフェーズに応じた動作指令を送る
-  void sendCurrentMotion();
+  // 内部関数: フェーズに応じた動作指令を送る (0:Pick1, 1:Place, 2:Pick2, 3:Place)
+  void sendMotion(int phase);
 
 };
 
@@ -0,0 +1,59 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  MetricsFileWriter.h
+ * @brief Background writer of the cycle metrics file for Manager
+ * @date  $Date$
+ *
+ * $Id$
+ */
+
+#ifndef METRICSFILEWRITER_H
+#define METRICSFILEWRITER_H
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "CycleMetrics.h"
+
+/*!
+ * @class MetricsFileWriter
+ * @brief 集計結果のファイル出力を別スレッドで行う
+ *
+ * onExecute は post() で集計結果を渡すだけにし、fopen・書き込み・rename は
+ * このスレッドで行う。post() はロックが取れなければ待たずに諦めるので、
+ * 実行周期がファイル I/O で止まることはない。
+ */
+class MetricsFileWriter
+{
+ public:
+  MetricsFileWriter();
+  ~MetricsFileWriter();
+
+  /*!
+   * @brief 書き出しスレッドを開始する
+   * @param path 出力先 (空なら開始しない)
+   */
+  void start(const std::string& path);
+  void stop();
+
+  /*!
+   * @brief 書き出す集計結果を渡す (前に渡した未書き出しのものは置き換える)
+   * @return 受け付けたら true。スレッドがない・ロック中なら false
+   */
+  bool post(const CycleMetrics::Snapshot& s);
+
+ private:
+  void run();
+
+  std::string m_path;
+  std::thread m_thread;
+  std::mutex m_mutex;
+  std::condition_variable m_cond;
+  CycleMetrics::Snapshot m_pending;
+  bool m_posted;
+  bool m_running;
+};
+
+#endif // METRICSFILEWRITER_H
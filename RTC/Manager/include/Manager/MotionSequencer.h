@@ -0,0 +1,69 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  MotionSequencer.h
+ * @brief Pick & place phase sequencing of Manager
+ * @date  $Date$
+ *
+ * $Id$
+ */
+
+#ifndef MOTIONSEQUENCER_H
+#define MOTIONSEQUENCER_H
+
+/*!
+ * @class MotionSequencer
+ * @brief safety の入力から、周期ごとに送るべき指令を決める
+ *
+ * Manager::onExecute の状態 (フェーズ・待機カウンタ・直前の危険状態) を
+ * RTC から切り離したもの。step() が返すフラグに従って呼び出し側が
+ * 停止信号や動作指令を送る。ベンチマークからも同じものを使う。
+ */
+class MotionSequencer
+{
+ public:
+  // 動作フェーズ数 (0:Pick1, 1:Place, 2:Pick2, 3:Place)
+  static const int PHASE_NUM = 4;
+
+  // step() の戻り値のビット
+  static const unsigned int STOP       = 0x01;  // 停止信号を送る
+  static const unsigned int STOP_BEGIN = 0x02;  // 今回から停止した
+  static const unsigned int RESUME     = 0x04;  // 中断していた動作を再送信する
+  static const unsigned int ADVANCE    = 0x08;  // 次のフェーズの動作を送る
+
+  MotionSequencer();
+
+  /*!
+   * @param wait_cycles 動作指令を送ってから次のフェーズまで待つ周期数
+   */
+  void configure(int wait_cycles);
+  void reset();
+
+  /*!
+   * @brief 1周期進める
+   * @param danger safety が停止を指示しているか
+   * @return STOP / STOP_BEGIN / RESUME / ADVANCE の組み合わせ
+   */
+  unsigned int step(bool danger);
+
+  int waitCycles() const { return m_wait_cycles; }
+
+  // RESUME で再送信するフェーズ
+  int resumePhase() const { return m_resume_phase; }
+  // ADVANCE で送るフェーズ
+  int advancePhase() const { return m_advance_phase; }
+
+ private:
+  int m_wait_cycles;
+
+  // 動作フェーズ管理
+  int m_phase;
+  // 待機用タイマーカウンタ
+  int m_wait_timer;
+  // 直前が危険状態だったかどうかを記録するフラグ
+  bool m_was_danger;
+
+  int m_resume_phase;
+  int m_advance_phase;
+};
+
+#endif // MOTIONSEQUENCER_H
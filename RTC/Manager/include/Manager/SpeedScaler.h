@@ -0,0 +1,63 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  SpeedScaler.h
+ * @brief Rate-limited speed ratio controller for Manager
+ * @date  $Date$
+ *
+ * $Id$
+ */
+
+#ifndef SPEEDSCALER_H
+#define SPEEDSCALER_H
+
+#include <chrono>
+
+/*!
+ * @class SpeedScaler
+ * @brief 許容速度比の入力から setSpeedJoint に渡す速度比 [%] を決める
+ *
+ * 入力が揺れるたびにアームへ指令しないよう、不感帯と保持時間を持たせる。
+ * - 減速側: 現在の指令より deadband 以上低くなったら即座に下げる
+ * - 加速側: deadband 以上高い状態が hold_time 続いたら上げる
+ * 完全な停止は safety ポート側で扱うので、速度比は min_ratio 未満にはしない。
+ */
+class SpeedScaler
+{
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  SpeedScaler();
+
+  /*!
+   * @param deadband  指令を変える最小の差 [0, 1]
+   * @param hold_time 加速側の変化を反映するまでの継続時間 [s]
+   * @param min_ratio 速度比の下限 [0, 1]
+   */
+  void configure(double deadband, double hold_time, double min_ratio);
+
+  /*!
+   * @brief 指令を 100% に戻す (onActivated から呼ぶ)
+   */
+  void reset(Clock::time_point now);
+
+  /*!
+   * @brief 入力を与え、指令を変えるべきか判定する
+   * @param ratio 許容速度比 [0, 1]
+   * @param percent 変えるべき場合に新しい速度比 [%] が入る
+   * @return 指令を送るべきなら true
+   */
+  bool update(double ratio, Clock::time_point now, unsigned long& percent);
+
+  unsigned long commanded() const { return m_commanded; }
+
+ private:
+  double m_deadband;
+  double m_hold_time;
+  double m_min_ratio;
+
+  unsigned long m_commanded;   // 最後に指令した速度比 [%]
+  bool m_raising;              // 加速側の候補を保持中
+  Clock::time_point m_raise_since;
+};
+
+#endif // SPEEDSCALER_H
@@ -0,0 +1,141 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  ArmStatePoller.cpp
+ * @brief Background poller of the manipulator state for Manager
+ * @date $Date$
+ *
+ * $Id$
+ */
+
+#include "ArmStatePoller.h"
+
+#include <cstring>
+#include <iostream>
+
+ArmStatePoller::ArmStatePoller(CommonConsumer& common)
+  : m_common(common), m_running(false), m_published(false), m_seq(0)
+{
+  for (int i = 0; i < WORDS; i++) m_words[i].store(0, std::memory_order_relaxed);
+}
+
+ArmStatePoller::~ArmStatePoller()
+{
+  stop();
+}
+
+void ArmStatePoller::start(double rate)
+{
+  stop();
+  if (rate <= 0.0) return;
+
+  // CorbaConsumer は実行コンテキスト・ポートの接続処理と共有なので、参照を複製して渡す
+  m_ref = JARA_ARM::ManipulatorCommonInterface_Common::_duplicate(m_common._ptr());
+  m_published.store(false, std::memory_order_relaxed);
+  m_running.store(true, std::memory_order_relaxed);
+  m_thread = std::thread(&ArmStatePoller::run, this, rate);
+}
+
+void ArmStatePoller::stop()
+{
+  m_running.store(false, std::memory_order_relaxed);
+  if (m_thread.joinable()) m_thread.join();
+  m_ref = JARA_ARM::ManipulatorCommonInterface_Common::_nil();
+}
+
+void ArmStatePoller::run(double rate)
+{
+  std::chrono::nanoseconds period(static_cast<long long>(1e9 / rate));
+  ArmState::Clock::time_point next = ArmState::Clock::now();
+
+  ArmState s = ArmState();
+  while (m_running.load(std::memory_order_relaxed))
+  {
+    poll(s);
+    publish(s);
+
+    next += period;
+    ArmState::Clock::time_point now = ArmState::Clock::now();
+    if (next < now) next = now; // 取得が周期を超えたら追いつこうとしない
+    std::this_thread::sleep_until(next);
+  }
+}
+
+void ArmStatePoller::poll(ArmState& s)
+{
+  if (CORBA::is_nil(m_ref))
+  {
+    // 活性化の時点で未接続
+    s.valid = false;
+    s.stamp = ArmState::Clock::now();
+    return;
+  }
+  try
+  {
+    JARA_ARM::JointPos_var pos;
+    JARA_ARM::RETURN_ID_var ret = m_ref->getFeedbackPosJoint(pos);
+    s.axis_num = 0;
+    if (ret->id == JARA_ARM::OK)
+    {
+      CORBA::ULong n = pos->length();
+      if (n > static_cast<CORBA::ULong>(ArmState::MAX_AXIS)) n = ArmState::MAX_AXIS;
+      for (CORBA::ULong i = 0; i < n; i++) s.joints[i] = pos[i];
+      s.axis_num = n;
+    }
+
+    JARA_ARM::ULONG state = 0;
+    ret = m_ref->getState(state);
+    s.state = state;
+
+    JARA_ARM::AlarmSeq_var alarms;
+    ret = m_ref->getActiveAlarm(alarms);
+    s.alarm_num = alarms->length();
+    s.alarm_code = (s.alarm_num > 0) ? alarms[0].code : 0;
+
+    s.valid = true;
+  }
+  catch (CORBA::SystemException&)
+  {
+    // 未接続・通信断の間は前回値を残して無効扱いにする
+    s.valid = false;
+  }
+  s.stamp = ArmState::Clock::now();
+}
+
+void ArmStatePoller::publish(const ArmState& s)
+{
+  unsigned long long words[WORDS];
+  std::memset(words, 0, sizeof(words));
+  std::memcpy(words, &s, sizeof(ArmState));
+
+  // 書き込み中は seq を奇数にする
+  unsigned int seq = m_seq.load(std::memory_order_relaxed);
+  m_seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (int i = 0; i < WORDS; i++) m_words[i].store(words[i], std::memory_order_relaxed);
+  m_seq.store(seq + 2, std::memory_order_release);
+
+  m_published.store(true, std::memory_order_release);
+}
+
+bool ArmStatePoller::read(ArmState& out) const
+{
+  if (!m_published.load(std::memory_order_acquire)) return false;
+
+  unsigned long long words[WORDS];
+  unsigned int before, after;
+  do
+  {
+    before = m_seq.load(std::memory_order_acquire);
+    for (int i = 0; i < WORDS; i++) words[i] = m_words[i].load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    after = m_seq.load(std::memory_order_relaxed);
+  } while ((before & 1) || before != after);
+
+  std::memcpy(&out, words, sizeof(ArmState));
+  return true;
+}
+
+double ArmStatePoller::age(const ArmState& s, ArmState::Clock::time_point now)
+{
+  return std::chrono::duration<double>(now - s.stamp).count();
+}
@@ -0,0 +1,254 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  CycleMetrics.cpp
+ * @brief Cycle throughput / availability metrics for Manager
+ * @date $Date$
+ *
+ * $Id$
+ */
+
+#include "CycleMetrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+CycleMetrics::CycleMetrics()
+  : m_window(600.0), m_bucket(10.0),
+    m_phase(-1), m_stopped(false),
+    m_total_cycles(0), m_total_stops(0)
+{
+  configure(m_window, m_bucket);
+}
+
+void CycleMetrics::configure(double window, double bucket)
+{
+  if (bucket <= 0.0) bucket = 1.0;
+  if (window < bucket) window = bucket;
+  m_window = window;
+  m_bucket = bucket;
+
+  // バケット数はここでだけ決まるので、以降の集計でメモリ確保は起きない
+  size_t n = static_cast<size_t>(std::ceil(window / bucket));
+  m_buckets.assign(n, Bucket());
+  for (size_t i = 0; i < m_buckets.size(); ++i) m_buckets[i].index = -1;
+}
+
+void CycleMetrics::reset(Clock::time_point now)
+{
+  for (size_t i = 0; i < m_buckets.size(); ++i)
+  {
+    std::memset(&m_buckets[i], 0, sizeof(Bucket));
+    m_buckets[i].index = -1;
+  }
+  m_origin = now;
+  m_phase_start = now;
+  m_stop_start = now;
+  m_phase = -1;
+  m_stopped = false;
+  m_total_cycles = 0;
+  m_total_stops = 0;
+}
+
+double CycleMetrics::seconds(Clock::time_point from, Clock::time_point to) const
+{
+  return std::chrono::duration<double>(to - from).count();
+}
+
+CycleMetrics::Bucket& CycleMetrics::bucketAt(Clock::time_point now)
+{
+  long index = static_cast<long>(seconds(m_origin, now) / m_bucket);
+  Bucket& b = m_buckets[index % m_buckets.size()];
+  if (b.index != index)
+  {
+    // 窓から外れた古いバケットを再利用する
+    std::memset(&b, 0, sizeof(Bucket));
+    b.index = index;
+  }
+  return b;
+}
+
+void CycleMetrics::onPhaseStart(int phase, Clock::time_point now)
+{
+  if (m_phase >= 0 && m_phase < PHASE_NUM)
+  {
+    Bucket& b = bucketAt(now);
+    b.phase_time[m_phase] += seconds(m_phase_start, now);
+    b.phase_count[m_phase] += 1;
+
+    // 最終フェーズ(Place)が終わって Pick1 に戻ったら1サイクル完了
+    if (m_phase == PHASE_NUM - 1 && phase == 0)
+    {
+      b.cycles += 1;
+      m_total_cycles += 1;
+    }
+  }
+  m_phase = phase;
+  m_phase_start = now;
+}
+
+void CycleMetrics::onStop(Clock::time_point now)
+{
+  if (m_stopped) return;
+  m_stopped = true;
+  m_stop_start = now;
+  bucketAt(now).stop_count += 1;
+  m_total_stops += 1;
+}
+
+void CycleMetrics::onResume(Clock::time_point now, double latency)
+{
+  if (!m_stopped) return;
+  m_stopped = false;
+  addStopTime(m_stop_start, now);
+
+  Bucket& b = bucketAt(now);
+  b.resume_latency += latency;
+  b.resume_count += 1;
+}
+
+void CycleMetrics::onSafetyLatency(Clock::time_point now, double latency)
+{
+  Bucket& b = bucketAt(now);
+  b.safety_latency += latency;
+  b.safety_latency_max = std::max(b.safety_latency_max, latency);
+  b.safety_count += 1;
+}
+
+void CycleMetrics::addStopTime(Clock::time_point from, Clock::time_point to)
+{
+  // 停止がバケット境界をまたぐ場合は各バケットへ按分する
+  while (from < to)
+  {
+    long index = static_cast<long>(seconds(m_origin, from) / m_bucket);
+    Clock::time_point edge = m_origin +
+      std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>((index + 1) * m_bucket));
+    Clock::time_point end = std::min(edge, to);
+    bucketAt(from).stop_time += seconds(from, end);
+    if (end <= from) break;
+    from = end;
+  }
+}
+
+CycleMetrics::Snapshot CycleMetrics::snapshot(Clock::time_point now) const
+{
+  Snapshot s;
+  std::memset(&s, 0, sizeof(s));
+
+  double elapsed = seconds(m_origin, now);
+  long current = static_cast<long>(elapsed / m_bucket);
+  long first = current - static_cast<long>(m_buckets.size()) + 1;
+  double window_start = std::max(0.0, first * m_bucket);
+  s.window = elapsed - window_start;
+
+  double resume_count = 0;
+  double safety_count = 0;
+  double phase_count[PHASE_NUM] = {0};
+  for (size_t i = 0; i < m_buckets.size(); ++i)
+  {
+    const Bucket& b = m_buckets[i];
+    if (b.index < first || b.index > current) continue;
+    s.cycles += b.cycles;
+    s.stop_count += b.stop_count;
+    s.stop_time += b.stop_time;
+    s.resume_latency += b.resume_latency;
+    resume_count += b.resume_count;
+    s.safety_latency += b.safety_latency;
+    s.safety_latency_max = std::max(s.safety_latency_max, b.safety_latency_max);
+    safety_count += b.safety_count;
+    for (int p = 0; p < PHASE_NUM; ++p)
+    {
+      s.phase_time[p] += b.phase_time[p];
+      phase_count[p] += b.phase_count[p];
+    }
+  }
+
+  // 継続中の停止も窓内の分だけ計上する
+  if (m_stopped)
+  {
+    double from = std::max(seconds(m_origin, m_stop_start), window_start);
+    s.stop_time += std::max(0.0, elapsed - from);
+  }
+
+  if (resume_count > 0) s.resume_latency /= resume_count;
+  s.cycles_total = m_total_cycles;
+  s.stop_count_total = m_total_stops;
+  if (safety_count > 0) s.safety_latency /= safety_count;
+  for (int p = 0; p < PHASE_NUM; ++p)
+  {
+    if (phase_count[p] > 0) s.phase_time[p] /= phase_count[p];
+  }
+
+  if (s.window > 0.0)
+  {
+    s.cycles_per_hour = s.cycles / s.window * 3600.0;
+    s.picks_per_hour = s.cycles_per_hour * PICKS_PER_CYCLE;
+    s.availability = 1.0 - std::min(s.stop_time, s.window) / s.window;
+  }
+
+  // 停止がなかった場合のサイクル時間から、停止で失ったサイクル数を見積もる
+  double productive = s.window - s.stop_time;
+  if (s.cycles > 0 && productive > 0.0)
+  {
+    double ideal_cycle = productive / s.cycles;
+    double lost_cycles = s.stop_time / ideal_cycle;
+    if (s.stop_count > 0) s.lost_cycles_per_stop = lost_cycles / s.stop_count;
+    s.lost_picks_per_hour = lost_cycles * PICKS_PER_CYCLE / s.window * 3600.0;
+  }
+
+  return s;
+}
+
+void CycleMetrics::toArray(const Snapshot& s, double* out)
+{
+  out[0]  = s.window;
+  out[1]  = s.cycles;
+  out[2]  = s.cycles_per_hour;
+  out[3]  = s.picks_per_hour;
+  out[4]  = s.availability;
+  out[5]  = s.stop_count;
+  out[6]  = s.stop_time;
+  out[7]  = s.resume_latency;
+  out[8]  = s.lost_cycles_per_stop;
+  out[9]  = s.lost_picks_per_hour;
+  out[10] = s.safety_latency;
+  for (int p = 0; p < PHASE_NUM; ++p) out[11 + p] = s.phase_time[p];
+}
+
+bool CycleMetrics::writeFile(const std::string& path, Clock::time_point now) const
+{
+  return writeFile(path, snapshot(now));
+}
+
+bool CycleMetrics::writeFile(const std::string& path, const Snapshot& s)
+{
+  if (path.empty()) return false;
+
+  std::string tmp = path + ".tmp";
+  FILE* fp = std::fopen(tmp.c_str(), "w");
+  if (fp == NULL) return false;
+
+  std::fprintf(fp, "window_seconds %.3f\n", s.window);
+  std::fprintf(fp, "cycles %.0f\n", s.cycles);
+  std::fprintf(fp, "cycles_total %.0f\n", s.cycles_total);
+  std::fprintf(fp, "cycles_per_hour %.2f\n", s.cycles_per_hour);
+  std::fprintf(fp, "picks_per_hour %.2f\n", s.picks_per_hour);
+  std::fprintf(fp, "availability %.4f\n", s.availability);
+  std::fprintf(fp, "stop_count %.0f\n", s.stop_count);
+  std::fprintf(fp, "stop_count_total %.0f\n", s.stop_count_total);
+  std::fprintf(fp, "stop_seconds %.3f\n", s.stop_time);
+  std::fprintf(fp, "resume_latency_seconds %.6f\n", s.resume_latency);
+  std::fprintf(fp, "lost_cycles_per_stop %.3f\n", s.lost_cycles_per_stop);
+  std::fprintf(fp, "lost_picks_per_hour %.2f\n", s.lost_picks_per_hour);
+  std::fprintf(fp, "safety_latency_seconds %.6f\n", s.safety_latency);
+  std::fprintf(fp, "safety_latency_max_seconds %.6f\n", s.safety_latency_max);
+  for (int p = 0; p < PHASE_NUM; ++p)
+  {
+    std::fprintf(fp, "phase_seconds{phase=\"%d\"} %.3f\n", p, s.phase_time[p]);
+  }
+  std::fclose(fp);
+
+  return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
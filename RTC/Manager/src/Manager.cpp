@@ -23,6 +23,54 @@ static const char* manager_spec[] =
     "max_instance",      "1",
     "language",          "C++",
     "lang_type",         "compile",
+    "conf.default.metrics_file", "Manager_metrics.txt",
+    "conf.default.metrics_window", "600",
+    "conf.default.metrics_period", "1.0",
+    "conf.default.metrics_flush_period", "10.0",
+    "conf.default.state_poll_rate", "50",
+    "conf.default.speed_deadband", "0.05",
+    "conf.default.speed_hold_time", "0.5",
+    "conf.default.speed_min_ratio", "0.1",
+    "conf.default.stop_heartbeat", "1.0",
+    "conf.default.trace_file", "",
+    "conf.default.prom_export", "",
+    "conf.default.prom_export_period", "5.0",
+    "conf.default.overrun_budget", "10",
+    "conf.default.overrun_window", "10.0",
+    "conf.default.cycle_status_period", "1.0",
+    "conf.default.phase_wait_time", "3.0",
+    "conf.__widget__.metrics_file", "text",
+    "conf.__widget__.metrics_window", "text",
+    "conf.__widget__.metrics_period", "text",
+    "conf.__widget__.metrics_flush_period", "text",
+    "conf.__widget__.state_poll_rate", "text",
+    "conf.__widget__.speed_deadband", "text",
+    "conf.__widget__.speed_hold_time", "text",
+    "conf.__widget__.speed_min_ratio", "text",
+    "conf.__widget__.stop_heartbeat", "text",
+    "conf.__widget__.trace_file", "text",
+    "conf.__widget__.prom_export", "text",
+    "conf.__widget__.prom_export_period", "text",
+    "conf.__widget__.overrun_budget", "text",
+    "conf.__widget__.overrun_window", "text",
+    "conf.__widget__.cycle_status_period", "text",
+    "conf.__widget__.phase_wait_time", "text",
+    "conf.__type__.metrics_file", "string",
+    "conf.__type__.metrics_window", "double",
+    "conf.__type__.metrics_period", "double",
+    "conf.__type__.metrics_flush_period", "double",
+    "conf.__type__.state_poll_rate", "double",
+    "conf.__type__.speed_deadband", "double",
+    "conf.__type__.speed_hold_time", "double",
+    "conf.__type__.speed_min_ratio", "double",
+    "conf.__type__.stop_heartbeat", "double",
+    "conf.__type__.trace_file", "string",
+    "conf.__type__.prom_export", "string",
+    "conf.__type__.prom_export_period", "double",
+    "conf.__type__.overrun_budget", "int",
+    "conf.__type__.overrun_window", "double",
+    "conf.__type__.cycle_status_period", "double",
+    "conf.__type__.phase_wait_time", "double",
     ""
   };
 
@@ -31,10 +79,15 @@ Manager::Manager(RTC::Manager* manager)
     m_safetyIn("safety", m_safety),
     m_end_moveIn("end_move", m_end_move),
     m_end_manipIn("end_manip", m_end_manip),
+    m_speed_ratioIn("speed_ratio", m_speed_ratio),
     m_stopOut("stop", m_stop),
     m_start_moveOut("start_move", m_start_move),
+    m_metricsOut("metrics", m_metrics),
+    m_cycle_statusOut("cycle_status", m_cycle_status),
+    m_joint_stateOut("joint_state", m_joint_state),
     m_ManipulatorCommonInterface_CommonPort("ManipulatorCommonInterface_Common"),
-    m_ManipulatorCommonInterface_MiddlePort("ManipulatorCommonInterface_Middle")
+    m_ManipulatorCommonInterface_MiddlePort("ManipulatorCommonInterface_Middle"),
+    poller(m_ManipulatorCommonInterface_Common)
 {
 }
 
@@ -47,9 +100,13 @@ RTC::ReturnCode_t Manager::onInitialize()
   addInPort("safety", m_safetyIn);
   addInPort("end_move", m_end_moveIn);
   addInPort("end_manip", m_end_manipIn);
+  addInPort("speed_ratio", m_speed_ratioIn);
 
   addOutPort("stop", m_stopOut);
   addOutPort("start_move", m_start_moveOut);
+  addOutPort("metrics", m_metricsOut);
+  addOutPort("cycle_status", m_cycle_statusOut);
+  addOutPort("joint_state", m_joint_stateOut);
 
   m_ManipulatorCommonInterface_CommonPort.registerConsumer("ManipulatorCommonInterface_Common", "JARA_ARM::ManipulatorCommonInterface_Common", m_ManipulatorCommonInterface_Common);
   m_ManipulatorCommonInterface_MiddlePort.registerConsumer("ManipulatorCommonInterface_Middle", "JARA_ARM::ManipulatorCommonInterface_Middle", m_ManipulatorCommonInterface_Middle);
@@ -57,6 +114,33 @@ RTC::ReturnCode_t Manager::onInitialize()
   addPort(m_ManipulatorCommonInterface_CommonPort);
   addPort(m_ManipulatorCommonInterface_MiddlePort);
 
+  bindParameter("metrics_file", m_metrics_file, "Manager_metrics.txt");
+  bindParameter("metrics_window", m_metrics_window, "600");
+  bindParameter("metrics_period", m_metrics_period, "1.0");
+  bindParameter("metrics_flush_period", m_metrics_flush_period, "10.0");
+  bindParameter("state_poll_rate", m_state_poll_rate, "50");
+  bindParameter("speed_deadband", m_speed_deadband, "0.05");
+  bindParameter("speed_hold_time", m_speed_hold_time, "0.5");
+  bindParameter("speed_min_ratio", m_speed_min_ratio, "0.1");
+  bindParameter("stop_heartbeat", m_stop_heartbeat, "1.0");
+  bindParameter("trace_file", m_trace_file, "");
+  bindParameter("prom_export", m_prom_export, "");
+  bindParameter("prom_export_period", m_prom_export_period, "5.0");
+  bindParameter("overrun_budget", m_overrun_budget, "10");
+  bindParameter("overrun_window", m_overrun_window, "10.0");
+  bindParameter("cycle_status_period", m_cycle_status_period, "1.0");
+  bindParameter("phase_wait_time", m_phase_wait_time, "3.0");
+
+  // 周期処理からは登録済みのメトリクスを更新するだけにする
+  std::string label = std::string("component=\"") + getInstanceName() + "\"";
+  stop_events = &MetricRegistry::counter("safety_stop_events_total", label, "Number of safety stops");
+  safety_latency = &MetricRegistry::histogram("safety_latency_seconds", label, "Camera capture to safety input latency");
+  move_time = &MetricRegistry::histogram("safety_corba_call_seconds", label + ",call=\"movePTPJointAbs\"", "CORBA call duration to the arm");
+  set_speed_time = &MetricRegistry::histogram("safety_corba_call_seconds", label + ",call=\"setSpeed\"", "CORBA call duration to the arm");
+  speed_gauge = &MetricRegistry::gauge("safety_speed_ratio", label, "Commanded arm speed ratio");
+  stopped_gauge = &MetricRegistry::gauge("safety_stopped", label, "1 while the arm is held by a safety stop");
+  monitor.attach(label);
+
   return RTC::RTC_OK;
 }
 
@@ -65,9 +149,43 @@ RTC::ReturnCode_t Manager::onActivated(RTC::UniqueId ec_id)
   sleep(1);
   std::cout << "Manager Activated: Sequence Loop Start." << std::endl;
   
-  phase = 0;          
-  wait_timer = 0;     
-  was_danger = false; 
+  // 待機時間は実行周期から周期数に換算する (800Hz, 3秒で2400)。
+  // 実際の待機時間は実測の周期から cycle_status に出力する
+  // getExecutionContext は複製した参照を返すので _var で解放する
+  RTC::ExecutionContext_var ec = getExecutionContext(ec_id);
+  double rate = CORBA::is_nil(ec) ? 0.0 : ec->get_rate();
+  double period = (rate > 0.0) ? 1.0 / rate : 1.0 / 800.0;
+  sequencer.configure(static_cast<int>(m_phase_wait_time / period + 0.5));
+  sequencer.reset();
+
+  // 集計はバケット幅10秒で行う
+  metrics.configure(m_metrics_window, 10.0);
+  CycleMetrics::Clock::time_point now = CycleMetrics::Clock::now();
+  metrics.reset(now);
+  metrics_publish_time = now;
+  metrics_flush_time = now;
+  m_metrics.data.length(CycleMetrics::SNAPSHOT_LENGTH);
+  metrics_writer.start(m_metrics_file);
+  resume_pending = false;
+  stop_published = false; // 最初の周期で必ず出力する
+
+  // アーム状態の取得を開始
+  poller.start(m_state_poll_rate);
+  joint_state_stamp = ArmState::Clock::time_point();
+
+  monitor.configure(period, m_overrun_budget, m_overrun_window);
+  m_cycle_status.data.length(CycleMonitor::STATUS_LENGTH + 1);
+  MetricRegistry::startExporter(m_prom_export, m_prom_export_period);
+  speed_gauge->set(1.0);
+  stopped_gauge->set(0.0);
+
+  // 速度比は通常速度から始める
+  m_speed_ratio.data = 1.0;
+  speed_scaler.configure(m_speed_deadband, m_speed_hold_time, m_speed_min_ratio);
+  speed_scaler.reset(now);
+  JARA_ARM::RETURN_ID_var ret;
+  ret = m_ManipulatorCommonInterface_Middle->setSpeedJoint(speed_scaler.commanded());
+  ret = m_ManipulatorCommonInterface_Middle->setSpeedCartesian(speed_scaler.commanded());
 
   // --- 座標データの定義 ---
   // Pick1姿勢
@@ -97,68 +215,264 @@ RTC::ReturnCode_t Manager::onActivated(RTC::UniqueId ec_id)
   Pick2Point[4] = 1.486;
   Pick2Point[5] = 0.000;
 
+  // 停止信号 (ありえない値 999.0)。onExecute でメモリを確保しないよう先に作っておく
+  StopPoint.length(6);
+  for(int i=0; i<6; i++) StopPoint[i] = 999.0;
+
+  Trace::dumpOnSignal(m_trace_file);
   return RTC::RTC_OK;
 }
 
 RTC::ReturnCode_t Manager::onDeactivated(RTC::UniqueId ec_id)
 {
+  poller.stop();
+  metrics_writer.stop();
+
+  // 停止時点の集計を残しておく
+  metrics.writeFile(m_metrics_file, CycleMetrics::Clock::now());
+  Trace::dump(m_trace_file);
   return RTC::RTC_OK;
 }
 
+// データのタイムスタンプからの経過時間 [s]
+static double elapsedSince(const RTC::Time& tm)
+{
+  double stamp = tm.sec + tm.nsec * 1e-9;
+  double wall = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+  return wall - stamp;
+}
+
+// 集計結果を周期的に OutPort とファイルへ出力する
+void Manager::publishMetrics(CycleMetrics::Clock::time_point now)
+{
+  if (std::chrono::duration<double>(now - metrics_publish_time).count() >= m_metrics_period)
+  {
+    metrics_publish_time = now;
+    double values[CycleMetrics::SNAPSHOT_LENGTH];
+    CycleMetrics::toArray(metrics.snapshot(now), values);
+    for (int i = 0; i < CycleMetrics::SNAPSHOT_LENGTH; i++) m_metrics.data[i] = values[i];
+    setTimestamp(m_metrics);
+    TRACE_SCOPE("Manager::metrics.write");
+    ALLOC_GUARD_PAUSE();
+    m_metricsOut.write();
+  }
+
+  if (std::chrono::duration<double>(now - metrics_flush_time).count() >= m_metrics_flush_period)
+  {
+    // ファイル出力は MetricsFileWriter のスレッドに任せ、ここでは集計を渡すだけにする
+    metrics_flush_time = now;
+    TRACE_SCOPE("Manager::metrics_writer.post");
+    metrics_writer.post(metrics.snapshot(now));
+  }
+}
+
+// 実行周期の実測値とオーバーランの状態を出力する
+void Manager::publishCycleStatus(CycleMonitor::Clock::time_point now)
+{
+  if (!monitor.statusDue(now, m_cycle_status_period)) return;
+
+  CycleMonitor::Status s = monitor.status();
+  if (s.over_budget)
+  {
+    std::cout << "Cycle overrun budget exceeded: " << s.overruns << " overruns in "
+              << m_overrun_window << "s (exec max " << s.exec_max * 1e3 << "ms)" << std::endl;
+  }
+
+  double values[CycleMonitor::STATUS_LENGTH];
+  CycleMonitor::toArray(s, values);
+  for (int i = 0; i < CycleMonitor::STATUS_LENGTH; i++) m_cycle_status.data[i] = values[i];
+  // 待機周期数 x 実測の周期 = 実際のフェーズ待機時間
+  m_cycle_status.data[CycleMonitor::STATUS_LENGTH] = sequencer.waitCycles() * s.interval;
+  setTimestamp(m_cycle_status);
+  TRACE_SCOPE("Manager::cycle_status.write");
+  ALLOC_GUARD_PAUSE();
+  m_cycle_statusOut.write();
+}
+
+// ポーリングで新しい状態が取れたときだけ関節角を書き込む
+void Manager::publishJointState()
+{
+  ArmState state;
+  if (!poller.isRunning() || !poller.read(state) || !state.valid || state.axis_num == 0) return;
+  if (state.stamp == joint_state_stamp) return;
+  joint_state_stamp = state.stamp;
+
+  // 軸数は ArmStatePoller が MAX_AXIS までに切り詰めている
+  CORBA::ULong n = static_cast<CORBA::ULong>(state.axis_num);
+  TRACE_SCOPE("Manager::joint_state.write");
+  ALLOC_GUARD_PAUSE();
+  // 軸数は変わらないので確保は最初の1回だけ
+  if (m_joint_state.data.length() != n) m_joint_state.data.length(n);
+  for (CORBA::ULong i = 0; i < n; i++) m_joint_state.data[i] = state.joints[i];
+  setTimestamp(m_joint_state);
+  m_joint_stateOut.write();
+}
+
+// 停止状態の変化時と heartbeat 周期でだけ stop を書き込む
+void Manager::publishStop(bool stop, CycleMetrics::Clock::time_point now)
+{
+  bool changed = !stop_published || (m_stop.data != stop);
+  bool heartbeat = m_stop_heartbeat > 0.0 &&
+    std::chrono::duration<double>(now - stop_publish_time).count() >= m_stop_heartbeat;
+  if (!changed && !heartbeat) return;
+
+  m_stop.data = stop;
+  setTimestamp(m_stop);
+  {
+    TRACE_SCOPE("Manager::stop.write");
+    ALLOC_GUARD_PAUSE();
+    m_stopOut.write();
+  }
+  stop_published = true;
+  stop_publish_time = now;
+}
+
+// 許容速度比が変わったときだけ速度指令を送る
+void Manager::updateSpeed(SpeedScaler::Clock::time_point now)
+{
+  unsigned long percent;
+  if (speed_scaler.update(m_speed_ratio.data, now, percent))
+  {
+    std::cout << "Speed ratio -> " << percent << "%" << std::endl;
+    TRACE_SCOPE("JARA_ARM::setSpeedJoint");
+    MetricTimer timer(*set_speed_time);
+    speed_gauge->set(percent / 100.0);
+    ALLOC_GUARD_PAUSE();
+    JARA_ARM::RETURN_ID_var ret;
+    ret = m_ManipulatorCommonInterface_Middle->setSpeedJoint(percent);
+    ret = m_ManipulatorCommonInterface_Middle->setSpeedCartesian(percent);
+  }
+}
+
+// 復帰指令後、アームが実際に動き出した時点を復帰完了とする
+void Manager::checkResume(CycleMetrics::Clock::time_point now)
+{
+  if (!resume_pending) return;
+
+  ArmState state;
+  if (!poller.isRunning() || !poller.read(state) || !state.valid)
+  {
+    // 状態が取れない場合は指令の送信完了までをレイテンシとする
+    metrics.onResume(now, std::chrono::duration<double>(now - resume_start).count());
+    resume_pending = false;
+  }
+  else if (state.stamp > resume_start && (state.state & JARA_ARM::CONST_BINARY_00000010))
+  {
+    metrics.onResume(state.stamp, std::chrono::duration<double>(state.stamp - resume_start).count());
+    resume_pending = false;
+  }
+  else if (std::chrono::duration<double>(now - resume_start).count() > 5.0)
+  {
+    // 動き出さないまま (既に目標位置にいる等) なら打ち切る
+    metrics.onResume(now, std::chrono::duration<double>(now - resume_start).count());
+    resume_pending = false;
+  }
+}
+
 // 動作指令を送信するヘルパー関数
-void Manager::sendCurrentMotion()
+void Manager::sendMotion(int phase)
 {
-    JARA_ARM::JointPos targetPoint;
+    // 座標はコピーせず参照で渡す
+    const JARA_ARM::JointPos* targetPoint;
     
     switch(phase) {
         case 0: 
             std::cout << ">>> Move to Pick1." << std::endl;
-            targetPoint = Pick1Point;
+            targetPoint = &Pick1Point;
             break;
         case 1: 
             std::cout << ">>> Move to Place." << std::endl;
-            targetPoint = PlacePoint;
+            targetPoint = &PlacePoint;
             break;
         case 2: 
             std::cout << ">>> Move to Pick2." << std::endl;
-            targetPoint = Pick2Point;
+            targetPoint = &Pick2Point;
             break;
         case 3: 
             std::cout << ">>> Move to Place." << std::endl;
-            targetPoint = PlacePoint;
+            targetPoint = &PlacePoint;
             break;
         default:
-            phase = 0;
-            targetPoint = Pick1Point;
+            targetPoint = &Pick1Point;
             break;
     }
-    m_ManipulatorCommonInterface_Middle->movePTPJointAbs(targetPoint);
+    TRACE_SCOPE("JARA_ARM::movePTPJointAbs");
+    MetricTimer timer(*move_time);
+    ALLOC_GUARD_PAUSE();
+    JARA_ARM::RETURN_ID_var ret = m_ManipulatorCommonInterface_Middle->movePTPJointAbs(*targetPoint);
 }
 
 RTC::ReturnCode_t Manager::onExecute(RTC::UniqueId ec_id)
 {
+  // 定常の制御周期ではヒープ確保をしない (ENABLE_ALLOC_GUARD ビルドで検査)。
+  // OpenRTM / CORBA 内部の確保は ALLOC_GUARD_PAUSE で除外する
+  ALLOC_GUARD_SCOPE("Manager::onExecute");
+  TRACE_SCOPE("Manager::onExecute");
+  CycleMonitor::Scope cycle(monitor);
+
+  bool safety_received = false;
   if(m_safetyIn.isNew())
   {
+    TRACE_SCOPE("Manager::safety.read");
+    ALLOC_GUARD_PAUSE();
     m_safetyIn.read();
+    safety_received = true;
+  }
+
+  if(m_speed_ratioIn.isNew())
+  {
+    TRACE_SCOPE("Manager::speed_ratio.read");
+    ALLOC_GUARD_PAUSE();
+    m_speed_ratioIn.read();
+  }
+
+  CycleMetrics::Clock::time_point now = CycleMetrics::Clock::now();
+  if (safety_received && (m_safety.tm.sec != 0 || m_safety.tm.nsec != 0))
+  {
+    // safety のタイムスタンプはカメラ取得時刻 (HumanDetection -> HumanProtection で引き継ぐ)
+    double latency = elapsedSince(m_safety.tm);
+    metrics.onSafetyLatency(now, latency);
+    safety_latency->observe(latency);
   }
+  publishMetrics(now);
+  publishCycleStatus(now);
+  publishJointState();
+
+  // 接近度合いに応じた減速 (停止は下の safety で扱う)
+  updateSpeed(now);
+
+  unsigned int actions = sequencer.step(m_safety.data != 0);
 
   // ============================================================
   // 1. 危険検知時 (safety != 0) -> 強制停止
   // ============================================================
-  if(m_safety.data != 0)
+  if(actions & MotionSequencer::STOP)
   {
     // 停止信号（ありえない値 999.0）を送信して、ブリッジ側で急停止させる
-    JARA_ARM::JointPos stopCmd;
-    stopCmd.length(6);
-    for(int i=0; i<6; i++) stopCmd[i] = 999.0;
-    m_ManipulatorCommonInterface_Middle->movePTPJointAbs(stopCmd);
+    {
+      TRACE_SCOPE("JARA_ARM::movePTPJointAbs(stop)");
+      MetricTimer timer(*move_time);
+      ALLOC_GUARD_PAUSE();
+      JARA_ARM::RETURN_ID_var ret = m_ManipulatorCommonInterface_Middle->movePTPJointAbs(StopPoint);
+    }
 
     // ログ表示
     // std::cout << "DANGER DETECTED! SENDING STOP SIGNAL (999.0)." << std::endl;
     
-    m_stop.data = "1";
-    m_stopOut.write();
-    was_danger = true;
+    publishStop(true, now);
+    if (actions & MotionSequencer::STOP_BEGIN)
+    {
+      TRACE_INSTANT("Manager::stop begin");
+      stop_events->inc();
+      stopped_gauge->set(1.0);
+      // 復帰待ちの途中で再停止した場合は、そこで前回の停止を締める
+      if (resume_pending)
+      {
+        metrics.onResume(now, std::chrono::duration<double>(now - resume_start).count());
+        resume_pending = false;
+      }
+      metrics.onStop(now);
+    }
     
     return RTC::RTC_OK; 
   }
@@ -167,30 +481,26 @@ RTC::ReturnCode_t Manager::onExecute(RTC::UniqueId ec_id)
   // ============================================================
   else 
   {
-    m_stop.data = "0";
-    m_stopOut.write();
+    publishStop(false, now);
 
     // ★復帰処理★
-    if (was_danger)
+    if (actions & MotionSequencer::RESUME)
     {
         std::cout << "Safety Restored. RESUMING Current Motion." << std::endl;
-        sendCurrentMotion(); // 中断していた動作を再送信
-        was_danger = false;
+        stopped_gauge->set(0.0);
+        sendMotion(sequencer.resumePhase()); // 中断していた動作を再送信
+        resume_pending = true;
+        resume_start = now;
     }
 
-    if (wait_timer > 0) {
-        wait_timer--;
-        return RTC::RTC_OK;
-    }
+    checkResume(CycleMetrics::Clock::now());
 
-    // 待機終了、次の動作へ
-    sendCurrentMotion();
-
-    phase++;
-    if (phase > 3) phase = 0;
-
-    // 3秒待機 (800Hz換算で2400)
-    wait_timer = 2400; 
+    // 待機終了、次の動作へ (待機周期数は onActivated で設定)
+    if (actions & MotionSequencer::ADVANCE)
+    {
+        metrics.onPhaseStart(sequencer.advancePhase(), now);
+        sendMotion(sequencer.advancePhase());
+    }
   }
 
   return RTC::RTC_OK;
@@ -0,0 +1,69 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  MetricsFileWriter.cpp
+ * @brief Background writer of the cycle metrics file for Manager
+ * @date $Date$
+ *
+ * $Id$
+ */
+
+#include "MetricsFileWriter.h"
+
+MetricsFileWriter::MetricsFileWriter()
+  : m_posted(false), m_running(false)
+{
+}
+
+MetricsFileWriter::~MetricsFileWriter()
+{
+  stop();
+}
+
+void MetricsFileWriter::start(const std::string& path)
+{
+  stop();
+  if (path.empty()) return;
+
+  m_path = path;
+  m_posted = false;
+  m_running = true;
+  m_thread = std::thread(&MetricsFileWriter::run, this);
+}
+
+void MetricsFileWriter::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_running = false;
+  }
+  m_cond.notify_all();
+  if (m_thread.joinable()) m_thread.join();
+}
+
+bool MetricsFileWriter::post(const CycleMetrics::Snapshot& s)
+{
+  // 書き手がコピー中なら次の flush 周期に回す
+  std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+  if (!lock.owns_lock() || !m_running) return false;
+  m_pending = s;
+  m_posted = true;
+  lock.unlock();
+  m_cond.notify_one();
+  return true;
+}
+
+void MetricsFileWriter::run()
+{
+  while (true)
+  {
+    CycleMetrics::Snapshot s;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cond.wait(lock, [this] { return m_posted || !m_running; });
+      if (!m_running) break;
+      s = m_pending;
+      m_posted = false;
+    }
+    CycleMetrics::writeFile(m_path, s);
+  }
+}
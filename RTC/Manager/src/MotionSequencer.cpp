@@ -0,0 +1,66 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  MotionSequencer.cpp
+ * @brief Pick & place phase sequencing of Manager
+ * @date $Date$
+ *
+ * $Id$
+ */
+
+#include "MotionSequencer.h"
+
+MotionSequencer::MotionSequencer()
+  : m_wait_cycles(2400)
+{
+  reset();
+}
+
+void MotionSequencer::configure(int wait_cycles)
+{
+  m_wait_cycles = (wait_cycles > 0) ? wait_cycles : 0;
+}
+
+void MotionSequencer::reset()
+{
+  m_phase = 0;
+  m_wait_timer = 0;
+  m_was_danger = false;
+  m_resume_phase = 0;
+  m_advance_phase = 0;
+}
+
+unsigned int MotionSequencer::step(bool danger)
+{
+  // 危険検知時 -> 強制停止
+  if (danger)
+  {
+    unsigned int actions = STOP;
+    if (!m_was_danger) actions |= STOP_BEGIN;
+    m_was_danger = true;
+    return actions;
+  }
+
+  // 安全時 -> 動作継続 / 再開
+  unsigned int actions = 0;
+  if (m_was_danger)
+  {
+    // 再送信するのは現在の phase (次に送る予定だったフェーズ)
+    actions |= RESUME;
+    m_resume_phase = m_phase;
+    m_was_danger = false;
+  }
+
+  if (m_wait_timer > 0)
+  {
+    m_wait_timer--;
+    return actions;
+  }
+
+  // 待機終了、次の動作へ
+  actions |= ADVANCE;
+  m_advance_phase = m_phase;
+  m_phase++;
+  if (m_phase >= PHASE_NUM) m_phase = 0;
+  m_wait_timer = m_wait_cycles;
+  return actions;
+}
@@ -0,0 +1,73 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  SpeedScaler.cpp
+ * @brief Rate-limited speed ratio controller for Manager
+ * @date $Date$
+ *
+ * $Id$
+ */
+
+#include "SpeedScaler.h"
+
+#include <algorithm>
+#include <cmath>
+
+SpeedScaler::SpeedScaler()
+  : m_deadband(0.05), m_hold_time(0.5), m_min_ratio(0.1),
+    m_commanded(100), m_raising(false)
+{
+}
+
+void SpeedScaler::configure(double deadband, double hold_time, double min_ratio)
+{
+  m_deadband = std::max(0.0, deadband);
+  m_hold_time = std::max(0.0, hold_time);
+  m_min_ratio = std::max(0.01, std::min(1.0, min_ratio));
+}
+
+void SpeedScaler::reset(Clock::time_point now)
+{
+  m_commanded = 100;
+  m_raising = false;
+  m_raise_since = now;
+}
+
+bool SpeedScaler::update(double ratio, Clock::time_point now, unsigned long& percent)
+{
+  if (!(ratio >= m_min_ratio)) ratio = m_min_ratio; // NaN も下限に寄せる
+  if (ratio > 1.0) ratio = 1.0;
+
+  unsigned long target = static_cast<unsigned long>(std::floor(ratio * 100.0 + 0.5));
+  double current = m_commanded / 100.0;
+
+  // 減速は安全側なので待たずに反映する
+  if (ratio <= current - m_deadband)
+  {
+    m_raising = false;
+    m_commanded = target;
+    percent = target;
+    return true;
+  }
+
+  // 加速は不感帯を超えた状態が続いてから反映する
+  // (上限の 100% へ戻る場合は不感帯より小さい差でも戻す)
+  if (ratio >= current + m_deadband || (target == 100 && m_commanded != 100))
+  {
+    if (!m_raising)
+    {
+      m_raising = true;
+      m_raise_since = now;
+    }
+    if (std::chrono::duration<double>(now - m_raise_since).count() >= m_hold_time)
+    {
+      m_raising = false;
+      m_commanded = target;
+      percent = target;
+      return true;
+    }
+    return false;
+  }
+
+  m_raising = false;
+  return false;
+}
@@ -7,7 +7,7 @@
  * $Id$
  */
 
-#ifndef MANAGER_TEST__H
+#ifndef MANAGER_TEST_H
 #define MANAGER_TEST_H
 
 #include <rtm/idl/BasicDataTypeSkel.h>
@@ -18,7 +18,6 @@
 // <rtc-template block="service_impl_h">
 #include "ManipulatorCommonInterface_CommonSVC_impl.h"
 #include "ManipulatorCommonInterface_MiddleSVC_impl.h"
-#include "BasicDataTypeSVC_impl.h"
 
 // </rtc-template>
 
@@ -37,6 +36,10 @@
 #include <rtm/DataInPort.h>
 #include <rtm/DataOutPort.h>
 
+#include <chrono>
+
+#include "SimulatedArm.h"
+
 /*!
  * @class ManagerTest
  * @brief Manager
@@ -229,15 +232,45 @@ class ManagerTest
 
   // Configuration variable declaration
   // <rtc-template block="config_declare">
+  /*!
+   * 実時間に対するシミュレーション時間の倍率
+   * - Name: time_scale
+   * - DefaultValue: 1.0
+   */
+  double m_time_scale;
+  /*!
+   * 各関節の最高速度 [rad/s]
+   * - Name: max_speed
+   * - DefaultValue: 1.0
+   */
+  double m_max_speed;
+  /*!
+   * 最高速度までの加速時間 [s]
+   * - Name: accel_time
+   * - DefaultValue: 0.2
+   */
+  double m_accel_time;
+  /*!
+   * 侵入を模擬する周期 [s] (シミュレーション時間, 0で無効)
+   * - Name: intrusion_period
+   * - DefaultValue: 0
+   */
+  double m_intrusion_period;
+  /*!
+   * 1回の侵入の継続時間 [s] (シミュレーション時間)
+   * - Name: intrusion_duration
+   * - DefaultValue: 2.0
+   */
+  double m_intrusion_duration;
 
   // </rtc-template>
 
   // DataInPort declaration
   // <rtc-template block="inport_declare">
-  RTC::TimedString m_stop;
+  RTC::TimedBoolean m_stop;
   /*!
    */
-  RTC::InPort<RTC::TimedString> m_stopIn;
+  RTC::InPort<RTC::TimedBoolean> m_stopIn;
   RTC::TimedString m_start_move;
   /*!
    */
@@ -278,10 +311,10 @@ class ManagerTest
   // <rtc-template block="service_declare">
   /*!
    */
-  ManipulatorCommonInterface_CommonSVC_impl m_ManipulatorCommonInterface_Common;
+  JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl m_ManipulatorCommonInterface_Common;
   /*!
    */
-  ManipulatorCommonInterface_MiddleSVC_impl m_ManipulatorCommonInterface_Middle;
+  JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl m_ManipulatorCommonInterface_Middle;
   
   // </rtc-template>
 
@@ -295,6 +328,12 @@ class ManagerTest
   
   // </rtc-template>
 
+  // サーバントが共有するシミュレータ
+  SimulatedArm m_arm;
+  std::chrono::steady_clock::time_point m_last_step;
+  long m_reported_moves;
+  long m_stop_msgs;   // Manager から受け取った stop の件数
+
   // <rtc-template block="private_operation">
   
   // </rtc-template>
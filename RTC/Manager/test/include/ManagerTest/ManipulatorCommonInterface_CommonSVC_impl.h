@@ -10,12 +10,16 @@
 
 #include "ManipulatorCommonInterface_CommonSkel.h"
 
+#include "SimulatedArm.h"
+
 #ifndef MANIPULATORCOMMONINTERFACE_COMMONSVC_IMPL_H
 #define MANIPULATORCOMMONINTERFACE_COMMONSVC_IMPL_H
  
 /*!
  * @class JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl
  * Example class implementing IDL interface JARA_ARM::ManipulatorCommonInterface_Common
+ *
+ * SimulatedArm の状態を返すシミュレーション用の実装
  */
 class JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl
  : public virtual POA_JARA_ARM::ManipulatorCommonInterface_Common,
@@ -36,6 +40,11 @@ class JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl
    */
    virtual ~JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl();
 
+   /*!
+    * @brief 指令を受けるシミュレータを設定する
+    */
+   void setArm(SimulatedArm* arm) { m_arm = arm; }
+
    // attributes and operations
    JARA_ARM::RETURN_ID* clearAlarms();
    JARA_ARM::RETURN_ID* getActiveAlarm(JARA_ARM::AlarmSeq_out alarms);
@@ -47,8 +56,17 @@ class JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl
    JARA_ARM::RETURN_ID* servoON();
    JARA_ARM::RETURN_ID* setSoftLimitJoint(const JARA_ARM::LimitSeq& softLimit);
 
+ private:
+   SimulatedArm* m_arm;
+   JARA_ARM::LimitSeq m_softLimit;
+
 };
 
+/*!
+ * @brief RETURN_ID を生成する (Middle 側のサーバントと共用)
+ */
+JARA_ARM::RETURN_ID* MakeReturnId(::CORBA::Long id, const char* comment);
+
 
 
 #endif // MANIPULATORCOMMONINTERFACE_COMMONSVC_IMPL_H
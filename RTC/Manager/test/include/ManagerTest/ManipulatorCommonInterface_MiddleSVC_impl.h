@@ -10,12 +10,18 @@
 
 #include "ManipulatorCommonInterface_MiddleLevelSkel.h"
 
+#include "ManipulatorCommonInterface_CommonSVC_impl.h"
+#include "SimulatedArm.h"
+
 #ifndef MANIPULATORCOMMONINTERFACE_MIDDLESVC_IMPL_H
 #define MANIPULATORCOMMONINTERFACE_MIDDLESVC_IMPL_H
  
 /*!
  * @class JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl
  * Example class implementing IDL interface JARA_ARM::ManipulatorCommonInterface_Middle
+ *
+ * 関節空間の指令を SimulatedArm へ渡すシミュレーション用の実装。
+ * 直交座標系の指令は NOT_IMPLEMENTED を返す。
  */
 class JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl
  : public virtual POA_JARA_ARM::ManipulatorCommonInterface_Middle,
@@ -36,6 +42,11 @@ class JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl
    */
    virtual ~JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl();
 
+   /*!
+    * @brief 指令を受けるシミュレータを設定する
+    */
+   void setArm(SimulatedArm* arm) { m_arm = arm; }
+
    // attributes and operations
    JARA_ARM::RETURN_ID* closeGripper();
    JARA_ARM::RETURN_ID* getBaseOffset(JARA_ARM::HgMatrix offset);
@@ -73,6 +84,9 @@ class JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl
    JARA_ARM::RETURN_ID* getHome(JARA_ARM::JointPos_out jointPoint);
    JARA_ARM::RETURN_ID* goHome();
 
+ private:
+   SimulatedArm* m_arm;
+
 };
 
 
@@ -0,0 +1,106 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  SimulatedArm.h
+ * @brief Kinematic 6-axis arm simulator for ManagerTest
+ * @date  $Date$
+ *
+ * $Id$
+ */
+
+#ifndef SIMULATEDARM_H
+#define SIMULATEDARM_H
+
+#include <mutex>
+
+/*!
+ * @class SimulatedArm
+ * @brief 関節速度・加速度制限つきで PTP 動作を補間する運動学シミュレータ
+ *
+ * ManipulatorCommonInterface のサーバント (CORBA スレッド) から指令を受け、
+ * ManagerTest::onExecute から step() でシミュレーション時刻を進める。
+ * step() に実時間より長い dt を渡せば実時間より速く回せる。
+ *
+ * Manager が送る停止信号 (全関節 999.0) は ROS ブリッジと同じく stop() として扱う。
+ */
+class SimulatedArm
+{
+ public:
+  static const int AXIS_NUM = 6;
+
+  // getState() のビット (ManipulatorCommonInterface_Common.idl と同じ並び)
+  static const unsigned long STATE_SERVO_ON = 0x01;
+  static const unsigned long STATE_MOVING   = 0x02;
+
+  // 停止信号とみなす関節値
+  static const double STOP_SENTINEL;
+
+  SimulatedArm();
+
+  /*!
+   * @brief シミュレーション時刻を dt [s] 進める
+   */
+  void step(double dt);
+
+  // --- 指令 ---
+  bool movePTPJointAbs(const double* target, int n);
+  bool movePTPJointRel(const double* delta, int n);
+  void pause();
+  void resume();
+  void stop();
+  void setSpeedRatio(unsigned long percent);
+  void setMaxSpeed(const double* speed, int n);
+  void setAccelTime(double time);
+  void setServo(bool on);
+  void setHome(const double* pos, int n);
+  bool goHome();
+
+  // --- 状態 ---
+  void getPosition(double* pos) const;
+  void getHome(double* pos) const;
+  void getMaxSpeed(double* speed) const;
+  double getAccelTime() const;
+  unsigned long getState() const;
+  double getTime() const;
+  bool isMoving() const;
+
+  /*!
+   * @brief 停止レイテンシの統計
+   *
+   * stop()/pause()/停止信号を受けてから全関節の速度が0になるまでの
+   * シミュレーション時間。
+   */
+  void getStopLatency(double& last, double& mean, double& max, long& count) const;
+
+  long getCompletedMoves() const;
+
+ private:
+  void startMove(const double* target);
+  void requestHalt(bool keep_target);
+  void integrate(double dt);
+
+  mutable std::mutex m_mutex;
+
+  double m_time;
+  double m_pos[AXIS_NUM];
+  double m_vel[AXIS_NUM];
+  double m_target[AXIS_NUM];
+  double m_home[AXIS_NUM];
+  double m_max_speed[AXIS_NUM];  // [rad/s]
+  double m_scale[AXIS_NUM];      // 同期 PTP 用の関節ごとの速度倍率
+  double m_accel_time;           // 最高速度までの加速時間 [s]
+  double m_speed_ratio;          // setSpeedJoint [0, 1]
+
+  bool m_servo;
+  bool m_moving;                 // 目標に向かって動作中
+  bool m_paused;                 // 一時停止中 (目標は保持)
+  bool m_halting;                // 減速停止中
+
+  double m_halt_time;
+  double m_stop_last;
+  double m_stop_sum;
+  double m_stop_max;
+  long   m_stop_count;
+  long   m_moves;
+};
+
+#endif // SIMULATEDARM_H
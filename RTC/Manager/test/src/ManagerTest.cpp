@@ -9,6 +9,9 @@
 
 #include "ManagerTest.h"
 
+#include <cmath>
+#include <cstdio>
+
 // Module specification
 // <rtc-template block="module_spec">
 static const char* manager_spec[] =
@@ -24,6 +27,21 @@ static const char* manager_spec[] =
     "max_instance",      "1",
     "language",          "C++",
     "lang_type",         "compile",
+    "conf.default.time_scale", "1.0",
+    "conf.default.max_speed", "1.0",
+    "conf.default.accel_time", "0.2",
+    "conf.default.intrusion_period", "0",
+    "conf.default.intrusion_duration", "2.0",
+    "conf.__widget__.time_scale", "text",
+    "conf.__widget__.max_speed", "text",
+    "conf.__widget__.accel_time", "text",
+    "conf.__widget__.intrusion_period", "text",
+    "conf.__widget__.intrusion_duration", "text",
+    "conf.__type__.time_scale", "double",
+    "conf.__type__.max_speed", "double",
+    "conf.__type__.accel_time", "double",
+    "conf.__type__.intrusion_period", "double",
+    "conf.__type__.intrusion_duration", "double",
     ""
   };
 // </rtc-template>
@@ -35,16 +53,18 @@ static const char* manager_spec[] =
 ManagerTest::ManagerTest(RTC::Manager* manager)
     // <rtc-template block="initializer">
   : RTC::DataFlowComponentBase(manager),
-    m_safetyIn("safety", m_safety),
-    m_end_moveIn("end_move", m_end_move),
-    m_end_manipIn("end_manip", m_end_manip),
-    m_stopOut("stop", m_stop),
-    m_start_moveOut("start_move", m_start_move),
+    m_stopIn("stop", m_stop),
+    m_start_moveIn("start_move", m_start_move),
+    m_safetyOut("safety", m_safety),
+    m_end_moveOut("end_move", m_end_move),
+    m_end_manipOut("end_manip", m_end_manip),
     m_ManipulatorCommonInterface_CommonPort("ManipulatorCommonInterface_Common"),
     m_ManipulatorCommonInterface_MiddlePort("ManipulatorCommonInterface_Middle")
 
     // </rtc-template>
 {
+  m_ManipulatorCommonInterface_Common.setArm(&m_arm);
+  m_ManipulatorCommonInterface_Middle.setArm(&m_arm);
 }
 
 /*!
@@ -82,6 +102,11 @@ RTC::ReturnCode_t ManagerTest::onInitialize()
   // </rtc-template>
 
   // <rtc-template block="bind_config">
+  bindParameter("time_scale", m_time_scale, "1.0");
+  bindParameter("max_speed", m_max_speed, "1.0");
+  bindParameter("accel_time", m_accel_time, "0.2");
+  bindParameter("intrusion_period", m_intrusion_period, "0");
+  bindParameter("intrusion_duration", m_intrusion_duration, "2.0");
   // </rtc-template>
 
   return RTC::RTC_OK;
@@ -111,18 +136,72 @@ RTC::ReturnCode_t ManagerTest::onShutdown(RTC::UniqueId ec_id)
 
 RTC::ReturnCode_t ManagerTest::onActivated(RTC::UniqueId ec_id)
 {
+  double max_speed[SimulatedArm::AXIS_NUM];
+  for (int i = 0; i < SimulatedArm::AXIS_NUM; i++) max_speed[i] = m_max_speed;
+  m_arm.setMaxSpeed(max_speed, SimulatedArm::AXIS_NUM);
+  m_arm.setAccelTime(m_accel_time);
+  m_arm.setServo(true);
+
+  m_last_step = std::chrono::steady_clock::now();
+  m_reported_moves = m_arm.getCompletedMoves();
+  m_stop_msgs = 0;
+
+  m_safety.data = false;
+  m_safetyOut.write();
   return RTC::RTC_OK;
 }
 
 
 RTC::ReturnCode_t ManagerTest::onDeactivated(RTC::UniqueId ec_id)
 {
+  double last, mean, max;
+  long count;
+  m_arm.getStopLatency(last, mean, max, count);
+  std::printf("SimulatedArm: t=%.3f s, moves=%ld, stops=%ld, stop latency mean=%.3f s max=%.3f s\n",
+              m_arm.getTime(), m_arm.getCompletedMoves(), count, mean, max);
+  std::printf("ManagerTest: stop messages received=%ld\n", m_stop_msgs);
   return RTC::RTC_OK;
 }
 
 
 RTC::ReturnCode_t ManagerTest::onExecute(RTC::UniqueId ec_id)
 {
+  // 実経過時間に倍率を掛けてシミュレーション時刻を進める
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  double dt = std::chrono::duration<double>(now - m_last_step).count();
+  m_last_step = now;
+  m_arm.step(dt * m_time_scale);
+
+  // stop は変化時と heartbeat でしか届かないので件数だけ数える
+  while (m_stopIn.isNew())
+  {
+    m_stopIn.read();
+    m_stop_msgs++;
+  }
+
+  // 周期的な侵入を模擬して safety を出す
+  if (m_intrusion_period > 0.0)
+  {
+    double t = std::fmod(m_arm.getTime(), m_intrusion_period);
+    bool danger = (t >= m_intrusion_period - m_intrusion_duration);
+    if (danger != static_cast<bool>(m_safety.data))
+    {
+      m_safety.data = danger;
+      setTimestamp(m_safety);
+      m_safetyOut.write();
+    }
+  }
+
+  // 動作完了をブリッジと同様に end_move で通知する
+  long moves = m_arm.getCompletedMoves();
+  if (moves != m_reported_moves)
+  {
+    m_reported_moves = moves;
+    m_end_move.data = "1";
+    setTimestamp(m_end_move);
+    m_end_moveOut.write();
+  }
+
   return RTC::RTC_OK;
 }
 
@@ -7,18 +7,32 @@
 
 #include "ManipulatorCommonInterface_CommonSVC_impl.h"
 
+JARA_ARM::RETURN_ID* MakeReturnId(::CORBA::Long id, const char* comment)
+{
+  JARA_ARM::RETURN_ID_var result = new JARA_ARM::RETURN_ID();
+  result->id = id;
+  result->comment = CORBA::string_dup(comment);
+  return result._retn();
+}
+
 /*
  * Example implementational code for IDL interface JARA_ARM::ManipulatorCommonInterface_Common
  */
 JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl::JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl()
+  : m_arm(NULL)
 {
-  // Please add extra constructor code here.
+  // 関節可動範囲の初期値は ±π
+  m_softLimit.length(SimulatedArm::AXIS_NUM);
+  for (CORBA::ULong i = 0; i < m_softLimit.length(); i++)
+  {
+    m_softLimit[i].upper = 3.14159265358979;
+    m_softLimit[i].lower = -3.14159265358979;
+  }
 }
 
 
 JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl::~JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl()
 {
-  // Please add extra destructor code here.
 }
 
 
@@ -27,92 +41,71 @@ JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl::~JARA_ARM_ManipulatorCommonI
  */
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl::clearAlarms()
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl::clearAlarms()>"
-#endif
-  return result;
+  // シミュレータはアラームを発生させない
+  return MakeReturnId(JARA_ARM::OK, "");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl::getActiveAlarm(JARA_ARM::AlarmSeq_out alarms)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl::getActiveAlarm(JARA_ARM::AlarmSeq_out alarms)>"
-#endif
-  return result;
+  alarms = new JARA_ARM::AlarmSeq();
+  alarms->length(0);
+  return MakeReturnId(JARA_ARM::OK, "");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl::getFeedbackPosJoint(JARA_ARM::JointPos_out pos)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl::getFeedbackPosJoint(JARA_ARM::JointPos_out pos)>"
-#endif
-  return result;
+  double joints[SimulatedArm::AXIS_NUM];
+  m_arm->getPosition(joints);
+
+  pos = new JARA_ARM::JointPos();
+  pos->length(SimulatedArm::AXIS_NUM);
+  for (int i = 0; i < SimulatedArm::AXIS_NUM; i++) (*pos)[i] = joints[i];
+  return MakeReturnId(JARA_ARM::OK, "");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl::getManipInfo(JARA_ARM::ManipInfo_out mInfo)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl::getManipInfo(JARA_ARM::ManipInfo_out mInfo)>"
-#endif
-  return result;
+  mInfo = new JARA_ARM::ManipInfo();
+  mInfo->manufactur = CORBA::string_dup("rsdlab");
+  mInfo->type = CORBA::string_dup("SimulatedArm");
+  mInfo->axisNum = SimulatedArm::AXIS_NUM;
+  mInfo->cmdCycle = 1;
+  mInfo->isGripper = false;
+  return MakeReturnId(JARA_ARM::OK, "");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl::getSoftLimitJoint(JARA_ARM::LimitSeq_out softLimit)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl::getSoftLimitJoint(JARA_ARM::LimitSeq_out softLimit)>"
-#endif
-  return result;
+  softLimit = new JARA_ARM::LimitSeq(m_softLimit);
+  return MakeReturnId(JARA_ARM::OK, "");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl::getState(JARA_ARM::ULONG& state)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl::getState(JARA_ARM::ULONG& state)>"
-#endif
-  return result;
+  state = m_arm->getState();
+  return MakeReturnId(JARA_ARM::OK, "");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl::servoOFF()
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl::servoOFF()>"
-#endif
-  return result;
+  m_arm->setServo(false);
+  return MakeReturnId(JARA_ARM::OK, "");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl::servoON()
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl::servoON()>"
-#endif
-  return result;
+  m_arm->setServo(true);
+  return MakeReturnId(JARA_ARM::OK, "");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl::setSoftLimitJoint(const JARA_ARM::LimitSeq& softLimit)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_CommonSVC_impl::setSoftLimitJoint(const JARA_ARM::LimitSeq& softLimit)>"
-#endif
-  return result;
+  if (softLimit.length() != SimulatedArm::AXIS_NUM)
+  {
+    return MakeReturnId(JARA_ARM::VALUE_ERR, "axis number mismatch");
+  }
+  m_softLimit = softLimit;
+  return MakeReturnId(JARA_ARM::OK, "");
 }
 
 
@@ -11,14 +11,13 @@
  * Example implementational code for IDL interface JARA_ARM::ManipulatorCommonInterface_Middle
  */
 JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl()
+  : m_arm(NULL)
 {
-  // Please add extra constructor code here.
 }
 
 
 JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::~JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl()
 {
-  // Please add extra destructor code here.
 }
 
 
@@ -27,352 +26,253 @@ JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::~JARA_ARM_ManipulatorCommonI
  */
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::closeGripper()
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::closeGripper()>"
-#endif
-  return result;
+  // グリッパはモデル化していないので受け付けるだけ
+  return MakeReturnId(JARA_ARM::OK, "");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::getBaseOffset(JARA_ARM::HgMatrix offset)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::getBaseOffset(JARA_ARM::HgMatrix offset)>"
-#endif
-  return result;
+  return MakeReturnId(JARA_ARM::NOT_IMPLEMENTED, "not supported by SimulatedArm");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::getFeedbackPosCartesian(JARA_ARM::CarPosWithElbow& pos)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::getFeedbackPosCartesian(JARA_ARM::CarPosWithElbow& pos)>"
-#endif
-  return result;
+  // 直交座標系の指令はシミュレータでは扱わない
+  return MakeReturnId(JARA_ARM::NOT_IMPLEMENTED, "not supported by SimulatedArm");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::getMaxSpeedCartesian(JARA_ARM::CartesianSpeed& speed)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::getMaxSpeedCartesian(JARA_ARM::CartesianSpeed& speed)>"
-#endif
-  return result;
+  // 直交座標系の指令はシミュレータでは扱わない
+  return MakeReturnId(JARA_ARM::NOT_IMPLEMENTED, "not supported by SimulatedArm");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::getMaxSpeedJoint(JARA_ARM::DoubleSeq_out speed)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::getMaxSpeedJoint(JARA_ARM::DoubleSeq_out speed)>"
-#endif
-  return result;
+  double max_speed[SimulatedArm::AXIS_NUM];
+  m_arm->getMaxSpeed(max_speed);
+
+  speed = new JARA_ARM::DoubleSeq();
+  speed->length(SimulatedArm::AXIS_NUM);
+  for (int i = 0; i < SimulatedArm::AXIS_NUM; i++) (*speed)[i] = max_speed[i];
+  return MakeReturnId(JARA_ARM::OK, "");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::getMinAccelTimeCartesian(::CORBA::Double& aclTime)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::getMinAccelTimeCartesian(::CORBA::Double& aclTime)>"
-#endif
-  return result;
+  // 直交座標系の指令はシミュレータでは扱わない
+  return MakeReturnId(JARA_ARM::NOT_IMPLEMENTED, "not supported by SimulatedArm");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::getMinAccelTimeJoint(::CORBA::Double& aclTime)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::getMinAccelTimeJoint(::CORBA::Double& aclTime)>"
-#endif
-  return result;
+  aclTime = m_arm->getAccelTime();
+  return MakeReturnId(JARA_ARM::OK, "");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::getSoftLimitCartesian(JARA_ARM::LimitValue& xLimit, JARA_ARM::LimitValue& yLimit, JARA_ARM::LimitValue& zLimit)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::getSoftLimitCartesian(JARA_ARM::LimitValue& xLimit, JARA_ARM::LimitValue& yLimit, JARA_ARM::LimitValue& zLimit)>"
-#endif
-  return result;
+  // 直交座標系の指令はシミュレータでは扱わない
+  return MakeReturnId(JARA_ARM::NOT_IMPLEMENTED, "not supported by SimulatedArm");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::moveGripper(JARA_ARM::ULONG angleRatio)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::moveGripper(JARA_ARM::ULONG angleRatio)>"
-#endif
-  return result;
+  return MakeReturnId(JARA_ARM::OK, "");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::moveLinearCartesianAbs(const JARA_ARM::CarPosWithElbow& carPoint)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::moveLinearCartesianAbs(const JARA_ARM::CarPosWithElbow& carPoint)>"
-#endif
-  return result;
+  // 直交座標系の指令はシミュレータでは扱わない
+  return MakeReturnId(JARA_ARM::NOT_IMPLEMENTED, "not supported by SimulatedArm");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::moveLinearCartesianRel(const JARA_ARM::CarPosWithElbow& carPoint)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::moveLinearCartesianRel(const JARA_ARM::CarPosWithElbow& carPoint)>"
-#endif
-  return result;
+  // 直交座標系の指令はシミュレータでは扱わない
+  return MakeReturnId(JARA_ARM::NOT_IMPLEMENTED, "not supported by SimulatedArm");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::movePTPCartesianAbs(const JARA_ARM::CarPosWithElbow& carPoint)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::movePTPCartesianAbs(const JARA_ARM::CarPosWithElbow& carPoint)>"
-#endif
-  return result;
+  // 直交座標系の指令はシミュレータでは扱わない
+  return MakeReturnId(JARA_ARM::NOT_IMPLEMENTED, "not supported by SimulatedArm");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::movePTPCartesianRel(const JARA_ARM::CarPosWithElbow& carPoint)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::movePTPCartesianRel(const JARA_ARM::CarPosWithElbow& carPoint)>"
-#endif
-  return result;
+  // 直交座標系の指令はシミュレータでは扱わない
+  return MakeReturnId(JARA_ARM::NOT_IMPLEMENTED, "not supported by SimulatedArm");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::movePTPJointAbs(const JARA_ARM::JointPos& jointPoints)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::movePTPJointAbs(const JARA_ARM::JointPos& jointPoints)>"
-#endif
-  return result;
+  double target[SimulatedArm::AXIS_NUM];
+  if (jointPoints.length() != SimulatedArm::AXIS_NUM)
+  {
+    return MakeReturnId(JARA_ARM::VALUE_ERR, "axis number mismatch");
+  }
+  for (int i = 0; i < SimulatedArm::AXIS_NUM; i++) target[i] = jointPoints[i];
+
+  if (!m_arm->movePTPJointAbs(target, SimulatedArm::AXIS_NUM))
+  {
+    return MakeReturnId(JARA_ARM::NOT_SV_ON_ERR, "servo is off");
+  }
+  return MakeReturnId(JARA_ARM::OK, "");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::movePTPJointRel(const JARA_ARM::JointPos& jointPoints)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::movePTPJointRel(const JARA_ARM::JointPos& jointPoints)>"
-#endif
-  return result;
+  double delta[SimulatedArm::AXIS_NUM];
+  if (jointPoints.length() != SimulatedArm::AXIS_NUM)
+  {
+    return MakeReturnId(JARA_ARM::VALUE_ERR, "axis number mismatch");
+  }
+  for (int i = 0; i < SimulatedArm::AXIS_NUM; i++) delta[i] = jointPoints[i];
+
+  if (!m_arm->movePTPJointRel(delta, SimulatedArm::AXIS_NUM))
+  {
+    return MakeReturnId(JARA_ARM::NOT_SV_ON_ERR, "servo is off");
+  }
+  return MakeReturnId(JARA_ARM::OK, "");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::openGripper()
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::openGripper()>"
-#endif
-  return result;
+  return MakeReturnId(JARA_ARM::OK, "");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::pause()
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::pause()>"
-#endif
-  return result;
+  m_arm->pause();
+  return MakeReturnId(JARA_ARM::OK, "");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::resume()
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::resume()>"
-#endif
-  return result;
+  m_arm->resume();
+  return MakeReturnId(JARA_ARM::OK, "");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::stop()
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::stop()>"
-#endif
-  return result;
+  m_arm->stop();
+  return MakeReturnId(JARA_ARM::OK, "");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::setAccelTimeCartesian(::CORBA::Double aclTime)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::setAccelTimeCartesian(::CORBA::Double aclTime)>"
-#endif
-  return result;
+  // 直交座標系の指令はシミュレータでは扱わない
+  return MakeReturnId(JARA_ARM::NOT_IMPLEMENTED, "not supported by SimulatedArm");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::setAccelTimeJoint(::CORBA::Double aclTime)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::setAccelTimeJoint(::CORBA::Double aclTime)>"
-#endif
-  return result;
+  if (aclTime <= 0.0) return MakeReturnId(JARA_ARM::VALUE_ERR, "aclTime must be positive");
+  m_arm->setAccelTime(aclTime);
+  return MakeReturnId(JARA_ARM::OK, "");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::setBaseOffset(const JARA_ARM::HgMatrix offset)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::setBaseOffset(const JARA_ARM::HgMatrix offset)>"
-#endif
-  return result;
+  return MakeReturnId(JARA_ARM::NOT_IMPLEMENTED, "not supported by SimulatedArm");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::setControlPointOffset(const JARA_ARM::HgMatrix offset)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::setControlPointOffset(const JARA_ARM::HgMatrix offset)>"
-#endif
-  return result;
+  return MakeReturnId(JARA_ARM::NOT_IMPLEMENTED, "not supported by SimulatedArm");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::setMaxSpeedCartesian(const JARA_ARM::CartesianSpeed& speed)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::setMaxSpeedCartesian(const JARA_ARM::CartesianSpeed& speed)>"
-#endif
-  return result;
+  // 直交座標系の指令はシミュレータでは扱わない
+  return MakeReturnId(JARA_ARM::NOT_IMPLEMENTED, "not supported by SimulatedArm");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::setMaxSpeedJoint(const JARA_ARM::DoubleSeq& speed)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::setMaxSpeedJoint(const JARA_ARM::DoubleSeq& speed)>"
-#endif
-  return result;
+  double max_speed[SimulatedArm::AXIS_NUM];
+  if (speed.length() != SimulatedArm::AXIS_NUM)
+  {
+    return MakeReturnId(JARA_ARM::VALUE_ERR, "axis number mismatch");
+  }
+  for (int i = 0; i < SimulatedArm::AXIS_NUM; i++) max_speed[i] = speed[i];
+  m_arm->setMaxSpeed(max_speed, SimulatedArm::AXIS_NUM);
+  return MakeReturnId(JARA_ARM::OK, "");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::setMinAccelTimeCartesian(::CORBA::Double aclTime)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::setMinAccelTimeCartesian(::CORBA::Double aclTime)>"
-#endif
-  return result;
+  // 直交座標系の指令はシミュレータでは扱わない
+  return MakeReturnId(JARA_ARM::NOT_IMPLEMENTED, "not supported by SimulatedArm");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::setMinAccelTimeJoint(::CORBA::Double aclTime)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::setMinAccelTimeJoint(::CORBA::Double aclTime)>"
-#endif
-  return result;
+  if (aclTime <= 0.0) return MakeReturnId(JARA_ARM::VALUE_ERR, "aclTime must be positive");
+  m_arm->setAccelTime(aclTime);
+  return MakeReturnId(JARA_ARM::OK, "");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::setSoftLimitCartesian(const JARA_ARM::LimitValue& xLimit, const JARA_ARM::LimitValue& yLimit, const JARA_ARM::LimitValue& zLimit)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::setSoftLimitCartesian(const JARA_ARM::LimitValue& xLimit, const JARA_ARM::LimitValue& yLimit, const JARA_ARM::LimitValue& zLimit)>"
-#endif
-  return result;
+  // 直交座標系の指令はシミュレータでは扱わない
+  return MakeReturnId(JARA_ARM::NOT_IMPLEMENTED, "not supported by SimulatedArm");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::setSpeedCartesian(JARA_ARM::ULONG spdRatio)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::setSpeedCartesian(JARA_ARM::ULONG spdRatio)>"
-#endif
-  return result;
+  // 直交座標系の動作はないので比率だけ受け付ける
+  if (spdRatio > 100) return MakeReturnId(JARA_ARM::VALUE_ERR, "spdRatio must be 0-100");
+  return MakeReturnId(JARA_ARM::OK, "");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::setSpeedJoint(JARA_ARM::ULONG spdRatio)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::setSpeedJoint(JARA_ARM::ULONG spdRatio)>"
-#endif
-  return result;
+  if (spdRatio > 100) return MakeReturnId(JARA_ARM::VALUE_ERR, "spdRatio must be 0-100");
+  m_arm->setSpeedRatio(spdRatio);
+  return MakeReturnId(JARA_ARM::OK, "");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::moveCircularCartesianAbs(const JARA_ARM::CarPosWithElbow& carPointR, const JARA_ARM::CarPosWithElbow& carPointT)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::moveCircularCartesianAbs(const JARA_ARM::CarPosWithElbow& carPointR, const JARA_ARM::CarPosWithElbow& carPointT)>"
-#endif
-  return result;
+  // 直交座標系の指令はシミュレータでは扱わない
+  return MakeReturnId(JARA_ARM::NOT_IMPLEMENTED, "not supported by SimulatedArm");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::moveCircularCartesianRel(const JARA_ARM::CarPosWithElbow& carPointR, const JARA_ARM::CarPosWithElbow& carPointT)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::moveCircularCartesianRel(const JARA_ARM::CarPosWithElbow& carPointR, const JARA_ARM::CarPosWithElbow& carPointT)>"
-#endif
-  return result;
+  // 直交座標系の指令はシミュレータでは扱わない
+  return MakeReturnId(JARA_ARM::NOT_IMPLEMENTED, "not supported by SimulatedArm");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::setHome(const JARA_ARM::JointPos& jointPoint)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::setHome(const JARA_ARM::JointPos& jointPoint)>"
-#endif
-  return result;
+  double home[SimulatedArm::AXIS_NUM];
+  if (jointPoint.length() != SimulatedArm::AXIS_NUM)
+  {
+    return MakeReturnId(JARA_ARM::VALUE_ERR, "axis number mismatch");
+  }
+  for (int i = 0; i < SimulatedArm::AXIS_NUM; i++) home[i] = jointPoint[i];
+  m_arm->setHome(home, SimulatedArm::AXIS_NUM);
+  return MakeReturnId(JARA_ARM::OK, "");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::getHome(JARA_ARM::JointPos_out jointPoint)
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::getHome(JARA_ARM::JointPos_out jointPoint)>"
-#endif
-  return result;
+  double home[SimulatedArm::AXIS_NUM];
+  m_arm->getHome(home);
+
+  jointPoint = new JARA_ARM::JointPos();
+  jointPoint->length(SimulatedArm::AXIS_NUM);
+  for (int i = 0; i < SimulatedArm::AXIS_NUM; i++) (*jointPoint)[i] = home[i];
+  return MakeReturnId(JARA_ARM::OK, "");
 }
 
 JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::goHome()
 {
-	JARA_ARM::RETURN_ID* result;
-  // Please insert your code here and remove the following warning pragma
-#ifndef WIN32
-  #warning "Code missing in function <JARA_ARM::RETURN_ID* JARA_ARM_ManipulatorCommonInterface_MiddleSVC_impl::goHome()>"
-#endif
-  return result;
+  if (!m_arm->goHome()) return MakeReturnId(JARA_ARM::NOT_SV_ON_ERR, "servo is off");
+  return MakeReturnId(JARA_ARM::OK, "");
 }
 
 
@@ -0,0 +1,321 @@
+﻿// -*- C++ -*-
+/*!
+ * @file  SimulatedArm.cpp
+ * @brief Kinematic 6-axis arm simulator for ManagerTest
+ * @date $Date$
+ *
+ * $Id$
+ */
+
+#include "SimulatedArm.h"
+
+#include <algorithm>
+#include <cmath>
+
+const double SimulatedArm::STOP_SENTINEL = 999.0;
+
+// 積分の刻み幅 [s]。step() に大きな dt が来てもこの幅で分割する
+static const double SIM_DT = 0.001;
+// 目標到達・停止とみなす閾値
+static const double POS_EPS = 1e-6;
+static const double VEL_EPS = 1e-9;
+
+SimulatedArm::SimulatedArm()
+  : m_time(0.0), m_accel_time(0.2), m_speed_ratio(1.0),
+    m_servo(true), m_moving(false), m_paused(false), m_halting(false),
+    m_halt_time(0.0), m_stop_last(0.0), m_stop_sum(0.0), m_stop_max(0.0),
+    m_stop_count(0), m_moves(0)
+{
+  for (int i = 0; i < AXIS_NUM; i++)
+  {
+    m_pos[i] = 0.0;
+    m_vel[i] = 0.0;
+    m_target[i] = 0.0;
+    m_home[i] = 0.0;
+    m_max_speed[i] = 1.0;
+    m_scale[i] = 1.0;
+  }
+}
+
+void SimulatedArm::step(double dt)
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+  while (dt > 0.0)
+  {
+    double h = std::min(dt, SIM_DT);
+    integrate(h);
+    dt -= h;
+  }
+}
+
+void SimulatedArm::integrate(double dt)
+{
+  m_time += dt;
+
+  bool arrived = true;
+  bool still = true;
+  for (int i = 0; i < AXIS_NUM; i++)
+  {
+    double vmax = m_max_speed[i] * m_speed_ratio * m_scale[i];
+    double amax = vmax / m_accel_time;
+
+    double v_des = 0.0;
+    double e = m_target[i] - m_pos[i];
+    if (m_moving && !m_halting && !m_paused)
+    {
+      // 残り距離で止まれる速度を超えないように台形速度で近づく
+      double v = std::min(vmax, std::sqrt(2.0 * amax * std::fabs(e)));
+      v_des = (e >= 0.0) ? v : -v;
+    }
+
+    double dv = std::max(-amax * dt, std::min(amax * dt, v_des - m_vel[i]));
+    if (amax <= 0.0) dv = -m_vel[i];
+    m_vel[i] += dv;
+
+    double move = m_vel[i] * dt;
+    if (m_moving && !m_halting && !m_paused && std::fabs(e) <= std::fabs(move) + POS_EPS)
+    {
+      // 目標を行き過ぎる刻みは目標で止める
+      m_pos[i] = m_target[i];
+      m_vel[i] = 0.0;
+    }
+    else
+    {
+      m_pos[i] += move;
+    }
+
+    if (std::fabs(m_target[i] - m_pos[i]) > POS_EPS) arrived = false;
+    if (std::fabs(m_vel[i]) > VEL_EPS) still = false;
+  }
+
+  if (m_moving && !m_halting && !m_paused && arrived)
+  {
+    m_moving = false;
+    m_moves++;
+  }
+
+  if (m_halting && still)
+  {
+    m_halting = false;
+    for (int i = 0; i < AXIS_NUM; i++) m_vel[i] = 0.0;
+    if (!m_moving)
+    {
+      for (int i = 0; i < AXIS_NUM; i++) m_target[i] = m_pos[i];
+    }
+
+    m_stop_last = m_time - m_halt_time;
+    m_stop_sum += m_stop_last;
+    m_stop_max = std::max(m_stop_max, m_stop_last);
+    m_stop_count++;
+  }
+}
+
+void SimulatedArm::startMove(const double* target)
+{
+  // 全関節が同時に到達するよう、最も時間のかかる関節に合わせて速度を落とす
+  double time[AXIS_NUM];
+  double slowest = 0.0;
+  for (int i = 0; i < AXIS_NUM; i++)
+  {
+    m_target[i] = target[i];
+    time[i] = std::fabs(target[i] - m_pos[i]) / m_max_speed[i];
+    slowest = std::max(slowest, time[i]);
+  }
+  for (int i = 0; i < AXIS_NUM; i++)
+  {
+    m_scale[i] = (slowest > 0.0) ? std::max(time[i] / slowest, 1e-3) : 1.0;
+  }
+  m_moving = true;
+}
+
+void SimulatedArm::requestHalt(bool keep_target)
+{
+  if (!keep_target) m_moving = false;
+
+  bool still = true;
+  for (int i = 0; i < AXIS_NUM; i++)
+  {
+    if (std::fabs(m_vel[i]) > VEL_EPS) still = false;
+  }
+  if (still)
+  {
+    if (!keep_target)
+    {
+      for (int i = 0; i < AXIS_NUM; i++) m_target[i] = m_pos[i];
+    }
+    return;
+  }
+
+  // 減速中に重ねて停止要求が来ても最初の要求時刻から計る
+  if (!m_halting)
+  {
+    m_halting = true;
+    m_halt_time = m_time;
+  }
+}
+
+bool SimulatedArm::movePTPJointAbs(const double* target, int n)
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+  if (n != AXIS_NUM) return false;
+
+  for (int i = 0; i < AXIS_NUM; i++)
+  {
+    if (std::fabs(target[i]) >= STOP_SENTINEL)
+    {
+      requestHalt(false);
+      return true;
+    }
+  }
+  if (!m_servo) return false;
+
+  m_halting = false;
+  startMove(target);
+  return true;
+}
+
+bool SimulatedArm::movePTPJointRel(const double* delta, int n)
+{
+  double target[AXIS_NUM];
+  {
+    std::lock_guard<std::mutex> guard(m_mutex);
+    if (n != AXIS_NUM) return false;
+    for (int i = 0; i < AXIS_NUM; i++) target[i] = m_target[i] + delta[i];
+  }
+  return movePTPJointAbs(target, n);
+}
+
+void SimulatedArm::pause()
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+  m_paused = true;
+  requestHalt(true);
+}
+
+void SimulatedArm::resume()
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+  m_paused = false;
+  m_halting = false;
+}
+
+void SimulatedArm::stop()
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+  m_paused = false;
+  requestHalt(false);
+}
+
+void SimulatedArm::setSpeedRatio(unsigned long percent)
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+  m_speed_ratio = std::min(100UL, percent) / 100.0;
+}
+
+void SimulatedArm::setMaxSpeed(const double* speed, int n)
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+  for (int i = 0; i < AXIS_NUM && i < n; i++)
+  {
+    if (speed[i] > 0.0) m_max_speed[i] = speed[i];
+  }
+}
+
+void SimulatedArm::setAccelTime(double time)
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+  if (time > 0.0) m_accel_time = time;
+}
+
+void SimulatedArm::setServo(bool on)
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+  m_servo = on;
+  if (!on)
+  {
+    // サーボオフは即座に停止する
+    m_moving = false;
+    m_paused = false;
+    m_halting = false;
+    for (int i = 0; i < AXIS_NUM; i++)
+    {
+      m_vel[i] = 0.0;
+      m_target[i] = m_pos[i];
+    }
+  }
+}
+
+void SimulatedArm::setHome(const double* pos, int n)
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+  for (int i = 0; i < AXIS_NUM && i < n; i++) m_home[i] = pos[i];
+}
+
+bool SimulatedArm::goHome()
+{
+  double home[AXIS_NUM];
+  getHome(home);
+  return movePTPJointAbs(home, AXIS_NUM);
+}
+
+void SimulatedArm::getPosition(double* pos) const
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+  for (int i = 0; i < AXIS_NUM; i++) pos[i] = m_pos[i];
+}
+
+void SimulatedArm::getHome(double* pos) const
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+  for (int i = 0; i < AXIS_NUM; i++) pos[i] = m_home[i];
+}
+
+void SimulatedArm::getMaxSpeed(double* speed) const
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+  for (int i = 0; i < AXIS_NUM; i++) speed[i] = m_max_speed[i];
+}
+
+double SimulatedArm::getAccelTime() const
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+  return m_accel_time;
+}
+
+unsigned long SimulatedArm::getState() const
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+  unsigned long state = 0;
+  if (m_servo) state |= STATE_SERVO_ON;
+  for (int i = 0; i < AXIS_NUM; i++)
+  {
+    if (std::fabs(m_vel[i]) > VEL_EPS) state |= STATE_MOVING;
+  }
+  return state;
+}
+
+double SimulatedArm::getTime() const
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+  return m_time;
+}
+
+bool SimulatedArm::isMoving() const
+{
+  return (getState() & STATE_MOVING) != 0;
+}
+
+void SimulatedArm::getStopLatency(double& last, double& mean, double& max, long& count) const
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+  last = m_stop_last;
+  mean = (m_stop_count > 0) ? m_stop_sum / m_stop_count : 0.0;
+  max = m_stop_max;
+  count = m_stop_count;
+}
+
+long SimulatedArm::getCompletedMoves() const
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+  return m_moves;
+}
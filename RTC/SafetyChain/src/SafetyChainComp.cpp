@@ -0,0 +1,78 @@
+﻿// -*- C++ -*-
+/*!
+ * @file SafetyChainComp.cpp
+ * @brief Composite launcher of HumanDetection, HumanProtection and Manager
+ * @date $Date$
+ *
+ * $Id$
+ */
+
+#include <rtm/Manager.h>
+#include <iostream>
+#include <string>
+#include <stdlib.h>
+#include "HumanDetection.h"
+#include "HumanProtection.h"
+#include "HumanFusion.h"
+#include "Manager.h"
+
+// 同一プロセスに生成するコンポーネント (型名)
+static const char* safety_chain_components[] =
+  {
+    "HumanDetection",
+    "HumanProtection",
+    "Manager",
+    ""
+  };
+
+void MyModuleInit(RTC::Manager* manager)
+{
+  HumanDetectionInit(manager);
+  HumanProtectionInit(manager);
+  HumanFusionInit(manager);
+  ManagerInit(manager);
+
+  // Create components
+  // ポート接続 (interface_type=direct) と活性化は rtc.conf の
+  // manager.components.preconnect / preactivation で行う
+  for (int i = 0; safety_chain_components[i][0] != '\0'; i++)
+  {
+    RTC::RtcBase* comp = manager->createComponent(safety_chain_components[i]);
+    if (comp==NULL)
+    {
+      std::cerr << "Component create failed: " << safety_chain_components[i] << std::endl;
+      abort();
+    }
+  }
+
+  // 複数カメラ構成 (rtc.multicamera.conf) では HumanFusion も同じプロセスに置く
+  if (manager->getConfig().getProperty("safety_chain.fusion") == "YES")
+  {
+    if (manager->createComponent("HumanFusion") == NULL)
+    {
+      std::cerr << "Component create failed: HumanFusion" << std::endl;
+      abort();
+    }
+  }
+
+  return;
+}
+
+int main (int argc, char** argv)
+{
+  RTC::Manager* manager;
+  manager = RTC::Manager::init(argc, argv);
+
+  // Set module initialization proceduer
+  // This procedure will be invoked in activateManager() function.
+  manager->setModuleInitProc(MyModuleInit);
+
+  // Activate manager and register to naming service
+  manager->activateManager();
+
+  // run the manager in blocking mode
+  // runManager(false) is the default.
+  manager->runManager();
+
+  return 0;
+}